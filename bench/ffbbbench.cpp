@@ -0,0 +1,290 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbbench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+const bench_resolution bench_resolutions[] =
+{
+    { "360p", 640, 360 },
+    { "480p", 854, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "1440p", 2560, 1440 },
+    { "4k", 3840, 2160 },
+    { 0, 0, 0 }
+};
+
+const bench_pattern bench_patterns[] =
+{
+    { "bars", FFSYNTH_PATTERN_BARS },
+    { "box", FFSYNTH_PATTERN_BOX },
+    { "noise", FFSYNTH_PATTERN_NOISE },
+    { "still", FFSYNTH_PATTERN_STILL },
+    { 0, FFSYNTH_PATTERN_BARS }
+};
+
+void bench_state_init(bench_state *state)
+{
+    pthread_mutex_init(&state->mutex, 0);
+    pthread_cond_init(&state->cond, 0);
+    state->sources_done = 0;
+    state->encoders_done = 0;
+    state->encoders_done_at = 0;
+}
+
+void bench_state_destroy(bench_state *state)
+{
+    pthread_mutex_destroy(&state->mutex);
+    pthread_cond_destroy(&state->cond);
+}
+
+void bench_source_closed(ffsynth_source*, void *arg)
+{
+    bench_state *state = (bench_state*) arg;
+
+    pthread_mutex_lock(&state->mutex);
+    state->sources_done++;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+void bench_encoder_closed(ffenc_context*, void *arg)
+{
+    bench_state *state = (bench_state*) arg;
+
+    pthread_mutex_lock(&state->mutex);
+    state->encoders_done++;
+    state->encoders_done_at = ffbb_time_usec();
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+void bench_wait_for(bench_state *state, int *done, int count)
+{
+    pthread_mutex_lock(&state->mutex);
+    while (*done < count) pthread_cond_wait(&state->cond, &state->mutex);
+    pthread_mutex_unlock(&state->mutex);
+}
+
+int64_t bench_cpu_usec()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+const char* bench_open_encoder(ffenc_context *ffe_context, const bench_resolution *resolution,
+        int threads, const char *preset, double fps, int bitrate)
+{
+#if X264_SUPPORT
+    x264_param_t param;
+    x264_param_default(&param);
+    if (x264_param_default_preset(&param, preset, 0) < 0) return 0;
+
+    param.i_width = resolution->width;
+    param.i_height = resolution->height;
+    param.i_csp = X264_CSP_NV12;
+    param.i_threads = threads;
+    param.i_fps_num = fps > 0 ? (int) (fps + 0.5) : 30;
+    param.i_fps_den = 1;
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = bitrate / 1000;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+
+    if (ffe_context->set_x264_params(&param) != FFENC_OK) return 0;
+    return "libx264";
+#else
+    AVCodec *codec = avcodec_find_encoder(CODEC_ID_H264);
+    if (!codec) codec = avcodec_find_encoder(CODEC_ID_MPEG4);
+    if (!codec) return 0;
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    codec_context->width = resolution->width;
+    codec_context->height = resolution->height;
+    codec_context->pix_fmt = PIX_FMT_YUV420P;
+    codec_context->time_base.num = 1;
+    codec_context->time_base.den = fps > 0 ? (int) (fps + 0.5) : 30;
+    codec_context->bit_rate = bitrate;
+    codec_context->gop_size = codec_context->time_base.den * 2;
+    codec_context->thread_count = threads;
+
+    // only libx264 knows presets, other encoders leave it in the dictionary
+    AVDictionary *dict = 0;
+    av_dict_set(&dict, "preset", preset, 0);
+    int result = avcodec_open2(codec_context, codec, &dict);
+    av_dict_free(&dict);
+
+    if (result < 0)
+    {
+        av_free(codec_context);
+        return 0;
+    }
+
+    ffe_context->codec_context = codec_context;
+    return codec->name;
+#endif
+}
+
+const ffbb_histogram* bench_find_stage(const ffbb_stats *stats, const char *name)
+{
+    for (int i = 0; i < stats->stage_count; i++)
+        if (!strcmp(stats->stage_names[i], name)) return &stats->stages[i];
+    return 0;
+}
+
+void bench_print_histogram(FILE *out, const char *name, const ffbb_histogram *histogram)
+{
+    fprintf(out, "\"%s\":{\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld,\"mean\":%lld}", name,
+            (long long) ffbb_histogram_percentile(histogram, 0.5),
+            (long long) ffbb_histogram_percentile(histogram, 0.9),
+            (long long) ffbb_histogram_percentile(histogram, 0.99),
+            (long long) ffbb_histogram_percentile(histogram, 0.999),
+            (long long) histogram->max,
+            (long long) (histogram->count > 0 ? histogram->sum / histogram->count : 0));
+}
+
+int bench_find_resolution(const char *name)
+{
+    for (int i = 0; bench_resolutions[i].name; i++)
+        if (!strcmp(bench_resolutions[i].name, name)) return i;
+    return -1;
+}
+
+int bench_find_pattern(const char *name)
+{
+    for (int i = 0; bench_patterns[i].name; i++)
+        if (!strcmp(bench_patterns[i].name, name)) return i;
+    return -1;
+}
+
+int bench_split(char *list, char **values)
+{
+    int count = 0;
+    char *save = 0;
+
+    for (char *value = strtok_r(list, ",", &save); value; value = strtok_r(0, ",", &save))
+    {
+        if (count == BENCH_MAX_VALUES) return -1;
+        values[count++] = value;
+    }
+
+    return count;
+}
+
+bool bench_parse_resolutions(char *list, int *values, int *count)
+{
+    char *names[BENCH_MAX_VALUES];
+
+    *count = bench_split(list, names);
+    if (*count <= 0) return false;
+
+    for (int i = 0; i < *count; i++)
+    {
+        values[i] = bench_find_resolution(names[i]);
+        if (values[i] < 0) return false;
+    }
+
+    return true;
+}
+
+bool bench_parse_ints(char *list, int *values, int *count)
+{
+    char *numbers[BENCH_MAX_VALUES];
+
+    *count = bench_split(list, numbers);
+    if (*count <= 0) return false;
+
+    for (int i = 0; i < *count; i++)
+        values[i] = atoi(numbers[i]);
+
+    return true;
+}
+
+bool bench_parse_strings(char *list, const char **values, int *count)
+{
+    char *strings[BENCH_MAX_VALUES];
+
+    *count = bench_split(list, strings);
+    if (*count <= 0) return false;
+
+    for (int i = 0; i < *count; i++)
+        values[i] = strings[i];
+
+    return true;
+}
+
+void bench_common_defaults(bench_common_options *options, int bitrate)
+{
+    options->frames = 300;
+    options->fps = 0;
+    options->bitrate = bitrate;
+    options->pattern = bench_find_pattern("box");
+    options->output = 0;
+}
+
+bool bench_parse_common(int option, const char *arg, bench_common_options *options)
+{
+    switch (option)
+    {
+        case BENCH_OPTION_FRAMES:
+            options->frames = atoi(arg);
+            return options->frames > 0;
+        case BENCH_OPTION_FPS:
+            options->fps = atof(arg);
+            return true;
+        case BENCH_OPTION_BITRATE:
+            options->bitrate = atoi(arg);
+            return true;
+        case BENCH_OPTION_PATTERN:
+            options->pattern = bench_find_pattern(arg);
+            return options->pattern >= 0;
+        case BENCH_OPTION_OUTPUT:
+            options->output = arg;
+            return true;
+    }
+
+    return false;
+}
+
+void bench_common_usage(const bench_common_options *defaults)
+{
+    fprintf(stderr,
+            "  --frames N          frames per encoder (default %d)\n"
+            "  --fps F             input frame rate, 0 for as fast as possible (default %g)\n"
+            "  --bitrate BPS       target bitrate (default %d)\n"
+            "  --pattern NAME      bars, box, noise or still (default %s)\n"
+            "  --output FILE       write the JSON here instead of stdout\n",
+            defaults->frames, defaults->fps, defaults->bitrate, bench_patterns[defaults->pattern].name);
+}
+
+FILE* bench_open_output(const bench_common_options *options)
+{
+    if (!options->output) return stdout;
+
+    FILE *out = fopen(options->output, "w");
+    if (!out) perror(options->output);
+    return out;
+}
+
+void bench_close_output(FILE *out)
+{
+    if (out != stdout) fclose(out);
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBBENCH_H
+#define FFBBBENCH_H
+
+#include "ffbbenc.h"
+#include "ffbbsynth.h"
+#include "ffbbtime.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+
+/*
+ * What the benchmarks in bench/ share: the resolutions and patterns they
+ * know by name, waiting for sources and encoders to close, opening an
+ * encoder, the options every one of them takes and the JSON output.
+ */
+
+// the most values a comma separated option can list
+#define BENCH_MAX_VALUES 16
+
+typedef struct
+{
+    const char *name;
+    int width;
+    int height;
+} bench_resolution;
+
+extern const bench_resolution bench_resolutions[];
+
+typedef struct
+{
+    const char *name;
+    ffsynth_pattern pattern;
+} bench_pattern;
+
+extern const bench_pattern bench_patterns[];
+
+/**
+ * Counted up by bench_source_closed and bench_encoder_closed, pass it as
+ * the argument of the close callbacks.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int sources_done;
+    int encoders_done;
+    int64_t encoders_done_at;
+} bench_state;
+
+void bench_state_init(bench_state *state);
+void bench_state_destroy(bench_state *state);
+
+void bench_source_closed(ffsynth_source *source, void *arg);
+void bench_encoder_closed(ffenc_context *ffe_context, void *arg);
+
+/**
+ * Block until *done, one of the counts in state, reaches count.
+ */
+void bench_wait_for(bench_state *state, int *done, int count);
+
+/**
+ * User and system CPU time of the whole process in microseconds.
+ */
+int64_t bench_cpu_usec();
+
+/**
+ * Set up ffe_context to encode at the given size, with libx264 directly
+ * when built with X264_SUPPORT or else with the H.264 or MPEG-4 encoder
+ * of libavcodec. Returns the name of the encoder, or 0 if it could not
+ * be opened.
+ */
+const char* bench_open_encoder(ffenc_context *ffe_context, const bench_resolution *resolution,
+        int threads, const char *preset, double fps, int bitrate);
+
+/**
+ * The stage of stats with this name, or 0.
+ */
+const ffbb_histogram* bench_find_stage(const ffbb_stats *stats, const char *name);
+
+/**
+ * Write the percentiles, max and mean of a histogram as a JSON member.
+ */
+void bench_print_histogram(FILE *out, const char *name, const ffbb_histogram *histogram);
+
+/**
+ * Index into bench_resolutions or bench_patterns, or -1 if unknown.
+ */
+int bench_find_resolution(const char *name);
+int bench_find_pattern(const char *name);
+
+/**
+ * Split a comma separated list in place. Return the number of values,
+ * or -1 if there are more than BENCH_MAX_VALUES.
+ */
+int bench_split(char *list, char **values);
+
+/**
+ * Parse a comma separated list into values. Returns false if it is
+ * empty or too long, or names a resolution not in bench_resolutions.
+ */
+bool bench_parse_resolutions(char *list, int *values, int *count);
+bool bench_parse_ints(char *list, int *values, int *count);
+bool bench_parse_strings(char *list, const char **values, int *count);
+
+/**
+ * The options every benchmark takes. Each keeps them in its own options
+ * and lists them in its getopt table with the values below.
+ */
+typedef struct
+{
+    int frames;
+    double fps;
+    int bitrate;
+    int pattern;
+    const char *output;
+} bench_common_options;
+
+#define BENCH_OPTION_FRAMES 'n'
+#define BENCH_OPTION_FPS 'f'
+#define BENCH_OPTION_BITRATE 'b'
+#define BENCH_OPTION_PATTERN 'a'
+#define BENCH_OPTION_OUTPUT 'o'
+
+#define BENCH_COMMON_LONG_OPTIONS \
+    { "frames", required_argument, 0, BENCH_OPTION_FRAMES }, \
+    { "fps", required_argument, 0, BENCH_OPTION_FPS }, \
+    { "bitrate", required_argument, 0, BENCH_OPTION_BITRATE }, \
+    { "pattern", required_argument, 0, BENCH_OPTION_PATTERN }, \
+    { "output", required_argument, 0, BENCH_OPTION_OUTPUT }, \
+    { "help", no_argument, 0, 'h' }
+
+/**
+ * 300 frames of the box pattern as fast as they are taken, at bitrate,
+ * written to stdout.
+ */
+void bench_common_defaults(bench_common_options *options, int bitrate);
+
+/**
+ * Take one of the common options returned by getopt_long. Returns false
+ * for any other option or a bad value.
+ */
+bool bench_parse_common(int option, const char *arg, bench_common_options *options);
+
+/**
+ * Print the usage lines of the common options, with their defaults.
+ */
+void bench_common_usage(const bench_common_options *defaults);
+
+/**
+ * The file named by the output option, or stdout. Returns 0 after
+ * printing why if it cannot be opened.
+ */
+FILE* bench_open_output(const bench_common_options *options);
+void bench_close_output(FILE *out);
+
+#endif
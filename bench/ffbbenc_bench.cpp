@@ -0,0 +1,324 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives ffenc_context with frames from ffsynth_source across a sweep of
+ * resolutions, queue policies, encoder thread counts and presets, and
+ * writes sustained fps, latency percentiles, CPU time per frame and peak
+ * RSS for each combination as JSON. See "Benchmarking" in the README.
+ */
+
+#include "ffbbbench.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+typedef struct
+{
+    const char *name;
+    ffenc_queue_policy policy;
+} bench_policy;
+
+static const bench_policy policies[] =
+{
+    { "block", FFENC_QUEUE_BLOCK },
+    { "drop-newest", FFENC_QUEUE_DROP_NEWEST },
+    { "drop-oldest", FFENC_QUEUE_DROP_OLDEST },
+    { "drop-until-keyframe", FFENC_QUEUE_DROP_UNTIL_KEYFRAME }
+};
+
+typedef struct
+{
+    bench_common_options common;
+    int resolutions[BENCH_MAX_VALUES];
+    int resolution_count;
+    int policies[BENCH_MAX_VALUES];
+    int policy_count;
+    int threads[BENCH_MAX_VALUES];
+    int thread_count;
+    const char *presets[BENCH_MAX_VALUES];
+    int preset_count;
+    int conversion_threads;
+    int queue_capacity;
+} bench_options;
+
+static void reset_peak_rss()
+{
+    // writing 5 to clear_refs resets VmHWM on Linux 4.0 and later
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return;
+    ssize_t written = write(fd, "5", 1);
+    (void) written;
+    close(fd);
+}
+
+static int64_t peak_rss_kb()
+{
+    FILE *status = fopen("/proc/self/status", "r");
+
+    if (status)
+    {
+        char line[256];
+        long long kb = -1;
+
+        while (fgets(line, sizeof(line), status))
+        {
+            if (sscanf(line, "VmHWM: %lld kB", &kb) == 1) break;
+        }
+
+        fclose(status);
+        if (kb >= 0) return kb;
+    }
+
+    // the peak of the whole process so far, not just this run
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool run(FILE *out, const bench_options *options, const bench_resolution *resolution,
+        const bench_policy *policy, int threads, const char *preset, bool first)
+{
+    ffenc_context *ffe_context = new ffenc_context();
+
+    const char *codec = bench_open_encoder(ffe_context, resolution, threads, preset,
+            options->common.fps, options->common.bitrate);
+    if (!codec)
+    {
+        fprintf(stderr, "could not open an encoder for %s %s\n", resolution->name, preset);
+        delete ffe_context;
+        return false;
+    }
+
+    bench_state state;
+    bench_state_init(&state);
+
+    ffe_context->set_frame_queue(options->queue_capacity, policy->policy);
+    ffe_context->set_conversion_threads(options->conversion_threads);
+    ffe_context->set_close_callback(&bench_encoder_closed, &state);
+
+    ffsynth_source source;
+    source.set_size(resolution->width, resolution->height);
+    source.set_fps(options->common.fps);
+    source.set_pattern(bench_patterns[options->common.pattern].pattern);
+    source.set_frame_limit(options->common.frames);
+    source.set_encoder(ffe_context);
+    source.set_close_callback(&bench_source_closed, &state);
+
+    reset_peak_rss();
+
+    if (ffe_context->start() != FFENC_OK)
+    {
+        fprintf(stderr, "could not start the encoder for %s %s\n", resolution->name, preset);
+        ffe_context->close();
+        delete ffe_context;
+        bench_state_destroy(&state);
+        return false;
+    }
+
+    int64_t cpu_started = bench_cpu_usec();
+    int64_t started_at = ffbb_time_usec();
+
+    source.start();
+    bench_wait_for(&state, &state.sources_done, 1);
+    source.stop();
+
+    // everything queued is encoded before the encoding thread exits
+    ffe_context->stop();
+    bench_wait_for(&state, &state.encoders_done, 1);
+
+    int64_t elapsed = state.encoders_done_at - started_at;
+    int64_t cpu = bench_cpu_usec() - cpu_started;
+    int64_t rss = peak_rss_kb();
+
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    ffe_context->get_stats(stats, false);
+
+    ffe_context->close();
+    delete ffe_context;
+
+    bench_state_destroy(&state);
+
+    double fps = elapsed > 0 ? stats->frames_out * 1000000.0 / elapsed : 0;
+    const ffbb_histogram *total = bench_find_stage(stats, "total");
+
+    fprintf(stderr, "%-6s %-20s threads %-2d %-10s %8.1f fps  p99 %lld us\n",
+            resolution->name, policy->name, threads, preset, fps,
+            (long long) (total ? ffbb_histogram_percentile(total, 0.99) : 0));
+
+    fprintf(out, "%s\n{\"resolution\":\"%s\",\"width\":%d,\"height\":%d,\"policy\":\"%s\",\"threads\":%d,"
+            "\"preset\":\"%s\",\"codec\":\"%s\",", first ? "" : ",", resolution->name,
+            resolution->width, resolution->height, policy->name, threads, preset, codec);
+    fprintf(out, "\"frames_in\":%lld,\"frames_encoded\":%lld,\"frames_dropped\":%lld,\"bytes\":%lld,",
+            (long long) stats->frames_in, (long long) stats->frames_out,
+            (long long) stats->frames_dropped, (long long) stats->bytes);
+    fprintf(out, "\"elapsed_usec\":%lld,\"fps\":%.2f,\"cpu_usec_per_frame\":%lld,\"peak_rss_kb\":%lld,\"latency_usec\":{",
+            (long long) elapsed, fps,
+            (long long) (stats->frames_out > 0 ? cpu / stats->frames_out : 0), (long long) rss);
+
+    for (int i = 0; i < stats->stage_count; i++)
+    {
+        if (i > 0) fputc(',', out);
+        bench_print_histogram(out, stats->stage_names[i], &stats->stages[i]);
+    }
+
+    fprintf(out, "},");
+    bench_print_histogram(out, "queue_depth", &stats->queue_depth);
+    fprintf(out, "}");
+    fflush(out);
+
+    free(stats);
+    return true;
+}
+
+static int find_policy(const char *name)
+{
+    for (int i = 0; i < (int) (sizeof(policies) / sizeof(policies[0])); i++)
+        if (!strcmp(policies[i].name, name)) return i;
+    return -1;
+}
+
+static void usage(const char *program)
+{
+    bench_common_options defaults;
+    bench_common_defaults(&defaults, 4000000);
+
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --resolutions LIST  360p,480p,720p,1080p,1440p,4k (default 360p,720p,1080p,4k)\n"
+            "  --policies LIST     block,drop-newest,drop-oldest,drop-until-keyframe (default block,drop-newest)\n"
+            "  --threads LIST      encoder threads, 0 for automatic (default 1,4)\n"
+            "  --presets LIST      x264 presets (default ultrafast,veryfast)\n"
+            "  --conversion N      NV12 conversion threads (default 0)\n"
+            "  --queue N           frame queue capacity (default 32)\n",
+            program);
+    bench_common_usage(&defaults);
+}
+
+static bool parse(int argc, char **argv, bench_options *options)
+{
+    static struct option long_options[] =
+    {
+        { "resolutions", required_argument, 0, 'r' },
+        { "policies", required_argument, 0, 'p' },
+        { "threads", required_argument, 0, 't' },
+        { "presets", required_argument, 0, 's' },
+        { "conversion", required_argument, 0, 'c' },
+        { "queue", required_argument, 0, 'q' },
+        BENCH_COMMON_LONG_OPTIONS,
+        { 0, 0, 0, 0 }
+    };
+
+    static char default_resolutions[] = "360p,720p,1080p,4k";
+    static char default_policies[] = "block,drop-newest";
+    static char default_threads[] = "1,4";
+    static char default_presets[] = "ultrafast,veryfast";
+
+    char *resolution_list = default_resolutions;
+    char *policy_list = default_policies;
+    char *thread_list = default_threads;
+    char *preset_list = default_presets;
+
+    bench_common_defaults(&options->common, 4000000);
+    options->conversion_threads = 0;
+    options->queue_capacity = 32;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", long_options, 0)) != -1)
+    {
+        switch (option)
+        {
+            case 'r': resolution_list = optarg; break;
+            case 'p': policy_list = optarg; break;
+            case 't': thread_list = optarg; break;
+            case 's': preset_list = optarg; break;
+            case 'c': options->conversion_threads = atoi(optarg); break;
+            case 'q': options->queue_capacity = atoi(optarg); break;
+            default:
+                if (!bench_parse_common(option, optarg, &options->common)) return false;
+                break;
+        }
+    }
+
+    char *values[BENCH_MAX_VALUES];
+
+    options->policy_count = bench_split(policy_list, values);
+    if (options->policy_count <= 0) return false;
+    for (int i = 0; i < options->policy_count; i++)
+    {
+        options->policies[i] = find_policy(values[i]);
+        if (options->policies[i] < 0) return false;
+    }
+
+    return bench_parse_resolutions(resolution_list, options->resolutions, &options->resolution_count)
+            && bench_parse_ints(thread_list, options->threads, &options->thread_count)
+            && bench_parse_strings(preset_list, options->presets, &options->preset_count)
+            && options->queue_capacity > 0;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+
+    if (!parse(argc, argv, &options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    avcodec_register_all();
+
+    FILE *out = bench_open_output(&options.common);
+    if (!out) return 1;
+
+    fprintf(out, "{\"benchmark\":\"ffbbenc\",\"frames\":%d,\"input_fps\":%.2f,\"bitrate\":%d,"
+            "\"pattern\":\"%s\",\"conversion_threads\":%d,\"queue_capacity\":%d,\"cpus\":%ld,\"runs\":[",
+            options.common.frames, options.common.fps, options.common.bitrate,
+            bench_patterns[options.common.pattern].name, options.conversion_threads,
+            options.queue_capacity, sysconf(_SC_NPROCESSORS_ONLN));
+
+    bool first = true;
+    int failed = 0;
+
+    for (int r = 0; r < options.resolution_count; r++)
+    {
+        for (int p = 0; p < options.policy_count; p++)
+        {
+            for (int t = 0; t < options.thread_count; t++)
+            {
+                for (int s = 0; s < options.preset_count; s++)
+                {
+                    if (run(out, &options, &bench_resolutions[options.resolutions[r]],
+                            &policies[options.policies[p]], options.threads[t], options.presets[s], first))
+                    {
+                        first = false;
+                    }
+                    else
+                    {
+                        failed++;
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    bench_close_output(out);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs 1 to N ffenc_contexts at once, each fed by its own ffsynth_source
+ * as a stand-in for a camera, first with a thread per context and then
+ * on a shared ffenc_executor, and writes the combined fps, CPU time per
+ * frame and latency percentiles of each as JSON. See "Benchmarking" in
+ * the README.
+ */
+
+#include "ffbbbench.h"
+#include "ffbbexecutor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+    bench_common_options common;
+    int contexts[BENCH_MAX_VALUES];
+    int context_count;
+    int executor_threads;
+    int resolution;
+    const char *preset;
+    int threads;
+    int queue_capacity;
+} bench_options;
+
+// executor is 0 for a thread per context
+static bool run(FILE *out, const bench_options *options, int count, ffenc_executor *executor, bool first)
+{
+    ffenc_context **contexts = new ffenc_context*[count];
+    ffsynth_source *sources = new ffsynth_source[count];
+    const bench_resolution *resolution = &bench_resolutions[options->resolution];
+    const char *codec = 0;
+    int started = 0;
+
+    bench_state state;
+    bench_state_init(&state);
+
+    for (int i = 0; i < count; i++)
+    {
+        contexts[i] = new ffenc_context();
+    }
+
+    for (; started < count; started++)
+    {
+        ffenc_context *ffe_context = contexts[started];
+
+        codec = bench_open_encoder(ffe_context, resolution, options->threads, options->preset,
+                options->common.fps, options->common.bitrate);
+        if (!codec) break;
+
+        ffe_context->set_frame_queue(options->queue_capacity, FFENC_QUEUE_BLOCK);
+        ffe_context->set_executor(executor);
+        ffe_context->set_close_callback(&bench_encoder_closed, &state);
+        if (ffe_context->start() != FFENC_OK) break;
+
+        sources[started].set_size(resolution->width, resolution->height);
+        sources[started].set_fps(options->common.fps);
+        sources[started].set_pattern(bench_patterns[options->common.pattern].pattern);
+        sources[started].set_frame_limit(options->common.frames);
+        sources[started].set_encoder(ffe_context);
+        sources[started].set_close_callback(&bench_source_closed, &state);
+    }
+
+    bool ok = started == count;
+    if (!ok) fprintf(stderr, "could not start encoder %d of %d\n", started + 1, count);
+
+    int64_t cpu_started = bench_cpu_usec();
+    int64_t started_at = ffbb_time_usec();
+
+    if (ok)
+    {
+        for (int i = 0; i < count; i++)
+            sources[i].start();
+
+        bench_wait_for(&state, &state.sources_done, count);
+
+        for (int i = 0; i < count; i++)
+            sources[i].stop();
+    }
+
+    // everything queued is encoded before the close callbacks
+    for (int i = 0; i < started; i++)
+        contexts[i]->stop();
+    bench_wait_for(&state, &state.encoders_done, started);
+
+    int64_t elapsed = state.encoders_done_at - started_at;
+    int64_t cpu = bench_cpu_usec() - cpu_started;
+
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    ffbb_stats *total = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    memset(total, 0, sizeof(ffbb_stats));
+
+    for (int i = 0; i < started; i++)
+    {
+        contexts[i]->get_stats(stats, false);
+
+        if (i == 0)
+        {
+            *total = *stats;
+            continue;
+        }
+
+        total->frames_in += stats->frames_in;
+        total->frames_out += stats->frames_out;
+        total->frames_dropped += stats->frames_dropped;
+        total->bytes += stats->bytes;
+        ffbb_histogram_merge(&total->queue_depth, &stats->queue_depth);
+
+        for (int s = 0; s < stats->stage_count; s++)
+            ffbb_histogram_merge(&total->stages[s], &stats->stages[s]);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        contexts[i]->close();
+        delete contexts[i];
+    }
+
+    delete[] contexts;
+    delete[] sources;
+
+    bench_state_destroy(&state);
+
+    if (ok)
+    {
+        const char *model = executor ? "executor" : "thread";
+        int threads = executor ? executor->thread_count() : count;
+        double fps = elapsed > 0 ? total->frames_out * 1000000.0 / elapsed : 0;
+
+        const ffbb_histogram *latency = bench_find_stage(total, "total");
+
+        fprintf(stderr, "%-8s contexts %-3d threads %-3d %9.1f fps  %7.1f fps each  p99 %lld us\n",
+                model, count, threads, fps, fps / count,
+                (long long) (latency ? ffbb_histogram_percentile(latency, 0.99) : 0));
+
+        fprintf(out, "%s\n{\"model\":\"%s\",\"contexts\":%d,\"encoding_threads\":%d,\"codec\":\"%s\",",
+                first ? "" : ",", model, count, threads, codec);
+        fprintf(out, "\"frames_in\":%lld,\"frames_encoded\":%lld,\"frames_dropped\":%lld,\"bytes\":%lld,",
+                (long long) total->frames_in, (long long) total->frames_out,
+                (long long) total->frames_dropped, (long long) total->bytes);
+        fprintf(out, "\"elapsed_usec\":%lld,\"fps\":%.2f,\"fps_per_context\":%.2f,\"cpu_usec_per_frame\":%lld,\"latency_usec\":{",
+                (long long) elapsed, fps, fps / count,
+                (long long) (total->frames_out > 0 ? cpu / total->frames_out : 0));
+
+        for (int i = 0; i < total->stage_count; i++)
+        {
+            if (i > 0) fputc(',', out);
+            bench_print_histogram(out, total->stage_names[i], &total->stages[i]);
+        }
+
+        fprintf(out, "},");
+        bench_print_histogram(out, "queue_depth", &total->queue_depth);
+        fprintf(out, "}");
+        fflush(out);
+    }
+
+    free(stats);
+    free(total);
+    return ok;
+}
+
+static void usage(const char *program)
+{
+    bench_common_options defaults;
+    bench_common_defaults(&defaults, 1000000);
+
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --contexts LIST     contexts encoding at once (default 1,2,4,8,16,24)\n"
+            "  --executor N        threads of the shared executor, 0 for one per CPU (default 0)\n"
+            "  --resolution NAME   360p, 480p, 720p, 1080p, 1440p or 4k (default 360p)\n"
+            "  --preset NAME       x264 preset (default ultrafast)\n"
+            "  --threads N         encoder threads of each context (default 1)\n"
+            "  --queue N           frame queue capacity (default 8)\n",
+            program);
+    bench_common_usage(&defaults);
+}
+
+static bool parse(int argc, char **argv, bench_options *options)
+{
+    static struct option long_options[] =
+    {
+        { "contexts", required_argument, 0, 'x' },
+        { "executor", required_argument, 0, 'e' },
+        { "resolution", required_argument, 0, 'r' },
+        { "preset", required_argument, 0, 's' },
+        { "threads", required_argument, 0, 't' },
+        { "queue", required_argument, 0, 'q' },
+        BENCH_COMMON_LONG_OPTIONS,
+        { 0, 0, 0, 0 }
+    };
+
+    static char default_contexts[] = "1,2,4,8,16,24";
+
+    char *context_list = default_contexts;
+
+    bench_common_defaults(&options->common, 1000000);
+    options->executor_threads = 0;
+    options->resolution = bench_find_resolution("360p");
+    options->preset = "ultrafast";
+    options->threads = 1;
+    options->queue_capacity = 8;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", long_options, 0)) != -1)
+    {
+        switch (option)
+        {
+            case 'x': context_list = optarg; break;
+            case 'e': options->executor_threads = atoi(optarg); break;
+            case 's': options->preset = optarg; break;
+            case 't': options->threads = atoi(optarg); break;
+            case 'q': options->queue_capacity = atoi(optarg); break;
+            case 'r':
+                options->resolution = bench_find_resolution(optarg);
+                if (options->resolution < 0) return false;
+                break;
+            default:
+                if (!bench_parse_common(option, optarg, &options->common)) return false;
+                break;
+        }
+    }
+
+    if (!bench_parse_ints(context_list, options->contexts, &options->context_count)) return false;
+    for (int i = 0; i < options->context_count; i++)
+    {
+        if (options->contexts[i] <= 0) return false;
+    }
+
+    return options->queue_capacity > 0;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+
+    if (!parse(argc, argv, &options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    avcodec_register_all();
+
+    FILE *out = bench_open_output(&options.common);
+    if (!out) return 1;
+
+    ffenc_executor executor(options.executor_threads);
+    if (!executor.start())
+    {
+        fprintf(stderr, "could not start the executor\n");
+        return 1;
+    }
+
+    const bench_resolution *resolution = &bench_resolutions[options.resolution];
+
+    fprintf(out, "{\"benchmark\":\"ffbbexecutor\",\"resolution\":\"%s\",\"width\":%d,\"height\":%d,"
+            "\"preset\":\"%s\",\"threads\":%d,\"frames\":%d,\"input_fps\":%.2f,\"bitrate\":%d,"
+            "\"pattern\":\"%s\",\"queue_capacity\":%d,\"executor_threads\":%d,\"cpus\":%ld,\"runs\":[",
+            resolution->name, resolution->width, resolution->height, options.preset, options.threads,
+            options.common.frames, options.common.fps, options.common.bitrate,
+            bench_patterns[options.common.pattern].name, options.queue_capacity,
+            executor.thread_count(), sysconf(_SC_NPROCESSORS_ONLN));
+
+    bool first = true;
+    int failed = 0;
+
+    for (int c = 0; c < options.context_count; c++)
+    {
+        // the same load on both models one after the other
+        for (int model = 0; model < 2; model++)
+        {
+            if (run(out, &options, options.contexts[c], model ? &executor : 0, first)) first = false;
+            else failed++;
+        }
+    }
+
+    executor.stop();
+
+    fprintf(out, "\n]}\n");
+    bench_close_output(out);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,323 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Encodes the same ffsynth_source frames with libx264 twice for every
+ * resolution, thread count and preset it is given: once driven directly,
+ * taking NV12 as is, and once through libavcodec's libx264 wrapper after
+ * the I420 conversion. Writes fps, CPU time per frame, output size and
+ * latency percentiles of both as JSON. See "Benchmarking" in the README.
+ */
+
+#include "ffbbbench.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#if !X264_SUPPORT
+#error "build with -DX264_SUPPORT=1, the direct libx264 path is what is being measured"
+#endif
+
+// the two ways libffbb can reach libx264
+typedef enum
+{
+    PATH_DIRECT,
+    PATH_LIBAVCODEC
+} bench_path;
+
+static const char *path_names[] = { "direct", "libavcodec" };
+
+typedef struct
+{
+    bench_common_options common;
+    int resolutions[BENCH_MAX_VALUES];
+    int resolution_count;
+    int threads[BENCH_MAX_VALUES];
+    int thread_count;
+    const char *presets[BENCH_MAX_VALUES];
+    int preset_count;
+    bool low_latency;
+} bench_options;
+
+// what one run measured, kept so the two paths can be compared
+typedef struct
+{
+    double fps;
+    int64_t cpu_per_frame;
+    int64_t p99;
+} bench_result;
+
+static bool open_direct(ffenc_context *ffe_context, const bench_resolution *resolution,
+        int threads, const char *preset, const bench_options *options)
+{
+    x264_param_t param;
+    x264_param_default(&param);
+    if (x264_param_default_preset(&param, preset, 0) < 0) return false;
+
+    param.i_width = resolution->width;
+    param.i_height = resolution->height;
+    param.i_csp = X264_CSP_NV12;
+    param.i_threads = threads;
+    param.i_fps_num = options->common.fps > 0 ? (int) (options->common.fps + 0.5) : 30;
+    param.i_fps_den = 1;
+    param.i_keyint_max = param.i_fps_num * 2;
+    param.rc.i_rc_method = X264_RC_ABR;
+    param.rc.i_bitrate = options->common.bitrate / 1000;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+
+    return ffe_context->set_x264_params(&param) == FFENC_OK;
+}
+
+static bool open_libavcodec(ffenc_context *ffe_context, const bench_resolution *resolution,
+        int threads, const char *preset, const bench_options *options)
+{
+    // by name, so another H.264 encoder is never measured in its place
+    AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) return false;
+
+    AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+    codec_context->width = resolution->width;
+    codec_context->height = resolution->height;
+    codec_context->pix_fmt = PIX_FMT_YUV420P;
+    codec_context->time_base.num = 1;
+    codec_context->time_base.den = options->common.fps > 0 ? (int) (options->common.fps + 0.5) : 30;
+    codec_context->bit_rate = options->common.bitrate;
+    codec_context->gop_size = codec_context->time_base.den * 2;
+    codec_context->thread_count = threads;
+
+    AVDictionary *dict = 0;
+    av_dict_set(&dict, "preset", preset, 0);
+    int result = avcodec_open2(codec_context, codec, &dict);
+    av_dict_free(&dict);
+
+    if (result < 0)
+    {
+        av_free(codec_context);
+        return false;
+    }
+
+    ffe_context->codec_context = codec_context;
+    return true;
+}
+
+static bool run(FILE *out, const bench_options *options, const bench_resolution *resolution,
+        int threads, const char *preset, bench_path path, bench_result *result, bool first)
+{
+    ffenc_context *ffe_context = new ffenc_context();
+
+    bool opened = path == PATH_DIRECT
+            ? open_direct(ffe_context, resolution, threads, preset, options)
+            : open_libavcodec(ffe_context, resolution, threads, preset, options);
+
+    if (!opened)
+    {
+        fprintf(stderr, "could not open the %s encoder for %s %s\n", path_names[path], resolution->name, preset);
+        delete ffe_context;
+        return false;
+    }
+
+    bench_state state;
+    bench_state_init(&state);
+
+    // every frame is encoded so both paths do the same work
+    ffe_context->set_frame_queue(32, FFENC_QUEUE_BLOCK);
+    ffe_context->set_low_latency(options->low_latency);
+    ffe_context->set_close_callback(&bench_encoder_closed, &state);
+
+    ffsynth_source source;
+    source.set_size(resolution->width, resolution->height);
+    source.set_fps(options->common.fps);
+    source.set_pattern(bench_patterns[options->common.pattern].pattern);
+    source.set_frame_limit(options->common.frames);
+    source.set_encoder(ffe_context);
+    source.set_close_callback(&bench_source_closed, &state);
+
+    if (ffe_context->start() != FFENC_OK)
+    {
+        fprintf(stderr, "could not start the %s encoder for %s %s\n", path_names[path], resolution->name, preset);
+        ffe_context->close();
+        delete ffe_context;
+        bench_state_destroy(&state);
+        return false;
+    }
+
+    int64_t cpu_started = bench_cpu_usec();
+    int64_t started_at = ffbb_time_usec();
+
+    source.start();
+    bench_wait_for(&state, &state.sources_done, 1);
+    source.stop();
+
+    ffe_context->stop();
+    bench_wait_for(&state, &state.encoders_done, 1);
+
+    int64_t elapsed = state.encoders_done_at - started_at;
+    int64_t cpu = bench_cpu_usec() - cpu_started;
+
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    ffe_context->get_stats(stats, false);
+
+    ffe_context->close();
+    delete ffe_context;
+
+    bench_state_destroy(&state);
+
+    const ffbb_histogram *total = bench_find_stage(stats, "total");
+
+    result->fps = elapsed > 0 ? stats->frames_out * 1000000.0 / elapsed : 0;
+    result->cpu_per_frame = stats->frames_out > 0 ? cpu / stats->frames_out : 0;
+    result->p99 = total ? ffbb_histogram_percentile(total, 0.99) : 0;
+
+    fprintf(stderr, "%-6s threads %-2d %-10s %-10s %8.1f fps  %6lld us cpu/frame  p99 %lld us\n",
+            resolution->name, threads, preset, path_names[path], result->fps,
+            (long long) result->cpu_per_frame, (long long) result->p99);
+
+    fprintf(out, "%s\n{\"resolution\":\"%s\",\"width\":%d,\"height\":%d,\"threads\":%d,\"preset\":\"%s\","
+            "\"path\":\"%s\",", first ? "" : ",", resolution->name, resolution->width, resolution->height,
+            threads, preset, path_names[path]);
+    fprintf(out, "\"frames_in\":%lld,\"frames_encoded\":%lld,\"bytes\":%lld,",
+            (long long) stats->frames_in, (long long) stats->frames_out, (long long) stats->bytes);
+    fprintf(out, "\"elapsed_usec\":%lld,\"fps\":%.2f,\"cpu_usec_per_frame\":%lld,\"latency_usec\":{",
+            (long long) elapsed, result->fps, (long long) result->cpu_per_frame);
+
+    for (int i = 0; i < stats->stage_count; i++)
+    {
+        if (i > 0) fputc(',', out);
+        bench_print_histogram(out, stats->stage_names[i], &stats->stages[i]);
+    }
+
+    fprintf(out, "}}");
+    fflush(out);
+
+    free(stats);
+    return true;
+}
+
+static void usage(const char *program)
+{
+    bench_common_options defaults;
+    bench_common_defaults(&defaults, 4000000);
+
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --resolutions LIST  360p,480p,720p,1080p,1440p,4k (default 360p,720p,1080p)\n"
+            "  --threads LIST      encoder threads, 0 for automatic (default 1,4)\n"
+            "  --presets LIST      x264 presets (default ultrafast,veryfast)\n"
+            "  --low-latency       tune both paths with set_low_latency\n",
+            program);
+    bench_common_usage(&defaults);
+}
+
+static bool parse(int argc, char **argv, bench_options *options)
+{
+    static struct option long_options[] =
+    {
+        { "resolutions", required_argument, 0, 'r' },
+        { "threads", required_argument, 0, 't' },
+        { "presets", required_argument, 0, 's' },
+        { "low-latency", no_argument, 0, 'l' },
+        BENCH_COMMON_LONG_OPTIONS,
+        { 0, 0, 0, 0 }
+    };
+
+    static char default_resolutions[] = "360p,720p,1080p";
+    static char default_threads[] = "1,4";
+    static char default_presets[] = "ultrafast,veryfast";
+
+    char *resolution_list = default_resolutions;
+    char *thread_list = default_threads;
+    char *preset_list = default_presets;
+
+    bench_common_defaults(&options->common, 4000000);
+    options->low_latency = false;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "h", long_options, 0)) != -1)
+    {
+        switch (option)
+        {
+            case 'r': resolution_list = optarg; break;
+            case 't': thread_list = optarg; break;
+            case 's': preset_list = optarg; break;
+            case 'l': options->low_latency = true; break;
+            default:
+                if (!bench_parse_common(option, optarg, &options->common)) return false;
+                break;
+        }
+    }
+
+    return bench_parse_resolutions(resolution_list, options->resolutions, &options->resolution_count)
+            && bench_parse_ints(thread_list, options->threads, &options->thread_count)
+            && bench_parse_strings(preset_list, options->presets, &options->preset_count);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+
+    if (!parse(argc, argv, &options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    avcodec_register_all();
+
+    FILE *out = bench_open_output(&options.common);
+    if (!out) return 1;
+
+    fprintf(out, "{\"benchmark\":\"ffbbx264\",\"frames\":%d,\"input_fps\":%.2f,\"bitrate\":%d,"
+            "\"pattern\":\"%s\",\"low_latency\":%s,\"cpus\":%ld,\"runs\":[",
+            options.common.frames, options.common.fps, options.common.bitrate,
+            bench_patterns[options.common.pattern].name,
+            options.low_latency ? "true" : "false", sysconf(_SC_NPROCESSORS_ONLN));
+
+    bool first = true;
+    int failed = 0;
+
+    for (int r = 0; r < options.resolution_count; r++)
+    {
+        for (int t = 0; t < options.thread_count; t++)
+        {
+            for (int s = 0; s < options.preset_count; s++)
+            {
+                const bench_resolution *resolution = &bench_resolutions[options.resolutions[r]];
+                bench_result results[2];
+                bool ran[2];
+
+                for (int p = PATH_DIRECT; p <= PATH_LIBAVCODEC; p++)
+                {
+                    ran[p] = run(out, &options, resolution, options.threads[t], options.presets[s],
+                            (bench_path) p, &results[p], first);
+                    if (ran[p]) first = false;
+                    else failed++;
+                }
+
+                if (ran[PATH_DIRECT] && ran[PATH_LIBAVCODEC] && results[PATH_LIBAVCODEC].fps > 0)
+                {
+                    fprintf(stderr, "%-6s threads %-2d %-10s direct is %.2fx the fps of libavcodec\n",
+                            resolution->name, options.threads[t], options.presets[s],
+                            results[PATH_DIRECT].fps / results[PATH_LIBAVCODEC].fps);
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    bench_close_output(out);
+
+    return failed ? 1 : 0;
+}
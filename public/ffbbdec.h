@@ -20,6 +20,10 @@
 #define OSX_PLATFORM 0
 #endif
 
+#ifndef LINUX_PLATFORM
+#define LINUX_PLATFORM 0
+#endif
+
 // include math.h otherwise it will get included
 // by avformat.h and cause duplicate definition
 // errors because of C vs C++ functions
@@ -34,7 +38,9 @@ extern "C"
 
 #include <sys/types.h>
 
-#if !OSX_PLATFORM
+#include "ffbbstats.h"
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
 #include <screen/screen.h>
 #include <QString>
 #endif
@@ -48,10 +54,11 @@ typedef enum
     FFDEC_CODEC_NOT_OPEN,
     FFDEC_NO_CODEC_SPECIFIED,
     FFDEC_ALREADY_RUNNING,
-    FFDEC_ALREADY_STOPPED
+    FFDEC_ALREADY_STOPPED,
+    FFDEC_WRITE_ERROR
 } ffdec_error;
 
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
 typedef struct
 {
     screen_context_t screen_context;
@@ -62,6 +69,8 @@ typedef struct
 } ffdec_view;
 #endif
 
+class ffbb_recorder;
+
 class ffdec_context
 {
     friend void* decoding_thread(void* arg);
@@ -105,7 +114,21 @@ public:
      */
     ffdec_error close();
 
-#if !OSX_PLATFORM
+    /**
+     * Get the buffers read, frames decoded, decode errors, bytes read
+     * and the read, decode and display latency histograms, and with
+     * reset start counting again from zero. frames_in counts the
+     * buffers returned by the read callback.
+     */
+    ffdec_error get_stats(ffbb_stats *stats, bool reset);
+
+    /**
+     * Write get_stats as text, one value per line with names starting
+     * with "ffdec", to a file or socket that something scrapes.
+     */
+    ffdec_error write_stats(int fd, bool reset);
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     ffdec_error create_view(QString group, QString id, screen_window_t *window);
     #endif
 
@@ -117,16 +140,18 @@ public:
 private:
 
     void decoding_thread();
+    void output_frame(AVFrame *frame);
 
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     void display_frame(AVFrame *frame);
     #endif
 
     int frame_index;
     bool running;
     bool open;
+    ffbb_recorder *recorder;
 
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     ffdec_view *view;
     #endif
 
@@ -20,6 +20,14 @@
 #define OSX_PLATFORM 0
 #endif
 
+#ifndef LINUX_PLATFORM
+#define LINUX_PLATFORM 0
+#endif
+
+#ifndef X264_SUPPORT
+#define X264_SUPPORT 0
+#endif
+
 // include math.h otherwise it will get included
 // by avformat.h and cause duplicate definition
 // errors because of C vs C++ functions
@@ -30,13 +38,20 @@ extern "C"
 #define UINT64_C uint64_t
 #define INT64_C int64_t
 #include <libavformat/avformat.h>
+
+#if X264_SUPPORT
+#include <stdint.h>
+#include <x264.h>
+#endif
 }
 
 #include <sys/types.h>
-#include <deque>
+#include <sys/uio.h>
 #include <pthread.h>
 
-#if !OSX_PLATFORM
+#include "ffbbstats.h"
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
 #include <camera/camera_api.h>
 #elif OSX_PLATFORM
 #import <CoreVideo/CoreVideo.h>
@@ -49,12 +64,571 @@ typedef enum
     FFENC_FRAME_NOT_SUPPORTED,
     FFENC_NOT_RUNNING,
     FFENC_ALREADY_RUNNING,
-    FFENC_ALREADY_STOPPED
+    FFENC_ALREADY_STOPPED,
+    FFENC_POOL_EXHAUSTED,
+    FFENC_QUEUE_FULL,
+    FFENC_ENCODER_ERROR,
+    FFENC_NO_PARAMETER_SETS,
+    FFENC_FRAME_SKIPPED,
+    FFENC_WRITE_ERROR
 } ffenc_error;
 
+typedef struct
+{
+    /**
+     * Frames served from a recycled buffer.
+     */
+    int64_t hits;
+
+    /**
+     * Frames that needed a new buffer allocated.
+     */
+    int64_t misses;
+
+    /**
+     * Frames refused because the in flight limit was reached.
+     */
+    int64_t rejected;
+
+    /**
+     * Buffers currently queued or being encoded.
+     */
+    int in_flight;
+
+    /**
+     * The largest number of buffers that were in flight at once.
+     */
+    int high_water;
+
+    /**
+     * Buffers currently owned by the pool, idle or in flight.
+     */
+    int allocated;
+} ffenc_pool_stats;
+
+typedef enum
+{
+    /**
+     * Wait in add_frame until the encoder frees a slot.
+     */
+    FFENC_QUEUE_BLOCK = 0,
+
+    /**
+     * Refuse the frame being added with FFENC_QUEUE_FULL.
+     */
+    FFENC_QUEUE_DROP_NEWEST,
+
+    /**
+     * Discard the oldest queued frame to make room.
+     */
+    FFENC_QUEUE_DROP_OLDEST,
+
+    /**
+     * Discard every queued frame and force the frame being added
+     * to be encoded as a keyframe.
+     */
+    FFENC_QUEUE_DROP_UNTIL_KEYFRAME
+} ffenc_queue_policy;
+
+typedef struct
+{
+    int capacity;
+    ffenc_queue_policy policy;
+
+    /**
+     * Frames queued when the stats were taken, and the most ever queued.
+     */
+    int depth;
+    int max_depth;
+
+    /**
+     * Times a producer had to wait with FFENC_QUEUE_BLOCK.
+     */
+    int64_t blocked;
+
+    int64_t dropped_newest;
+    int64_t dropped_oldest;
+    int64_t dropped_until_keyframe;
+
+    /**
+     * Keyframes forced after a FFENC_QUEUE_DROP_UNTIL_KEYFRAME flush.
+     */
+    int64_t forced_keyframes;
+
+    /**
+     * Keyframes forced by request_keyframe, and requests ignored because
+     * they came within the minimum interval of the previous one.
+     */
+    int64_t requested_keyframes;
+    int64_t limited_keyframe_requests;
+
+    /**
+     * Frames turned away in add_frame before being copied, by the admit
+     * callback and by the target frame rate.
+     */
+    int64_t skipped_by_callback;
+    int64_t skipped_by_rate;
+
+    /**
+     * Frames found unchanged by scene detection that were not encoded,
+     * and that were encoded as cheap near-copies.
+     */
+    int64_t static_skipped;
+    int64_t static_duplicated;
+} ffenc_queue_stats;
+
+typedef enum
+{
+    /**
+     * Stall the encoding thread until the writer catches up.
+     */
+    FFENC_WRITER_BLOCK = 0,
+
+    /**
+     * Drop the packet that does not fit and everything after it up to
+     * the next point a decoder can resume from: a keyframe, an SPS or
+     * PPS, or the recovery point that starts an intra refresh cycle. A
+     * keyframe is requested as soon as dropping starts. Packets queued
+     * before the drop are still written, so only the tail of the GOP is
+     * lost and the sink resumes at a clean picture rather than at holes.
+     */
+    FFENC_WRITER_DROP_GOP
+} ffenc_writer_policy;
+
+typedef struct
+{
+    int capacity;
+    ffenc_writer_policy policy;
+
+    /**
+     * Packets waiting for the writer when the stats were taken, and the most ever waiting.
+     */
+    int depth;
+    int max_depth;
+
+    int64_t packets;
+    int64_t batches;
+    int64_t bytes;
+
+    int64_t blocked;
+    int64_t dropped_packets;
+    int64_t dropped_gops;
+
+    /**
+     * Microseconds packets spent queued before being written.
+     */
+    int64_t queue_usec_total;
+    int64_t queue_usec_max;
+
+    /**
+     * Microseconds spent in the sink callbacks for each batch.
+     */
+    int64_t write_usec_last;
+    int64_t write_usec_total;
+    int64_t write_usec_max;
+} ffenc_writer_stats;
+
+typedef struct
+{
+    /**
+     * Microseconds for the most recent frame, the slowest frame and
+     * the sum over all frames.
+     */
+    int64_t last;
+    int64_t max;
+    int64_t total;
+} ffenc_latency;
+
+typedef struct
+{
+    /**
+     * Frames encoded since the context was started.
+     */
+    int64_t frames;
+
+    /**
+     * Time from add_frame until the encoding thread took the frame.
+     */
+    ffenc_latency queue;
+
+    /**
+     * Time spent inside the encoder for the frame.
+     */
+    ffenc_latency encode;
+
+    /**
+     * Time from handing the frame to the encoder until the first packet
+     * came out, only counted for frames that produced output right away.
+     */
+    ffenc_latency first_output;
+
+    /**
+     * Time from add_frame until the first packet came out.
+     */
+    ffenc_latency total;
+} ffenc_latency_stats;
+
+typedef enum
+{
+    /**
+     * Do not encode the frame at all.
+     */
+    FFENC_STATIC_SKIP = 0,
+
+    /**
+     * Encode the frame so it costs as little as possible, keeping the
+     * frame rate constant. With libx264 every macroblock is marked as
+     * unchanged so it is coded as skip without motion search. With
+     * codec_context, or a libx264 without macroblock info, the frame is
+     * skipped instead.
+     */
+    FFENC_STATIC_DUPLICATE
+} ffenc_static_action;
+
+typedef struct
+{
+    /**
+     * The mean absolute luma difference, from 0 to 255, over a 64x64
+     * pixel block for the block to count as changed.
+     */
+    int block_threshold;
+
+    /**
+     * How many blocks have to change for the frame to count as changed, at least 1.
+     */
+    int min_changed_blocks;
+
+    /**
+     * Count the next frame as changed after this many unchanged ones,
+     * or 0 to never force one.
+     */
+    int max_static_frames;
+
+    ffenc_static_action action;
+} ffenc_scene_config;
+
+/**
+ * The x264 presets, fastest first.
+ */
+typedef enum
+{
+    FFENC_PRESET_ULTRAFAST = 0,
+    FFENC_PRESET_SUPERFAST,
+    FFENC_PRESET_VERYFAST,
+    FFENC_PRESET_FASTER,
+    FFENC_PRESET_FAST,
+    FFENC_PRESET_MEDIUM,
+    FFENC_PRESET_SLOW,
+    FFENC_PRESET_SLOWER,
+    FFENC_PRESET_VERYSLOW
+} ffenc_preset;
+
+typedef struct
+{
+    /**
+     * Microseconds from add_frame until a frame is encoded that the
+     * controller tries to stay under.
+     */
+    int64_t target_latency;
+
+    /**
+     * Microseconds between decisions.
+     */
+    int64_t interval;
+
+    /**
+     * Bitrate range in bits per second and the percentage of one step,
+     * from 1 to 99.
+     */
+    int min_bitrate;
+    int max_bitrate;
+    int bitrate_step;
+
+    /**
+     * Preset range. Use the same preset for both to only adapt the bitrate.
+     */
+    ffenc_preset fastest_preset;
+    ffenc_preset slowest_preset;
+} ffenc_adapt_config;
+
+typedef struct
+{
+    /**
+     * The new settings.
+     */
+    int bitrate;
+    ffenc_preset preset;
+
+    /**
+     * What was measured over the interval that led to the decision.
+     */
+    int64_t latency;
+    int64_t encode_usec;
+    int max_depth;
+    int64_t output_rate;
+
+    /**
+     * A readable line with the decision and the numbers behind it.
+     */
+    char reason[192];
+} ffenc_adapt_decision;
+
+typedef enum
+{
+    /**
+     * Y plane, then one plane of interleaved U and V.
+     */
+    FFENC_PIXEL_NV12 = 0,
+
+    /**
+     * NV12 with V before U, as Android cameras produce.
+     */
+    FFENC_PIXEL_NV21,
+
+    /**
+     * Packed 4:2:2 in one plane as Y0 U Y1 V, as most UVC cameras produce.
+     */
+    FFENC_PIXEL_YUYV,
+
+    /**
+     * Packed 4:2:2 in one plane as U Y0 V Y1.
+     */
+    FFENC_PIXEL_UYVY,
+
+    /**
+     * Separate Y, U and V planes.
+     */
+    FFENC_PIXEL_I420,
+
+    /**
+     * NV12 with 10-bit samples in the high bits of little endian 16-bit
+     * words. Encoded as 8-bit.
+     */
+    FFENC_PIXEL_P010,
+
+    /**
+     * Packed B G R A in one plane, as screen capture and most render
+     * targets produce. Alpha is ignored. See set_rgb_conversion.
+     */
+    FFENC_PIXEL_BGRA,
+
+    /**
+     * Packed R G B A in one plane, as read back from OpenGL.
+     */
+    FFENC_PIXEL_RGBA
+} ffenc_pixel_format;
+
+typedef enum
+{
+    /**
+     * Standard definition, and what most players assume when the stream does not say.
+     */
+    FFENC_MATRIX_BT601 = 0,
+
+    /**
+     * High definition.
+     */
+    FFENC_MATRIX_BT709
+} ffenc_color_matrix;
+
+/**
+ * How camera frames are cropped, rotated and mirrored on the way in.
+ */
+typedef struct
+{
+    /**
+     * Clockwise, in degrees: 0, 90, 180 or 270.
+     */
+    int rotation;
+
+    /**
+     * Flip left to right after rotating, as for a front facing camera.
+     */
+    bool mirror;
+
+    /**
+     * The part of each camera frame to keep, in the camera's own
+     * orientation, all even. A width or height of 0 keeps the whole frame.
+     */
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
+} ffenc_orientation;
+
+typedef enum
+{
+    /**
+     * Keep frames at the size they were added.
+     */
+    FFENC_SCALE_NONE = 0,
+
+    /**
+     * Average whole blocks of pixels when the frame is a multiple of the
+     * new size in each direction, up to 16 times, and interpolate as
+     * BILINEAR otherwise.
+     */
+    FFENC_SCALE_BOX,
+
+    /**
+     * Interpolate between the four nearest pixels. Takes any size, but
+     * pixels are skipped when shrinking by more than 2.
+     */
+    FFENC_SCALE_BILINEAR
+} ffenc_scale_filter;
+
+// the most reduced copies kept with each frame by set_pyramid
+#define FFENC_MAX_LAYERS 4
+
+/**
+ * A frame size in pixels.
+ */
+typedef struct
+{
+    int width;
+    int height;
+} ffenc_size;
+
+/**
+ * A frame in caller memory for add_frame.
+ */
+typedef struct
+{
+    ffenc_pixel_format format;
+
+    /**
+     * In pixels, both even.
+     */
+    int width;
+    int height;
+
+    /**
+     * One plane for packed formats, two for NV12, NV21 and P010, three
+     * for I420. Strides are in bytes.
+     */
+    const uint8_t *planes[3];
+    int strides[3];
+
+    /**
+     * Microseconds, seen by set_target_fps and the admit callback.
+     */
+    int64_t timestamp;
+
+    /**
+     * Optional. Called once the planes are no longer needed, only if
+     * add_frame returns FFENC_OK. Most formats are converted before
+     * add_frame returns and release is called right away. But I420, and
+     * NV12 for libx264 or the conversion threads, is then read in place
+     * and released once encoded, converted or dropped, possibly from
+     * another thread.
+     */
+    void (*release)(void *opaque);
+    void *opaque;
+} ffenc_image;
+
+// the most NAL units described by one packet
+#define FFENC_PACKET_MAX_NALS 64
+
+/**
+ * One H.264 NAL unit inside a packet, found by splitting the Annex B output.
+ */
+typedef struct
+{
+    /**
+     * Offset of the NAL header from packet->data, past the start code.
+     */
+    int offset;
+
+    /**
+     * Bytes from the NAL header up to the next start code.
+     */
+    int size;
+
+    /**
+     * nal_unit_type, e.g. 5 for an IDR slice, 7 for SPS and 8 for PPS.
+     */
+    int type;
+} ffenc_nal;
+
+class ffenc_packet_pool;
+class ffenc_writer;
+
+/**
+ * An encoded packet. The packet passed to the packet callback is only
+ * guaranteed to live for the duration of the callback, call retain()
+ * to keep it longer and release() once done with it. The buffer is
+ * recycled, so there is no need to copy the data out.
+ */
+class ffenc_packet
+{
+    friend class ffenc_packet_pool;
+    friend class ffenc_writer;
+
+public:
+
+    uint8_t *data;
+    int size;
+    int64_t pts;
+    int64_t dts;
+
+    /**
+     * AV_PKT_FLAG_KEY if the packet contains a keyframe.
+     */
+    int flags;
+
+    /**
+     * The AV_PICTURE_TYPE of the first slice, or AV_PICTURE_TYPE_NONE
+     * if the packet holds no slice.
+     */
+    int frame_type;
+
+    /**
+     * Whether this packet ends its picture. Only false in low latency
+     * mode with libx264, where every NAL unit is a packet of its own and
+     * those of one picture share their timestamps.
+     */
+    bool frame_end;
+
+    /**
+     * The NAL units of H.264 output. Left empty for other codecs.
+     * Only the first FFENC_PACKET_MAX_NALS are listed.
+     */
+    int nal_count;
+    ffenc_nal nals[FFENC_PACKET_MAX_NALS];
+
+    void retain();
+    void release();
+
+private:
+
+    volatile int refcount;
+    int size_class;
+    int capacity;
+    uint8_t *buffer;
+    ffenc_packet_pool *pool;
+    ffenc_packet *next;
+    int64_t queued_at;
+};
+
+struct ffenc_frame;
+class ffenc_frame_pool;
+class ffenc_adapter;
+class ffenc_convert_pool;
+class ffenc_scene_detector;
+class ffbb_recorder;
+class ffbb_band_pool;
+class ffenc_executor;
+struct ffenc_layers;
+template<typename T> class ffbb_ring;
+
+#if X264_SUPPORT
+class ffenc_x264;
+#endif
+
 class ffenc_context
 {
     friend void* encoding_thread(void* arg);
+    friend class ffenc_executor;
 
 public:
 
@@ -77,9 +651,141 @@ public:
     ffenc_error set_write_callback(void (*write_callback)(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg),
             void *arg);
 
+    /**
+     * Called once everything has been encoded and written after the
+     * context stops, whether stop was called or the encoder failed.
+     */
     ffenc_error set_close_callback(void (*close_callback)(ffenc_context *ffe_context, void *arg),
             void *arg);
 
+    /**
+     * Receive each encoded packet as a reference counted ffenc_packet.
+     * This is called before the write callback for the same packet.
+     */
+    ffenc_error set_packet_callback(void (*packet_callback)(ffenc_context *ffe_context, ffenc_packet *packet, void *arg),
+            void *arg);
+
+#if X264_SUPPORT
+    /**
+     * Encode with libx264 directly instead of codec_context. Camera
+     * frames are queued as NV12 and handed to x264_encoder_encode without
+     * converting them to I420. The parameters are copied and the encoder
+     * is opened by start(). Pass 0 to go back to codec_context.
+     */
+    ffenc_error set_x264_params(x264_param_t *param);
+
+    /**
+     * Change the libx264 parameters of a running encoder, see
+     * x264_encoder_reconfig for which ones can change. The new values
+     * take effect before the next frame is encoded.
+     */
+    ffenc_error reconfig_x264(x264_param_t *param);
+
+    /**
+     * Receive the NAL units of each encoded frame from the libx264 encoder.
+     * This is called before the write callback for the same data.
+     */
+    ffenc_error set_nal_callback(
+            void (*nal_callback)(ffenc_context *ffe_context, x264_nal_t *nals, int nal_count, void *arg),
+            void *arg);
+#endif
+
+    /**
+     * Receive the packets of one writer batch in a single call, in the
+     * style of writev. Only used when the writer thread is enabled, and
+     * then the write callback is not called.
+     */
+    ffenc_error set_writev_callback(
+            void (*writev_callback)(ffenc_context *ffe_context, const struct iovec *iov, int iovcnt, void *arg),
+            void *arg);
+
+    /**
+     * Run the packet, write and writev callbacks on a separate writer
+     * thread fed by a queue of the given capacity, so a slow sink does
+     * not hold up encoding. Everything waiting when the writer wakes is
+     * delivered as one batch. Use a capacity of 0 to write inline on the
+     * encoding thread, which is the default. Only valid while stopped.
+     */
+    ffenc_error set_writer_thread(int capacity, ffenc_writer_policy policy);
+
+    /**
+     * Get the writer queue depth, drop counters and write latency.
+     */
+    ffenc_error get_writer_stats(ffenc_writer_stats *stats);
+
+    /**
+     * Get the most recent SPS and PPS of H.264 output as one Annex B
+     * packet, so a sink joining late can start decoding at the next
+     * keyframe. The packet is retained for the caller, who must release
+     * it. Returns FFENC_NO_PARAMETER_SETS if none have been seen yet.
+     */
+    ffenc_error get_parameter_sets(ffenc_packet **packet);
+
+    /**
+     * Tune the encoder for the least delay between add_frame and the
+     * write callback: no B-frames or lookahead, sliced threads, and
+     * periodic intra refresh in place of large IDR frames. With libx264
+     * each slice is written as soon as it is encoded, as its own packet,
+     * instead of once the whole frame is done, and the nal callback is
+     * not used. There libx264 cuts each picture into one slice per
+     * thread and encodes them at once, handing each out in picture order.
+     * Only valid while stopped, it takes effect on start().
+     */
+    ffenc_error set_low_latency(bool low_latency);
+
+    /**
+     * Get the per-frame queue, encode and output latency.
+     */
+    ffenc_error get_latency_stats(ffenc_latency_stats *stats);
+
+    /**
+     * Get the frame counters, output bytes, queue depth and the ingest,
+     * queue, encode, write and total latency histograms, and with reset
+     * start counting again from zero. Recording takes no locks so this
+     * is cheap enough to leave on and can be called from any thread.
+     */
+    ffenc_error get_stats(ffbb_stats *stats, bool reset);
+
+    /**
+     * Write get_stats as text, one value per line with names starting
+     * with "ffenc", to a file or socket that something scrapes.
+     */
+    ffenc_error write_stats(int fd, bool reset);
+
+    /**
+     * Step the bitrate and preset down while the encoder falls behind
+     * the target latency or the queue fills, and back up once there has
+     * been headroom for a while. A faster preset is tried before a lower
+     * bitrate. Both start from what the encoder was configured with,
+     * moved into the ranges of the config, and a tuned libx264 config is
+     * kept as it is until the first decision, which moves it to the
+     * nearest preset. With libx264 the bitrate only changes if VBV is
+     * enabled. With codec_context the codec is drained and reopened for
+     * each change, so decisions are at least two seconds apart, and if
+     * it cannot be reopened the decision is reported with "reopen
+     * failed" in its reason and the context stops. The resolution is
+     * not adapted: set_scaling fixes the size frames are scaled to at
+     * start, and a new size needs new parameter sets, which libx264
+     * cannot reconfigure and which would break a stream already being
+     * decoded. Pass 0 to turn it off. Returns
+     * FFENC_FRAME_NOT_SUPPORTED for a config that cannot be used. Only
+     * valid while stopped.
+     */
+    ffenc_error set_adaptive(const ffenc_adapt_config *config);
+
+    /**
+     * Receive every decision of the adaptive controller.
+     */
+    ffenc_error set_adapt_callback(
+            void (*adapt_callback)(ffenc_context *ffe_context, const ffenc_adapt_decision *decision, void *arg),
+            void *arg);
+
+    /**
+     * The size frames are encoded at, that of codec_context or of the
+     * libx264 parameters.
+     */
+    ffenc_error get_frame_size(ffenc_size *size);
+
     /**
      * Start recording and encoding the camera frames.
      * Encoding will begin on a background thread.
@@ -98,13 +804,193 @@ public:
      */
     ffenc_error close();
 
+    /**
+     * Set how many frames can wait for the encoder and what add_frame
+     * does once that many are queued. The queue holds exactly capacity
+     * frames, which must be at least 1, or FFENC_FRAME_NOT_SUPPORTED is
+     * returned. This can only be changed while the context is stopped.
+     * The default is 32 frames with FFENC_QUEUE_DROP_NEWEST.
+     */
+    ffenc_error set_frame_queue(int capacity, ffenc_queue_policy policy);
+
+    /**
+     * Get the queue depth and per-policy drop counters.
+     */
+    ffenc_error get_frame_queue_stats(ffenc_queue_stats *stats);
+
+    /**
+     * Encode the next frame taken off the queue as an IDR frame, for
+     * example when a viewer joins or a decoder reports loss. Requests
+     * made within the minimum interval of the last accepted one are
+     * ignored since a keyframe is already on the way. Safe to call from
+     * any thread.
+     */
+    ffenc_error request_keyframe();
+
+    /**
+     * Set the minimum microseconds between accepted keyframe requests.
+     * The default is half a second, use 0 to accept every request.
+     * Only valid while stopped.
+     */
+    ffenc_error set_keyframe_request_interval(int64_t usec);
+
     /**
      * Add an AVFrame. The frame and frame->data[0] passed into this
-     * method will be freed by the encoding thread.
+     * method will be freed by the encoding thread. If the frame is
+     * refused with FFENC_QUEUE_FULL or FFENC_FRAME_SKIPPED the caller
+     * keeps ownership.
+     *
+     * Any add_frame method may be called from several threads at once.
      */
     ffenc_error add_frame(AVFrame *frame);
 
-#if !OSX_PLATFORM
+    /**
+     * Decide in add_frame, before anything is copied or converted,
+     * whether a frame is wanted at all. The timestamp is the camera's
+     * when there is one, otherwise the time add_frame was called, in
+     * microseconds. Return false to skip the frame, add_frame then
+     * returns FFENC_FRAME_SKIPPED. Called on the thread adding the frame.
+     */
+    ffenc_error set_admit_callback(bool (*admit_callback)(ffenc_context *ffe_context, int64_t timestamp, void *arg),
+            void *arg);
+
+    /**
+     * Only let frames through add_frame at up to this rate, skipping the
+     * rest before they are copied, for time-lapse or a lower frame rate
+     * than the camera's. Use 0 to keep every frame, which is the default.
+     * Only valid while stopped.
+     */
+    ffenc_error set_target_fps(double fps);
+
+    /**
+     * Convert camera frames from NV12 on this many threads instead of in
+     * add_frame. add_frame then only copies the frame, and converted
+     * frames reach the encoder in the order they were added. When the
+     * frames converting reach the queue capacity, add_frame returns
+     * FFENC_QUEUE_FULL. With FFENC_QUEUE_BLOCK every frame add_frame
+     * accepted is still encoded after stop. Use 0 to convert in add_frame,
+     * which is the default. Frames for the libx264 backend are never converted so this
+     * has no effect there. Only valid while stopped.
+     */
+    ffenc_error set_conversion_threads(int threads);
+
+    /**
+     * Encode on the threads of executor instead of a thread of this
+     * context's own, so many contexts can share a few threads. Frames are
+     * still encoded one at a time and in order, and the close callback is
+     * called on one of the executor's threads. The executor must be
+     * running when start is called, otherwise start returns
+     * FFENC_NOT_RUNNING. Use 0 for a thread of its own, which is the
+     * default. Only valid while stopped.
+     */
+    ffenc_error set_executor(ffenc_executor *executor);
+
+    /**
+     * How add_frame turns BGRA and RGBA into YUV: the matrix, and whether
+     * Y spans 0-255 or the 16-235 of limited range video. Frames of
+     * 2560x1440 and up are converted in bands on this many threads, the
+     * one calling add_frame included. The default is BT.601, limited
+     * range, on one thread. Only the samples change, set colorspace and
+     * color_range on the codec context to match so players decode them
+     * the same way. Only valid while stopped.
+     */
+    ffenc_error set_rgb_conversion(ffenc_color_matrix matrix, bool full_range, int threads);
+
+    /**
+     * Crop, rotate and mirror NV12 and NV21 frames in the same pass that
+     * turns them into I420, so each sample is read and written once. The
+     * codec context must have the size of the result, which is height x
+     * width after a rotation of 90 or 270. While set, frames for the
+     * libx264 backend are converted to I420 as well, and other formats or
+     * frames the crop does not fit return FFENC_FRAME_NOT_SUPPORTED from
+     * add_frame. Pass 0 to turn it off. Returns FFENC_FRAME_NOT_SUPPORTED
+     * for any other rotation or an odd crop. Only valid while stopped.
+     */
+    ffenc_error set_orientation(const ffenc_orientation *orientation);
+
+    /**
+     * Scale NV12 and NV21 frames that are not the size of the codec
+     * context, after any crop, to that size in the same pass that turns
+     * them into I420, instead of copying them at the camera's size first.
+     * Frames for the libx264 backend that need scaling are converted to
+     * I420 as well. Scaling cannot be combined with a rotation or mirror
+     * from set_orientation, such frames return FFENC_FRAME_NOT_SUPPORTED
+     * from add_frame, as do ffenc_image frames of other formats. The
+     * default is FFENC_SCALE_NONE, any value that is not a filter returns
+     * FFENC_FRAME_NOT_SUPPORTED. Only valid while stopped.
+     */
+    ffenc_error set_scaling(ffenc_scale_filter filter);
+
+    /**
+     * Make reduced copies of every frame as it is queued, for analytics
+     * or previews, so they are not each made from the full frame by a
+     * pass of their own. Sizes go from largest to smallest, are even and
+     * each is made from the one before it, the first from the frame.
+     * Read them with get_pyramid. Use a count of 0 to turn it off.
+     * Returns FFENC_FRAME_NOT_SUPPORTED for more than FFENC_MAX_LAYERS
+     * sizes, sizes out of order, FFENC_SCALE_NONE or a filter that does
+     * not exist. Only valid while stopped.
+     */
+    ffenc_error set_pyramid(const ffenc_size *sizes, int count, ffenc_scale_filter filter);
+
+    /**
+     * Fill layers with the reduced copies of the current frame from
+     * set_pyramid, largest first, for use inside the frame callback.
+     * They are I420 and only valid until the callback returns. Returns
+     * how many there are, 0 when the pyramid is off or could not be
+     * made for this frame.
+     */
+    int get_pyramid(AVFrame **layers);
+
+    /**
+     * Compare each frame with the last one encoded as changed, before it
+     * reaches the encoder, and skip or cheaply encode the unchanged ones.
+     * Runs on the encoding thread ahead of the frame callback. Pass 0
+     * to turn it off. Returns FFENC_FRAME_NOT_SUPPORTED for a config
+     * outside the documented ranges. Only valid while stopped.
+     */
+    ffenc_error set_scene_detection(const ffenc_scene_config *config);
+
+    /**
+     * The percentage of blocks of the current frame that changed, for use
+     * inside the frame callback. Returning false from the callback still
+     * skips the frame, returning true does not stop an unchanged frame from
+     * being skipped. Returns -1 when scene detection is off.
+     */
+    float get_change_score();
+
+    /**
+     * Limit how many pooled frames can be queued or encoding at once.
+     * When the limit is reached add_frame returns FFENC_POOL_EXHAUSTED.
+     * Use 0 for no limit, which is the default.
+     */
+    ffenc_error set_frame_pool_limit(int max_in_flight);
+
+    /**
+     * Get the hit, miss and high-water counters of the frame pool.
+     */
+    ffenc_error get_frame_pool_stats(ffenc_pool_stats *stats);
+
+    /**
+     * Add an NV12 frame from memory on any platform, such as one from
+     * ffsynth_source. The planes are copied before this returns. The
+     * timestamp is in microseconds and is what set_target_fps and the
+     * admit callback see.
+     */
+    ffenc_error add_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+            int width, int height, int64_t timestamp);
+
+    /**
+     * Add a frame of any ffenc_pixel_format from memory. Everything but
+     * NV12 is converted to I420 on the calling thread, not by the
+     * conversion threads, though large BGRA and RGBA frames are shared
+     * with those of set_rgb_conversion. Returns FFENC_FRAME_NOT_SUPPORTED for an
+     * unknown format or odd size, and for formats other than NV12 and
+     * NV21 while set_orientation or set_scaling is in use.
+     */
+    ffenc_error add_frame(const ffenc_image *image);
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     /**
      * Add a frame from the native camera API.
      * This should have a buf->frametype of CAMERA_FRAMETYPE_NV12.
@@ -122,12 +1008,107 @@ private:
 
     void free_frames();
     void encoding_thread();
+    void begin_encoding();
+    void encode_entry(ffenc_frame *entry);
+    void finish_encoding();
+    bool run_turn();
+    void wait_for_frame();
+    void signal_frame();
+    void wait_for_space();
+    void signal_space();
+    ffenc_error queue_frame(ffenc_frame *entry);
+    ffenc_error push_frame(ffenc_frame *entry, bool accepted);
+    void close_queue();
+    void drop_frame(ffenc_frame *entry);
+    int encode(AVFrame *frame);
+    int codec_preset();
+    ffenc_error reopen_codec();
+    void adapt(int64_t latency, int64_t encode_usec);
+    void write_packet(ffenc_packet *packet);
+    static void write_packet(ffenc_packet *packet, void *arg);
+    void inspect_packet(ffenc_packet *packet);
+    void cache_parameter_set(const uint8_t *nal, int size, ffenc_packet **cached);
+    void deliver_packets(ffenc_packet **packets, int count);
+    static void deliver_packets(ffenc_packet **packets, int count, void *arg);
+    static void writer_dropping(void *arg);
 
-    bool running;
+    bool admit_frame(int64_t timestamp);
+    static void queue_converted(ffenc_frame *entry, void *arg);
+    void hold_frame(ffenc_frame *entry);
+    bool take_held(ffenc_frame **entry);
+    ffenc_error add_nv12_frame(const uint8_t *srcy, int stride,
+            const uint8_t *srcuv, int uv_stride, int width, int height);
+    ffenc_error copy_nv12_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+            int width, int height, const ffenc_image *image, bool *kept);
+    ffenc_error copy_image(const ffenc_image *image, bool *kept);
+    bool crop_frame(const uint8_t **srcy, int stride, const uint8_t **srcuv, int uv_stride,
+            int *width, int *height);
+    bool scalable(int width, int height);
+
+    volatile bool running;
+    volatile int reader_waiting;
+    volatile int writers_waiting;
+    volatile int producers;
+    volatile int queue_closed;
+    ffenc_frame *held_head;
+    ffenc_frame *held_tail;
     pthread_mutex_t reading_mutex;
     pthread_cond_t read_cond;
-    std::deque<AVFrame*> frames;
+    pthread_cond_t write_cond;
+    ffbb_ring<ffenc_frame*> *frames;
+    ffenc_queue_policy queue_policy;
+    ffenc_queue_stats queue_stats;
+    int64_t admit_interval;
+    volatile int64_t admit_next;
+    volatile int keyframe_requested;
+    volatile int64_t keyframe_requested_at;
+    int64_t keyframe_request_interval;
+    ffenc_frame_pool *frame_pool;
+    int conversion_threads;
+    ffenc_convert_pool *converter;
+    ffenc_executor *executor;
+    volatile int executor_scheduled;
+    ffenc_context *executor_next;
+    ffenc_color_matrix rgb_matrix;
+    bool rgb_full_range;
+    int rgb_threads;
+    ffbb_band_pool *rgb_bands;
+    bool oriented;
+    ffenc_orientation orientation;
+    ffenc_scale_filter scale_filter;
+    int scale_width;
+    int scale_height;
+    ffenc_size pyramid_sizes[FFENC_MAX_LAYERS];
+    int pyramid_count;
+    ffenc_scale_filter pyramid_filter;
+    ffenc_layers *current_layers;
+    bool scene_detection;
+    ffenc_scene_config scene_config;
+    ffenc_scene_detector *scene_detector;
+    float change_score;
     int frame_index;
+    ffenc_packet_pool *packet_pool;
+    ffenc_writer *writer;
+    bool low_latency;
+    bool inspect_nals;
+    pthread_mutex_t parameter_sets_mutex;
+    ffenc_packet *sps;
+    ffenc_packet *pps;
+    ffenc_packet *parameter_sets;
+    ffenc_latency_stats latency_stats;
+    volatile int64_t first_output_at;
+    volatile int64_t output_bytes;
+    ffbb_recorder *recorder;
+    bool adaptive;
+    ffenc_adapt_config adapt_config;
+    ffenc_adapter *adapter;
+
+#if X264_SUPPORT
+    ffenc_x264 *x264;
+
+    void (*nal_callback)(ffenc_context *ffe_context, x264_nal_t *nals, int nal_count, void *arg);
+    void *nal_callback_arg;
+#endif
 
     bool (*frame_callback)(ffenc_context *ffe_context, AVFrame *frame, int index, void *arg);
     void *frame_callback_arg;
@@ -135,8 +1116,20 @@ private:
     void (*write_callback)(ffenc_context *ffe_context, uint8_t *buf, ssize_t size, void *arg);
     void *write_callback_arg;
 
+    void (*packet_callback)(ffenc_context *ffe_context, ffenc_packet *packet, void *arg);
+    void *packet_callback_arg;
+
+    void (*writev_callback)(ffenc_context *ffe_context, const struct iovec *iov, int iovcnt, void *arg);
+    void *writev_callback_arg;
+
     void (*close_callback)(ffenc_context *ffe_context, void *arg);
     void *close_callback_arg;
+
+    void (*adapt_callback)(ffenc_context *ffe_context, const ffenc_adapt_decision *decision, void *arg);
+    void *adapt_callback_arg;
+
+    bool (*admit_callback)(ffenc_context *ffe_context, int64_t timestamp, void *arg);
+    void *admit_callback_arg;
 };
 
 #endif
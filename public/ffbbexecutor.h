@@ -0,0 +1,96 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBEXECUTOR_H
+#define FFBBEXECUTOR_H
+
+#include "ffbbenc.h"
+
+/**
+ * A fixed set of encoding threads shared by any number of contexts, in
+ * place of a thread started by each context. A context with queued
+ * frames is handed to one thread at a time, which encodes one frame and
+ * puts it back at the end of its own queue, so every context gets a turn
+ * and frames of one context are still encoded in order. A thread that
+ * runs out of contexts takes them from the other threads.
+ */
+class ffenc_executor
+{
+    friend void* executor_thread(void* arg);
+
+public:
+
+    /**
+     * Use 0 threads for one per online processor.
+     */
+    ffenc_executor(int threads);
+    virtual ~ffenc_executor();
+
+    bool start();
+
+    /**
+     * Finish the work already handed to the threads and wait for them to
+     * exit. Stop the contexts using this executor and wait for their close
+     * callbacks first, a context started afterwards never runs.
+     */
+    void stop();
+
+    bool is_running()
+    {
+        return running;
+    }
+
+    int thread_count()
+    {
+        return threads;
+    }
+
+    /**
+     * Queue context to encode what it has queued, unless it already is.
+     * Called by the context itself when frames are queued or it stops.
+     */
+    void schedule(ffenc_context *context);
+
+private:
+
+    struct worker
+    {
+        pthread_mutex_t mutex;
+        ffenc_context *head;
+        ffenc_context *tail;
+        ffenc_executor *executor;
+        int index;
+    };
+
+    void executor_thread(worker *self);
+    void push(worker *target, ffenc_context *context);
+    ffenc_context* pop(worker *target);
+    ffenc_context* take(worker *self);
+    bool has_work();
+    void wait_for_work();
+
+    int threads;
+    int worker_count;
+    pthread_t *pthreads;
+    worker *workers;
+    volatile bool running;
+    volatile int next_worker;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    volatile int sleepers;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBMUX_H
+#define FFBBMUX_H
+
+#include "ffbbenc.h"
+
+typedef enum
+{
+    FFMUX_OK = 0,
+    FFMUX_ALREADY_OPEN,
+    FFMUX_NOT_OPEN,
+    FFMUX_FORMAT_NOT_FOUND,
+    FFMUX_WRITE_ERROR
+} ffmux_error;
+
+typedef enum
+{
+    /**
+     * Fragmented MP4 with an empty moov, so every fragment stands on its
+     * own. H.264 needs the SPS and PPS as extradata, open the encoder with
+     * CODEC_FLAG_GLOBAL_HEADER.
+     */
+    FFMUX_FORMAT_FMP4 = 0,
+
+    /**
+     * MPEG transport stream.
+     */
+    FFMUX_FORMAT_MPEGTS
+} ffmux_format;
+
+/**
+ * Wraps encoded packets in a container and streams the result out
+ * through a callback or a file descriptor. The output is never seeked,
+ * so a recording is readable up to the last fragment after a crash and
+ * can be tailed while it is being written.
+ */
+class ffmux_context
+{
+public:
+
+    ffmux_context();
+    virtual ~ffmux_context();
+
+    /**
+     * Reset the context with default values.
+     */
+    void reset();
+
+    /**
+     * Receive the container bytes. Return the number of bytes consumed,
+     * or a negative value on error.
+     */
+    ffmux_error set_write_callback(int (*write_callback)(ffmux_context *ffm_context, uint8_t *buf, int size, void *arg),
+            void *arg);
+
+    /**
+     * Write the container bytes to a file descriptor instead of a callback.
+     * The descriptor is not closed by the context.
+     */
+    ffmux_error set_fd(int fd);
+
+    /**
+     * How much media to collect before a fragment is written out, in
+     * microseconds. Fragments also start at keyframes. The default is one second.
+     */
+    ffmux_error set_fragment_duration(int64_t fragment_duration);
+
+    /**
+     * Open the container using the stream parameters of the encoder.
+     */
+    ffmux_error open(ffmux_format format, AVCodecContext *codec_context);
+
+    /**
+     * Open the container with explicit stream parameters, for
+     * encoders that are not driven through an AVCodecContext.
+     */
+    ffmux_error open(ffmux_format format, enum CodecID codec_id, int width, int height,
+            AVRational time_base, const uint8_t *extradata, int extradata_size);
+
+    /**
+     * Add one encoded packet. The timestamps are in the time base
+     * the context was opened with. Packets that do not end their picture,
+     * the NAL units of low latency mode, are collected and written as one
+     * sample with the packet that does. After a write error every call
+     * returns FFMUX_WRITE_ERROR.
+     */
+    ffmux_error write_packet(ffenc_packet *packet);
+
+    /**
+     * Write the trailer and release the container. Returns
+     * FFMUX_WRITE_ERROR if any packet could not be written.
+     */
+    ffmux_error close();
+
+    /**
+     * A packet callback for ffenc_context::set_packet_callback that
+     * forwards to the ffmux_context passed as the argument, in low
+     * latency mode too. A write error is kept and returned by close.
+     */
+    static void packet_callback(ffenc_context *ffe_context, ffenc_packet *packet, void *arg);
+
+private:
+
+    static int write_output(void *opaque, uint8_t *buf, int buf_size);
+    ffmux_error write_sample(uint8_t *data, int size, int flags, int64_t pts, int64_t dts);
+    bool collect(ffenc_packet *packet);
+
+    AVFormatContext *format_context;
+    AVStream *stream;
+    AVRational time_base;
+    uint8_t *io_buffer;
+    int64_t fragment_duration;
+    int64_t fragment_start;
+    int fd;
+    ffmux_error error;
+
+    // the NAL units of the picture being collected
+    uint8_t *frame_buffer;
+    int frame_size;
+    int frame_capacity;
+    int frame_flags;
+    int64_t frame_pts;
+    int64_t frame_dts;
+
+    int (*write_callback)(ffmux_context *ffm_context, uint8_t *buf, int size, void *arg);
+    void *write_callback_arg;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSIMULCAST_H
+#define FFBBSIMULCAST_H
+
+#include "ffbbenc.h"
+
+// the most contexts one camera can be encoded by
+#define FFENC_SIMULCAST_MAX_LAYERS 8
+
+class ffenc_shared_pool;
+
+/**
+ * Encodes one camera at several sizes and bitrates at once. Each frame
+ * is converted to I420 once, at the size of the largest layer, each
+ * smaller size is scaled from the next larger one once, and every
+ * layer queues the shared planes without copying them. Each layer is an
+ * ffenc_context with its own encoding thread, callbacks and codec
+ * settings, and the planes are recycled once every layer is done.
+ */
+class ffenc_simulcast
+{
+public:
+
+    ffenc_simulcast();
+    virtual ~ffenc_simulcast();
+
+    /**
+     * Encode frames with context at the size from its get_frame_size.
+     * Set the context up as usual, but leave it stopped and without
+     * set_orientation or set_scaling, the layers are given I420 of their
+     * own size. Layers of the same size share one set of planes. Returns
+     * FFENC_QUEUE_FULL beyond FFENC_SIMULCAST_MAX_LAYERS layers. Only
+     * valid while stopped.
+     */
+    ffenc_error add_layer(ffenc_context *context);
+
+    /**
+     * How frames are scaled to the largest layer and the layers to each
+     * other. The default is FFENC_SCALE_BOX. Only valid while stopped.
+     */
+    ffenc_error set_scale_filter(ffenc_scale_filter filter);
+
+    /**
+     * Start every layer. Returns FFENC_FRAME_NOT_SUPPORTED if the layers
+     * come in more than FFENC_MAX_LAYERS + 1 sizes.
+     */
+    ffenc_error start();
+
+    /**
+     * Stop every layer. Each encodes the frames it has queued and calls
+     * its close callback as if stopped on its own.
+     */
+    ffenc_error stop();
+
+    /**
+     * Add an NV12 frame of any even size. It is converted and scaled
+     * before this returns, and added to every layer as I420. Returns
+     * FFENC_OK if at least one layer took the frame, otherwise the
+     * error of the first layer.
+     */
+    ffenc_error add_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+            int width, int height, int64_t timestamp);
+
+    /**
+     * Add an NV12 or NV21 frame, as the NV12 add_frame. The release
+     * function of the image is called before this returns.
+     */
+    ffenc_error add_frame(const ffenc_image *image);
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
+    /**
+     * Add a frame from the native camera API, of CAMERA_FRAMETYPE_NV12.
+     */
+    ffenc_error add_frame(camera_buffer_t* buf);
+#elif OSX_PLATFORM
+    /**
+     * Add a frame from CoreVideo, of kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange.
+     */
+    ffenc_error add_frame(CVImageBufferRef pixelBuffer);
+#endif
+
+    /**
+     * Get one set of stats for the whole group. The ingest stage is the
+     * shared conversion, frames_in counts frames added to the group, and
+     * everything else adds up the stats of the layers, so frames_out and
+     * bytes cover every layer. With reset, the group and every layer
+     * start counting again from zero.
+     */
+    ffenc_error get_stats(ffbb_stats *stats, bool reset);
+
+    /**
+     * Write get_stats as text, with names starting with "ffenc_simulcast".
+     */
+    ffenc_error write_stats(int fd, bool reset);
+
+private:
+
+    ffenc_error add_nv12_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+            int width, int height, int64_t timestamp, bool nv21);
+
+    ffenc_context *layers[FFENC_SIMULCAST_MAX_LAYERS];
+    int layer_count;
+
+    // which pyramid layer each context encodes, -1 for the full frame
+    int sources[FFENC_SIMULCAST_MAX_LAYERS];
+    int width;
+    int height;
+
+    ffenc_scale_filter scale_filter;
+    ffenc_shared_pool *shared;
+    ffbb_recorder *recorder;
+    volatile bool running;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSTATS_H
+#define FFBBSTATS_H
+
+#include <stdint.h>
+
+// eight buckets per power of two up to 2^40, about 12% wide each
+#define FFBB_HISTOGRAM_BUCKETS 312
+#define FFBB_STATS_MAX_STAGES 6
+
+/**
+ * A log-linear histogram of microseconds, or of queue depth. Values
+ * below 8 have a bucket each, above that every power of two is split
+ * into 8 buckets.
+ */
+typedef struct
+{
+    int64_t count;
+    int64_t sum;
+    int64_t min;
+    int64_t max;
+    int64_t buckets[FFBB_HISTOGRAM_BUCKETS];
+} ffbb_histogram;
+
+typedef struct
+{
+    /**
+     * Microseconds covered, since start or since the last reset.
+     */
+    int64_t elapsed;
+
+    /**
+     * Frames handed to the context, frames that came out of the codec,
+     * and frames that were dropped, skipped or failed on the way.
+     */
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t frames_dropped;
+
+    /**
+     * Bytes written by an encoder or read by a decoder.
+     */
+    int64_t bytes;
+
+    /**
+     * frames_out over elapsed.
+     */
+    double fps;
+
+    /**
+     * Queue depth sampled each time a frame is taken off the queue.
+     */
+    ffbb_histogram queue_depth;
+
+    /**
+     * Microseconds spent in each stage of the pipeline.
+     */
+    int stage_count;
+    const char *stage_names[FFBB_STATS_MAX_STAGES];
+    ffbb_histogram stages[FFBB_STATS_MAX_STAGES];
+} ffbb_stats;
+
+/**
+ * The value below which the given fraction, 0 to 1, of the recorded
+ * values fall, to the precision of the bucket it lands in.
+ */
+int64_t ffbb_histogram_percentile(const ffbb_histogram *histogram, double fraction);
+
+/**
+ * Add the values recorded in src to dst, as if both had been recorded
+ * in one histogram.
+ */
+void ffbb_histogram_merge(ffbb_histogram *dst, const ffbb_histogram *src);
+
+/**
+ * Write the stats as text, one "name{labels} value" line per value,
+ * with every name starting with prefix. Returns the length of the full
+ * text like snprintf, which may be more than size.
+ */
+int ffbb_stats_format(const ffbb_stats *stats, const char *prefix, char *buf, int size);
+
+/**
+ * Format the stats and write them to a file or socket.
+ * Returns 0, or -1 if the write failed.
+ */
+int ffbb_stats_write(const ffbb_stats *stats, const char *prefix, int fd);
+
+#endif
@@ -0,0 +1,188 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSYNTH_H
+#define FFBBSYNTH_H
+
+#include "ffbbenc.h"
+
+#include <stdio.h>
+
+typedef enum
+{
+    FFSYNTH_OK = 0,
+    FFSYNTH_INVALID_SIZE,
+    FFSYNTH_FILE_ERROR,
+    FFSYNTH_ALREADY_RUNNING,
+    FFSYNTH_ALREADY_STOPPED,
+    FFSYNTH_THREAD_ERROR
+} ffsynth_error;
+
+typedef enum
+{
+    /**
+     * Color bars scrolling sideways, mostly horizontal motion.
+     */
+    FFSYNTH_PATTERN_BARS = 0,
+
+    /**
+     * A box bouncing over a still gradient, a small moving area.
+     */
+    FFSYNTH_PATTERN_BOX,
+
+    /**
+     * New random pixels every frame, the worst case for an encoder.
+     */
+    FFSYNTH_PATTERN_NOISE,
+
+    /**
+     * The same color bars every frame, for static scene detection.
+     */
+    FFSYNTH_PATTERN_STILL
+} ffsynth_pattern;
+
+typedef struct
+{
+    const uint8_t *y;
+    int y_stride;
+    const uint8_t *uv;
+    int uv_stride;
+    int width;
+    int height;
+
+    /**
+     * Frames produced before this one.
+     */
+    int64_t index;
+
+    /**
+     * Microseconds on the monotonic clock, spaced 1 / fps apart.
+     */
+    int64_t timestamp;
+} ffsynth_frame;
+
+/**
+ * Produces NV12 frames without a camera, drawn as a moving test pattern
+ * or read in a loop from a file of raw NV12 frames, so the encoder can
+ * be run and measured on any machine.
+ */
+class ffsynth_source
+{
+    friend void* synthesizing_thread(void* arg);
+
+public:
+
+    ffsynth_source();
+    virtual ~ffsynth_source();
+
+    /**
+     * Set the frame size. Both must be even. The default is 1280x720.
+     */
+    ffsynth_error set_size(int width, int height);
+
+    /**
+     * Set the frame rate start() keeps to, or 0 to produce frames as
+     * fast as they are taken. The default is 30.
+     */
+    ffsynth_error set_fps(double fps);
+
+    ffsynth_error set_pattern(ffsynth_pattern pattern);
+
+    /**
+     * Replay a file of raw NV12 frames of the configured size instead
+     * of drawing a pattern, starting over at the end. Pass 0 to go back
+     * to the pattern. One can be made with:
+     * ffmpeg -i input.mp4 -s 1280x720 -pix_fmt nv12 -f rawvideo input.nv12
+     */
+    ffsynth_error set_replay_file(const char *path);
+
+    /**
+     * Stop after this many frames, or 0 to run until stop(). The default is 0.
+     */
+    ffsynth_error set_frame_limit(int64_t frames);
+
+    /**
+     * Hand every frame to this encoder with ffenc_context::add_frame.
+     */
+    ffsynth_error set_encoder(ffenc_context *ffe_context);
+
+    ffsynth_error set_frame_callback(
+            void (*frame_callback)(ffsynth_source *source, const ffsynth_frame *frame, void *arg),
+            void *arg);
+
+    /**
+     * Called on the source thread once the frame limit is reached or
+     * the file cannot be read.
+     */
+    ffsynth_error set_close_callback(
+            void (*close_callback)(ffsynth_source *source, void *arg),
+            void *arg);
+
+    /**
+     * Produce the next frame into frame on the calling thread. The
+     * planes stay valid until the next call. Not for use while started.
+     */
+    ffsynth_error next_frame(ffsynth_frame *frame);
+
+    /**
+     * Produce frames at the configured rate on a background thread,
+     * handing each to the encoder and the frame callback.
+     */
+    ffsynth_error start();
+
+    /**
+     * Stop producing frames and wait for the background thread. Do not
+     * call from the frame callback.
+     */
+    ffsynth_error stop();
+
+private:
+
+    void synthesizing_thread();
+    bool allocate();
+    void draw_bars(int offset);
+    void draw_box(int64_t index);
+    void draw_noise();
+    bool read_frame();
+
+    int width;
+    int height;
+    double fps;
+    ffsynth_pattern pattern;
+    int64_t frame_limit;
+    int64_t frame_index;
+    int64_t started_at;
+
+    uint8_t *y;
+    uint8_t *uv;
+    uint8_t *background;
+    uint32_t seed;
+
+    FILE *replay;
+
+    volatile bool running;
+    bool joinable;
+    pthread_t thread;
+
+    ffenc_context *ffe_context;
+
+    void (*frame_callback)(ffsynth_source *source, const ffsynth_frame *frame, void *arg);
+    void *frame_callback_arg;
+
+    void (*close_callback)(ffsynth_source *source, void *arg);
+    void *close_callback_arg;
+};
+
+#endif
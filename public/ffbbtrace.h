@@ -0,0 +1,41 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBTRACE_H
+#define FFBBTRACE_H
+
+/**
+ * Start recording a timeline of every frame through ingest, convert,
+ * queue, encode and write, and through read, decode and display, for
+ * all contexts. Each thread keeps its last events_per_thread events in
+ * its own ring, so recording takes no locks. Events from an earlier
+ * capture are dropped. Tracing is off until this is called.
+ */
+void ffbb_trace_start(int events_per_thread);
+
+/**
+ * Stop recording. The captured events are kept until the next start.
+ */
+void ffbb_trace_stop();
+
+/**
+ * Write the captured events as Chrome trace-event JSON, which can be
+ * opened in Perfetto or chrome://tracing. Call after ffbb_trace_stop,
+ * events recorded while writing may be torn. Returns 0, or -1 if the
+ * write failed.
+ */
+int ffbb_trace_write(int fd);
+
+#endif
@@ -0,0 +1,176 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbadapt.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *preset_names[] = { "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow",
+        "slower", "veryslow" };
+
+const char* ffenc_preset_name(int preset)
+{
+    if (preset < FFENC_PRESET_ULTRAFAST || preset > FFENC_PRESET_VERYSLOW) return 0;
+    return preset_names[preset];
+}
+
+int ffenc_preset_from_name(const char *name)
+{
+    for (int i = FFENC_PRESET_ULTRAFAST; i <= FFENC_PRESET_VERYSLOW; i++)
+    {
+        if (!strcmp(name, preset_names[i])) return i;
+    }
+
+    return -1;
+}
+
+bool ffenc_adapt_config_valid(const ffenc_adapt_config *config)
+{
+    // a step of 0 would make every decision a change to the same bitrate
+    if (config->target_latency <= 0 || config->interval <= 0) return false;
+    if (config->min_bitrate <= 0 || config->min_bitrate > config->max_bitrate) return false;
+    if (config->bitrate_step < 1 || config->bitrate_step > 99) return false;
+    if (!ffenc_preset_name(config->fastest_preset) || !ffenc_preset_name(config->slowest_preset)) return false;
+    return config->fastest_preset <= config->slowest_preset;
+}
+
+ffenc_adapter::ffenc_adapter(const ffenc_adapt_config *config, int bitrate, int preset)
+{
+    this->config = *config;
+
+    // start from what the encoder was set up with, moved into the range,
+    // and the best quality allowed when it has no bitrate of its own
+    if (bitrate <= 0 || bitrate > config->max_bitrate) bitrate = config->max_bitrate;
+    if (bitrate < config->min_bitrate) bitrate = config->min_bitrate;
+    if (preset < config->fastest_preset) preset = config->fastest_preset;
+    if (preset > config->slowest_preset) preset = config->slowest_preset;
+
+    this->bitrate = bitrate;
+    this->preset = preset;
+    calm_windows = 0;
+
+    window_start = 0;
+    window_frames = 0;
+    window_latency = 0;
+    window_encode = 0;
+    window_bytes_start = 0;
+    window_max_depth = 0;
+
+    latency = 0;
+    encode_usec = 0;
+    max_depth = 0;
+    output_rate = 0;
+}
+
+bool ffenc_adapter::update(int64_t now, int queue_depth, int queue_capacity,
+        int64_t latency, int64_t encode_usec, int64_t output_bytes,
+        ffenc_adapt_decision *decision)
+{
+    if (!window_start)
+    {
+        window_start = now;
+        window_bytes_start = output_bytes;
+    }
+
+    window_frames++;
+    window_latency += latency;
+    window_encode += encode_usec;
+    if (queue_depth > window_max_depth) window_max_depth = queue_depth;
+
+    int64_t elapsed = now - window_start;
+    if (elapsed < config.interval) return false;
+
+    this->latency = window_latency / window_frames;
+    this->encode_usec = window_encode / window_frames;
+    max_depth = window_max_depth;
+    output_rate = (output_bytes - window_bytes_start) * 8 * 1000000 / (elapsed > 0 ? elapsed : 1);
+
+    window_start = now;
+    window_bytes_start = output_bytes;
+    window_frames = 0;
+    window_latency = 0;
+    window_encode = 0;
+    window_max_depth = 0;
+
+    bool overloaded = this->latency > config.target_latency || max_depth > queue_capacity / 2;
+    bool headroom = this->latency < config.target_latency / 2 && max_depth <= 1;
+
+    if (overloaded)
+    {
+        calm_windows = 0;
+
+        // a faster preset frees the most cpu, the bitrate goes next
+        if (preset > config.fastest_preset)
+        {
+            preset--;
+            fill_decision(decision, "overloaded, faster preset");
+            return true;
+        }
+
+        if (bitrate > config.min_bitrate)
+        {
+            bitrate = bitrate - (int) ((int64_t) bitrate * config.bitrate_step / 100);
+            if (bitrate < config.min_bitrate) bitrate = config.min_bitrate;
+            fill_decision(decision, "overloaded, lower bitrate");
+            return true;
+        }
+
+        return false;
+    }
+
+    if (!headroom)
+    {
+        calm_windows = 0;
+        return false;
+    }
+
+    if (++calm_windows < ADAPT_CALM_WINDOWS) return false;
+
+    calm_windows = 0;
+
+    // only raise the bitrate if the encoder is using what it already has
+    if (bitrate < config.max_bitrate && output_rate >= (int64_t) bitrate * 8 / 10)
+    {
+        bitrate = bitrate + (int) ((int64_t) bitrate * config.bitrate_step / 100);
+        if (bitrate > config.max_bitrate) bitrate = config.max_bitrate;
+        fill_decision(decision, "headroom, higher bitrate");
+        return true;
+    }
+
+    if (preset < config.slowest_preset)
+    {
+        preset++;
+        fill_decision(decision, "headroom, slower preset");
+        return true;
+    }
+
+    return false;
+}
+
+void ffenc_adapter::fill_decision(ffenc_adapt_decision *decision, const char *action)
+{
+    decision->bitrate = bitrate;
+    decision->preset = (ffenc_preset) preset;
+    decision->latency = latency;
+    decision->encode_usec = encode_usec;
+    decision->max_depth = max_depth;
+    decision->output_rate = output_rate;
+
+    snprintf(decision->reason, sizeof(decision->reason),
+            "%s: bitrate %d preset %s (latency %lld us target %lld us, encode %lld us, queue %d, output %lld bps)",
+            action, bitrate, ffenc_preset_name(preset), (long long) latency, (long long) config.target_latency,
+            (long long) encode_usec, max_depth, (long long) output_rate);
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBADAPT_H
+#define FFBBADAPT_H
+
+#include "ffbbenc.h"
+
+// windows in a row with headroom before stepping back up
+#define ADAPT_CALM_WINDOWS 3
+
+// the least microseconds between decisions when each reopens the codec
+#define ADAPT_REOPEN_INTERVAL 2000000
+
+/**
+ * Decides when to step the bitrate and preset down or up. It is fed
+ * once per encoded frame by the encoding thread and makes at most one
+ * decision per interval from what it saw during that interval.
+ */
+class ffenc_adapter
+{
+public:
+
+    /**
+     * Start from the bitrate and preset the encoder was configured with,
+     * each moved into the range of the config. A bitrate of 0 starts at
+     * the maximum. The config must be valid.
+     */
+    ffenc_adapter(const ffenc_adapt_config *config, int bitrate, int preset);
+
+    /**
+     * Record one encoded frame. Returns true and fills in the decision
+     * when the bitrate or preset should change.
+     */
+    bool update(int64_t now, int queue_depth, int queue_capacity,
+            int64_t latency, int64_t encode_usec, int64_t output_bytes,
+            ffenc_adapt_decision *decision);
+
+    int bitrate;
+    int preset;
+
+private:
+
+    void fill_decision(ffenc_adapt_decision *decision, const char *action);
+
+    ffenc_adapt_config config;
+    int calm_windows;
+
+    int64_t window_start;
+    int64_t window_frames;
+    int64_t window_latency;
+    int64_t window_encode;
+    int64_t window_bytes_start;
+    int window_max_depth;
+
+    int64_t latency;
+    int64_t encode_usec;
+    int max_depth;
+    int64_t output_rate;
+};
+
+/**
+ * The x264 name of an ffenc_preset.
+ */
+const char* ffenc_preset_name(int preset);
+
+/**
+ * The ffenc_preset of an x264 preset name, or -1 if there is none.
+ */
+int ffenc_preset_from_name(const char *name);
+
+/**
+ * Whether the ranges, step and interval of a config can be used.
+ */
+bool ffenc_adapt_config_valid(const ffenc_adapt_config *config);
+
+#endif
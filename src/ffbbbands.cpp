@@ -0,0 +1,164 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbbands.h"
+
+void* band_thread(void* arg);
+
+ffbb_band_pool::ffbb_band_pool(int threads)
+{
+    this->threads = threads > 1 ? threads : 1;
+    worker_count = 0;
+    workers = new pthread_t[this->threads];
+    running = false;
+
+    job = 0;
+    job_arg = 0;
+    job_bands = 0;
+    next_band = 0;
+    remaining = 0;
+    generation = 0;
+
+    pthread_mutex_init(&run_mutex, 0);
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&work_cond, 0);
+    pthread_cond_init(&done_cond, 0);
+}
+
+ffbb_band_pool::~ffbb_band_pool()
+{
+    stop();
+
+    delete[] workers;
+
+    pthread_mutex_destroy(&run_mutex);
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work_cond);
+    pthread_cond_destroy(&done_cond);
+}
+
+bool ffbb_band_pool::start()
+{
+    if (running) return true;
+
+    running = true;
+
+    for (int i = 0; i < threads - 1; i++)
+    {
+        if (pthread_create(&workers[i], 0, &::band_thread, this) != 0)
+        {
+            stop();
+            return false;
+        }
+        worker_count++;
+    }
+
+    return true;
+}
+
+void ffbb_band_pool::stop()
+{
+    if (!running) return;
+
+    pthread_mutex_lock(&mutex);
+    running = false;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mutex);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], 0);
+    }
+
+    worker_count = 0;
+}
+
+void ffbb_band_pool::run(int bands, void (*job)(int band, int bands, void *arg), void *arg)
+{
+    if (bands <= 0) return;
+
+    pthread_mutex_lock(&run_mutex);
+
+    pthread_mutex_lock(&mutex);
+    this->job = job;
+    job_arg = arg;
+    job_bands = bands;
+    next_band = 0;
+    remaining = bands;
+    generation++;
+    if (bands > 1) pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mutex);
+
+    work();
+
+    // the last band may still be running on a worker
+    pthread_mutex_lock(&mutex);
+    while (remaining > 0)
+        pthread_cond_wait(&done_cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_mutex_unlock(&run_mutex);
+}
+
+void ffbb_band_pool::work()
+{
+    pthread_mutex_lock(&mutex);
+
+    while (next_band < job_bands)
+    {
+        int band = next_band++;
+        int bands = job_bands;
+        void (*job)(int band, int bands, void *arg) = this->job;
+        void *arg = job_arg;
+
+        pthread_mutex_unlock(&mutex);
+        job(band, bands, arg);
+        pthread_mutex_lock(&mutex);
+
+        if (--remaining == 0) pthread_cond_signal(&done_cond);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void* band_thread(void* arg)
+{
+    ffbb_band_pool* pool = (ffbb_band_pool*) arg;
+    pool->band_thread();
+    return 0;
+}
+
+void ffbb_band_pool::band_thread()
+{
+    pthread_mutex_lock(&mutex);
+
+    int seen = generation;
+
+    while (true)
+    {
+        while (running && generation == seen)
+            pthread_cond_wait(&work_cond, &mutex);
+
+        if (!running) break;
+
+        seen = generation;
+
+        pthread_mutex_unlock(&mutex);
+        work();
+        pthread_mutex_lock(&mutex);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
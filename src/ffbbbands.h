@@ -0,0 +1,77 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBBANDS_H
+#define FFBBBANDS_H
+
+#include <pthread.h>
+
+/**
+ * Splits one job at a time into bands run side by side, for work on a
+ * single large frame such as a color conversion. The thread calling
+ * run takes bands too, so threads - 1 workers are started.
+ */
+class ffbb_band_pool
+{
+    friend void* band_thread(void* arg);
+
+public:
+
+    ffbb_band_pool(int threads);
+    virtual ~ffbb_band_pool();
+
+    bool start();
+
+    /**
+     * Wait for the workers to exit. run still works, on the calling thread alone.
+     */
+    void stop();
+
+    int thread_count()
+    {
+        return threads;
+    }
+
+    /**
+     * Call job once for each band from 0 to bands - 1 and return once
+     * all of them are done. Concurrent callers take turns.
+     */
+    void run(int bands, void (*job)(int band, int bands, void *arg), void *arg);
+
+private:
+
+    void band_thread();
+    void work();
+
+    int threads;
+    int worker_count;
+    pthread_t *workers;
+    volatile bool running;
+
+    pthread_mutex_t run_mutex;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    // the current job, only touched with mutex held
+    void (*job)(int band, int bands, void *arg);
+    void *job_arg;
+    int job_bands;
+    int next_band;
+    int remaining;
+    int generation;
+};
+
+#endif
@@ -0,0 +1,2118 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbconv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+extern "C"
+{
+#include <libavutil/cpu.h>
+}
+
+#if FFCONV_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if FFCONV_HAVE_AVX2
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if FFCONV_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+static void copy_plane_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    if (dst_stride == width && src_stride == width)
+    {
+        memcpy(dst, src, (size_t) width * height);
+        return;
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        memcpy(dst, src, width);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void split_uv_c(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *curuv = src;
+        for (int j = 0; j < width; j++)
+        {
+            dstu[j] = *curuv++;
+            dstv[j] = *curuv++;
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void downsample_8x8_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height / 8; i++)
+    {
+        for (int j = 0; j < width / 8; j++)
+        {
+            const uint8_t *block = src + j * 8;
+            int sum = 0;
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                    sum += block[x];
+                block += src_stride;
+            }
+            dst[j] = (uint8_t) (sum >> 6);
+        }
+        src += src_stride * 8;
+        dst += dst_stride;
+    }
+}
+
+static uint32_t sad_c(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            int d = a[j] - b[j];
+            sum += d < 0 ? -d : d;
+        }
+        a += a_stride;
+        b += b_stride;
+    }
+    return sum;
+}
+
+static void packed_422_to_i420_c(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height, bool uyvy)
+{
+    int luma = uyvy ? 1 : 0;
+    int chroma = uyvy ? 0 : 1;
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        for (int j = 0; j < width / 2; j++)
+        {
+            const uint8_t *a = row0 + j * 4;
+            const uint8_t *b = row1 + j * 4;
+            dsty[j * 2] = a[luma];
+            dsty[j * 2 + 1] = a[luma + 2];
+            dsty1[j * 2] = b[luma];
+            dsty1[j * 2 + 1] = b[luma + 2];
+            dstu[j] = (uint8_t) ((a[chroma] + b[chroma] + 1) >> 1);
+            dstv[j] = (uint8_t) ((a[chroma + 2] + b[chroma + 2] + 1) >> 1);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static inline uint8_t narrow_sample(uint16_t sample)
+{
+    // rounded, saturating at the top the same way as the SIMD versions
+    return sample >= 0xff80 ? 255 : (uint8_t) ((sample + 128) >> 8);
+}
+
+static void narrow_16_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint16_t *samples = (const uint16_t*) src;
+        for (int j = 0; j < width; j++)
+            dst[j] = narrow_sample(samples[j]);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void split_uv_16_c(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint16_t *samples = (const uint16_t*) src;
+        for (int j = 0; j < width; j++)
+        {
+            dstu[j] = narrow_sample(samples[j * 2]);
+            dstv[j] = narrow_sample(samples[j * 2 + 1]);
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static inline uint8_t rgb_luma(const uint8_t *p, const ffconv_rgb_coeffs *coeffs)
+{
+    const int16_t *k = coeffs->y;
+    return (uint8_t) (((k[0] * p[0] + k[1] * p[1] + k[2] * p[2] + 128) >> 8) + coeffs->y_offset);
+}
+
+static inline uint8_t rgb_chroma(int c0, int c1, int c2, const int16_t *k)
+{
+    // full range chroma of a pure primary rounds up to 256
+    int value = ((k[0] * c0 + k[1] * c1 + k[2] * c2 + 128) >> 8) + 128;
+    return value > 255 ? 255 : (uint8_t) value;
+}
+
+static void rgb_to_i420_c(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height,
+        const ffconv_rgb_coeffs *coeffs)
+{
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        for (int j = 0; j < width / 2; j++)
+        {
+            const uint8_t *a = row0 + j * 8;
+            const uint8_t *b = row1 + j * 8;
+            dsty[j * 2] = rgb_luma(a, coeffs);
+            dsty[j * 2 + 1] = rgb_luma(a + 4, coeffs);
+            dsty1[j * 2] = rgb_luma(b, coeffs);
+            dsty1[j * 2 + 1] = rgb_luma(b + 4, coeffs);
+
+            int c0 = (a[0] + a[4] + b[0] + b[4] + 2) >> 2;
+            int c1 = (a[1] + a[5] + b[1] + b[5] + 2) >> 2;
+            int c2 = (a[2] + a[6] + b[2] + b[6] + 2) >> 2;
+            dstu[j] = rgb_chroma(c0, c1, c2, coeffs->u);
+            dstv[j] = rgb_chroma(c0, c1, c2, coeffs->v);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+// the destination rows of one block stay in cache until the next block starts
+#define TRANSPOSE_BLOCK 64
+
+static inline int block_size(int remaining)
+{
+    return remaining < TRANSPOSE_BLOCK ? remaining : TRANSPOSE_BLOCK;
+}
+
+static void transpose_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int by = 0; by < height; by += TRANSPOSE_BLOCK)
+    {
+        int bh = block_size(height - by);
+        for (int bx = 0; bx < width; bx += TRANSPOSE_BLOCK)
+        {
+            int bw = block_size(width - bx);
+            for (int j = 0; j < bw; j++)
+            {
+                uint8_t *out = dst + (bx + j) * dst_stride + by;
+                const uint8_t *in = src + by * src_stride + bx + j;
+                for (int i = 0; i < bh; i++)
+                    out[i] = in[i * src_stride];
+            }
+        }
+    }
+}
+
+static void transpose_uv_c(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int by = 0; by < height; by += TRANSPOSE_BLOCK)
+    {
+        int bh = block_size(height - by);
+        for (int bx = 0; bx < width; bx += TRANSPOSE_BLOCK)
+        {
+            int bw = block_size(width - bx);
+            for (int j = 0; j < bw; j++)
+            {
+                uint8_t *outu = dstu + (bx + j) * dstu_stride + by;
+                uint8_t *outv = dstv + (bx + j) * dstv_stride + by;
+                const uint8_t *in = src + by * src_stride + (bx + j) * 2;
+                for (int i = 0; i < bh; i++)
+                {
+                    outu[i] = in[i * src_stride];
+                    outv[i] = in[i * src_stride + 1];
+                }
+            }
+        }
+    }
+}
+
+static void mirror_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+            dst[j] = src[width - 1 - j];
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void mirror_uv_c(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            dstu[j] = src[(width - 1 - j) * 2];
+            dstv[j] = src[(width - 1 - j) * 2 + 1];
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void halve_c(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        for (int j = 0; j < width; j++)
+            dst[j] = (uint8_t) ((row0[j * 2] + row0[j * 2 + 1] + row1[j * 2] + row1[j * 2 + 1] + 2) >> 2);
+        src += src_stride * 2;
+        dst += dst_stride;
+    }
+}
+
+static void halve_uv_c(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        for (int j = 0; j < width; j++)
+        {
+            dstu[j] = (uint8_t) ((row0[j * 4] + row0[j * 4 + 2] + row1[j * 4] + row1[j * 4 + 2] + 2) >> 2);
+            dstv[j] = (uint8_t) ((row0[j * 4 + 1] + row0[j * 4 + 3] + row1[j * 4 + 1] + row1[j * 4 + 3] + 2) >> 2);
+        }
+        src += src_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void sum_rows_c(uint16_t *dst, const uint8_t *src, int src_stride, int width, int rows)
+{
+    for (int j = 0; j < width; j++)
+        dst[j] = src[j];
+
+    for (int i = 1; i < rows; i++)
+    {
+        src += src_stride;
+        for (int j = 0; j < width; j++)
+            dst[j] += src[j];
+    }
+}
+
+static void blend_rows_c(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int width, int fraction)
+{
+    int rest = 256 - fraction;
+    for (int j = 0; j < width; j++)
+        dst[j] = (uint8_t) ((row0[j] * rest + row1[j] * fraction + 128) >> 8);
+}
+
+// walk a transpose block by block and 8x8 tile by tile, leaving the
+// edges that do not fill a tile to the C version. The tile is a struct
+// with a static run so it is inlined, C++98 takes no static function here
+template<typename tile>
+static void transpose_tiled(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int by = 0; by < height; by += TRANSPOSE_BLOCK)
+    {
+        int bh = block_size(height - by);
+        for (int bx = 0; bx < width; bx += TRANSPOSE_BLOCK)
+        {
+            int bw = block_size(width - bx);
+            int i = 0;
+            for (; i + 8 <= bh; i += 8)
+            {
+                int j = 0;
+                for (; j + 8 <= bw; j += 8)
+                {
+                    tile::run(dst + (bx + j) * dst_stride + by + i, dst_stride,
+                            src + (by + i) * src_stride + bx + j, src_stride);
+                }
+                if (j < bw)
+                {
+                    transpose_c(dst + (bx + j) * dst_stride + by + i, dst_stride,
+                            src + (by + i) * src_stride + bx + j, src_stride, bw - j, 8);
+                }
+            }
+            if (i < bh)
+            {
+                transpose_c(dst + bx * dst_stride + by + i, dst_stride,
+                        src + (by + i) * src_stride + bx, src_stride, bw, bh - i);
+            }
+        }
+    }
+}
+
+template<typename tile>
+static void transpose_uv_tiled(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int by = 0; by < height; by += TRANSPOSE_BLOCK)
+    {
+        int bh = block_size(height - by);
+        for (int bx = 0; bx < width; bx += TRANSPOSE_BLOCK)
+        {
+            int bw = block_size(width - bx);
+            int i = 0;
+            for (; i + 8 <= bh; i += 8)
+            {
+                int j = 0;
+                for (; j + 8 <= bw; j += 8)
+                {
+                    tile::run(dstu + (bx + j) * dstu_stride + by + i, dstu_stride,
+                            dstv + (bx + j) * dstv_stride + by + i, dstv_stride,
+                            src + (by + i) * src_stride + (bx + j) * 2, src_stride);
+                }
+                if (j < bw)
+                {
+                    transpose_uv_c(dstu + (bx + j) * dstu_stride + by + i, dstu_stride,
+                            dstv + (bx + j) * dstv_stride + by + i, dstv_stride,
+                            src + (by + i) * src_stride + (bx + j) * 2, src_stride, bw - j, 8);
+                }
+            }
+            if (i < bh)
+            {
+                transpose_uv_c(dstu + bx * dstu_stride + by + i, dstu_stride,
+                        dstv + bx * dstv_stride + by + i, dstv_stride,
+                        src + (by + i) * src_stride + bx * 2, src_stride, bw, bh - i);
+            }
+        }
+    }
+}
+
+const ffconv_kernels ffconv_kernels_c = { "c", copy_plane_c, split_uv_c, downsample_8x8_c, sad_c,
+        packed_422_to_i420_c, narrow_16_c, split_uv_16_c, rgb_to_i420_c,
+        transpose_c, transpose_uv_c, mirror_c, mirror_uv_c, halve_c, halve_uv_c, sum_rows_c, blend_rows_c };
+
+#if FFCONV_HAVE_SSE2
+static void copy_plane_sse2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    if (dst_stride == width && src_stride == width)
+    {
+        width *= height;
+        height = 1;
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 64 <= width; j += 64)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (src + j));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + j + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*) (src + j + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*) (src + j + 48));
+            _mm_storeu_si128((__m128i*) (dst + j), a);
+            _mm_storeu_si128((__m128i*) (dst + j + 16), b);
+            _mm_storeu_si128((__m128i*) (dst + j + 32), c);
+            _mm_storeu_si128((__m128i*) (dst + j + 48), d);
+        }
+        for (; j + 16 <= width; j += 16)
+        {
+            _mm_storeu_si128((__m128i*) (dst + j), _mm_loadu_si128((const __m128i*) (src + j)));
+        }
+        if (j < width) memcpy(dst + j, src + j, width - j);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void split_uv_sse2(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (src + j * 2));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + j * 2 + 16));
+            __m128i u = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+            __m128i v = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i*) (dstu + j), u);
+            _mm_storeu_si128((__m128i*) (dstv + j), v);
+        }
+        for (; j < width; j++)
+        {
+            dstu[j] = src[j * 2];
+            dstv[j] = src[j * 2 + 1];
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void downsample_8x8_sse2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int out_width = width / 8;
+
+    for (int i = 0; i < height / 8; i++)
+    {
+        int j = 0;
+        for (; j + 2 <= out_width; j += 2)
+        {
+            // sad against zero sums each half of the row, two blocks at a time
+            const uint8_t *row = src + j * 8;
+            __m128i sum = zero;
+            for (int y = 0; y < 8; y++)
+            {
+                sum = _mm_add_epi32(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i*) row), zero));
+                row += src_stride;
+            }
+            sum = _mm_srli_epi32(sum, 6);
+            dst[j] = (uint8_t) _mm_cvtsi128_si32(sum);
+            dst[j + 1] = (uint8_t) _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        }
+        if (j < out_width)
+        {
+            downsample_8x8_c(dst + j, dst_stride, src + j * 8, src_stride, 8, 8);
+        }
+        src += src_stride * 8;
+        dst += dst_stride;
+    }
+}
+
+static uint32_t sad_sse2(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+    __m128i sum = _mm_setzero_si128();
+    uint32_t tail = 0;
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*) (a + j));
+            __m128i y = _mm_loadu_si128((const __m128i*) (b + j));
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(x, y));
+        }
+        for (; j + 8 <= width; j += 8)
+        {
+            __m128i x = _mm_loadl_epi64((const __m128i*) (a + j));
+            __m128i y = _mm_loadl_epi64((const __m128i*) (b + j));
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(x, y));
+        }
+        if (j < width) tail += sad_c(a + j, a_stride, b + j, b_stride, width - j, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+
+    return tail + _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+}
+
+template<bool uyvy>
+static void packed_422_to_i420_sse2(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + j * 2));
+            __m128i b0 = _mm_loadu_si128((const __m128i*) (row0 + j * 2 + 16));
+            __m128i a1 = _mm_loadu_si128((const __m128i*) (row1 + j * 2));
+            __m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + j * 2 + 16));
+
+            // luma is every even byte of YUYV and every odd byte of UYVY, chroma the rest
+            __m128i y0, y1, c0, c1;
+            if (uyvy)
+            {
+                y0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+                y1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+                c0 = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(b0, mask));
+                c1 = _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask));
+            }
+            else
+            {
+                y0 = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(b0, mask));
+                y1 = _mm_packus_epi16(_mm_and_si128(a1, mask), _mm_and_si128(b1, mask));
+                c0 = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+                c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+            }
+
+            _mm_storeu_si128((__m128i*) (dsty + j), y0);
+            _mm_storeu_si128((__m128i*) (dsty1 + j), y1);
+
+            // eight UV pairs, averaged over the two rows
+            __m128i c = _mm_avg_epu8(c0, c1);
+            _mm_storel_epi64((__m128i*) (dstu + j / 2), _mm_packus_epi16(_mm_and_si128(c, mask), zero));
+            _mm_storel_epi64((__m128i*) (dstv + j / 2), _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+        }
+        if (j < width)
+        {
+            packed_422_to_i420_c(dsty + j, dsty_stride, dstu + j / 2, dstu_stride, dstv + j / 2, dstv_stride,
+                    src + j * 2, src_stride, width - j, 2, uyvy);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void packed_422_to_i420_sse2(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height, bool uyvy)
+{
+    if (uyvy) packed_422_to_i420_sse2<true>(dsty, dsty_stride, dstu, dstu_stride, dstv, dstv_stride,
+            src, src_stride, width, height);
+    else packed_422_to_i420_sse2<false>(dsty, dsty_stride, dstu, dstu_stride, dstv, dstv_stride,
+            src, src_stride, width, height);
+}
+
+static inline __m128i narrow_sse2(__m128i a, __m128i b)
+{
+    // adds saturates so the rounding cannot carry past 255
+    const __m128i half = _mm_set1_epi16(128);
+    a = _mm_srli_epi16(_mm_adds_epu16(a, half), 8);
+    b = _mm_srli_epi16(_mm_adds_epu16(b, half), 8);
+    return _mm_packus_epi16(a, b);
+}
+
+static void narrow_16_sse2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (src + j * 2));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + j * 2 + 16));
+            _mm_storeu_si128((__m128i*) (dst + j), narrow_sse2(a, b));
+        }
+        if (j < width) narrow_16_c(dst + j, dst_stride, src + j * 2, src_stride, width - j, 1);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void split_uv_16_sse2(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 8 <= width; j += 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*) (src + j * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + j * 4 + 16));
+            __m128i uv = narrow_sse2(a, b);
+            _mm_storel_epi64((__m128i*) (dstu + j), _mm_packus_epi16(_mm_and_si128(uv, mask), zero));
+            _mm_storel_epi64((__m128i*) (dstv + j), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+        }
+        if (j < width)
+        {
+            split_uv_16_c(dstu + j, dstu_stride, dstv + j, dstv_stride, src + j * 4, src_stride, width - j, 1);
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static inline __m128i coeff_pair_sse2(int16_t lo, int16_t hi)
+{
+    return _mm_set1_epi32((int) ((uint16_t) lo | ((uint32_t) (uint16_t) hi << 16)));
+}
+
+static inline __m128i rgb_pair_sse2(__m128i pixels)
+{
+    // bytes 0 and 1 of each pixel as two 16-bit values, ready for madd
+    const __m128i low = _mm_set1_epi32(0x000000ff);
+    const __m128i high = _mm_set1_epi32(0x00ff0000);
+    return _mm_or_si128(_mm_and_si128(pixels, low), _mm_and_si128(_mm_slli_epi32(pixels, 8), high));
+}
+
+static inline __m128i rgb_third_sse2(__m128i pixels)
+{
+    return _mm_and_si128(_mm_srli_epi32(pixels, 16), _mm_set1_epi32(0x000000ff));
+}
+
+static inline __m128i rgb_dot_sse2(__m128i pair, __m128i third, __m128i k01, __m128i k2, __m128i bias)
+{
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(pair, k01), _mm_madd_epi16(third, k2));
+    return _mm_srai_epi32(_mm_add_epi32(sum, bias), 8);
+}
+
+static inline __m128i rgb_block_sum_sse2(__m128i a0, __m128i b0, __m128i a1, __m128i b1)
+{
+    // add the two rows, then each pixel to its neighbour, leaving the
+    // 2x2 sums in the even dwords which are then gathered into one register
+    __m128i s0 = _mm_add_epi16(a0, b0);
+    __m128i s1 = _mm_add_epi16(a1, b1);
+    s0 = _mm_add_epi16(s0, _mm_srli_epi64(s0, 32));
+    s1 = _mm_add_epi16(s1, _mm_srli_epi64(s1, 32));
+    s0 = _mm_shuffle_epi32(s0, _MM_SHUFFLE(3, 1, 2, 0));
+    s1 = _mm_shuffle_epi32(s1, _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i sum = _mm_unpacklo_epi64(s0, s1);
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+static void rgb_to_i420_sse2(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height,
+        const ffconv_rgb_coeffs *coeffs)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ky01 = coeff_pair_sse2(coeffs->y[0], coeffs->y[1]);
+    const __m128i ky2 = coeff_pair_sse2(coeffs->y[2], 0);
+    const __m128i ku01 = coeff_pair_sse2(coeffs->u[0], coeffs->u[1]);
+    const __m128i ku2 = coeff_pair_sse2(coeffs->u[2], 0);
+    const __m128i kv01 = coeff_pair_sse2(coeffs->v[0], coeffs->v[1]);
+    const __m128i kv2 = coeff_pair_sse2(coeffs->v[2], 0);
+
+    // rounding and offset folded into one constant ahead of the shift
+    const __m128i ybias = _mm_set1_epi32(128 + (coeffs->y_offset << 8));
+    const __m128i cbias = _mm_set1_epi32(128 + (128 << 8));
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        int j = 0;
+        for (; j + 8 <= width; j += 8)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + j * 4));
+            __m128i a1 = _mm_loadu_si128((const __m128i*) (row0 + j * 4 + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i*) (row1 + j * 4));
+            __m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + j * 4 + 16));
+
+            __m128i pa0 = rgb_pair_sse2(a0), qa0 = rgb_third_sse2(a0);
+            __m128i pa1 = rgb_pair_sse2(a1), qa1 = rgb_third_sse2(a1);
+            __m128i pb0 = rgb_pair_sse2(b0), qb0 = rgb_third_sse2(b0);
+            __m128i pb1 = rgb_pair_sse2(b1), qb1 = rgb_third_sse2(b1);
+
+            __m128i ya = _mm_packs_epi32(rgb_dot_sse2(pa0, qa0, ky01, ky2, ybias),
+                    rgb_dot_sse2(pa1, qa1, ky01, ky2, ybias));
+            __m128i yb = _mm_packs_epi32(rgb_dot_sse2(pb0, qb0, ky01, ky2, ybias),
+                    rgb_dot_sse2(pb1, qb1, ky01, ky2, ybias));
+            _mm_storel_epi64((__m128i*) (dsty + j), _mm_packus_epi16(ya, zero));
+            _mm_storel_epi64((__m128i*) (dsty1 + j), _mm_packus_epi16(yb, zero));
+
+            __m128i p = rgb_block_sum_sse2(pa0, pb0, pa1, pb1);
+            __m128i q = rgb_block_sum_sse2(qa0, qb0, qa1, qb1);
+
+            __m128i u = _mm_packs_epi32(rgb_dot_sse2(p, q, ku01, ku2, cbias), zero);
+            __m128i v = _mm_packs_epi32(rgb_dot_sse2(p, q, kv01, kv2, cbias), zero);
+            int u4 = _mm_cvtsi128_si32(_mm_packus_epi16(u, zero));
+            int v4 = _mm_cvtsi128_si32(_mm_packus_epi16(v, zero));
+            memcpy(dstu + j / 2, &u4, 4);
+            memcpy(dstv + j / 2, &v4, 4);
+        }
+        if (j < width)
+        {
+            rgb_to_i420_c(dsty + j, dsty_stride, dstu + j / 2, dstu_stride, dstv + j / 2, dstv_stride,
+                    src + j * 4, src_stride, width - j, 2, coeffs);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+struct transpose_8x8_sse2
+{
+    static void run(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride)
+    {
+        __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) src),
+                _mm_loadl_epi64((const __m128i*) (src + src_stride)));
+        __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (src + src_stride * 2)),
+                _mm_loadl_epi64((const __m128i*) (src + src_stride * 3)));
+        __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (src + src_stride * 4)),
+                _mm_loadl_epi64((const __m128i*) (src + src_stride * 5)));
+        __m128i a3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (src + src_stride * 6)),
+                _mm_loadl_epi64((const __m128i*) (src + src_stride * 7)));
+
+        // columns 0-3 and 4-7 of rows 0-3, then of rows 4-7
+        __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+        __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+        __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+        __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+        // two whole columns in each
+        __m128i c[4];
+        c[0] = _mm_unpacklo_epi32(b0, b2);
+        c[1] = _mm_unpackhi_epi32(b0, b2);
+        c[2] = _mm_unpacklo_epi32(b1, b3);
+        c[3] = _mm_unpackhi_epi32(b1, b3);
+
+        for (int k = 0; k < 4; k++)
+        {
+            _mm_storel_epi64((__m128i*) (dst + dst_stride * k * 2), c[k]);
+            _mm_storel_epi64((__m128i*) (dst + dst_stride * (k * 2 + 1)), _mm_srli_si128(c[k], 8));
+        }
+    }
+};
+
+struct transpose_uv_8x8_sse2
+{
+    static void run(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+            const uint8_t *src, int src_stride)
+    {
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+
+        // the same transpose one level up, on 16-bit UV pairs
+        __m128i r[8];
+        for (int k = 0; k < 8; k++)
+            r[k] = _mm_loadu_si128((const __m128i*) (src + src_stride * k));
+
+        __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+        __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+        __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+        __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+        __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+        __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+        __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+        __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+        __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+        __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+        __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+        __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+        __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+        __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+        __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+        __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+        __m128i c[8];
+        c[0] = _mm_unpacklo_epi64(b0, b4);
+        c[1] = _mm_unpackhi_epi64(b0, b4);
+        c[2] = _mm_unpacklo_epi64(b1, b5);
+        c[3] = _mm_unpackhi_epi64(b1, b5);
+        c[4] = _mm_unpacklo_epi64(b2, b6);
+        c[5] = _mm_unpackhi_epi64(b2, b6);
+        c[6] = _mm_unpacklo_epi64(b3, b7);
+        c[7] = _mm_unpackhi_epi64(b3, b7);
+
+        for (int k = 0; k < 8; k += 2)
+        {
+            __m128i u = _mm_packus_epi16(_mm_and_si128(c[k], mask), _mm_and_si128(c[k + 1], mask));
+            __m128i v = _mm_packus_epi16(_mm_srli_epi16(c[k], 8), _mm_srli_epi16(c[k + 1], 8));
+            _mm_storel_epi64((__m128i*) (dstu + dstu_stride * k), u);
+            _mm_storel_epi64((__m128i*) (dstu + dstu_stride * (k + 1)), _mm_srli_si128(u, 8));
+            _mm_storel_epi64((__m128i*) (dstv + dstv_stride * k), v);
+            _mm_storel_epi64((__m128i*) (dstv + dstv_stride * (k + 1)), _mm_srli_si128(v, 8));
+        }
+    }
+};
+
+static inline __m128i reverse_pairs_sse2(__m128i x)
+{
+    x = _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static void mirror_sse2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            // SSE2 has no byte shuffle, reverse the words and then the bytes inside them
+            __m128i x = reverse_pairs_sse2(_mm_loadu_si128((const __m128i*) (src + width - j - 16)));
+            _mm_storeu_si128((__m128i*) (dst + j), _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)));
+        }
+        if (j < width) mirror_c(dst + j, dst_stride, src, src_stride, width - j, 1);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void mirror_uv_sse2(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i a = reverse_pairs_sse2(_mm_loadu_si128((const __m128i*) (src + (width - j - 8) * 2)));
+            __m128i b = reverse_pairs_sse2(_mm_loadu_si128((const __m128i*) (src + (width - j - 16) * 2)));
+            _mm_storeu_si128((__m128i*) (dstu + j),
+                    _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+            _mm_storeu_si128((__m128i*) (dstv + j),
+                    _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+        }
+        if (j < width) mirror_uv_c(dstu + j, dstu_stride, dstv + j, dstv_stride, src, src_stride, width - j, 1);
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void halve_sse2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + j * 2));
+            __m128i a1 = _mm_loadu_si128((const __m128i*) (row0 + j * 2 + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i*) (row1 + j * 2));
+            __m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + j * 2 + 16));
+
+            // the even and odd bytes of both rows
+            __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, mask), _mm_srli_epi16(a0, 8)),
+                    _mm_add_epi16(_mm_and_si128(b0, mask), _mm_srli_epi16(b0, 8)));
+            __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, mask), _mm_srli_epi16(a1, 8)),
+                    _mm_add_epi16(_mm_and_si128(b1, mask), _mm_srli_epi16(b1, 8)));
+
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+            _mm_storeu_si128((__m128i*) (dst + j), _mm_packus_epi16(lo, hi));
+        }
+        if (j < width) halve_c(dst + j, dst_stride, row0 + j * 2, src_stride, width - j, 1);
+        src += src_stride * 2;
+        dst += dst_stride;
+    }
+}
+
+static inline __m128i halve_pairs_sse2(__m128i a0, __m128i a1, __m128i b0, __m128i b1)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+
+    // both rows first, then neighbouring samples with a multiply add
+    __m128i lo = _mm_madd_epi16(_mm_add_epi16(a0, b0), ones);
+    __m128i hi = _mm_madd_epi16(_mm_add_epi16(a1, b1), ones);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(lo, hi), two), 2);
+}
+
+static void halve_uv_sse2(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        int j = 0;
+        for (; j + 8 <= width; j += 8)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + j * 4));
+            __m128i a1 = _mm_loadu_si128((const __m128i*) (row0 + j * 4 + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i*) (row1 + j * 4));
+            __m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + j * 4 + 16));
+
+            __m128i u = halve_pairs_sse2(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask),
+                    _mm_and_si128(b0, mask), _mm_and_si128(b1, mask));
+            __m128i v = halve_pairs_sse2(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8),
+                    _mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+
+            _mm_storel_epi64((__m128i*) (dstu + j), _mm_packus_epi16(u, u));
+            _mm_storel_epi64((__m128i*) (dstv + j), _mm_packus_epi16(v, v));
+        }
+        if (j < width) halve_uv_c(dstu + j, dstu_stride, dstv + j, dstv_stride, row0 + j * 4, src_stride, width - j, 1);
+        src += src_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void sum_rows_sse2(uint16_t *dst, const uint8_t *src, int src_stride, int width, int rows)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        const uint8_t *row = src + j;
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for (int i = 0; i < rows; i++)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*) row);
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(x, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(x, zero));
+            row += src_stride;
+        }
+        _mm_storeu_si128((__m128i*) (dst + j), lo);
+        _mm_storeu_si128((__m128i*) (dst + j + 8), hi);
+    }
+    if (j < width) sum_rows_c(dst + j, src + j, src_stride, width - j, rows);
+}
+
+static void blend_rows_sse2(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int width, int fraction)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i w0 = _mm_set1_epi16(256 - fraction);
+    const __m128i w1 = _mm_set1_epi16(fraction);
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*) (row0 + j));
+        __m128i b = _mm_loadu_si128((const __m128i*) (row1 + j));
+
+        // at most 255 * 256 + 128, which still fits unsigned 16 bits
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, bias), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, bias), 8);
+        _mm_storeu_si128((__m128i*) (dst + j), _mm_packus_epi16(lo, hi));
+    }
+    if (j < width) blend_rows_c(dst + j, row0 + j, row1 + j, width - j, fraction);
+}
+
+const ffconv_kernels ffconv_kernels_sse2 = { "sse2", copy_plane_sse2, split_uv_sse2, downsample_8x8_sse2,
+        sad_sse2, packed_422_to_i420_sse2, narrow_16_sse2, split_uv_16_sse2, rgb_to_i420_sse2,
+        transpose_tiled<transpose_8x8_sse2>, transpose_uv_tiled<transpose_uv_8x8_sse2>,
+        mirror_sse2, mirror_uv_sse2, halve_sse2, halve_uv_sse2, sum_rows_sse2, blend_rows_sse2 };
+#endif
+
+#if FFCONV_HAVE_AVX2
+__attribute__((target("avx2")))
+static void copy_plane_avx2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    if (dst_stride == width && src_stride == width)
+    {
+        width *= height;
+        height = 1;
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 64 <= width; j += 64)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (src + j));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (src + j + 32));
+            _mm256_storeu_si256((__m256i*) (dst + j), a);
+            _mm256_storeu_si256((__m256i*) (dst + j + 32), b);
+        }
+        for (; j + 32 <= width; j += 32)
+        {
+            _mm256_storeu_si256((__m256i*) (dst + j), _mm256_loadu_si256((const __m256i*) (src + j)));
+        }
+        if (j < width) memcpy(dst + j, src + j, width - j);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+__attribute__((target("avx2")))
+static void split_uv_avx2(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 32 <= width; j += 32)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*) (src + j * 2));
+            __m256i b = _mm256_loadu_si256((const __m256i*) (src + j * 2 + 32));
+
+            // packus works per 128-bit lane so the qwords come out as a0 b0 a1 b1
+            __m256i u = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+            __m256i v = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+            u = _mm256_permute4x64_epi64(u, 0xd8);
+            v = _mm256_permute4x64_epi64(v, 0xd8);
+
+            _mm256_storeu_si256((__m256i*) (dstu + j), u);
+            _mm256_storeu_si256((__m256i*) (dstv + j), v);
+        }
+        for (; j < width; j++)
+        {
+            dstu[j] = src[j * 2];
+            dstv[j] = src[j * 2 + 1];
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+__attribute__((target("avx2")))
+static void downsample_8x8_avx2(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    int out_width = width / 8;
+
+    for (int i = 0; i < height / 8; i++)
+    {
+        int j = 0;
+        for (; j + 4 <= out_width; j += 4)
+        {
+            const uint8_t *row = src + j * 8;
+            __m256i sum = zero;
+            for (int y = 0; y < 8; y++)
+            {
+                sum = _mm256_add_epi32(sum, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*) row), zero));
+                row += src_stride;
+            }
+            sum = _mm256_srli_epi32(sum, 6);
+
+            // one sum in the low dword of each qword
+            __m128i lo = _mm256_castsi256_si128(sum);
+            __m128i hi = _mm256_extracti128_si256(sum, 1);
+            dst[j] = (uint8_t) _mm_cvtsi128_si32(lo);
+            dst[j + 1] = (uint8_t) _mm_cvtsi128_si32(_mm_srli_si128(lo, 8));
+            dst[j + 2] = (uint8_t) _mm_cvtsi128_si32(hi);
+            dst[j + 3] = (uint8_t) _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+        }
+        if (j < out_width)
+        {
+            downsample_8x8_sse2(dst + j, dst_stride, src + j * 8, src_stride, (out_width - j) * 8, 8);
+        }
+        src += src_stride * 8;
+        dst += dst_stride;
+    }
+}
+
+__attribute__((target("avx2")))
+static uint32_t sad_avx2(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+    if (width < 32) return sad_sse2(a, a_stride, b, b_stride, width, height);
+
+    __m256i sum = _mm256_setzero_si256();
+    uint32_t tail = 0;
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 32 <= width; j += 32)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*) (a + j));
+            __m256i y = _mm256_loadu_si256((const __m256i*) (b + j));
+            sum = _mm256_add_epi32(sum, _mm256_sad_epu8(x, y));
+        }
+        if (j < width) tail += sad_sse2(a + j, a_stride, b + j, b_stride, width - j, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+
+    __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return tail + _mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_pair_avx2(__m256i pixels)
+{
+    const __m256i low = _mm256_set1_epi32(0x000000ff);
+    const __m256i high = _mm256_set1_epi32(0x00ff0000);
+    return _mm256_or_si256(_mm256_and_si256(pixels, low), _mm256_and_si256(_mm256_slli_epi32(pixels, 8), high));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_third_avx2(__m256i pixels)
+{
+    return _mm256_and_si256(_mm256_srli_epi32(pixels, 16), _mm256_set1_epi32(0x000000ff));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_dot_avx2(__m256i pair, __m256i third, __m256i k01, __m256i k2, __m256i bias)
+{
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(pair, k01), _mm256_madd_epi16(third, k2));
+    return _mm256_srai_epi32(_mm256_add_epi32(sum, bias), 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i rgb_luma_avx2(__m256i p0, __m256i q0, __m256i p1, __m256i q1,
+        __m256i k01, __m256i k2, __m256i bias)
+{
+    // each pack interleaves the two 128-bit lanes, the permutes put them back in order
+    __m256i y = _mm256_packs_epi32(rgb_dot_avx2(p0, q0, k01, k2, bias), rgb_dot_avx2(p1, q1, k01, k2, bias));
+    y = _mm256_permute4x64_epi64(y, 0xd8);
+    y = _mm256_permute4x64_epi64(_mm256_packus_epi16(y, y), 0xd8);
+    return _mm256_castsi256_si128(y);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rgb_block_sum_avx2(__m256i a0, __m256i b0, __m256i a1, __m256i b1)
+{
+    __m256i s0 = _mm256_add_epi16(a0, b0);
+    __m256i s1 = _mm256_add_epi16(a1, b1);
+    s0 = _mm256_add_epi16(s0, _mm256_srli_epi64(s0, 32));
+    s1 = _mm256_add_epi16(s1, _mm256_srli_epi64(s1, 32));
+    s0 = _mm256_shuffle_epi32(s0, 0xd8);
+    s1 = _mm256_shuffle_epi32(s1, 0xd8);
+    __m256i sum = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(s0, s1), 0xd8);
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i rgb_chroma_avx2(__m256i p, __m256i q, __m256i k01, __m256i k2, __m256i bias)
+{
+    __m256i c = _mm256_packs_epi32(rgb_dot_avx2(p, q, k01, k2, bias), _mm256_setzero_si256());
+    c = _mm256_permute4x64_epi64(c, 0xd8);
+    return _mm_packus_epi16(_mm256_castsi256_si128(c), _mm_setzero_si128());
+}
+
+__attribute__((target("avx2")))
+static void rgb_to_i420_avx2(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height,
+        const ffconv_rgb_coeffs *coeffs)
+{
+    const __m256i ky01 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->y[0], coeffs->y[1]));
+    const __m256i ky2 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->y[2], 0));
+    const __m256i ku01 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->u[0], coeffs->u[1]));
+    const __m256i ku2 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->u[2], 0));
+    const __m256i kv01 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->v[0], coeffs->v[1]));
+    const __m256i kv2 = _mm256_broadcastsi128_si256(coeff_pair_sse2(coeffs->v[2], 0));
+    const __m256i ybias = _mm256_set1_epi32(128 + (coeffs->y_offset << 8));
+    const __m256i cbias = _mm256_set1_epi32(128 + (128 << 8));
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            __m256i a0 = _mm256_loadu_si256((const __m256i*) (row0 + j * 4));
+            __m256i a1 = _mm256_loadu_si256((const __m256i*) (row0 + j * 4 + 32));
+            __m256i b0 = _mm256_loadu_si256((const __m256i*) (row1 + j * 4));
+            __m256i b1 = _mm256_loadu_si256((const __m256i*) (row1 + j * 4 + 32));
+
+            __m256i pa0 = rgb_pair_avx2(a0), qa0 = rgb_third_avx2(a0);
+            __m256i pa1 = rgb_pair_avx2(a1), qa1 = rgb_third_avx2(a1);
+            __m256i pb0 = rgb_pair_avx2(b0), qb0 = rgb_third_avx2(b0);
+            __m256i pb1 = rgb_pair_avx2(b1), qb1 = rgb_third_avx2(b1);
+
+            _mm_storeu_si128((__m128i*) (dsty + j), rgb_luma_avx2(pa0, qa0, pa1, qa1, ky01, ky2, ybias));
+            _mm_storeu_si128((__m128i*) (dsty1 + j), rgb_luma_avx2(pb0, qb0, pb1, qb1, ky01, ky2, ybias));
+
+            __m256i p = rgb_block_sum_avx2(pa0, pb0, pa1, pb1);
+            __m256i q = rgb_block_sum_avx2(qa0, qb0, qa1, qb1);
+            _mm_storel_epi64((__m128i*) (dstu + j / 2), rgb_chroma_avx2(p, q, ku01, ku2, cbias));
+            _mm_storel_epi64((__m128i*) (dstv + j / 2), rgb_chroma_avx2(p, q, kv01, kv2, cbias));
+        }
+        if (j < width)
+        {
+            rgb_to_i420_sse2(dsty + j, dsty_stride, dstu + j / 2, dstu_stride, dstv + j / 2, dstv_stride,
+                    src + j * 4, src_stride, width - j, 2, coeffs);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+// the packed, 16-bit and scaling kernels are bound by memory well before SSE2 runs
+// out, and the transposes work on 8x8 tiles that fill no more than an SSE2 register
+const ffconv_kernels ffconv_kernels_avx2 = { "avx2", copy_plane_avx2, split_uv_avx2, downsample_8x8_avx2,
+        sad_avx2, packed_422_to_i420_sse2, narrow_16_sse2, split_uv_16_sse2, rgb_to_i420_avx2,
+        transpose_tiled<transpose_8x8_sse2>, transpose_uv_tiled<transpose_uv_8x8_sse2>,
+        mirror_sse2, mirror_uv_sse2, halve_sse2, halve_uv_sse2, sum_rows_sse2, blend_rows_sse2 };
+
+static bool cpu_has_avx2()
+{
+    // libavutil only reports up to AVX, which already covers the OS saving the ymm state
+    if (!(av_get_cpu_flags() & AV_CPU_FLAG_AVX)) return false;
+
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, 0) < 7) return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;
+}
+#endif
+
+#if FFCONV_HAVE_NEON
+static void copy_plane_neon(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    if (dst_stride == width && src_stride == width)
+    {
+        width *= height;
+        height = 1;
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 32 <= width; j += 32)
+        {
+            uint8x16_t a = vld1q_u8(src + j);
+            uint8x16_t b = vld1q_u8(src + j + 16);
+            vst1q_u8(dst + j, a);
+            vst1q_u8(dst + j + 16, b);
+        }
+        if (j < width) memcpy(dst + j, src + j, width - j);
+        dst += dst_stride;
+        src += src_stride;
+    }
+}
+
+static void split_uv_neon(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            uint8x16x2_t uv = vld2q_u8(src + j * 2);
+            vst1q_u8(dstu + j, uv.val[0]);
+            vst1q_u8(dstv + j, uv.val[1]);
+        }
+        for (; j + 8 <= width; j += 8)
+        {
+            uint8x8x2_t uv = vld2_u8(src + j * 2);
+            vst1_u8(dstu + j, uv.val[0]);
+            vst1_u8(dstv + j, uv.val[1]);
+        }
+        for (; j < width; j++)
+        {
+            dstu[j] = src[j * 2];
+            dstv[j] = src[j * 2 + 1];
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void downsample_8x8_neon(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    int out_width = width / 8;
+
+    for (int i = 0; i < height / 8; i++)
+    {
+        int j = 0;
+        for (; j + 2 <= out_width; j += 2)
+        {
+            // eight rows of pairwise sums fit in 16 bits
+            const uint8_t *row = src + j * 8;
+            uint16x8_t sum = vdupq_n_u16(0);
+            for (int y = 0; y < 8; y++)
+            {
+                sum = vpadalq_u8(sum, vld1q_u8(row));
+                row += src_stride;
+            }
+            uint64x2_t blocks = vpaddlq_u32(vpaddlq_u16(sum));
+            dst[j] = (uint8_t) (vgetq_lane_u64(blocks, 0) >> 6);
+            dst[j + 1] = (uint8_t) (vgetq_lane_u64(blocks, 1) >> 6);
+        }
+        if (j < out_width)
+        {
+            downsample_8x8_c(dst + j, dst_stride, src + j * 8, src_stride, 8, 8);
+        }
+        src += src_stride * 8;
+        dst += dst_stride;
+    }
+}
+
+static uint32_t sad_neon(const uint8_t *a, int a_stride, const uint8_t *b, int b_stride, int width, int height)
+{
+    uint32x4_t sum = vdupq_n_u32(0);
+    uint32_t tail = 0;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint16x8_t row = vdupq_n_u16(0);
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            uint8x16_t x = vld1q_u8(a + j);
+            uint8x16_t y = vld1q_u8(b + j);
+            row = vabal_u8(row, vget_low_u8(x), vget_low_u8(y));
+            row = vabal_u8(row, vget_high_u8(x), vget_high_u8(y));
+
+            // flush before the 16 bit lanes can overflow
+            if ((j & 1023) == 1008)
+            {
+                sum = vpadalq_u16(sum, row);
+                row = vdupq_n_u16(0);
+            }
+        }
+        for (; j + 8 <= width; j += 8)
+        {
+            row = vabal_u8(row, vld1_u8(a + j), vld1_u8(b + j));
+        }
+        sum = vpadalq_u16(sum, row);
+        if (j < width) tail += sad_c(a + j, a_stride, b + j, b_stride, width - j, 1);
+        a += a_stride;
+        b += b_stride;
+    }
+
+    uint64x2_t total = vpaddlq_u32(sum);
+    return tail + (uint32_t) (vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+}
+
+static void packed_422_to_i420_neon(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height, bool uyvy)
+{
+    // vld4 splits 16 groups of four bytes into Y0 U Y1 V, or U Y0 V Y1 for UYVY
+    int y0 = uyvy ? 1 : 0;
+    int y1 = uyvy ? 3 : 2;
+    int u = uyvy ? 0 : 1;
+    int v = uyvy ? 2 : 3;
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        int j = 0;
+        for (; j + 32 <= width; j += 32)
+        {
+            uint8x16x4_t a = vld4q_u8(row0 + j * 2);
+            uint8x16x4_t b = vld4q_u8(row1 + j * 2);
+
+            uint8x16x2_t ya;
+            ya.val[0] = a.val[y0];
+            ya.val[1] = a.val[y1];
+            vst2q_u8(dsty + j, ya);
+
+            uint8x16x2_t yb;
+            yb.val[0] = b.val[y0];
+            yb.val[1] = b.val[y1];
+            vst2q_u8(dsty1 + j, yb);
+
+            vst1q_u8(dstu + j / 2, vrhaddq_u8(a.val[u], b.val[u]));
+            vst1q_u8(dstv + j / 2, vrhaddq_u8(a.val[v], b.val[v]));
+        }
+        if (j < width)
+        {
+            packed_422_to_i420_c(dsty + j, dsty_stride, dstu + j / 2, dstu_stride, dstv + j / 2, dstv_stride,
+                    src + j * 2, src_stride, width - j, 2, uyvy);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void narrow_16_neon(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint16_t *samples = (const uint16_t*) src;
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            // rounding, saturating shift and narrow in one
+            uint8x8_t a = vqrshrn_n_u16(vld1q_u16(samples + j), 8);
+            uint8x8_t b = vqrshrn_n_u16(vld1q_u16(samples + j + 8), 8);
+            vst1q_u8(dst + j, vcombine_u8(a, b));
+        }
+        if (j < width) narrow_16_c(dst + j, dst_stride, src + j * 2, src_stride, width - j, 1);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void split_uv_16_neon(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint16_t *samples = (const uint16_t*) src;
+        int j = 0;
+        for (; j + 8 <= width; j += 8)
+        {
+            uint16x8x2_t uv = vld2q_u16(samples + j * 2);
+            vst1_u8(dstu + j, vqrshrn_n_u16(uv.val[0], 8));
+            vst1_u8(dstv + j, vqrshrn_n_u16(uv.val[1], 8));
+        }
+        if (j < width)
+        {
+            split_uv_16_c(dstu + j, dstu_stride, dstv + j, dstv_stride, src + j * 4, src_stride, width - j, 1);
+        }
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static inline uint8x16_t rgb_luma_neon(const uint8x16x4_t &p, uint8x8_t k0, uint8x8_t k1, uint8x8_t k2,
+        uint8x16_t offset)
+{
+    uint16x8_t lo = vmull_u8(vget_low_u8(p.val[0]), k0);
+    lo = vmlal_u8(lo, vget_low_u8(p.val[1]), k1);
+    lo = vmlal_u8(lo, vget_low_u8(p.val[2]), k2);
+
+    uint16x8_t hi = vmull_u8(vget_high_u8(p.val[0]), k0);
+    hi = vmlal_u8(hi, vget_high_u8(p.val[1]), k1);
+    hi = vmlal_u8(hi, vget_high_u8(p.val[2]), k2);
+
+    return vaddq_u8(vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)), offset);
+}
+
+static inline uint8x8_t rgb_chroma_neon(uint16x8_t c0, uint16x8_t c1, uint16x8_t c2, const int16_t *k)
+{
+    int16x8_t s0 = vreinterpretq_s16_u16(c0);
+    int16x8_t s1 = vreinterpretq_s16_u16(c1);
+    int16x8_t s2 = vreinterpretq_s16_u16(c2);
+    const int32x4_t bias = vdupq_n_s32(128 + (128 << 8));
+
+    int32x4_t lo = vmull_n_s16(vget_low_s16(s0), k[0]);
+    lo = vmlal_n_s16(lo, vget_low_s16(s1), k[1]);
+    lo = vmlal_n_s16(lo, vget_low_s16(s2), k[2]);
+    lo = vshrq_n_s32(vaddq_s32(lo, bias), 8);
+
+    int32x4_t hi = vmull_n_s16(vget_high_s16(s0), k[0]);
+    hi = vmlal_n_s16(hi, vget_high_s16(s1), k[1]);
+    hi = vmlal_n_s16(hi, vget_high_s16(s2), k[2]);
+    hi = vshrq_n_s32(vaddq_s32(hi, bias), 8);
+
+    return vqmovn_u16(vcombine_u16(vqmovun_s32(lo), vqmovun_s32(hi)));
+}
+
+static void rgb_to_i420_neon(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height,
+        const ffconv_rgb_coeffs *coeffs)
+{
+    // luma coefficients are never negative and fit in a byte
+    uint8x8_t ky0 = vdup_n_u8((uint8_t) coeffs->y[0]);
+    uint8x8_t ky1 = vdup_n_u8((uint8_t) coeffs->y[1]);
+    uint8x8_t ky2 = vdup_n_u8((uint8_t) coeffs->y[2]);
+    uint8x16_t offset = vdupq_n_u8((uint8_t) coeffs->y_offset);
+
+    for (int i = 0; i < height / 2; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        uint8_t *dsty1 = dsty + dsty_stride;
+
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            uint8x16x4_t a = vld4q_u8(row0 + j * 4);
+            uint8x16x4_t b = vld4q_u8(row1 + j * 4);
+
+            vst1q_u8(dsty + j, rgb_luma_neon(a, ky0, ky1, ky2, offset));
+            vst1q_u8(dsty1 + j, rgb_luma_neon(b, ky0, ky1, ky2, offset));
+
+            // pairwise sums of both rows, rounded to the mean of each 2x2 block
+            uint16x8_t c0 = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2);
+            uint16x8_t c1 = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2);
+            uint16x8_t c2 = vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[2]), b.val[2]), 2);
+
+            vst1_u8(dstu + j / 2, rgb_chroma_neon(c0, c1, c2, coeffs->u));
+            vst1_u8(dstv + j / 2, rgb_chroma_neon(c0, c1, c2, coeffs->v));
+        }
+        if (j < width)
+        {
+            rgb_to_i420_c(dsty + j, dsty_stride, dstu + j / 2, dstu_stride, dstv + j / 2, dstv_stride,
+                    src + j * 4, src_stride, width - j, 2, coeffs);
+        }
+
+        src += src_stride * 2;
+        dsty += dsty_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+struct transpose_8x8_neon
+{
+    static void run(uint8_t *dst, int dst_stride, const uint8_t *src, int src_stride)
+    {
+        uint8x8x2_t t0 = vtrn_u8(vld1_u8(src), vld1_u8(src + src_stride));
+        uint8x8x2_t t1 = vtrn_u8(vld1_u8(src + src_stride * 2), vld1_u8(src + src_stride * 3));
+        uint8x8x2_t t2 = vtrn_u8(vld1_u8(src + src_stride * 4), vld1_u8(src + src_stride * 5));
+        uint8x8x2_t t3 = vtrn_u8(vld1_u8(src + src_stride * 6), vld1_u8(src + src_stride * 7));
+
+        uint16x4x2_t u0 = vtrn_u16(vreinterpret_u16_u8(t0.val[0]), vreinterpret_u16_u8(t1.val[0]));
+        uint16x4x2_t u1 = vtrn_u16(vreinterpret_u16_u8(t0.val[1]), vreinterpret_u16_u8(t1.val[1]));
+        uint16x4x2_t u2 = vtrn_u16(vreinterpret_u16_u8(t2.val[0]), vreinterpret_u16_u8(t3.val[0]));
+        uint16x4x2_t u3 = vtrn_u16(vreinterpret_u16_u8(t2.val[1]), vreinterpret_u16_u8(t3.val[1]));
+
+        // columns k and k + 4 come out of each
+        uint32x2x2_t v0 = vtrn_u32(vreinterpret_u32_u16(u0.val[0]), vreinterpret_u32_u16(u2.val[0]));
+        uint32x2x2_t v1 = vtrn_u32(vreinterpret_u32_u16(u1.val[0]), vreinterpret_u32_u16(u3.val[0]));
+        uint32x2x2_t v2 = vtrn_u32(vreinterpret_u32_u16(u0.val[1]), vreinterpret_u32_u16(u2.val[1]));
+        uint32x2x2_t v3 = vtrn_u32(vreinterpret_u32_u16(u1.val[1]), vreinterpret_u32_u16(u3.val[1]));
+
+        vst1_u8(dst, vreinterpret_u8_u32(v0.val[0]));
+        vst1_u8(dst + dst_stride, vreinterpret_u8_u32(v1.val[0]));
+        vst1_u8(dst + dst_stride * 2, vreinterpret_u8_u32(v2.val[0]));
+        vst1_u8(dst + dst_stride * 3, vreinterpret_u8_u32(v3.val[0]));
+        vst1_u8(dst + dst_stride * 4, vreinterpret_u8_u32(v0.val[1]));
+        vst1_u8(dst + dst_stride * 5, vreinterpret_u8_u32(v1.val[1]));
+        vst1_u8(dst + dst_stride * 6, vreinterpret_u8_u32(v2.val[1]));
+        vst1_u8(dst + dst_stride * 7, vreinterpret_u8_u32(v3.val[1]));
+    }
+};
+
+static inline void store_uv_neon(uint8_t *dstu, uint8_t *dstv, uint16x4_t a, uint16x4_t b)
+{
+    uint8x8x2_t uv = vuzp_u8(vreinterpret_u8_u16(a), vreinterpret_u8_u16(b));
+    vst1_u8(dstu, uv.val[0]);
+    vst1_u8(dstv, uv.val[1]);
+}
+
+struct transpose_uv_8x8_neon
+{
+    static void run(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+            const uint8_t *src, int src_stride)
+    {
+        uint16x8_t r[8];
+        for (int k = 0; k < 8; k++)
+            r[k] = vreinterpretq_u16_u8(vld1q_u8(src + src_stride * k));
+
+        uint16x8x2_t t0 = vtrnq_u16(r[0], r[1]);
+        uint16x8x2_t t1 = vtrnq_u16(r[2], r[3]);
+        uint16x8x2_t t2 = vtrnq_u16(r[4], r[5]);
+        uint16x8x2_t t3 = vtrnq_u16(r[6], r[7]);
+
+        // columns k and k + 4 of rows 0-3, then of rows 4-7
+        uint32x4x2_t u0 = vtrnq_u32(vreinterpretq_u32_u16(t0.val[0]), vreinterpretq_u32_u16(t1.val[0]));
+        uint32x4x2_t u1 = vtrnq_u32(vreinterpretq_u32_u16(t0.val[1]), vreinterpretq_u32_u16(t1.val[1]));
+        uint32x4x2_t u2 = vtrnq_u32(vreinterpretq_u32_u16(t2.val[0]), vreinterpretq_u32_u16(t3.val[0]));
+        uint32x4x2_t u3 = vtrnq_u32(vreinterpretq_u32_u16(t2.val[1]), vreinterpretq_u32_u16(t3.val[1]));
+
+        uint16x8_t top[4], bottom[4];
+        top[0] = vreinterpretq_u16_u32(u0.val[0]);
+        top[1] = vreinterpretq_u16_u32(u1.val[0]);
+        top[2] = vreinterpretq_u16_u32(u0.val[1]);
+        top[3] = vreinterpretq_u16_u32(u1.val[1]);
+        bottom[0] = vreinterpretq_u16_u32(u2.val[0]);
+        bottom[1] = vreinterpretq_u16_u32(u3.val[0]);
+        bottom[2] = vreinterpretq_u16_u32(u2.val[1]);
+        bottom[3] = vreinterpretq_u16_u32(u3.val[1]);
+
+        for (int k = 0; k < 4; k++)
+        {
+            store_uv_neon(dstu + dstu_stride * k, dstv + dstv_stride * k,
+                    vget_low_u16(top[k]), vget_low_u16(bottom[k]));
+            store_uv_neon(dstu + dstu_stride * (k + 4), dstv + dstv_stride * (k + 4),
+                    vget_high_u16(top[k]), vget_high_u16(bottom[k]));
+        }
+    }
+};
+
+static inline uint8x16_t reverse_neon(uint8x16_t x)
+{
+    x = vrev64q_u8(x);
+    return vcombine_u8(vget_high_u8(x), vget_low_u8(x));
+}
+
+static void mirror_neon(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            vst1q_u8(dst + j, reverse_neon(vld1q_u8(src + width - j - 16)));
+        }
+        if (j < width) mirror_c(dst + j, dst_stride, src, src_stride, width - j, 1);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+static void mirror_uv_neon(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            uint8x16x2_t uv = vld2q_u8(src + (width - j - 16) * 2);
+            vst1q_u8(dstu + j, reverse_neon(uv.val[0]));
+            vst1q_u8(dstv + j, reverse_neon(uv.val[1]));
+        }
+        if (j < width) mirror_uv_c(dstu + j, dstu_stride, dstv + j, dstv_stride, src, src_stride, width - j, 1);
+        src += src_stride;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void halve_neon(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        int j = 0;
+        for (; j + 16 <= width; j += 16)
+        {
+            // neighbouring bytes added pairwise, then the second row on top
+            uint16x8_t lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(row0 + j * 2)), vld1q_u8(row1 + j * 2));
+            uint16x8_t hi = vpadalq_u8(vpaddlq_u8(vld1q_u8(row0 + j * 2 + 16)), vld1q_u8(row1 + j * 2 + 16));
+            vst1q_u8(dst + j, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+        }
+        if (j < width) halve_c(dst + j, dst_stride, row0 + j * 2, src_stride, width - j, 1);
+        src += src_stride * 2;
+        dst += dst_stride;
+    }
+}
+
+static void halve_uv_neon(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height)
+{
+    for (int i = 0; i < height; i++)
+    {
+        const uint8_t *row0 = src;
+        const uint8_t *row1 = src + src_stride;
+        int j = 0;
+        for (; j + 8 <= width; j += 8)
+        {
+            uint8x16x2_t a = vld2q_u8(row0 + j * 4);
+            uint8x16x2_t b = vld2q_u8(row1 + j * 4);
+            vst1_u8(dstu + j, vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2));
+            vst1_u8(dstv + j, vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2));
+        }
+        if (j < width) halve_uv_c(dstu + j, dstu_stride, dstv + j, dstv_stride, row0 + j * 4, src_stride, width - j, 1);
+        src += src_stride * 2;
+        dstu += dstu_stride;
+        dstv += dstv_stride;
+    }
+}
+
+static void sum_rows_neon(uint16_t *dst, const uint8_t *src, int src_stride, int width, int rows)
+{
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        const uint8_t *row = src + j;
+        uint16x8_t lo = vdupq_n_u16(0);
+        uint16x8_t hi = vdupq_n_u16(0);
+        for (int i = 0; i < rows; i++)
+        {
+            uint8x16_t x = vld1q_u8(row);
+            lo = vaddw_u8(lo, vget_low_u8(x));
+            hi = vaddw_u8(hi, vget_high_u8(x));
+            row += src_stride;
+        }
+        vst1q_u16(dst + j, lo);
+        vst1q_u16(dst + j + 8, hi);
+    }
+    if (j < width) sum_rows_c(dst + j, src + j, src_stride, width - j, rows);
+}
+
+static void blend_rows_neon(uint8_t *dst, const uint8_t *row0, const uint8_t *row1, int width, int fraction)
+{
+    // the weights reach 256 so they are applied in 16 bits
+    uint16x8_t w0 = vdupq_n_u16(256 - fraction);
+    uint16x8_t w1 = vdupq_n_u16(fraction);
+
+    int j = 0;
+    for (; j + 16 <= width; j += 16)
+    {
+        uint8x16_t a = vld1q_u8(row0 + j);
+        uint8x16_t b = vld1q_u8(row1 + j);
+        uint16x8_t lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(a)), w0), vmovl_u8(vget_low_u8(b)), w1);
+        uint16x8_t hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(a)), w0), vmovl_u8(vget_high_u8(b)), w1);
+        vst1q_u8(dst + j, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    if (j < width) blend_rows_c(dst + j, row0 + j, row1 + j, width - j, fraction);
+}
+
+const ffconv_kernels ffconv_kernels_neon = { "neon", copy_plane_neon, split_uv_neon, downsample_8x8_neon,
+        sad_neon, packed_422_to_i420_neon, narrow_16_neon, split_uv_16_neon, rgb_to_i420_neon,
+        transpose_tiled<transpose_8x8_neon>, transpose_uv_tiled<transpose_uv_8x8_neon>,
+        mirror_neon, mirror_uv_neon, halve_neon, halve_uv_neon, sum_rows_neon, blend_rows_neon };
+#endif
+
+static const ffconv_kernels* select_kernels()
+{
+    int cpu_flags = av_get_cpu_flags();
+
+#if FFCONV_HAVE_AVX2
+    if (cpu_has_avx2()) return &ffconv_kernels_avx2;
+#endif
+
+#if FFCONV_HAVE_SSE2
+    if (cpu_flags & AV_CPU_FLAG_SSE2) return &ffconv_kernels_sse2;
+#endif
+
+#if FFCONV_HAVE_NEON
+    if (cpu_flags & AV_CPU_FLAG_NEON) return &ffconv_kernels_neon;
+#endif
+
+    (void) cpu_flags;
+    return &ffconv_kernels_c;
+}
+
+const ffconv_kernels* ffconv_get_kernels()
+{
+    // probing twice from two threads is harmless, both get the same answer
+    static const ffconv_kernels * volatile kernels = 0;
+    if (!kernels) kernels = select_kernels();
+    return kernels;
+}
+
+void ffconv_rgb_coeffs_init(ffconv_rgb_coeffs *coeffs, bool bgr, bool bt709, bool full_range)
+{
+    // R G B weights in 1/256ths, rounded so each chroma row sums to 0 and gray stays neutral
+    static const int16_t matrices[4][3][3] =
+    {
+        { { 66, 129, 25 }, { -38, -74, 112 }, { 112, -94, -18 } },
+        { { 77, 150, 29 }, { -43, -85, 128 }, { 128, -107, -21 } },
+        { { 47, 157, 16 }, { -26, -86, 112 }, { 112, -102, -10 } },
+        { { 54, 183, 19 }, { -29, -99, 128 }, { 128, -116, -12 } }
+    };
+
+    const int16_t (*m)[3] = matrices[(bt709 ? 2 : 0) + (full_range ? 1 : 0)];
+
+    for (int i = 0; i < 3; i++)
+    {
+        int channel = bgr ? 2 - i : i;
+        coeffs->y[i] = m[0][channel];
+        coeffs->u[i] = m[1][channel];
+        coeffs->v[i] = m[2][channel];
+    }
+
+    coeffs->y_offset = full_range ? 0 : 16;
+}
+
+void ffconv_nv12_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height)
+{
+    kernels->copy_plane(dsty, dsty_stride, srcy, srcy_stride, width, height);
+    kernels->split_uv(dstu, dstu_stride, dstv, dstv_stride, srcuv, srcuv_stride, width / 2, height / 2);
+}
+
+void ffconv_nv12_to_i420_oriented(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height, int rotation, bool mirror)
+{
+    // every orientation is a transpose or not, followed by flips of the result
+    bool transpose = rotation == 90 || rotation == 270;
+    bool flip_x = (rotation == 90 || rotation == 180) != mirror;
+    bool flip_y = rotation == 180 || rotation == 270;
+
+    int out_height = transpose ? width : height;
+
+    // flipping upside down is writing the rows bottom up
+    if (flip_y)
+    {
+        dsty += (out_height - 1) * dsty_stride;
+        dstu += (out_height / 2 - 1) * dstu_stride;
+        dstv += (out_height / 2 - 1) * dstv_stride;
+        dsty_stride = -dsty_stride;
+        dstu_stride = -dstu_stride;
+        dstv_stride = -dstv_stride;
+    }
+
+    if (transpose)
+    {
+        // and after a transpose, mirroring is reading the rows bottom up
+        if (flip_x)
+        {
+            srcy += (height - 1) * srcy_stride;
+            srcuv += (height / 2 - 1) * srcuv_stride;
+            srcy_stride = -srcy_stride;
+            srcuv_stride = -srcuv_stride;
+        }
+
+        kernels->transpose(dsty, dsty_stride, srcy, srcy_stride, width, height);
+        kernels->transpose_uv(dstu, dstu_stride, dstv, dstv_stride, srcuv, srcuv_stride, width / 2, height / 2);
+    }
+    else if (flip_x)
+    {
+        kernels->mirror(dsty, dsty_stride, srcy, srcy_stride, width, height);
+        kernels->mirror_uv(dstu, dstu_stride, dstv, dstv_stride, srcuv, srcuv_stride, width / 2, height / 2);
+    }
+    else
+    {
+        kernels->copy_plane(dsty, dsty_stride, srcy, srcy_stride, width, height);
+        kernels->split_uv(dstu, dstu_stride, dstv, dstv_stride, srcuv, srcuv_stride, width / 2, height / 2);
+    }
+}
+
+// the most samples a box averages in each direction, so a whole block sums within 16 bits
+#define BOX_MAX_FACTOR 16
+
+static bool box_factors(int src_width, int src_height, int dst_width, int dst_height, int *fx, int *fy)
+{
+    if (src_width % dst_width || src_height % dst_height) return false;
+    *fx = src_width / dst_width;
+    *fy = src_height / dst_height;
+    return *fx <= BOX_MAX_FACTOR && *fy <= BOX_MAX_FACTOR;
+}
+
+// scale a plane of one or two interleaved channels, the second written to dst1
+static void box_plane(const ffconv_kernels *kernels,
+        const uint8_t *src, int src_stride, int src_width, int channels,
+        uint8_t *dst0, int dst0_stride, uint8_t *dst1, int dst1_stride,
+        int dst_width, int dst_height, int fx, int fy)
+{
+    uint16_t *sums = (uint16_t*) malloc(src_width * channels * sizeof(uint16_t));
+    if (!sums) return;
+
+    // dividing by a multiply, exact and within 32 bits for any block of at most 256 bytes
+    int count = fx * fy;
+    uint32_t scale = ((1 << 24) + count - 1) / count;
+
+    uint8_t *dst[2] = { dst0, dst1 };
+    int dst_stride[2] = { dst0_stride, dst1_stride };
+
+    for (int i = 0; i < dst_height; i++)
+    {
+        kernels->sum_rows(sums, src, src_stride, src_width * channels, fy);
+
+        for (int c = 0; c < channels; c++)
+        {
+            const uint16_t *in = sums + c;
+            uint8_t *out = dst[c] + i * dst_stride[c];
+            for (int j = 0; j < dst_width; j++)
+            {
+                uint32_t sum = count / 2;
+                for (int k = 0; k < fx; k++)
+                    sum += in[k * channels];
+                out[j] = (uint8_t) ((sum * scale) >> 24);
+                in += fx * channels;
+            }
+        }
+
+        src += src_stride * fy;
+    }
+
+    free(sums);
+}
+
+static void bilinear_plane(const ffconv_kernels *kernels,
+        const uint8_t *src, int src_stride, int src_width, int src_height, int channels,
+        uint8_t *dst0, int dst0_stride, uint8_t *dst1, int dst1_stride, int dst_width, int dst_height)
+{
+    int *columns = (int*) malloc(dst_width * 3 * sizeof(int));
+    uint8_t *row = (uint8_t*) malloc(src_width * channels);
+
+    if (!columns || !row)
+    {
+        free(columns);
+        free(row);
+        return;
+    }
+
+    // 16.16 positions of the output sample centres, the last input sample repeating past the edge
+    int step = (src_width << 16) / dst_width;
+    for (int j = 0; j < dst_width; j++)
+    {
+        int pos = step / 2 - 0x8000 + j * step;
+        if (pos < 0) pos = 0;
+        int x = pos >> 16;
+        int next = x + 1 < src_width ? x + 1 : x;
+        columns[j * 3] = x * channels;
+        columns[j * 3 + 1] = next * channels;
+        columns[j * 3 + 2] = (pos & 0xffff) >> 8;
+    }
+
+    // blending rows first leaves the horizontal pass only the output rows
+    step = (src_height << 16) / dst_height;
+    for (int i = 0; i < dst_height; i++)
+    {
+        int pos = step / 2 - 0x8000 + i * step;
+        if (pos < 0) pos = 0;
+        int y = pos >> 16;
+        int fraction = (pos & 0xffff) >> 8;
+
+        const uint8_t *in = src + y * src_stride;
+        if (fraction && y + 1 < src_height)
+        {
+            kernels->blend_rows(row, in, in + src_stride, src_width * channels, fraction);
+            in = row;
+        }
+
+        uint8_t *out0 = dst0 + i * dst0_stride;
+        uint8_t *out1 = dst1 + i * dst1_stride;
+        const int *column = columns;
+
+        if (channels == 1)
+        {
+            for (int j = 0; j < dst_width; j++, column += 3)
+            {
+                int f = column[2];
+                out0[j] = (uint8_t) ((in[column[0]] * (256 - f) + in[column[1]] * f + 128) >> 8);
+            }
+        }
+        else
+        {
+            for (int j = 0; j < dst_width; j++, column += 3)
+            {
+                const uint8_t *a = in + column[0];
+                const uint8_t *b = in + column[1];
+                int f = column[2];
+                out0[j] = (uint8_t) ((a[0] * (256 - f) + b[0] * f + 128) >> 8);
+                out1[j] = (uint8_t) ((a[1] * (256 - f) + b[1] * f + 128) >> 8);
+            }
+        }
+    }
+
+    free(columns);
+    free(row);
+}
+
+static void scale_plane(const ffconv_kernels *kernels, bool box,
+        const uint8_t *src, int src_stride, int src_width, int src_height, int channels,
+        uint8_t *dst0, int dst0_stride, uint8_t *dst1, int dst1_stride, int dst_width, int dst_height)
+{
+    int fx, fy;
+
+    if (src_width == dst_width && src_height == dst_height)
+    {
+        if (channels == 1) kernels->copy_plane(dst0, dst0_stride, src, src_stride, dst_width, dst_height);
+        else kernels->split_uv(dst0, dst0_stride, dst1, dst1_stride, src, src_stride, dst_width, dst_height);
+    }
+    else if (box && box_factors(src_width, src_height, dst_width, dst_height, &fx, &fy))
+    {
+        if (fx == 2 && fy == 2 && channels == 1)
+            kernels->halve(dst0, dst0_stride, src, src_stride, dst_width, dst_height);
+        else if (fx == 2 && fy == 2)
+            kernels->halve_uv(dst0, dst0_stride, dst1, dst1_stride, src, src_stride, dst_width, dst_height);
+        else
+            box_plane(kernels, src, src_stride, src_width, channels,
+                    dst0, dst0_stride, dst1, dst1_stride, dst_width, dst_height, fx, fy);
+    }
+    else
+    {
+        bilinear_plane(kernels, src, src_stride, src_width, src_height, channels,
+                dst0, dst0_stride, dst1, dst1_stride, dst_width, dst_height);
+    }
+}
+
+void ffconv_nv12_to_i420_scaled(const ffconv_kernels *kernels, bool box,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        int src_width, int src_height,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int dst_width, int dst_height)
+{
+    // with even sizes the chroma divides evenly exactly when the luma does
+    scale_plane(kernels, box, srcy, srcy_stride, src_width, src_height, 1,
+            dsty, dsty_stride, 0, 0, dst_width, dst_height);
+    scale_plane(kernels, box, srcuv, srcuv_stride, src_width / 2, src_height / 2, 2,
+            dstu, dstu_stride, dstv, dstv_stride, dst_width / 2, dst_height / 2);
+}
+
+void ffconv_scale_i420(const ffconv_kernels *kernels, bool box,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcu, int srcu_stride,
+        const uint8_t *srcv, int srcv_stride, int src_width, int src_height,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int dst_width, int dst_height)
+{
+    scale_plane(kernels, box, srcy, srcy_stride, src_width, src_height, 1,
+            dsty, dsty_stride, 0, 0, dst_width, dst_height);
+    scale_plane(kernels, box, srcu, srcu_stride, src_width / 2, src_height / 2, 1,
+            dstu, dstu_stride, 0, 0, dst_width / 2, dst_height / 2);
+    scale_plane(kernels, box, srcv, srcv_stride, src_width / 2, src_height / 2, 1,
+            dstv, dstv_stride, 0, 0, dst_width / 2, dst_height / 2);
+}
+
+void ffconv_nv21_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcvu, int srcvu_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height)
+{
+    kernels->copy_plane(dsty, dsty_stride, srcy, srcy_stride, width, height);
+    kernels->split_uv(dstv, dstv_stride, dstu, dstu_stride, srcvu, srcvu_stride, width / 2, height / 2);
+}
+
+void ffconv_p010_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height)
+{
+    kernels->narrow_16(dsty, dsty_stride, srcy, srcy_stride, width, height);
+    kernels->split_uv_16(dstu, dstu_stride, dstv, dstv_stride, srcuv, srcuv_stride, width / 2, height / 2);
+}
+
+void ffconv_copy_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcu, int srcu_stride,
+        const uint8_t *srcv, int srcv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height)
+{
+    kernels->copy_plane(dsty, dsty_stride, srcy, srcy_stride, width, height);
+    kernels->copy_plane(dstu, dstu_stride, srcu, srcu_stride, width / 2, height / 2);
+    kernels->copy_plane(dstv, dstv_stride, srcv, srcv_stride, width / 2, height / 2);
+}
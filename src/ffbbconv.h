@@ -0,0 +1,264 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBCONV_H
+#define FFBBCONV_H
+
+#include <stdint.h>
+
+/**
+ * Copy a plane of width x height bytes between two strided buffers.
+ */
+typedef void (*ffconv_copy_plane_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Split an interleaved UV plane into separate U and V planes.
+ * The width is the number of UV pairs per row.
+ */
+typedef void (*ffconv_split_uv_fn)(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Shrink a plane by 8 in both directions, each output byte being the mean
+ * of an 8x8 block. Partial blocks at the right and bottom edge are left out.
+ */
+typedef void (*ffconv_downsample_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Sum of absolute differences between two width x height regions.
+ */
+typedef uint32_t (*ffconv_sad_fn)(const uint8_t *a, int a_stride,
+        const uint8_t *b, int b_stride, int width, int height);
+
+/**
+ * Turn packed 4:2:2 (YUYV, or UYVY when uyvy is set) into the three planes
+ * of I420, averaging the chroma of each pair of rows. Width and height
+ * are in pixels and even.
+ */
+typedef void (*ffconv_packed_422_fn)(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height, bool uyvy);
+
+/**
+ * Round a plane of 16-bit little endian samples, such as the luma of
+ * P010, down to 8 bits. The width is in samples and strides in bytes.
+ */
+typedef void (*ffconv_narrow_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * split_uv for an interleaved UV plane of 16-bit samples, rounding each
+ * down to 8 bits on the way.
+ */
+typedef void (*ffconv_split_uv_16_fn)(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Fixed point RGB to YUV coefficients in 1/256ths, for the first three
+ * bytes of each 4-byte pixel in memory order. Filled in by
+ * ffconv_rgb_coeffs_init.
+ */
+typedef struct
+{
+    int16_t y[3];
+    int16_t u[3];
+    int16_t v[3];
+    int16_t y_offset;
+} ffconv_rgb_coeffs;
+
+/**
+ * Turn 4-byte RGB pixels, such as BGRA, into the three planes of I420.
+ * Chroma is taken from the mean color of each 2x2 block and the fourth
+ * byte of each pixel is ignored. Width and height are in pixels and even.
+ */
+typedef void (*ffconv_rgb_to_i420_fn)(uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride,
+        uint8_t *dstv, int dstv_stride, const uint8_t *src, int src_stride, int width, int height,
+        const ffconv_rgb_coeffs *coeffs);
+
+/**
+ * Transpose a width x height plane into a height x width one, source row
+ * i becoming destination column i. Either stride may be negative to walk
+ * the rows bottom up, which together with the transpose gives a rotation.
+ */
+typedef void (*ffconv_transpose_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * transpose for an interleaved UV plane, split into separate U and V
+ * planes on the way. The width is the number of UV pairs per row.
+ */
+typedef void (*ffconv_transpose_uv_fn)(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * copy_plane with every row reversed left to right.
+ */
+typedef void (*ffconv_mirror_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * split_uv with every row reversed left to right, each pair still read as U then V.
+ */
+typedef void (*ffconv_mirror_uv_fn)(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Shrink a plane by 2 in both directions, each output byte being the
+ * rounded mean of a 2x2 block. Width and height are those of the output.
+ */
+typedef void (*ffconv_halve_fn)(uint8_t *dst, int dst_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * halve for an interleaved UV plane, split into separate U and V planes
+ * on the way. The width is the number of UV pairs per output row.
+ */
+typedef void (*ffconv_halve_uv_fn)(uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        const uint8_t *src, int src_stride, int width, int height);
+
+/**
+ * Add up the bytes of rows consecutive rows, column by column, into
+ * 16-bit sums. No more than 257 rows fit.
+ */
+typedef void (*ffconv_sum_rows_fn)(uint16_t *dst, const uint8_t *src, int src_stride, int width, int rows);
+
+/**
+ * Blend two rows of bytes, the second weighted by fraction / 256 and the
+ * first by the rest, rounded. A fraction of 0 copies the first row.
+ */
+typedef void (*ffconv_blend_rows_fn)(uint8_t *dst, const uint8_t *row0, const uint8_t *row1,
+        int width, int fraction);
+
+typedef struct
+{
+    const char *name;
+    ffconv_copy_plane_fn copy_plane;
+    ffconv_split_uv_fn split_uv;
+    ffconv_downsample_fn downsample_8x8;
+    ffconv_sad_fn sad;
+    ffconv_packed_422_fn packed_422_to_i420;
+    ffconv_narrow_fn narrow_16;
+    ffconv_split_uv_16_fn split_uv_16;
+    ffconv_rgb_to_i420_fn rgb_to_i420;
+    ffconv_transpose_fn transpose;
+    ffconv_transpose_uv_fn transpose_uv;
+    ffconv_mirror_fn mirror;
+    ffconv_mirror_uv_fn mirror_uv;
+    ffconv_halve_fn halve;
+    ffconv_halve_uv_fn halve_uv;
+    ffconv_sum_rows_fn sum_rows;
+    ffconv_blend_rows_fn blend_rows;
+} ffconv_kernels;
+
+extern const ffconv_kernels ffconv_kernels_c;
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#define FFCONV_HAVE_SSE2 1
+extern const ffconv_kernels ffconv_kernels_sse2;
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define FFCONV_HAVE_AVX2 1
+extern const ffconv_kernels ffconv_kernels_avx2;
+#endif
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FFCONV_HAVE_NEON 1
+extern const ffconv_kernels ffconv_kernels_neon;
+#endif
+
+/**
+ * Return the fastest kernels supported by the running CPU.
+ * The CPU is only probed on the first call.
+ */
+const ffconv_kernels* ffconv_get_kernels();
+
+/**
+ * Fill in the coefficients for BT.601, or BT.709 when bt709 is set, with
+ * Y in 16-235 or, when full_range is set, 0-255. The pixels are B G R
+ * when bgr is set, otherwise R G B.
+ */
+void ffconv_rgb_coeffs_init(ffconv_rgb_coeffs *coeffs, bool bgr, bool bt709, bool full_range);
+
+/**
+ * Convert an NV12 image into the three planes of an I420 image.
+ */
+void ffconv_nv12_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height);
+
+/**
+ * Convert the width x height region of an NV12 image at srcy and srcuv
+ * into I420, rotated clockwise by 0, 90, 180 or 270 degrees and then
+ * mirrored left to right if asked, reading and writing each sample once.
+ * The I420 image is height x width when rotated by 90 or 270.
+ */
+void ffconv_nv12_to_i420_oriented(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height, int rotation, bool mirror);
+
+/**
+ * Convert an NV12 image into I420 of another size in the same pass,
+ * without an I420 copy at the original size in between. With box set,
+ * each output sample is the mean of a block of input samples when the
+ * input is a whole multiple of the output in each direction, up to 16
+ * times. Any other sizes, or box not being set, interpolate bilinearly
+ * between the four nearest samples, which skips samples beyond a ratio
+ * of 2. All sizes are even.
+ */
+void ffconv_nv12_to_i420_scaled(const ffconv_kernels *kernels, bool box,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        int src_width, int src_height,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int dst_width, int dst_height);
+
+/**
+ * Scale an I420 image to another size, as ffconv_nv12_to_i420_scaled.
+ */
+void ffconv_scale_i420(const ffconv_kernels *kernels, bool box,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcu, int srcu_stride,
+        const uint8_t *srcv, int srcv_stride, int src_width, int src_height,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int dst_width, int dst_height);
+
+/**
+ * Convert an NV21 image, NV12 with V before U, into I420.
+ */
+void ffconv_nv21_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcvu, int srcvu_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height);
+
+/**
+ * Convert a P010 image, NV12 with 10-bit samples in the high bits of
+ * 16-bit words, into 8-bit I420.
+ */
+void ffconv_p010_to_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcuv, int srcuv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height);
+
+/**
+ * Copy the three planes of an I420 image.
+ */
+void ffconv_copy_i420(const ffconv_kernels *kernels,
+        const uint8_t *srcy, int srcy_stride, const uint8_t *srcu, int srcu_stride,
+        const uint8_t *srcv, int srcv_stride,
+        uint8_t *dsty, int dsty_stride, uint8_t *dstu, int dstu_stride, uint8_t *dstv, int dstv_stride,
+        int width, int height);
+
+#endif
@@ -0,0 +1,326 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbconvpool.h"
+#include "ffbbconv.h"
+#include "ffbbpool.h"
+#include "ffbbtime.h"
+#include "ffbbtracer.h"
+
+#include <sched.h>
+
+void* converting_thread(void* arg);
+
+ffenc_convert_pool::ffenc_convert_pool(int threads, int capacity, int width, int height,
+        ffenc_frame_pool *frame_pool, void (*output)(ffenc_frame *entry, void *arg), void *arg)
+{
+    thread_count = threads;
+    this->threads = new pthread_t[threads];
+    this->capacity = capacity;
+
+    raw_pool = new ffenc_frame_pool();
+    raw_pool->configure(PIX_FMT_NV12, width, height);
+    this->frame_pool = frame_pool;
+    raw_frames = new ffbb_ring<ffenc_frame*>(capacity);
+
+    this->output = output;
+    output_arg = arg;
+
+    rotation = 0;
+    mirror = false;
+    scale_width = 0;
+    scale_height = 0;
+    scale_box = false;
+
+    running = false;
+    workers_waiting = 0;
+    in_flight = 0;
+    next_sequence = 0;
+    next_output = 0;
+
+    converted = new ffenc_frame*[capacity];
+    done = new bool[capacity];
+
+    for (int i = 0; i < capacity; i++)
+    {
+        converted[i] = 0;
+        done[i] = false;
+    }
+
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&work_cond, 0);
+    pthread_mutex_init(&reorder_mutex, 0);
+}
+
+ffenc_convert_pool::~ffenc_convert_pool()
+{
+    finish();
+
+    ffenc_frame *entry;
+    while (raw_frames->pop(&entry))
+    {
+        raw_pool->release(entry);
+    }
+
+    for (int i = 0; i < capacity; i++)
+    {
+        if (converted[i]) frame_pool->release(converted[i]);
+    }
+
+    delete raw_frames;
+    delete raw_pool;
+    delete[] threads;
+    delete[] converted;
+    delete[] done;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work_cond);
+    pthread_mutex_destroy(&reorder_mutex);
+}
+
+void ffenc_convert_pool::set_orientation(int rotation, bool mirror)
+{
+    this->rotation = rotation;
+    this->mirror = mirror;
+}
+
+void ffenc_convert_pool::set_scaling(int width, int height, bool box)
+{
+    scale_width = width;
+    scale_height = height;
+    scale_box = box;
+}
+
+bool ffenc_convert_pool::start()
+{
+    if (running) return true;
+
+    running = true;
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        if (pthread_create(&threads[i], 0, &::converting_thread, this) != 0)
+        {
+            thread_count = i;
+            finish();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ffenc_convert_pool::finish()
+{
+    if (!running) return;
+
+    running = false;
+
+    __sync_synchronize();
+    pthread_mutex_lock(&mutex);
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mutex);
+
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i], 0);
+    }
+
+    // a submit that claimed its slot just before running dropped may still
+    // be copying, its frame is converted here rather than left behind
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+
+    while (in_flight)
+    {
+        ffenc_frame *raw;
+        if (raw_frames->pop(&raw)) convert(kernels, raw);
+        else sched_yield();
+    }
+}
+
+ffenc_error ffenc_convert_pool::submit(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+        int width, int height, void (*release)(void *opaque), void *opaque)
+{
+    // claim a slot before copying so a refused frame costs nothing
+    if (__sync_add_and_fetch(&in_flight, 1) > capacity)
+    {
+        __sync_sub_and_fetch(&in_flight, 1);
+        return FFENC_QUEUE_FULL;
+    }
+
+    // the claim is seen by finish, or we see it has started
+    if (!running)
+    {
+        __sync_sub_and_fetch(&in_flight, 1);
+        return FFENC_NOT_RUNNING;
+    }
+
+    ffenc_frame *entry;
+
+    if (release)
+    {
+        // the converting thread reads the caller's planes, releasing the raw frame releases them
+        const uint8_t *planes[2] = { srcy, srcuv };
+        int strides[2] = { stride, uv_stride };
+        entry = raw_pool->wrap_planes(PIX_FMT_NV12, planes, strides, width, height, release, opaque);
+    }
+    else
+    {
+        entry = raw_pool->acquire(PIX_FMT_NV12, width, height);
+    }
+
+    if (!entry)
+    {
+        __sync_sub_and_fetch(&in_flight, 1);
+        return FFENC_POOL_EXHAUSTED;
+    }
+
+    if (!release)
+    {
+        const ffconv_kernels *kernels = ffconv_get_kernels();
+
+        AVFrame *frame = entry->frame;
+        kernels->copy_plane(frame->data[0], frame->linesize[0], srcy, stride, width, height);
+        kernels->copy_plane(frame->data[1], frame->linesize[1], srcuv, uv_stride, width, height / 2);
+    }
+
+    entry->queued_at = ffbb_time_usec();
+    entry->sequence = __sync_fetch_and_add(&next_sequence, 1);
+
+    // cannot fail, the ring holds at least capacity frames
+    raw_frames->push(entry);
+
+    __sync_synchronize();
+
+    if (workers_waiting)
+    {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    return FFENC_OK;
+}
+
+void* converting_thread(void* arg)
+{
+    ffenc_convert_pool *pool = (ffenc_convert_pool*) arg;
+    pool->converting_thread();
+    return 0;
+}
+
+void ffenc_convert_pool::converting_thread()
+{
+    ffbb_trace_name_thread("ffenc convert");
+
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+
+    while (true)
+    {
+        ffenc_frame *raw;
+
+        if (!raw_frames->pop(&raw))
+        {
+            if (!running) break;
+
+            pthread_mutex_lock(&mutex);
+            workers_waiting++;
+            __sync_synchronize();
+            if (running && raw_frames->empty())
+            {
+                pthread_cond_wait(&work_cond, &mutex);
+            }
+            workers_waiting--;
+            pthread_mutex_unlock(&mutex);
+            continue;
+        }
+
+        convert(kernels, raw);
+    }
+}
+
+void ffenc_convert_pool::convert(const ffconv_kernels *kernels, ffenc_frame *raw)
+{
+    bool transpose = rotation == 90 || rotation == 270;
+    bool scaled = scale_width && (raw->width != scale_width || raw->height != scale_height);
+    int width = scaled ? scale_width : transpose ? raw->height : raw->width;
+    int height = scaled ? scale_height : transpose ? raw->width : raw->height;
+
+    ffenc_frame *entry = frame_pool->acquire(PIX_FMT_YUV420P, width, height);
+
+    if (entry)
+    {
+        AVFrame *src = raw->frame;
+        AVFrame *dst = entry->frame;
+
+        int64_t converting_at = ffbb_tracing() ? ffbb_time_usec() : 0;
+
+        if (scaled)
+        {
+            ffconv_nv12_to_i420_scaled(kernels, scale_box, src->data[0], src->linesize[0],
+                    src->data[1], src->linesize[1], raw->width, raw->height,
+                    dst->data[0], dst->linesize[0],
+                    dst->data[1], dst->linesize[1],
+                    dst->data[2], dst->linesize[2],
+                    width, height);
+        }
+        else
+        {
+            ffconv_nv12_to_i420_oriented(kernels, src->data[0], src->linesize[0], src->data[1], src->linesize[1],
+                    dst->data[0], dst->linesize[0],
+                    dst->data[1], dst->linesize[1],
+                    dst->data[2], dst->linesize[2],
+                    raw->width, raw->height, rotation, mirror);
+        }
+
+        // the pyramid is made here too, in parallel, rather than in the ordered output
+        frame_pool->build_layers(entry);
+
+        if (converting_at) ffbb_trace_span("convert", converting_at, ffbb_time_usec(), raw->sequence);
+
+        entry->queued_at = raw->queued_at;
+    }
+
+    int64_t sequence = raw->sequence;
+    raw_pool->release(raw);
+
+    // a frame the pool had no room for still takes its turn, as a gap
+    complete(sequence, entry);
+}
+
+void ffenc_convert_pool::complete(int64_t sequence, ffenc_frame *entry)
+{
+    pthread_mutex_lock(&reorder_mutex);
+
+    int slot = (int) (sequence % capacity);
+    converted[slot] = entry;
+    done[slot] = true;
+
+    // output under the lock so frames leave in the order they came in
+    while (done[next_output % capacity])
+    {
+        slot = (int) (next_output % capacity);
+
+        ffenc_frame *ready = converted[slot];
+        converted[slot] = 0;
+        done[slot] = false;
+        next_output++;
+
+        if (ready) output(ready, output_arg);
+        __sync_sub_and_fetch(&in_flight, 1);
+    }
+
+    pthread_mutex_unlock(&reorder_mutex);
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBCONVPOOL_H
+#define FFBBCONVPOOL_H
+
+#include "ffbbenc.h"
+#include "ffbbconv.h"
+#include "ffbbring.h"
+
+struct ffenc_frame;
+class ffenc_frame_pool;
+
+/**
+ * Takes NV12 to I420 conversion off the thread adding frames. The raw
+ * frame is only copied at ingest, or not at all when the caller lets us
+ * hold on to it, a pool of converting threads turns it
+ * into I420 and the results are put back in ingest order before they
+ * are handed on, one at a time, to the output function.
+ */
+class ffenc_convert_pool
+{
+    friend void* converting_thread(void* arg);
+
+public:
+
+    /**
+     * Converted frames are taken from frame_pool. At most capacity
+     * frames can be between submit and output at once. The width and
+     * height are those of the frames expected, for recycling buffers.
+     */
+    ffenc_convert_pool(int threads, int capacity, int width, int height, ffenc_frame_pool *frame_pool,
+            void (*output)(ffenc_frame *entry, void *arg), void *arg);
+    virtual ~ffenc_convert_pool();
+
+    /**
+     * Rotate by 0, 90, 180 or 270 degrees clockwise and then mirror while
+     * converting. Submitted frames are then the size before rotating.
+     * Call before start.
+     */
+    void set_orientation(int rotation, bool mirror);
+
+    /**
+     * Scale frames of any other size to width x height while converting,
+     * averaging blocks when box is set and the sizes allow. Call before
+     * start.
+     */
+    void set_scaling(int width, int height, bool box);
+
+    bool start();
+
+    /**
+     * Convert and output everything submitted, then wait for the threads to exit.
+     */
+    void finish();
+
+    bool is_running()
+    {
+        return running;
+    }
+
+    /**
+     * Queue an NV12 frame for conversion. It is copied unless release is
+     * given, then the planes are read in place and release is called
+     * with opaque from a converting thread once they have been, only if
+     * FFENC_OK is returned. Returns FFENC_QUEUE_FULL when capacity
+     * frames are already converting and FFENC_NOT_RUNNING once finish
+     * has been called.
+     */
+    ffenc_error submit(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+            int width, int height, void (*release)(void *opaque), void *opaque);
+
+private:
+
+    void converting_thread();
+    void convert(const ffconv_kernels *kernels, ffenc_frame *raw);
+    void complete(int64_t sequence, ffenc_frame *entry);
+
+    int thread_count;
+    pthread_t *threads;
+    int capacity;
+
+    // raw frames have their own pool so both keep recycling one layout
+    ffenc_frame_pool *raw_pool;
+    ffenc_frame_pool *frame_pool;
+    ffbb_ring<ffenc_frame*> *raw_frames;
+
+    void (*output)(ffenc_frame *entry, void *arg);
+    void *output_arg;
+
+    int rotation;
+    bool mirror;
+    int scale_width;
+    int scale_height;
+    bool scale_box;
+
+    volatile bool running;
+    volatile int workers_waiting;
+    volatile int in_flight;
+    volatile int64_t next_sequence;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+
+    // converted frames wait here, indexed by sequence, until their turn
+    pthread_mutex_t reorder_mutex;
+    ffenc_frame **converted;
+    bool *done;
+    int64_t next_output;
+};
+
+#endif
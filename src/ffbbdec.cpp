@@ -14,18 +14,29 @@
  */
 
 #include "ffbbdec.h"
+#include "ffbbrecorder.h"
+#include "ffbbtime.h"
+#include "ffbbtracer.h"
 
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
+// indexes into the latency histograms of get_stats
+#define STAGE_READ 0
+#define STAGE_DECODE 1
+#define STAGE_DISPLAY 2
+
+static const char *stage_names[] = { "read", "decode", "display" };
+
 void* decoding_thread(void* arg);
 
 ffdec_context::ffdec_context()
 {
     codec_context = 0;
+    recorder = new ffbb_recorder(3, stage_names);
 
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     view = 0;
 #endif
 
@@ -34,9 +45,11 @@ ffdec_context::ffdec_context()
 
 ffdec_context::~ffdec_context()
 {
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     if (view) free(view);
 #endif
+
+    delete recorder;
 }
 
 void ffdec_context::reset()
@@ -45,7 +58,7 @@ void ffdec_context::reset()
     running = false;
     open = false;
 
-#if !OSX_PLATFORM
+#if !OSX_PLATFORM && !LINUX_PLATFORM
     if (view)
     {
         free(view);
@@ -114,6 +127,7 @@ ffdec_error ffdec_context::start()
     if (!codec_context) return FFDEC_NO_CODEC_SPECIFIED;
 
     running = true;
+    recorder->reset();
 
     pthread_t pthread;
     pthread_create(&pthread, 0, &::decoding_thread, this);
@@ -130,6 +144,24 @@ ffdec_error ffdec_context::stop()
     return FFDEC_OK;
 }
 
+ffdec_error ffdec_context::get_stats(ffbb_stats *stats, bool reset)
+{
+    recorder->snapshot(stats, reset);
+    return FFDEC_OK;
+}
+
+ffdec_error ffdec_context::write_stats(int fd, bool reset)
+{
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    if (!stats) return FFDEC_WRITE_ERROR;
+
+    recorder->snapshot(stats, reset);
+    int result = ffbb_stats_write(stats, "ffdec", fd);
+    free(stats);
+
+    return result == 0 ? FFDEC_OK : FFDEC_WRITE_ERROR;
+}
+
 void* decoding_thread(void* arg)
 {
     ffdec_context *ffd_context = (ffdec_context*) arg;
@@ -148,12 +180,22 @@ void ffdec_context::decoding_thread()
 
     AVFrame *frame = avcodec_alloc_frame();
 
+    ffbb_trace_name_thread("ffdec decode");
+
     while (running)
     {
+        int64_t read_at = ffbb_time_usec();
+
         if (read_callback) packet.size = read_callback(this, decode_buffer, decode_buffer_length, read_callback_arg);
 
         if (packet.size <= 0) break;
 
+        int64_t read_done_at = ffbb_time_usec();
+        recorder->record_stage(STAGE_READ, read_done_at - read_at);
+        if (ffbb_tracing()) ffbb_trace_span("read", read_at, read_done_at, -1);
+        recorder->add_frames_in();
+        recorder->add_bytes(packet.size);
+
         packet.data = decode_buffer;
 
         while (running && packet.size > 0)
@@ -162,25 +204,21 @@ void ffdec_context::decoding_thread()
             av_init_packet(&packet);
 
             got_frame = 0;
+            int64_t decode_at = ffbb_time_usec();
             int decode_result = avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
+            int64_t decoded_at = ffbb_time_usec();
+            recorder->record_stage(STAGE_DECODE, decoded_at - decode_at);
+            if (ffbb_tracing()) ffbb_trace_span("decode", decode_at, decoded_at, -1);
 
             if (decode_result < 0)
             {
                 fprintf(stderr, "Error while decoding video\n");
+                recorder->add_frames_dropped();
                 running = false;
                 break;
             }
 
-            if (got_frame)
-            {
-                frame_index++;
-
-                if (frame_callback) frame_callback(this, frame, frame_index, frame_callback_arg);
-
-#if !OSX_PLATFORM
-                display_frame(frame);
-#endif
-            }
+            if (got_frame) output_frame(frame);
 
             packet.size -= decode_result;
             packet.data += decode_result;
@@ -197,16 +235,7 @@ void ffdec_context::decoding_thread()
         got_frame = 0;
         avcodec_decode_video2(codec_context, frame, &got_frame, &packet);
 
-        if (got_frame)
-        {
-            frame_index++;
-
-            if (frame_callback) frame_callback(this, frame, frame_index, frame_callback_arg);
-
-#if !OSX_PLATFORM
-            display_frame(frame);
-#endif
-        }
+        if (got_frame) output_frame(frame);
     }
 
     av_free(frame);
@@ -215,7 +244,25 @@ void ffdec_context::decoding_thread()
     if (close_callback) close_callback(this, close_callback_arg);
 }
 
-#if !OSX_PLATFORM
+void ffdec_context::output_frame(AVFrame *frame)
+{
+    int64_t started_at = ffbb_time_usec();
+
+    frame_index++;
+    recorder->add_frames_out();
+
+    if (frame_callback) frame_callback(this, frame, frame_index, frame_callback_arg);
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
+    display_frame(frame);
+#endif
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_DISPLAY, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("display", started_at, finished_at, frame_index);
+}
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
 ffdec_error ffdec_context::create_view(QString group, QString id, screen_window_t *window)
 {
     if (this->view)
@@ -14,38 +14,159 @@
  */
 
 #include "ffbbenc.h"
+#include "ffbbconv.h"
+#include "ffbbpool.h"
+#include "ffbbring.h"
+#include "ffbbx264.h"
+#include "ffbbpacket.h"
+#include "ffbbwriter.h"
+#include "ffbbtime.h"
+#include "ffbbnal.h"
+#include "ffbbadapt.h"
+#include "ffbbconvpool.h"
+#include "ffbbscene.h"
+#include "ffbbrecorder.h"
+#include "ffbbtracer.h"
+#include "ffbbbands.h"
+#include "ffbbexecutor.h"
+
+extern "C"
+{
+#include <libavutil/opt.h>
+}
 
 #include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
 #include <sys/stat.h>
 
+#define FRAME_QUEUE_CAPACITY 32
+#define KEYFRAME_REQUEST_INTERVAL 500000
+
+// smaller RGB frames convert faster than the band threads wake up
+#define RGB_BAND_MIN_PIXELS (2560 * 1440)
+
+// indexes into the latency histograms of get_stats
+#define STAGE_INGEST 0
+#define STAGE_QUEUE 1
+#define STAGE_ENCODE 2
+#define STAGE_WRITE 3
+#define STAGE_TOTAL 4
+
+static const char *stage_names[] = { "ingest", "queue", "encode", "write", "total" };
+
 void* encoding_thread(void* arg);
 
 ffenc_context::ffenc_context()
 {
     codec_context = 0;
+    frame_pool = new ffenc_frame_pool();
+    conversion_threads = 0;
+    converter = 0;
+    executor = 0;
+    executor_scheduled = 0;
+    executor_next = 0;
+    rgb_matrix = FFENC_MATRIX_BT601;
+    rgb_full_range = false;
+    rgb_threads = 1;
+    rgb_bands = 0;
+    oriented = false;
+    memset(&orientation, 0, sizeof(ffenc_orientation));
+    scale_filter = FFENC_SCALE_NONE;
+    scale_width = 0;
+    scale_height = 0;
+    pyramid_count = 0;
+    pyramid_filter = FFENC_SCALE_BOX;
+    current_layers = 0;
+    scene_detection = false;
+    scene_detector = 0;
+    change_score = -1;
+    packet_pool = new ffenc_packet_pool();
+    writer = 0;
+    low_latency = false;
+    inspect_nals = false;
+    sps = 0;
+    pps = 0;
+    parameter_sets = 0;
+    output_bytes = 0;
+    recorder = new ffbb_recorder(5, stage_names);
+    adaptive = false;
+    adapter = 0;
+
+#if X264_SUPPORT
+    x264 = 0;
+#endif
+    frames = new ffbb_ring<ffenc_frame*>(FRAME_QUEUE_CAPACITY);
+    reader_waiting = 0;
+    writers_waiting = 0;
+    producers = 0;
+    queue_closed = 0;
+    held_head = 0;
+    held_tail = 0;
+
+    queue_policy = FFENC_QUEUE_DROP_NEWEST;
+    memset(&queue_stats, 0, sizeof(ffenc_queue_stats));
+
+    keyframe_requested = 0;
+    keyframe_requested_at = 0;
+    keyframe_request_interval = KEYFRAME_REQUEST_INTERVAL;
+
+    admit_interval = 0;
+    admit_next = 0;
 
     pthread_mutex_init(&reading_mutex, 0);
     pthread_cond_init(&read_cond, 0);
+    pthread_cond_init(&write_cond, 0);
+    pthread_mutex_init(&parameter_sets_mutex, 0);
 
     reset();
 }
 
 ffenc_context::~ffenc_context()
 {
+    // converted frames go back to frame_pool
+    if (converter) delete converter;
+    if (rgb_bands) delete rgb_bands;
+
+    free_frames();
+
+    delete frames;
+    delete frame_pool;
+
+    // the converting threads signal these until they are joined above
     pthread_mutex_destroy(&reading_mutex);
     pthread_cond_destroy(&read_cond);
+    pthread_cond_destroy(&write_cond);
 
-    free_frames();
+    if (writer) delete writer;
+    if (adapter) delete adapter;
+    if (scene_detector) delete scene_detector;
+    delete recorder;
+
+    if (sps) sps->release();
+    if (pps) pps->release();
+    if (parameter_sets) parameter_sets->release();
+    pthread_mutex_destroy(&parameter_sets_mutex);
+
+    // packets still held by the application keep the pool alive
+    packet_pool->destroy();
+
+#if X264_SUPPORT
+    if (x264) delete x264;
+#endif
 }
 
 void ffenc_context::free_frames()
 {
-    while (frames.size())
+    ffenc_frame *entry;
+    while (frames->pop(&entry))
+    {
+        frame_pool->release(entry);
+    }
+
+    while (take_held(&entry))
     {
-        AVFrame *frame = frames.front();
-        frames.pop_front();
-        free(frame->data[0]);
-        av_free(frame);
+        frame_pool->release(entry);
     }
 }
 
@@ -56,14 +177,34 @@ void ffenc_context::reset()
     running = false;
     frame_index = 0;
 
+    memset(&latency_stats, 0, sizeof(ffenc_latency_stats));
+    first_output_at = 0;
+
     frame_callback = 0;
     frame_callback_arg = 0;
 
     write_callback = 0;
     write_callback_arg = 0;
 
+    packet_callback = 0;
+    packet_callback_arg = 0;
+
+    writev_callback = 0;
+    writev_callback_arg = 0;
+
     close_callback = 0;
     close_callback_arg = 0;
+
+    adapt_callback = 0;
+    adapt_callback_arg = 0;
+
+    admit_callback = 0;
+    admit_callback_arg = 0;
+
+#if X264_SUPPORT
+    nal_callback = 0;
+    nal_callback_arg = 0;
+#endif
 }
 
 ffenc_error ffenc_context::set_frame_callback(
@@ -93,254 +234,1802 @@ ffenc_error ffenc_context::set_close_callback(
     return FFENC_OK;
 }
 
-ffenc_error ffenc_context::close()
+ffenc_error ffenc_context::set_packet_callback(
+        void (*packet_callback)(ffenc_context *ffe_context, ffenc_packet *packet, void *arg),
+        void *arg)
 {
-    stop();
+    this->packet_callback = packet_callback;
+    packet_callback_arg = arg;
+    return FFENC_OK;
+}
 
-    if (codec_context)
+ffenc_error ffenc_context::set_writev_callback(
+        void (*writev_callback)(ffenc_context *ffe_context, const struct iovec *iov, int iovcnt, void *arg),
+        void *arg)
+{
+    this->writev_callback = writev_callback;
+    writev_callback_arg = arg;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::set_writer_thread(int capacity, ffenc_writer_policy policy)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+
+    if (writer)
     {
-        if (avcodec_is_open(codec_context))
-        {
-            avcodec_close(codec_context);
-        }
+        delete writer;
+        writer = 0;
+    }
 
-        av_free(codec_context);
-        codec_context = 0;
+    if (capacity > 0)
+    {
+        writer = new ffenc_writer(capacity, policy, &ffenc_context::deliver_packets, this);
+        writer->set_drop_callback(&ffenc_context::writer_dropping, this);
     }
 
     return FFENC_OK;
 }
 
-ffenc_error ffenc_context::start()
+ffenc_error ffenc_context::get_writer_stats(ffenc_writer_stats *stats)
 {
-    if (running) return FFENC_ALREADY_RUNNING;
-    if (!codec_context) return FFENC_NO_CODEC_SPECIFIED;
+    if (!writer)
+    {
+        memset(stats, 0, sizeof(ffenc_writer_stats));
+        return FFENC_OK;
+    }
 
-    running = true;
+    writer->get_stats(stats);
+    return FFENC_OK;
+}
 
-    free_frames();
+ffenc_error ffenc_context::get_parameter_sets(ffenc_packet **packet)
+{
+    pthread_mutex_lock(&parameter_sets_mutex);
 
-    pthread_t pthread;
-    pthread_create(&pthread, 0, &::encoding_thread, this);
+    if (!parameter_sets && sps && pps)
+    {
+        ffenc_packet *out = packet_pool->acquire(sps->size + pps->size + 8);
 
+        if (out)
+        {
+            static const uint8_t start_code[] = { 0, 0, 0, 1 };
+
+            uint8_t *dst = out->data;
+            memcpy(dst, start_code, 4);
+            memcpy(dst + 4, sps->data, sps->size);
+            dst += 4 + sps->size;
+            memcpy(dst, start_code, 4);
+            memcpy(dst + 4, pps->data, pps->size);
+
+            out->size = sps->size + pps->size + 8;
+            out->nal_count = ffbb_split_nals(out->data, out->size, out->nals, FFENC_PACKET_MAX_NALS);
+            parameter_sets = out;
+        }
+    }
+
+    *packet = parameter_sets;
+    if (parameter_sets) parameter_sets->retain();
+
+    pthread_mutex_unlock(&parameter_sets_mutex);
+
+    return *packet ? FFENC_OK : FFENC_NO_PARAMETER_SETS;
+}
+
+ffenc_error ffenc_context::set_low_latency(bool low_latency)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    this->low_latency = low_latency;
     return FFENC_OK;
 }
 
-ffenc_error ffenc_context::stop()
+ffenc_error ffenc_context::set_adaptive(const ffenc_adapt_config *config)
 {
-    if (!running) return FFENC_ALREADY_STOPPED;
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (config && !ffenc_adapt_config_valid(config)) return FFENC_FRAME_NOT_SUPPORTED;
 
-    running = false;
+    adaptive = config != 0;
+    if (config) adapt_config = *config;
 
-    pthread_cond_signal(&read_cond);
+    return FFENC_OK;
+}
 
+ffenc_error ffenc_context::set_adapt_callback(
+        void (*adapt_callback)(ffenc_context *ffe_context, const ffenc_adapt_decision *decision, void *arg),
+        void *arg)
+{
+    this->adapt_callback = adapt_callback;
+    adapt_callback_arg = arg;
     return FFENC_OK;
 }
 
-void* encoding_thread(void* arg)
+ffenc_error ffenc_context::get_latency_stats(ffenc_latency_stats *stats)
 {
-    ffenc_context* ffe_context = (ffenc_context*) arg;
-    ffe_context->encoding_thread();
-    return 0;
+    __sync_synchronize();
+    *stats = latency_stats;
+    return FFENC_OK;
 }
 
-void ffenc_context::encoding_thread()
+ffenc_error ffenc_context::get_stats(ffbb_stats *stats, bool reset)
 {
-    int encode_buffer_len = 10000000;
-    uint8_t *encode_buffer = (uint8_t *) av_malloc(encode_buffer_len);
+    recorder->snapshot(stats, reset);
+    return FFENC_OK;
+}
 
-    AVPacket packet;
-    int got_packet;
+ffenc_error ffenc_context::write_stats(int fd, bool reset)
+{
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    if (!stats) return FFENC_WRITE_ERROR;
+
+    recorder->snapshot(stats, reset);
+    int result = ffbb_stats_write(stats, "ffenc", fd);
+    free(stats);
+
+    return result == 0 ? FFENC_OK : FFENC_WRITE_ERROR;
+}
 
-    while (running || !frames.empty())
+#if X264_SUPPORT
+ffenc_error ffenc_context::set_x264_params(x264_param_t *param)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+
+    if (x264)
     {
-        if (frames.empty())
-        {
-            pthread_mutex_lock(&reading_mutex);
-            pthread_cond_wait(&read_cond, &reading_mutex);
-            pthread_mutex_unlock(&reading_mutex);
-            continue;
-        }
+        delete x264;
+        x264 = 0;
+    }
 
-        AVFrame *frame = frames.front();
-        frames.pop_front();
+    if (param) x264 = new ffenc_x264(param);
 
-        int frame_index = frame_index + 1;
+    return FFENC_OK;
+}
 
-        bool encode_frame = true;
+ffenc_error ffenc_context::reconfig_x264(x264_param_t *param)
+{
+    if (!x264) return FFENC_NO_CODEC_SPECIFIED;
+    x264->reconfig(param);
+    return FFENC_OK;
+}
 
-        if (frame_callback) encode_frame = frame_callback(this, frame, frame_index, frame_callback_arg);
+ffenc_error ffenc_context::set_nal_callback(
+        void (*nal_callback)(ffenc_context *ffe_context, x264_nal_t *nals, int nal_count, void *arg),
+        void *arg)
+{
+    this->nal_callback = nal_callback;
+    nal_callback_arg = arg;
+    return FFENC_OK;
+}
+#endif
 
-        if (encode_frame)
-        {
-            this->frame_index = frame_index;
+ffenc_error ffenc_context::set_admit_callback(
+        bool (*admit_callback)(ffenc_context *ffe_context, int64_t timestamp, void *arg),
+        void *arg)
+{
+    this->admit_callback = admit_callback;
+    admit_callback_arg = arg;
+    return FFENC_OK;
+}
 
-            // reset the AVPacket
-            av_init_packet(&packet);
-            packet.data = encode_buffer;
-            packet.size = encode_buffer_len;
+ffenc_error ffenc_context::set_target_fps(double fps)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    admit_interval = fps > 0 ? (int64_t) (1000000 / fps) : 0;
+    admit_next = 0;
+    return FFENC_OK;
+}
 
-            got_packet = 0;
-            int encode_result = avcodec_encode_video2(codec_context, &packet, frame, &got_packet);
+ffenc_error ffenc_context::set_conversion_threads(int threads)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    conversion_threads = threads;
+    return FFENC_OK;
+}
 
-            if (encode_result == 0 && got_packet > 0)
-            {
-                if (write_callback) write_callback(this, packet.data, packet.size, write_callback_arg);
-            }
-        }
+ffenc_error ffenc_context::set_executor(ffenc_executor *executor)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    this->executor = executor;
+    return FFENC_OK;
+}
 
-        free(frame->data[0]);
-        av_free(frame);
-        frame = 0;
-    }
+ffenc_error ffenc_context::set_rgb_conversion(ffenc_color_matrix matrix, bool full_range, int threads)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    rgb_matrix = matrix;
+    rgb_full_range = full_range;
+    rgb_threads = threads > 1 ? threads : 1;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::set_orientation(const ffenc_orientation *orientation)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
 
-    do
+    if (!orientation)
     {
-        // reset the AVPacket
-        av_init_packet(&packet);
-        packet.data = encode_buffer;
-        packet.size = encode_buffer_len;
+        oriented = false;
+        return FFENC_OK;
+    }
 
-        got_packet = 0;
-        int encode_result = avcodec_encode_video2(codec_context, &packet, 0, &got_packet);
+    int rotation = orientation->rotation;
+    if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270) return FFENC_FRAME_NOT_SUPPORTED;
 
-        if (encode_result == 0 && got_packet > 0)
-        {
-            if (write_callback) write_callback(this, packet.data, packet.size, write_callback_arg);
-        }
-    }
-    while (got_packet > 0);
+    if (orientation->crop_x < 0 || orientation->crop_y < 0 || orientation->crop_width < 0
+            || orientation->crop_height < 0) return FFENC_FRAME_NOT_SUPPORTED;
 
-    av_free(encode_buffer);
-    encode_buffer = 0;
-    encode_buffer_len = 0;
+    if ((orientation->crop_x | orientation->crop_y | orientation->crop_width | orientation->crop_height) & 1)
+        return FFENC_FRAME_NOT_SUPPORTED;
 
-    if (close_callback) close_callback(this, close_callback_arg);
+    oriented = true;
+    this->orientation = *orientation;
+    return FFENC_OK;
 }
 
-ffenc_error ffenc_context::add_frame(AVFrame *frame)
+ffenc_error ffenc_context::set_scaling(ffenc_scale_filter filter)
 {
-    if (!running) return FFENC_NOT_RUNNING;
-    frames.push_back(frame);
-    pthread_cond_signal(&read_cond);
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (filter < FFENC_SCALE_NONE || filter > FFENC_SCALE_BILINEAR) return FFENC_FRAME_NOT_SUPPORTED;
+    scale_filter = filter;
     return FFENC_OK;
 }
 
-#if !OSX_PLATFORM
-ffenc_error ffenc_context::add_frame(camera_buffer_t* buf)
+ffenc_error ffenc_context::set_pyramid(const ffenc_size *sizes, int count, ffenc_scale_filter filter)
 {
-    if (buf->frametype != CAMERA_FRAMETYPE_NV12) return FFENC_FRAME_NOT_SUPPORTED;
+    if (running) return FFENC_ALREADY_RUNNING;
 
-    if (!running) return FFENC_NOT_RUNNING;
+    if (count < 0 || count > FFENC_MAX_LAYERS) return FFENC_FRAME_NOT_SUPPORTED;
+    if (count && (filter <= FFENC_SCALE_NONE || filter > FFENC_SCALE_BILINEAR)) return FFENC_FRAME_NOT_SUPPORTED;
 
-    int64_t uv_offset = buf->framedesc.nv12.uv_offset;
-    uint32_t height = buf->framedesc.nv12.height;
-    uint32_t width = buf->framedesc.nv12.width;
-    uint32_t stride = buf->framedesc.nv12.stride;
+    for (int i = 0; i < count; i++)
+    {
+        int width = sizes[i].width;
+        int height = sizes[i].height;
+        if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) return FFENC_FRAME_NOT_SUPPORTED;
+        if (i > 0 && (width > sizes[i - 1].width || height > sizes[i - 1].height)) return FFENC_FRAME_NOT_SUPPORTED;
+    }
 
-    uint32_t _stride = width;
-    int64_t _uv_offset = _stride * height;
+    for (int i = 0; i < count; i++)
+        pyramid_sizes[i] = sizes[i];
+    pyramid_count = count;
+    pyramid_filter = filter;
 
-    AVFrame *frame = avcodec_alloc_frame();
+    return FFENC_OK;
+}
 
-    frame->linesize[0] = _stride;
-    frame->linesize[1] = _stride / 2;
-    frame->linesize[2] = _stride / 2;
+int ffenc_context::get_pyramid(AVFrame **layers)
+{
+    if (!current_layers) return 0;
 
-    frame->data[0] = (uint8_t*) malloc(width * height * 3 / 2);
-    frame->data[1] = &frame->data[0][_uv_offset];
-    frame->data[2] = &frame->data[0][_uv_offset + ((width * height) / 4)];
+    for (int i = 0; i < current_layers->count; i++)
+        layers[i] = current_layers->frames[i];
 
-    for (uint32_t i = 0; i < height; i++)
-    {
-        int64_t doff = i * _stride;
-        int64_t soff = i * stride;
-        memcpy(&frame->data[0][doff], &buf->framebuf[soff], width);
-    }
+    return current_layers->count;
+}
 
-    uint8_t *srcuv = &buf->framebuf[uv_offset];
-    uint8_t *destu = frame->data[1];
-    uint8_t *destv = frame->data[2];
+ffenc_error ffenc_context::set_scene_detection(const ffenc_scene_config *config)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
 
-    for (uint32_t i = 0; i < height / 2; i++)
+    if (config)
     {
-        uint8_t* curuv = srcuv;
-        for (uint32_t j = 0; j < width / 2; j++)
-        {
-            *destu++ = *curuv++;
-            *destv++ = *curuv++;
-        }
-        srcuv += stride;
+        if (config->block_threshold < 0 || config->block_threshold > 255) return FFENC_FRAME_NOT_SUPPORTED;
+        if (config->min_changed_blocks < 1 || config->max_static_frames < 0) return FFENC_FRAME_NOT_SUPPORTED;
+        if (config->action != FFENC_STATIC_SKIP && config->action != FFENC_STATIC_DUPLICATE) return FFENC_FRAME_NOT_SUPPORTED;
     }
 
-    frames.push_back(frame);
+    scene_detection = config != 0;
+    if (config) scene_config = *config;
 
-    pthread_cond_signal(&read_cond);
+    return FFENC_OK;
+}
+
+float ffenc_context::get_change_score()
+{
+    return change_score;
+}
 
+ffenc_error ffenc_context::set_frame_pool_limit(int max_in_flight)
+{
+    frame_pool->set_limit(max_in_flight);
     return FFENC_OK;
 }
-#elif OSX_PLATFORM
-ffenc_error ffenc_context::add_frame(CVImageBufferRef pixelBuffer)
+
+ffenc_error ffenc_context::get_frame_pool_stats(ffenc_pool_stats *stats)
 {
-    OSType formatType = CVPixelBufferGetPixelFormatType(pixelBuffer);
-    if (formatType != kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange)
+    frame_pool->get_stats(stats);
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::set_frame_queue(int capacity, ffenc_queue_policy policy)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (capacity <= 0) return FFENC_FRAME_NOT_SUPPORTED;
+
+    free_frames();
+
+    delete frames;
+    frames = new ffbb_ring<ffenc_frame*>(capacity);
+    queue_policy = policy;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::get_frame_queue_stats(ffenc_queue_stats *stats)
+{
+    __sync_synchronize();
+    *stats = queue_stats;
+    stats->capacity = frames->capacity();
+    stats->policy = queue_policy;
+    stats->depth = frames->size();
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::request_keyframe()
+{
+    if (!running) return FFENC_NOT_RUNNING;
+
+    int64_t now = ffbb_time_usec();
+    int64_t last = keyframe_requested_at;
+
+    // only one of several racing callers gets to move the timestamp
+    if ((last && now - last < keyframe_request_interval)
+            || !__sync_bool_compare_and_swap(&keyframe_requested_at, last, now))
     {
-        return FFENC_FRAME_NOT_SUPPORTED;
+        __sync_fetch_and_add(&queue_stats.limited_keyframe_requests, 1);
+        return FFENC_OK;
     }
 
-    if (!running) return FFENC_NOT_RUNNING;
+    keyframe_requested = 1;
+    __sync_synchronize();
 
-    CVPixelBufferLockBaseAddress(pixelBuffer, 0);
+    return FFENC_OK;
+}
 
-    int height = CVPixelBufferGetHeight(pixelBuffer);
-    int width = CVPixelBufferGetWidth(pixelBuffer);
+ffenc_error ffenc_context::set_keyframe_request_interval(int64_t usec)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    keyframe_request_interval = usec;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_context::close()
+{
+    stop();
+
+    if (codec_context)
+    {
+        if (avcodec_is_open(codec_context))
+        {
+            avcodec_close(codec_context);
+        }
 
-    uint32_t stride = CVPixelBufferGetWidthOfPlane(pixelBuffer, 0);
-    uint32_t uv_stride = CVPixelBufferGetWidthOfPlane(pixelBuffer, 0);
+        av_free(codec_context);
+        codec_context = 0;
+    }
 
-    uint32_t _stride = width;
-    int64_t _uv_offset = _stride * height;
+    return FFENC_OK;
+}
 
-    AVFrame *frame = avcodec_alloc_frame();
+ffenc_error ffenc_context::get_frame_size(ffenc_size *size)
+{
+#if X264_SUPPORT
+    if (x264)
+    {
+        size->width = x264->param.i_width;
+        size->height = x264->param.i_height;
+        return FFENC_OK;
+    }
+#endif
 
-    frame->linesize[0] = _stride;
-    frame->linesize[1] = _stride / 2;
-    frame->linesize[2] = _stride / 2;
+    if (!codec_context) return FFENC_NO_CODEC_SPECIFIED;
 
-    frame->data[0] = (uint8_t*)malloc(width * height * 3 / 2);
-    frame->data[1] = &frame->data[0][_uv_offset];
-    frame->data[2] = &frame->data[0][_uv_offset + ((width * height) / 4)];
+    size->width = codec_context->width;
+    size->height = codec_context->height;
+    return FFENC_OK;
+}
 
-    uint8_t *srcy = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 0);
+ffenc_error ffenc_context::start()
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (executor && !executor->is_running()) return FFENC_NOT_RUNNING;
 
-    for (uint32_t i = 0; i < height; i++)
+    if (adapter)
     {
-        int64_t doff = i * _stride;
-        int64_t soff = i * stride;
-        memcpy(&frame->data[0][doff], &srcy[soff], width);
+        delete adapter;
+        adapter = 0;
     }
 
-    uint8_t *srcuv = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 1);
-    uint8_t *destu = frame->data[1];
-    uint8_t *destv = frame->data[2];
+    if (converter)
+    {
+        delete converter;
+        converter = 0;
+    }
+
+    if (scene_detector)
+    {
+        delete scene_detector;
+        scene_detector = 0;
+    }
 
-    for (uint32_t i = 0; i < height / 2; i++)
+    if (rgb_bands)
     {
-        uint8_t* curuv = srcuv;
-        for (uint32_t j = 0; j < width / 2; j++)
+        delete rgb_bands;
+        rgb_bands = 0;
+    }
+
+    if (rgb_threads > 1)
+    {
+        rgb_bands = new ffbb_band_pool(rgb_threads);
+        if (!rgb_bands->start())
         {
-            *destu++ = *curuv++;
-            *destv++ = *curuv++;
+            delete rgb_bands;
+            rgb_bands = 0;
         }
-        srcuv += uv_stride;
     }
 
-    CVPixelBufferUnlockBaseAddress(pixelBuffer, 0);
+    if (scene_detection)
+    {
+        // only libx264 can be made to code a frame as skipped blocks,
+        // other encoders would spend a whole frame on a duplicate
+        ffenc_scene_config config = scene_config;
+#if X264_SUPPORT
+        if (!x264) config.action = FFENC_STATIC_SKIP;
+#else
+        config.action = FFENC_STATIC_SKIP;
+#endif
+        scene_detector = new ffenc_scene_detector(&config);
+    }
+    change_score = -1;
 
-    frames.push_back(frame);
+    frame_pool->configure_layers(pyramid_sizes, pyramid_count, pyramid_filter == FFENC_SCALE_BOX);
 
-    pthread_cond_signal(&read_cond);
+#if X264_SUPPORT
+    if (x264)
+    {
+        if (adaptive)
+        {
+            // a tuned config counts as the preset it is closest to, but
+            // is encoded as given until the first decision
+            int preset = FFENC_PRESET_MEDIUM;
+            int closest = ffenc_x264::preset_distance(&x264->param, ffenc_preset_name(preset));
+            for (int i = FFENC_PRESET_ULTRAFAST; i <= FFENC_PRESET_VERYSLOW; i++)
+            {
+                int distance = ffenc_x264::preset_distance(&x264->param, ffenc_preset_name(i));
+                if (distance < closest)
+                {
+                    preset = i;
+                    closest = distance;
+                }
+            }
+
+            adapter = new ffenc_adapter(&adapt_config, x264->param.rc.i_bitrate * 1000, preset);
+        }
+
+        x264->set_static_frames(scene_detection && scene_config.action == FFENC_STATIC_DUPLICATE);
+        x264->set_low_latency(low_latency, packet_pool, &ffenc_context::write_packet, this);
+        if (!x264->open()) return FFENC_ENCODER_ERROR;
+        scale_width = x264->param.i_width;
+        scale_height = x264->param.i_height;
+        frame_pool->configure(oriented || scale_filter ? PIX_FMT_YUV420P : PIX_FMT_NV12, scale_width, scale_height);
+    }
+    else
+#endif
+    {
+        if (!codec_context) return FFENC_NO_CODEC_SPECIFIED;
+
+        if (adaptive)
+        {
+            // each decision reopens the codec, which costs a keyframe, so
+            // they are spaced further apart than with libx264
+            ffenc_adapt_config config = adapt_config;
+            if (config.interval < ADAPT_REOPEN_INTERVAL) config.interval = ADAPT_REOPEN_INTERVAL;
+
+            adapter = new ffenc_adapter(&config, codec_context->bit_rate, codec_preset());
+        }
+
+        if (low_latency || adapter)
+        {
+            ffenc_error result = reopen_codec();
+            if (result != FFENC_OK) return result;
+        }
+
+        scale_width = codec_context->width;
+        scale_height = codec_context->height;
+        frame_pool->configure(PIX_FMT_YUV420P, scale_width, scale_height);
+
+        if (conversion_threads > 0)
+        {
+            // the raw frames are copied before they are rotated
+            bool transpose = oriented && (orientation.rotation == 90 || orientation.rotation == 270);
+            converter = new ffenc_convert_pool(conversion_threads, frames->capacity(),
+                    transpose ? codec_context->height : codec_context->width,
+                    transpose ? codec_context->width : codec_context->height, frame_pool,
+                    &ffenc_context::queue_converted, this);
+            if (oriented) converter->set_orientation(orientation.rotation, orientation.mirror);
+            if (scale_filter) converter->set_scaling(scale_width, scale_height, scale_filter == FFENC_SCALE_BOX);
+        }
+    }
+
+#if X264_SUPPORT
+    inspect_nals = x264 || codec_context->codec_id == CODEC_ID_H264;
+#else
+    inspect_nals = codec_context->codec_id == CODEC_ID_H264;
+#endif
+
+    pthread_mutex_lock(&parameter_sets_mutex);
+    if (sps) sps->release();
+    if (pps) pps->release();
+    if (parameter_sets) parameter_sets->release();
+    sps = 0;
+    pps = 0;
+    parameter_sets = 0;
+    pthread_mutex_unlock(&parameter_sets_mutex);
+
+    // with global headers the parameter sets are only in the extradata
+    if (inspect_nals && codec_context && codec_context->extradata_size > 0)
+    {
+        ffenc_nal nals[FFENC_PACKET_MAX_NALS];
+        int count = ffbb_split_nals(codec_context->extradata, codec_context->extradata_size,
+                nals, FFENC_PACKET_MAX_NALS);
+
+        for (int i = 0; i < count; i++)
+        {
+            const uint8_t *nal = codec_context->extradata + nals[i].offset;
+            if (nals[i].type == NAL_TYPE_SPS) cache_parameter_set(nal, nals[i].size, &sps);
+            else if (nals[i].type == NAL_TYPE_PPS) cache_parameter_set(nal, nals[i].size, &pps);
+        }
+    }
+
+    queue_closed = 0;
+    running = true;
+
+    free_frames();
+    memset(&latency_stats, 0, sizeof(ffenc_latency_stats));
+    output_bytes = 0;
+    recorder->reset();
+    admit_next = 0;
+    keyframe_requested = 0;
+    keyframe_requested_at = 0;
+
+    if (converter && !converter->start())
+    {
+        running = false;
+        return FFENC_ENCODER_ERROR;
+    }
+
+    if (executor)
+    {
+        begin_encoding();
+        executor_scheduled = 0;
+        return FFENC_OK;
+    }
+
+    pthread_t pthread;
+    pthread_create(&pthread, 0, &::encoding_thread, this);
+
+    return FFENC_OK;
+}
+
+int ffenc_context::codec_preset()
+{
+    // libx264 keeps the preset it was opened with as a private option
+    int preset = -1;
+    uint8_t *name = 0;
+
+    if (codec_context->priv_data && av_opt_get(codec_context->priv_data, "preset", 0, &name) >= 0 && name)
+    {
+        preset = ffenc_preset_from_name((const char*) name);
+    }
+
+    av_free(name);
+
+    return preset < 0 ? FFENC_PRESET_MEDIUM : preset;
+}
+
+ffenc_error ffenc_context::reopen_codec()
+{
+    // avcodec_close forgets the codec
+    AVCodec *codec = (AVCodec*) codec_context->codec;
+    if (!codec) codec = avcodec_find_encoder(codec_context->codec_id);
+    if (!codec) return FFENC_NO_CODEC_SPECIFIED;
+
+    if (avcodec_is_open(codec_context)) avcodec_close(codec_context);
+
+    // private options of libx264, other encoders leave them in the dictionary
+    AVDictionary *options = 0;
+
+    if (low_latency)
+    {
+        codec_context->max_b_frames = 0;
+        codec_context->thread_type = FF_THREAD_SLICE;
+
+        av_dict_set(&options, "tune", "zerolatency", 0);
+        av_dict_set(&options, "x264opts", "intra-refresh=1:sliced-threads=1", 0);
+    }
+
+    if (adapter)
+    {
+        codec_context->bit_rate = adapter->bitrate;
+        av_dict_set(&options, "preset", ffenc_preset_name(adapter->preset), 0);
+    }
+
+    int result = avcodec_open2(codec_context, codec, &options);
+    av_dict_free(&options);
+
+    return result < 0 ? FFENC_ENCODER_ERROR : FFENC_OK;
+}
+
+ffenc_error ffenc_context::stop()
+{
+    if (!running) return FFENC_ALREADY_STOPPED;
+
+    running = false;
+
+    // always take the lock so a reader that is about to wait sees the change
+    __sync_synchronize();
+    pthread_mutex_lock(&reading_mutex);
+    pthread_cond_signal(&read_cond);
+    pthread_cond_broadcast(&write_cond);
+    pthread_mutex_unlock(&reading_mutex);
+
+    // the executor finishes the context on its next turn
+    if (executor) executor->schedule(this);
+
+    return FFENC_OK;
+}
+
+void* encoding_thread(void* arg)
+{
+    ffenc_context* ffe_context = (ffenc_context*) arg;
+    ffe_context->encoding_thread();
+    return 0;
+}
+
+void ffenc_context::wait_for_frame()
+{
+    pthread_mutex_lock(&reading_mutex);
+
+    // publish that we are about to sleep before looking at the queue one
+    // last time, a producer either sees the flag or we see its frame
+    reader_waiting = 1;
+    __sync_synchronize();
+
+    if (running && frames->empty())
+    {
+        pthread_cond_wait(&read_cond, &reading_mutex);
+    }
+
+    reader_waiting = 0;
+
+    pthread_mutex_unlock(&reading_mutex);
+}
+
+void ffenc_context::signal_frame()
+{
+    if (executor)
+    {
+        executor->schedule(this);
+        return;
+    }
+
+    __sync_synchronize();
+
+    if (reader_waiting)
+    {
+        pthread_mutex_lock(&reading_mutex);
+        pthread_cond_signal(&read_cond);
+        pthread_mutex_unlock(&reading_mutex);
+    }
+}
+
+void ffenc_context::wait_for_space()
+{
+    pthread_mutex_lock(&reading_mutex);
+
+    writers_waiting++;
+    __sync_synchronize();
+
+    if (running && frames->size() >= frames->capacity())
+    {
+        pthread_cond_wait(&write_cond, &reading_mutex);
+    }
+
+    writers_waiting--;
+
+    pthread_mutex_unlock(&reading_mutex);
+}
+
+void ffenc_context::signal_space()
+{
+    __sync_synchronize();
+
+    if (writers_waiting)
+    {
+        pthread_mutex_lock(&reading_mutex);
+        pthread_cond_broadcast(&write_cond);
+        pthread_mutex_unlock(&reading_mutex);
+    }
+}
+
+void ffenc_context::drop_frame(ffenc_frame *entry)
+{
+    frame_pool->release(entry);
+    signal_space();
+}
+
+static void record_latency(ffenc_latency *latency, int64_t usec)
+{
+    latency->last = usec;
+    latency->total += usec;
+    if (usec > latency->max) latency->max = usec;
+}
+
+ffenc_error ffenc_context::queue_frame(ffenc_frame *entry)
+{
+    // counted in before looking at the flag, close_queue waits for us to leave
+    __sync_fetch_and_add(&producers, 1);
+
+    ffenc_error result;
+
+    if (queue_closed)
+    {
+        recorder->add_frames_dropped();
+        result = FFENC_NOT_RUNNING;
+    }
+    else
+    {
+        result = push_frame(entry, false);
+    }
+
+    __sync_fetch_and_sub(&producers, 1);
+
+    return result;
+}
+
+ffenc_error ffenc_context::push_frame(ffenc_frame *entry, bool accepted)
+{
+    ffenc_frame *dropped;
+
+    // once one accepted frame is held the rest follow it, to stay in order
+    if (accepted && held_head)
+    {
+        hold_frame(entry);
+        return FFENC_OK;
+    }
+
+    // frames converted off the camera thread keep their ingest time
+    if (!entry->queued_at) entry->queued_at = ffbb_time_usec();
+
+    // the conversion threads make the pyramid of their frames themselves
+    if (pyramid_count && !entry->layers)
+    {
+        int64_t scaling_at = ffbb_tracing() ? ffbb_time_usec() : 0;
+        frame_pool->build_layers(entry);
+        if (scaling_at) ffbb_trace_span("pyramid", scaling_at, ffbb_time_usec(), -1);
+    }
+
+    while (!frames->push(entry))
+    {
+        switch (queue_policy)
+        {
+            case FFENC_QUEUE_BLOCK:
+                if (!running && accepted)
+                {
+                    // the encoding thread may be waiting in converter->finish for us
+                    hold_frame(entry);
+                    return FFENC_OK;
+                }
+                if (!running)
+                {
+                    recorder->add_frames_dropped();
+                    return FFENC_NOT_RUNNING;
+                }
+                __sync_fetch_and_add(&queue_stats.blocked, 1);
+                wait_for_space();
+                break;
+
+            case FFENC_QUEUE_DROP_NEWEST:
+                __sync_fetch_and_add(&queue_stats.dropped_newest, 1);
+                recorder->add_frames_dropped();
+                return FFENC_QUEUE_FULL;
+
+            case FFENC_QUEUE_DROP_OLDEST:
+                if (frames->pop(&dropped))
+                {
+                    __sync_fetch_and_add(&queue_stats.dropped_oldest, 1);
+                    recorder->add_frames_dropped();
+                    drop_frame(dropped);
+                }
+                break;
+
+            case FFENC_QUEUE_DROP_UNTIL_KEYFRAME:
+                while (frames->pop(&dropped))
+                {
+                    __sync_fetch_and_add(&queue_stats.dropped_until_keyframe, 1);
+                    recorder->add_frames_dropped();
+                    drop_frame(dropped);
+                }
+                // the encoder restarts from a clean picture after the gap
+                entry->frame->pict_type = AV_PICTURE_TYPE_I;
+                __sync_fetch_and_add(&queue_stats.forced_keyframes, 1);
+                break;
+        }
+    }
+
+    int depth = frames->size();
+    int max_depth = queue_stats.max_depth;
+    while (depth > max_depth)
+    {
+        int prev = __sync_val_compare_and_swap(&queue_stats.max_depth, max_depth, depth);
+        if (prev == max_depth) break;
+        max_depth = prev;
+    }
+
+    signal_frame();
 
     return FFENC_OK;
 }
+
+void ffenc_context::begin_encoding()
+{
+    if (writer) writer->start();
+}
+
+void ffenc_context::encoding_thread()
+{
+    ffbb_trace_name_thread("ffenc encode");
+
+    begin_encoding();
+
+    while (true)
+    {
+        ffenc_frame *entry;
+
+        if (!frames->pop(&entry))
+        {
+            if (!running)
+            {
+                // frames still converting are queued in order once the workers finish
+                if (converter && converter->is_running())
+                {
+                    converter->finish();
+                    continue;
+                }
+
+                if (take_held(&entry))
+                {
+                    encode_entry(entry);
+                    continue;
+                }
+
+                break;
+            }
+
+            wait_for_frame();
+            continue;
+        }
+
+        encode_entry(entry);
+    }
+
+    finish_encoding();
+}
+
+bool ffenc_context::run_turn()
+{
+    ffenc_frame *entry;
+
+    // one frame a turn so a busy context cannot hold a thread the others need
+    if (frames->pop(&entry))
+    {
+        encode_entry(entry);
+        return true;
+    }
+
+    if (!running)
+    {
+        if (converter && converter->is_running())
+        {
+            converter->finish();
+            return true;
+        }
+
+        if (take_held(&entry))
+        {
+            encode_entry(entry);
+            return true;
+        }
+
+        // stays scheduled so nothing queues it again once it is closed
+        finish_encoding();
+        return false;
+    }
+
+    // a full barrier, so the queue below is read after the flag drops
+    __sync_bool_compare_and_swap(&executor_scheduled, 1, 0);
+
+    // a frame or stop that came after the pop saw the flag still raised
+    if ((!frames->empty() || !running) && __sync_bool_compare_and_swap(&executor_scheduled, 0, 1)) return true;
+
+    return false;
+}
+
+void ffenc_context::encode_entry(ffenc_frame *entry)
+{
+    signal_space();
+
+    // sampled as each frame leaves, counting the frame itself
+    recorder->record_depth(frames->size() + 1);
+
+    AVFrame *frame = entry->frame;
+
+    int frame_index = this->frame_index + 1;
+
+    bool encode_frame = true;
+    bool unchanged = false;
+
+    if (scene_detector)
+    {
+        change_score = scene_detector->analyze(frame);
+        unchanged = scene_detector->is_static();
+    }
+
+    if (frame_callback)
+    {
+        current_layers = entry->layers;
+        encode_frame = frame_callback(this, frame, frame_index, frame_callback_arg);
+        current_layers = 0;
+    }
+
+    // a keyframe, forced or requested, is never worth skipping
+    if (unchanged && (frame->pict_type == AV_PICTURE_TYPE_I || keyframe_requested)) unchanged = false;
+
+    if (encode_frame && unchanged)
+    {
+        bool duplicate = scene_detector->action() == FFENC_STATIC_DUPLICATE;
+
+#if X264_SUPPORT
+        // only reached with libx264, start turns it into a skip otherwise
+        if (duplicate) duplicate = x264->encode_next_as_static();
+#endif
+
+        if (duplicate)
+        {
+            __sync_fetch_and_add(&queue_stats.static_duplicated, 1);
+        }
+        else
+        {
+            __sync_fetch_and_add(&queue_stats.static_skipped, 1);
+            encode_frame = false;
+        }
+    }
+
+    // later frames are compared with the last one encoded as changed
+    if (encode_frame && !unchanged && scene_detector) scene_detector->accept();
+
+    if (encode_frame)
+    {
+        this->frame_index = frame_index;
+
+        // a frame the callback skips does not use up the request
+        if (keyframe_requested && __sync_bool_compare_and_swap(&keyframe_requested, 1, 0))
+        {
+            frame->pict_type = AV_PICTURE_TYPE_I;
+            __sync_fetch_and_add(&queue_stats.requested_keyframes, 1);
+        }
+
+        int64_t started_at = ffbb_time_usec();
+        first_output_at = 0;
+
+        encode(frame);
+
+        int64_t finished_at = ffbb_time_usec();
+        int64_t output_at = first_output_at;
+
+        latency_stats.frames++;
+        record_latency(&latency_stats.queue, started_at - entry->queued_at);
+        record_latency(&latency_stats.encode, finished_at - started_at);
+
+        if (output_at)
+        {
+            record_latency(&latency_stats.first_output, output_at - started_at);
+            record_latency(&latency_stats.total, output_at - entry->queued_at);
+        }
+
+        if (ffbb_tracing())
+        {
+            ffbb_trace_async("queue", entry->queued_at, started_at, (intptr_t) entry);
+            ffbb_trace_span("encode", started_at, finished_at, frame_index);
+        }
+
+        recorder->add_frames_out();
+        recorder->record_stage(STAGE_QUEUE, started_at - entry->queued_at);
+        recorder->record_stage(STAGE_ENCODE, finished_at - started_at);
+        if (output_at) recorder->record_stage(STAGE_TOTAL, output_at - entry->queued_at);
+
+        if (adapter)
+        {
+            int64_t done_at = output_at ? output_at : finished_at;
+            adapt(done_at - entry->queued_at, finished_at - started_at);
+        }
+    }
+    else
+    {
+        recorder->add_frames_dropped();
+    }
+
+    frame_pool->release(entry);
+}
+
+void ffenc_context::close_queue()
+{
+    queue_closed = 1;
+    __sync_synchronize();
+
+    // a producer that got past the running check just before the last pop
+    // is still pushing, its frame is encoded rather than left in the ring
+    while (producers)
+        sched_yield();
+
+    ffenc_frame *entry;
+    while (frames->pop(&entry))
+    {
+        encode_entry(entry);
+    }
+}
+
+void ffenc_context::finish_encoding()
+{
+    close_queue();
+
+    // drain the frames still buffered inside the encoder
+    while (encode(0) > 0);
+
+#if X264_SUPPORT
+    if (x264) x264->close();
+#endif
+
+    // everything encoded has been written by the time close is called
+    if (writer) writer->finish();
+
+    if (close_callback) close_callback(this, close_callback_arg);
+}
+
+int ffenc_context::encode(AVFrame *frame)
+{
+#if X264_SUPPORT
+    if (x264)
+    {
+        x264_nal_t *nals;
+        int nal_count;
+        x264_picture_t pic_out;
+
+        int size = x264->encode(frame, &nals, &nal_count, &pic_out);
+        if (size < 0) return 0;
+
+        if (size > 0)
+        {
+            if (nal_callback) nal_callback(this, nals, nal_count, nal_callback_arg);
+
+            // the payloads of one call are contiguous in memory but belong
+            // to x264 until the next call, so this is the one copy we make
+            ffenc_packet *packet = packet_pool->acquire(size);
+
+            if (packet)
+            {
+                memcpy(packet->data, nals[0].p_payload, size);
+                packet->size = size;
+                packet->pts = pic_out.i_pts;
+                packet->dts = pic_out.i_dts;
+                if (pic_out.b_keyframe) packet->flags |= AV_PKT_FLAG_KEY;
+                write_packet(packet);
+            }
+        }
+
+        // while flushing keep going until x264 has nothing buffered
+        if (!frame) return x264->delayed_frames() > 0;
+        return size > 0;
+    }
+#endif
+
+    // a codec that failed to reopen has nothing to encode with
+    if (!avcodec_is_open(codec_context)) return 0;
+
+    // encode straight into a pooled packet with room for the worst case,
+    // the size class is the same every time so it is recycled, not allocated
+    int size = ffenc_max_packet_size(codec_context->width, codec_context->height);
+    ffenc_packet *out = packet_pool->acquire(size);
+    if (!out) return 0;
+
+    AVPacket packet;
+
+    // reset the AVPacket
+    av_init_packet(&packet);
+    packet.data = out->data;
+    packet.size = size;
+
+    int got_packet = 0;
+    int encode_result = avcodec_encode_video2(codec_context, &packet, frame, &got_packet);
+
+    if (encode_result == 0 && got_packet > 0)
+    {
+        out->size = packet.size;
+        out->pts = packet.pts;
+        out->dts = packet.dts;
+        out->flags = packet.flags;
+        write_packet(out);
+
+        return 1;
+    }
+
+    out->release();
+    return 0;
+}
+
+void ffenc_context::adapt(int64_t latency, int64_t encode_usec)
+{
+    ffenc_adapt_decision decision;
+
+    if (!adapter->update(ffbb_time_usec(), frames->size(), frames->capacity(),
+            latency, encode_usec, output_bytes, &decision))
+    {
+        return;
+    }
+
+#if X264_SUPPORT
+    if (x264)
+    {
+        x264_param_t param = x264->param;
+        ffenc_x264::apply_preset(&param, ffenc_preset_name(decision.preset));
+        ffenc_x264::apply_bitrate(&param, decision.bitrate);
+        x264->reconfig(&param);
+    }
+    else
+#endif
+    {
+        // the settings are fixed once the codec is open, so write out what
+        // it has buffered and open it again
+        while (encode(0) > 0);
+
+        if (reopen_codec() != FFENC_OK)
+        {
+            int used = strlen(decision.reason);
+            snprintf(decision.reason + used, sizeof(decision.reason) - used, ", reopen failed");
+
+            // nothing more can be encoded, the close callback follows
+            if (adapt_callback) adapt_callback(this, &decision, adapt_callback_arg);
+            stop();
+            return;
+        }
+    }
+
+    if (adapt_callback) adapt_callback(this, &decision, adapt_callback_arg);
+}
+
+void ffenc_context::write_packet(ffenc_packet *packet, void *arg)
+{
+    ffenc_context *ffe_context = (ffenc_context*) arg;
+    ffe_context->write_packet(packet);
+}
+
+void ffenc_context::inspect_packet(ffenc_packet *packet)
+{
+    packet->nal_count = ffbb_split_nals(packet->data, packet->size, packet->nals, FFENC_PACKET_MAX_NALS);
+
+    for (int i = 0; i < packet->nal_count; i++)
+    {
+        const uint8_t *nal = packet->data + packet->nals[i].offset;
+        int size = packet->nals[i].size;
+
+        switch (packet->nals[i].type)
+        {
+            case NAL_TYPE_SLICE_IDR:
+                packet->flags |= AV_PKT_FLAG_KEY;
+                // fall through
+            case NAL_TYPE_SLICE:
+                if (packet->frame_type == AV_PICTURE_TYPE_NONE)
+                {
+                    packet->frame_type = ffbb_slice_picture_type(nal, size);
+                }
+                break;
+
+            case NAL_TYPE_SPS:
+                cache_parameter_set(nal, size, &sps);
+                break;
+
+            case NAL_TYPE_PPS:
+                cache_parameter_set(nal, size, &pps);
+                break;
+        }
+    }
+}
+
+void ffenc_context::cache_parameter_set(const uint8_t *nal, int size, ffenc_packet **cached)
+{
+    pthread_mutex_lock(&parameter_sets_mutex);
+
+    // x264 repeats them in front of every keyframe, usually unchanged
+    if (!*cached || (*cached)->size != size || memcmp((*cached)->data, nal, size) != 0)
+    {
+        ffenc_packet *packet = packet_pool->acquire(size);
+
+        if (packet)
+        {
+            memcpy(packet->data, nal, size);
+            packet->size = size;
+
+            if (*cached) (*cached)->release();
+            *cached = packet;
+
+            if (parameter_sets) parameter_sets->release();
+            parameter_sets = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&parameter_sets_mutex);
+}
+
+void ffenc_context::write_packet(ffenc_packet *packet)
+{
+    // split once here instead of in every sink
+    if (inspect_nals) inspect_packet(packet);
+
+    __sync_fetch_and_add(&output_bytes, packet->size);
+    recorder->add_bytes(packet->size);
+
+    // slices may be written from the encoder's threads, the first one wins
+    if (!first_output_at) __sync_bool_compare_and_swap(&first_output_at, 0, ffbb_time_usec());
+
+    if (writer)
+    {
+        writer->push(packet);
+        return;
+    }
+
+    deliver_packets(&packet, 1);
+    packet->release();
+}
+
+void ffenc_context::writer_dropping(void *arg)
+{
+    // subject to the request interval like any other request
+    ffenc_context *ffe_context = (ffenc_context*) arg;
+    ffe_context->request_keyframe();
+}
+
+void ffenc_context::deliver_packets(ffenc_packet **packets, int count, void *arg)
+{
+    ffenc_context *ffe_context = (ffenc_context*) arg;
+    ffe_context->deliver_packets(packets, count);
+}
+
+void ffenc_context::deliver_packets(ffenc_packet **packets, int count)
+{
+    int64_t started_at = ffbb_time_usec();
+
+    // a batch goes out through writev or write, never both
+    bool vectored = writev_callback && writer;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (packet_callback) packet_callback(this, packets[i], packet_callback_arg);
+        if (write_callback && !vectored) write_callback(this, packets[i]->data, packets[i]->size, write_callback_arg);
+    }
+
+    if (vectored)
+    {
+        struct iovec iov[WRITER_MAX_BATCH];
+
+        for (int i = 0; i < count; i++)
+        {
+            iov[i].iov_base = packets[i]->data;
+            iov[i].iov_len = packets[i]->size;
+        }
+
+        writev_callback(this, iov, count, writev_callback_arg);
+    }
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_WRITE, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("write", started_at, finished_at, -1);
+}
+
+bool ffenc_context::admit_frame(int64_t timestamp)
+{
+    recorder->add_frames_in();
+
+    if (admit_callback && !admit_callback(this, timestamp, admit_callback_arg))
+    {
+        __sync_fetch_and_add(&queue_stats.skipped_by_callback, 1);
+        recorder->add_frames_dropped();
+        return false;
+    }
+
+    int64_t interval = admit_interval;
+    if (!interval) return true;
+
+    int64_t next = admit_next;
+
+    // a quarter interval of slack so camera jitter does not skip an extra frame
+    if (next && timestamp < next - interval / 4)
+    {
+        __sync_fetch_and_add(&queue_stats.skipped_by_rate, 1);
+        recorder->add_frames_dropped();
+        return false;
+    }
+
+    // start over from this frame after a gap instead of letting a burst through
+    int64_t due = next && timestamp < next + interval ? next + interval : timestamp + interval;
+
+    if (!__sync_bool_compare_and_swap(&admit_next, next, due))
+    {
+        // another thread took this slot
+        __sync_fetch_and_add(&queue_stats.skipped_by_rate, 1);
+        recorder->add_frames_dropped();
+        return false;
+    }
+
+    return true;
+}
+
+void ffenc_context::queue_converted(ffenc_frame *entry, void *arg)
+{
+    ffenc_context *ffe_context = (ffenc_context*) arg;
+
+    // the converter is finished before the queue is closed, so this skips queue_frame
+    if (ffe_context->push_frame(entry, true) != FFENC_OK) ffe_context->frame_pool->release(entry);
+}
+
+void ffenc_context::hold_frame(ffenc_frame *entry)
+{
+    // outputs are one at a time, and the encoding thread only takes these
+    // after joining the converter, so the list needs no lock
+    entry->next = 0;
+    if (held_tail) held_tail->next = entry;
+    else held_head = entry;
+    held_tail = entry;
+}
+
+bool ffenc_context::take_held(ffenc_frame **entry)
+{
+    if (!held_head) return false;
+
+    *entry = held_head;
+    held_head = held_head->next;
+    if (!held_head) held_tail = 0;
+
+    return true;
+}
+
+ffenc_error ffenc_context::add_frame(AVFrame *frame)
+{
+    if (!running) return FFENC_NOT_RUNNING;
+
+    if (!admit_frame(ffbb_time_usec())) return FFENC_FRAME_SKIPPED;
+
+    int64_t started_at = ffbb_time_usec();
+
+    ffenc_frame *entry = frame_pool->wrap(frame);
+    ffenc_error result = queue_frame(entry);
+
+    if (result != FFENC_OK)
+    {
+        frame_pool->unwrap(entry);
+        return result;
+    }
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_INGEST, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("ingest", started_at, finished_at, -1);
+
+    return result;
+}
+
+ffenc_error ffenc_context::add_nv12_frame(const uint8_t *srcy, int stride,
+        const uint8_t *srcuv, int uv_stride, int width, int height)
+{
+    int64_t started_at = ffbb_time_usec();
+
+    bool kept;
+    ffenc_error result = copy_nv12_frame(srcy, stride, srcuv, uv_stride, width, height, 0, &kept);
+    if (result != FFENC_OK) return result;
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_INGEST, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("ingest", started_at, finished_at, -1);
+
+    return result;
+}
+
+bool ffenc_context::crop_frame(const uint8_t **srcy, int stride, const uint8_t **srcuv, int uv_stride,
+        int *width, int *height)
+{
+    if (!oriented || !orientation.crop_width || !orientation.crop_height) return true;
+
+    int x = orientation.crop_x;
+    int y = orientation.crop_y;
+    if (x + orientation.crop_width > *width || y + orientation.crop_height > *height) return false;
+
+    // both even, so the UV offset is a whole pair on a whole row
+    *srcy += y * stride + x;
+    *srcuv += (y / 2) * uv_stride + x;
+    *width = orientation.crop_width;
+    *height = orientation.crop_height;
+    return true;
+}
+
+bool ffenc_context::scalable(int width, int height)
+{
+    if (!scale_filter || (width == scale_width && height == scale_height)) return true;
+
+    // scaling and rotating are separate passes, only cropping comes for free
+    return !oriented || (orientation.rotation == 0 && !orientation.mirror);
+}
+
+ffenc_error ffenc_context::copy_nv12_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+        int width, int height, const ffenc_image *image, bool *kept)
+{
+    // an image with a release callback may be read after add_frame returns
+    void (*release)(void *opaque) = image ? image->release : 0;
+    void *opaque = image ? image->opaque : 0;
+
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+
+    if (!crop_frame(&srcy, stride, &srcuv, uv_stride, &width, &height) || !scalable(width, height))
+    {
+        recorder->add_frames_dropped();
+        return FFENC_FRAME_NOT_SUPPORTED;
+    }
+
+    bool scaled = scale_filter && (width != scale_width || height != scale_height);
+
+#if X264_SUPPORT
+    if (x264 && !oriented && !scaled)
+    {
+        // x264 takes nv12 as is, it is only copied when the caller's buffer cannot be held
+        ffenc_frame *entry;
+
+        if (release)
+        {
+            const uint8_t *planes[2] = { srcy, srcuv };
+            int strides[2] = { stride, uv_stride };
+            entry = frame_pool->wrap_planes(PIX_FMT_NV12, planes, strides, width, height, release, opaque);
+        }
+        else
+        {
+            entry = frame_pool->acquire(PIX_FMT_NV12, width, height);
+        }
+
+        if (!entry)
+        {
+            recorder->add_frames_dropped();
+            return FFENC_POOL_EXHAUSTED;
+        }
+
+        if (!release)
+        {
+            AVFrame *frame = entry->frame;
+            kernels->copy_plane(frame->data[0], frame->linesize[0], srcy, stride, width, height);
+            kernels->copy_plane(frame->data[1], frame->linesize[1], srcuv, uv_stride, width, height / 2);
+        }
+
+        ffenc_error result = queue_frame(entry);
+        if (result != FFENC_OK && release) frame_pool->unwrap(entry);
+        else if (result != FFENC_OK) frame_pool->release(entry);
+        else *kept = release != 0;
+
+        return result;
+    }
+#endif
+
+    if (converter)
+    {
+        ffenc_error result = converter->submit(srcy, stride, srcuv, uv_stride, width, height, release, opaque);
+        if (result == FFENC_QUEUE_FULL) __sync_fetch_and_add(&queue_stats.dropped_newest, 1);
+        if (result != FFENC_OK) recorder->add_frames_dropped();
+        else *kept = release != 0;
+        return result;
+    }
+
+    int rotation = oriented ? orientation.rotation : 0;
+    bool transpose = rotation == 90 || rotation == 270;
+
+    ffenc_frame *entry;
+    if (scaled) entry = frame_pool->acquire(PIX_FMT_YUV420P, scale_width, scale_height);
+    else entry = frame_pool->acquire(PIX_FMT_YUV420P, transpose ? height : width, transpose ? width : height);
+
+    if (!entry)
+    {
+        recorder->add_frames_dropped();
+        return FFENC_POOL_EXHAUSTED;
+    }
+
+    AVFrame *frame = entry->frame;
+
+    int64_t converting_at = ffbb_tracing() ? ffbb_time_usec() : 0;
+
+    if (scaled)
+    {
+        ffconv_nv12_to_i420_scaled(kernels, scale_filter == FFENC_SCALE_BOX, srcy, stride, srcuv, uv_stride,
+                width, height,
+                frame->data[0], frame->linesize[0],
+                frame->data[1], frame->linesize[1],
+                frame->data[2], frame->linesize[2],
+                scale_width, scale_height);
+    }
+    else
+    {
+        ffconv_nv12_to_i420_oriented(kernels, srcy, stride, srcuv, uv_stride,
+                frame->data[0], frame->linesize[0],
+                frame->data[1], frame->linesize[1],
+                frame->data[2], frame->linesize[2],
+                width, height, rotation, oriented && orientation.mirror);
+    }
+
+    if (converting_at) ffbb_trace_span("convert", converting_at, ffbb_time_usec(), -1);
+
+    ffenc_error result = queue_frame(entry);
+    if (result != FFENC_OK) frame_pool->release(entry);
+
+    return result;
+}
+
+ffenc_error ffenc_context::add_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+        int width, int height, int64_t timestamp)
+{
+    if (!running) return FFENC_NOT_RUNNING;
+
+    if (!admit_frame(timestamp)) return FFENC_FRAME_SKIPPED;
+
+    return add_nv12_frame(srcy, stride, srcuv, uv_stride, width, height);
+}
+
+ffenc_error ffenc_context::add_frame(const ffenc_image *image)
+{
+    if (image->format < FFENC_PIXEL_NV12 || image->format > FFENC_PIXEL_RGBA) return FFENC_FRAME_NOT_SUPPORTED;
+    if (image->width <= 0 || image->height <= 0 || (image->width & 1) || (image->height & 1))
+        return FFENC_FRAME_NOT_SUPPORTED;
+
+    // only the NV12 layouts can be cropped, rotated and scaled
+    if ((oriented || scale_filter) && image->format != FFENC_PIXEL_NV12 && image->format != FFENC_PIXEL_NV21)
+        return FFENC_FRAME_NOT_SUPPORTED;
+
+    if (!running) return FFENC_NOT_RUNNING;
+
+    if (!admit_frame(image->timestamp)) return FFENC_FRAME_SKIPPED;
+
+    int64_t started_at = ffbb_time_usec();
+
+    bool kept = false;
+    ffenc_error result = copy_image(image, &kept);
+    if (result != FFENC_OK) return result;
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_INGEST, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("ingest", started_at, finished_at, -1);
+
+    // a converted frame is done with the caller's memory already
+    if (image->release && !kept) image->release(image->opaque);
+
+    return result;
+}
+
+typedef struct
+{
+    const ffconv_kernels *kernels;
+    ffconv_rgb_coeffs coeffs;
+    const uint8_t *src;
+    int stride;
+    AVFrame *frame;
+    int width;
+    int height;
+} rgb_band_job;
+
+static void convert_rgb_band(int band, int bands, void *arg)
+{
+    rgb_band_job *job = (rgb_band_job*) arg;
+    AVFrame *frame = job->frame;
+
+    // bands start on an even row so each owns whole rows of chroma
+    int pairs = job->height / 2;
+    int first = pairs * band / bands;
+    int last = pairs * (band + 1) / bands;
+    if (first == last) return;
+
+    job->kernels->rgb_to_i420(frame->data[0] + first * 2 * frame->linesize[0], frame->linesize[0],
+            frame->data[1] + first * frame->linesize[1], frame->linesize[1],
+            frame->data[2] + first * frame->linesize[2], frame->linesize[2],
+            job->src + first * 2 * job->stride, job->stride, job->width, (last - first) * 2, &job->coeffs);
+}
+
+ffenc_error ffenc_context::copy_image(const ffenc_image *image, bool *kept)
+{
+    const uint8_t * const *planes = image->planes;
+    const int *strides = image->strides;
+    int width = image->width;
+    int height = image->height;
+
+    if (image->format == FFENC_PIXEL_NV12)
+    {
+        return copy_nv12_frame(planes[0], strides[0], planes[1], strides[1], width, height, image, kept);
+    }
+
+    ffenc_frame *entry;
+
+    if (image->format == FFENC_PIXEL_I420 && image->release)
+    {
+        // both encoders take I420 as is, the caller's planes are queued without a copy
+        entry = frame_pool->wrap_planes(PIX_FMT_YUV420P, planes, strides, width, height,
+                image->release, image->opaque);
+        if (!entry)
+        {
+            recorder->add_frames_dropped();
+            return FFENC_POOL_EXHAUSTED;
+        }
+
+        ffenc_error result = queue_frame(entry);
+        if (result != FFENC_OK) frame_pool->unwrap(entry);
+        else *kept = true;
+
+        return result;
+    }
+
+    // add_frame lets nothing but NV12 and NV21 through while oriented
+    const uint8_t *srcy = planes[0];
+    const uint8_t *srcvu = planes[1];
+    int rotation = oriented ? orientation.rotation : 0;
+    bool transpose = rotation == 90 || rotation == 270;
+
+    bool nv21 = image->format == FFENC_PIXEL_NV21;
+    if (nv21 && (!crop_frame(&srcy, strides[0], &srcvu, strides[1], &width, &height) || !scalable(width, height)))
+    {
+        recorder->add_frames_dropped();
+        return FFENC_FRAME_NOT_SUPPORTED;
+    }
+
+    bool scaled = nv21 && scale_filter && (width != scale_width || height != scale_height);
+
+    if (scaled) entry = frame_pool->acquire(PIX_FMT_YUV420P, scale_width, scale_height);
+    else entry = frame_pool->acquire(PIX_FMT_YUV420P, transpose ? height : width, transpose ? width : height);
+    if (!entry)
+    {
+        recorder->add_frames_dropped();
+        return FFENC_POOL_EXHAUSTED;
+    }
+
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+    AVFrame *frame = entry->frame;
+
+    int64_t converting_at = ffbb_tracing() ? ffbb_time_usec() : 0;
+
+    switch (image->format)
+    {
+        case FFENC_PIXEL_NV21:
+            // NV12 with the chroma planes swapped
+            if (scaled)
+            {
+                ffconv_nv12_to_i420_scaled(kernels, scale_filter == FFENC_SCALE_BOX, srcy, strides[0],
+                        srcvu, strides[1], width, height,
+                        frame->data[0], frame->linesize[0],
+                        frame->data[2], frame->linesize[2],
+                        frame->data[1], frame->linesize[1],
+                        scale_width, scale_height);
+            }
+            else
+            {
+                ffconv_nv12_to_i420_oriented(kernels, srcy, strides[0], srcvu, strides[1],
+                        frame->data[0], frame->linesize[0],
+                        frame->data[2], frame->linesize[2],
+                        frame->data[1], frame->linesize[1],
+                        width, height, rotation, oriented && orientation.mirror);
+            }
+            break;
+
+        case FFENC_PIXEL_YUYV:
+        case FFENC_PIXEL_UYVY:
+            kernels->packed_422_to_i420(frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    frame->data[2], frame->linesize[2],
+                    planes[0], strides[0], width, height, image->format == FFENC_PIXEL_UYVY);
+            break;
+
+        case FFENC_PIXEL_I420:
+            ffconv_copy_i420(kernels, planes[0], strides[0], planes[1], strides[1], planes[2], strides[2],
+                    frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    frame->data[2], frame->linesize[2],
+                    width, height);
+            break;
+
+        case FFENC_PIXEL_P010:
+            ffconv_p010_to_i420(kernels, planes[0], strides[0], planes[1], strides[1],
+                    frame->data[0], frame->linesize[0],
+                    frame->data[1], frame->linesize[1],
+                    frame->data[2], frame->linesize[2],
+                    width, height);
+            break;
+
+        case FFENC_PIXEL_BGRA:
+        case FFENC_PIXEL_RGBA:
+        {
+            rgb_band_job job;
+            job.kernels = kernels;
+            ffconv_rgb_coeffs_init(&job.coeffs, image->format == FFENC_PIXEL_BGRA,
+                    rgb_matrix == FFENC_MATRIX_BT709, rgb_full_range);
+            job.src = planes[0];
+            job.stride = strides[0];
+            job.frame = frame;
+            job.width = width;
+            job.height = height;
+
+            if (rgb_bands && width * height >= RGB_BAND_MIN_PIXELS)
+            {
+                rgb_bands->run(rgb_bands->thread_count(), &convert_rgb_band, &job);
+            }
+            else
+            {
+                convert_rgb_band(0, 1, &job);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    if (converting_at) ffbb_trace_span("convert", converting_at, ffbb_time_usec(), -1);
+
+    ffenc_error result = queue_frame(entry);
+    if (result != FFENC_OK) frame_pool->release(entry);
+
+    return result;
+}
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
+ffenc_error ffenc_context::add_frame(camera_buffer_t* buf)
+{
+    if (buf->frametype != CAMERA_FRAMETYPE_NV12) return FFENC_FRAME_NOT_SUPPORTED;
+
+    if (!running) return FFENC_NOT_RUNNING;
+
+    // decided before touching the frame, a skipped buffer costs nothing
+    if (!admit_frame(buf->frametimestamp)) return FFENC_FRAME_SKIPPED;
+
+    int64_t uv_offset = buf->framedesc.nv12.uv_offset;
+    uint32_t height = buf->framedesc.nv12.height;
+    uint32_t width = buf->framedesc.nv12.width;
+    uint32_t stride = buf->framedesc.nv12.stride;
+
+    return add_nv12_frame(buf->framebuf, stride, &buf->framebuf[uv_offset], stride, width, height);
+}
+#elif OSX_PLATFORM
+ffenc_error ffenc_context::add_frame(CVImageBufferRef pixelBuffer)
+{
+    OSType formatType = CVPixelBufferGetPixelFormatType(pixelBuffer);
+    if (formatType != kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange)
+    {
+        return FFENC_FRAME_NOT_SUPPORTED;
+    }
+
+    if (!running) return FFENC_NOT_RUNNING;
+
+    if (!admit_frame(ffbb_time_usec())) return FFENC_FRAME_SKIPPED;
+
+    CVPixelBufferLockBaseAddress(pixelBuffer, 0);
+
+    int height = CVPixelBufferGetHeight(pixelBuffer);
+    int width = CVPixelBufferGetWidth(pixelBuffer);
+
+    uint32_t stride = CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 0);
+    uint32_t uv_stride = CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 1);
+
+    uint8_t *srcy = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 0);
+    uint8_t *srcuv = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 1);
+
+    ffenc_error result = add_nv12_frame(srcy, stride, srcuv, uv_stride, width, height);
+
+    CVPixelBufferUnlockBaseAddress(pixelBuffer, 0);
+
+    return result;
+}
 #endif
@@ -0,0 +1,221 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbexecutor.h"
+#include "ffbbtracer.h"
+
+#include <unistd.h>
+
+void* executor_thread(void* arg);
+
+ffenc_executor::ffenc_executor(int threads)
+{
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    this->threads = threads > 1 ? threads : 1;
+
+    worker_count = 0;
+    pthreads = new pthread_t[this->threads];
+    workers = new worker[this->threads];
+    running = false;
+    next_worker = 0;
+    sleepers = 0;
+
+    for (int i = 0; i < this->threads; i++)
+    {
+        pthread_mutex_init(&workers[i].mutex, 0);
+        workers[i].head = 0;
+        workers[i].tail = 0;
+        workers[i].executor = this;
+        workers[i].index = i;
+    }
+
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&work_cond, 0);
+}
+
+ffenc_executor::~ffenc_executor()
+{
+    stop();
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_mutex_destroy(&workers[i].mutex);
+    }
+
+    delete[] workers;
+    delete[] pthreads;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&work_cond);
+}
+
+bool ffenc_executor::start()
+{
+    if (running) return true;
+
+    running = true;
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&pthreads[i], 0, &::executor_thread, &workers[i]) != 0)
+        {
+            stop();
+            return false;
+        }
+        worker_count++;
+    }
+
+    return true;
+}
+
+void ffenc_executor::stop()
+{
+    if (!running) return;
+
+    pthread_mutex_lock(&mutex);
+    running = false;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&mutex);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(pthreads[i], 0);
+    }
+
+    worker_count = 0;
+}
+
+void ffenc_executor::schedule(ffenc_context *context)
+{
+    // only the caller that raises the flag queues it, so it is never on two lists
+    if (!__sync_bool_compare_and_swap(&context->executor_scheduled, 0, 1)) return;
+
+    int index = __sync_fetch_and_add(&next_worker, 1);
+    push(&workers[(unsigned int) index % threads], context);
+}
+
+void ffenc_executor::push(worker *target, ffenc_context *context)
+{
+    pthread_mutex_lock(&target->mutex);
+    context->executor_next = 0;
+    if (target->tail) target->tail->executor_next = context;
+    else target->head = context;
+    target->tail = context;
+    pthread_mutex_unlock(&target->mutex);
+
+    // the same handshake as the frame queue, a sleeper either sees the
+    // context or is woken
+    __sync_synchronize();
+
+    if (sleepers)
+    {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+ffenc_context* ffenc_executor::pop(worker *target)
+{
+    // skip the lock for an empty list, a context pushed meanwhile wakes a sleeper
+    if (!target->head) return 0;
+
+    pthread_mutex_lock(&target->mutex);
+
+    ffenc_context *context = target->head;
+
+    if (context)
+    {
+        target->head = context->executor_next;
+        if (!target->head) target->tail = 0;
+        context->executor_next = 0;
+    }
+
+    pthread_mutex_unlock(&target->mutex);
+
+    return context;
+}
+
+ffenc_context* ffenc_executor::take(worker *self)
+{
+    ffenc_context *context = pop(self);
+
+    // steal from the others, starting with the next one so the threads
+    // do not all go after the same list
+    for (int i = 1; !context && i < threads; i++)
+    {
+        context = pop(&workers[(self->index + i) % threads]);
+    }
+
+    return context;
+}
+
+bool ffenc_executor::has_work()
+{
+    __sync_synchronize();
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (workers[i].head) return true;
+    }
+
+    return false;
+}
+
+void ffenc_executor::wait_for_work()
+{
+    pthread_mutex_lock(&mutex);
+
+    sleepers++;
+    __sync_synchronize();
+
+    if (running && !has_work())
+    {
+        pthread_cond_wait(&work_cond, &mutex);
+    }
+
+    sleepers--;
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void* executor_thread(void* arg)
+{
+    ffenc_executor::worker *self = (ffenc_executor::worker*) arg;
+    self->executor->executor_thread(self);
+    return 0;
+}
+
+void ffenc_executor::executor_thread(worker *self)
+{
+    ffbb_trace_name_thread("ffenc executor");
+
+    while (true)
+    {
+        ffenc_context *context = take(self);
+
+        if (!context)
+        {
+            // contexts already queued are finished before the threads exit
+            if (!running) break;
+
+            wait_for_work();
+            continue;
+        }
+
+        // back on our own list so it tends to stay on this thread
+        if (context->run_turn()) push(self, context);
+    }
+}
@@ -0,0 +1,337 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbmux.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MUX_IO_BUFFER_SIZE 32768
+
+ffmux_context::ffmux_context()
+{
+    format_context = 0;
+    stream = 0;
+    io_buffer = 0;
+    error = FFMUX_OK;
+
+    frame_buffer = 0;
+    frame_size = 0;
+    frame_capacity = 0;
+
+    reset();
+}
+
+ffmux_context::~ffmux_context()
+{
+    close();
+    av_free(frame_buffer);
+}
+
+void ffmux_context::reset()
+{
+    close();
+
+    fragment_duration = AV_TIME_BASE;
+    fragment_start = AV_NOPTS_VALUE;
+    fd = -1;
+
+    write_callback = 0;
+    write_callback_arg = 0;
+}
+
+ffmux_error ffmux_context::set_write_callback(
+        int (*write_callback)(ffmux_context *ffm_context, uint8_t *buf, int size, void *arg),
+        void *arg)
+{
+    this->write_callback = write_callback;
+    write_callback_arg = arg;
+    return FFMUX_OK;
+}
+
+ffmux_error ffmux_context::set_fd(int fd)
+{
+    this->fd = fd;
+    return FFMUX_OK;
+}
+
+ffmux_error ffmux_context::set_fragment_duration(int64_t fragment_duration)
+{
+    this->fragment_duration = fragment_duration;
+    return FFMUX_OK;
+}
+
+ffmux_error ffmux_context::open(ffmux_format format, AVCodecContext *codec_context)
+{
+    return open(format, codec_context->codec_id, codec_context->width, codec_context->height,
+            codec_context->time_base, codec_context->extradata, codec_context->extradata_size);
+}
+
+ffmux_error ffmux_context::open(ffmux_format format, enum CodecID codec_id, int width, int height,
+        AVRational time_base, const uint8_t *extradata, int extradata_size)
+{
+    if (format_context) return FFMUX_ALREADY_OPEN;
+
+    av_register_all();
+
+    const char *format_name = format == FFMUX_FORMAT_MPEGTS ? "mpegts" : "mp4";
+
+    if (avformat_alloc_output_context2(&format_context, 0, format_name, 0) < 0 || !format_context)
+    {
+        format_context = 0;
+        return FFMUX_FORMAT_NOT_FOUND;
+    }
+
+    // the only buffer the muxer writes through, allocated once per recording
+    io_buffer = (uint8_t*) av_malloc(MUX_IO_BUFFER_SIZE);
+    AVIOContext *pb = io_buffer ? avio_alloc_context(io_buffer, MUX_IO_BUFFER_SIZE, 1, this, 0,
+            &ffmux_context::write_output, 0) : 0;
+
+    if (!pb)
+    {
+        av_free(io_buffer);
+        io_buffer = 0;
+        avformat_free_context(format_context);
+        format_context = 0;
+        return FFMUX_WRITE_ERROR;
+    }
+
+    pb->seekable = 0;
+
+    format_context->pb = pb;
+    format_context->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    stream = avformat_new_stream(format_context, 0);
+
+    if (!stream)
+    {
+        close();
+        return FFMUX_WRITE_ERROR;
+    }
+
+    stream->id = 0;
+
+    AVCodecContext *stream_codec = stream->codec;
+    stream_codec->codec_type = AVMEDIA_TYPE_VIDEO;
+    stream_codec->codec_id = codec_id;
+    stream_codec->width = width;
+    stream_codec->height = height;
+    stream_codec->time_base = time_base;
+    stream->time_base = time_base;
+    this->time_base = time_base;
+
+    if (format_context->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        stream_codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (extradata && extradata_size > 0)
+    {
+        stream_codec->extradata = (uint8_t*) av_mallocz(extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+
+        if (!stream_codec->extradata)
+        {
+            stream = 0;
+            close();
+            return FFMUX_WRITE_ERROR;
+        }
+
+        memcpy(stream_codec->extradata, extradata, extradata_size);
+        stream_codec->extradata_size = extradata_size;
+    }
+
+    AVDictionary *options = 0;
+
+    if (format == FFMUX_FORMAT_FMP4)
+    {
+        char duration[32];
+        snprintf(duration, sizeof(duration), "%lld", (long long) fragment_duration);
+
+        av_dict_set(&options, "movflags", "frag_keyframe+empty_moov", 0);
+        av_dict_set(&options, "frag_duration", duration, 0);
+    }
+
+    int result = avformat_write_header(format_context, &options);
+    av_dict_free(&options);
+
+    if (result < 0)
+    {
+        // no header means no trailer either
+        stream = 0;
+        close();
+        return FFMUX_WRITE_ERROR;
+    }
+
+    avio_flush(pb);
+    fragment_start = AV_NOPTS_VALUE;
+    error = FFMUX_OK;
+    frame_size = 0;
+
+    return FFMUX_OK;
+}
+
+ffmux_error ffmux_context::write_packet(ffenc_packet *packet)
+{
+    if (!format_context) return FFMUX_NOT_OPEN;
+    if (error != FFMUX_OK) return error;
+
+    int64_t pts = packet->pts;
+    int64_t dts = packet->dts != (int64_t) AV_NOPTS_VALUE ? packet->dts : pts;
+
+    // a whole picture points straight at the encoder's buffer, nothing
+    // is copied or allocated
+    if (packet->frame_end && !frame_size)
+    {
+        error = write_sample(packet->data, packet->size, packet->flags, pts, dts);
+        return error;
+    }
+
+    if (!frame_size)
+    {
+        frame_flags = 0;
+        frame_pts = pts;
+        frame_dts = dts;
+    }
+
+    // the container takes one sample per picture with rising timestamps,
+    // so the NAL units of low latency mode are put back together first
+    if (!collect(packet))
+    {
+        error = FFMUX_WRITE_ERROR;
+        return error;
+    }
+
+    if (!packet->frame_end) return FFMUX_OK;
+
+    error = write_sample(frame_buffer, frame_size, frame_flags, frame_pts, frame_dts);
+    frame_size = 0;
+    return error;
+}
+
+bool ffmux_context::collect(ffenc_packet *packet)
+{
+    if (frame_size + packet->size > frame_capacity)
+    {
+        int capacity = frame_capacity ? frame_capacity : MUX_IO_BUFFER_SIZE;
+        while (capacity < frame_size + packet->size) capacity *= 2;
+
+        uint8_t *buffer = (uint8_t*) av_realloc(frame_buffer, capacity + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!buffer) return false;
+
+        frame_buffer = buffer;
+        frame_capacity = capacity;
+    }
+
+    memcpy(frame_buffer + frame_size, packet->data, packet->size);
+    frame_size += packet->size;
+    frame_flags |= packet->flags;
+    memset(frame_buffer + frame_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    return true;
+}
+
+ffmux_error ffmux_context::write_sample(uint8_t *data, int size, int flags, int64_t pts, int64_t dts)
+{
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = data;
+    pkt.size = size;
+    pkt.stream_index = stream->index;
+    pkt.flags = flags;
+
+    if (pts != (int64_t) AV_NOPTS_VALUE) pkt.pts = av_rescale_q(pts, time_base, stream->time_base);
+    if (dts != (int64_t) AV_NOPTS_VALUE) pkt.dts = av_rescale_q(dts, time_base, stream->time_base);
+
+    if (av_write_frame(format_context, &pkt) < 0) return FFMUX_WRITE_ERROR;
+
+    // push the output out once per fragment duration so a reader tailing
+    // it sees each fragment, with intra refresh there are no keyframes
+    if (dts != (int64_t) AV_NOPTS_VALUE)
+    {
+        int64_t now = av_rescale_q(dts, time_base, AV_TIME_BASE_Q);
+
+        if (fragment_start == (int64_t) AV_NOPTS_VALUE || now - fragment_start >= fragment_duration)
+        {
+            avio_flush(format_context->pb);
+            fragment_start = now;
+        }
+    }
+
+    return format_context->pb->error < 0 ? FFMUX_WRITE_ERROR : FFMUX_OK;
+}
+
+ffmux_error ffmux_context::close()
+{
+    if (!format_context) return FFMUX_NOT_OPEN;
+
+    AVIOContext *pb = format_context->pb;
+
+    // a picture the encoder never finished is left out
+    frame_size = 0;
+
+    if (stream) av_write_trailer(format_context);
+
+    if (pb)
+    {
+        avio_flush(pb);
+        if (pb->error < 0) error = FFMUX_WRITE_ERROR;
+        av_free(pb->buffer);
+        av_free(pb);
+    }
+
+    avformat_free_context(format_context);
+    format_context = 0;
+    stream = 0;
+    io_buffer = 0;
+
+    return error;
+}
+
+void ffmux_context::packet_callback(ffenc_context*, ffenc_packet *packet, void *arg)
+{
+    // write_packet keeps the error for close
+    ffmux_context *ffm_context = (ffmux_context*) arg;
+    ffm_context->write_packet(packet);
+}
+
+int ffmux_context::write_output(void *opaque, uint8_t *buf, int buf_size)
+{
+    ffmux_context *ffm_context = (ffmux_context*) opaque;
+
+    if (ffm_context->write_callback)
+    {
+        return ffm_context->write_callback(ffm_context, buf, buf_size, ffm_context->write_callback_arg);
+    }
+
+    if (ffm_context->fd < 0) return buf_size;
+
+    int written = 0;
+
+    while (written < buf_size)
+    {
+        ssize_t result = write(ffm_context->fd, buf + written, buf_size - written);
+
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        written += result;
+    }
+
+    return written;
+}
@@ -0,0 +1,228 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbnal.h"
+
+#define SEI_TYPE_RECOVERY_POINT 6
+
+// returns the offset just past the next 00 00 01, or -1
+static int find_start_code(const uint8_t *data, int offset, int size)
+{
+    for (int i = offset; i + 2 < size; i++)
+    {
+        if (data[i + 2] > 1)
+        {
+            // no start code can end in the next two bytes either
+            i += 2;
+        }
+        else if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+        {
+            return i + 3;
+        }
+    }
+
+    return -1;
+}
+
+int ffbb_split_nals(const uint8_t *data, int size, ffenc_nal *nals, int max_nals)
+{
+    int count = 0;
+    int start = find_start_code(data, 0, size);
+
+    while (start >= 0 && count < max_nals)
+    {
+        int next = find_start_code(data, start, size);
+
+        int end = next < 0 ? size : next - 3;
+
+        // the zero in front of a four byte start code belongs to the next one
+        if (next >= 0)
+        {
+            while (end > start && data[end - 1] == 0) end--;
+        }
+
+        if (end > start)
+        {
+            nals[count].offset = start;
+            nals[count].size = end - start;
+            nals[count].type = data[start] & 0x1f;
+            count++;
+        }
+
+        start = next;
+    }
+
+    return count;
+}
+
+/**
+ * Reads exp-Golomb codes from the start of a NAL payload, skipping the
+ * emulation prevention bytes.
+ */
+struct ffbb_bit_reader
+{
+    const uint8_t *data;
+    int size;
+    int byte;
+    int bit;
+    int zeros;
+};
+
+static int read_bit(ffbb_bit_reader *reader)
+{
+    if (reader->bit == 0)
+    {
+        if (reader->byte >= reader->size) return -1;
+
+        if (reader->zeros >= 2 && reader->data[reader->byte] == 3)
+        {
+            reader->byte++;
+            reader->zeros = 0;
+            if (reader->byte >= reader->size) return -1;
+        }
+
+        reader->zeros = reader->data[reader->byte] == 0 ? reader->zeros + 1 : 0;
+    }
+
+    int value = (reader->data[reader->byte] >> (7 - reader->bit)) & 1;
+
+    if (++reader->bit == 8)
+    {
+        reader->bit = 0;
+        reader->byte++;
+    }
+
+    return value;
+}
+
+static int read_ue(ffbb_bit_reader *reader)
+{
+    int leading_zeros = 0;
+
+    while (true)
+    {
+        int bit = read_bit(reader);
+        if (bit < 0 || leading_zeros > 31) return -1;
+        if (bit) break;
+        leading_zeros++;
+    }
+
+    unsigned int value = 0;
+
+    for (int i = 0; i < leading_zeros; i++)
+    {
+        int bit = read_bit(reader);
+        if (bit < 0) return -1;
+        value = (value << 1) | bit;
+    }
+
+    return (int) ((1u << leading_zeros) - 1 + value);
+}
+
+static int read_byte(ffbb_bit_reader *reader)
+{
+    int value = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        int bit = read_bit(reader);
+        if (bit < 0) return -1;
+        value = (value << 1) | bit;
+    }
+
+    return value;
+}
+
+int ffbb_slice_picture_type(const uint8_t *nal, int size)
+{
+    int type = nal[0] & 0x1f;
+    if (type != NAL_TYPE_SLICE && type != NAL_TYPE_SLICE_IDR) return AV_PICTURE_TYPE_NONE;
+
+    ffbb_bit_reader reader;
+    reader.data = nal + 1;
+    reader.size = size - 1;
+    reader.byte = 0;
+    reader.bit = 0;
+    reader.zeros = 0;
+
+    // first_mb_in_slice, then slice_type
+    if (read_ue(&reader) < 0) return AV_PICTURE_TYPE_NONE;
+    int slice_type = read_ue(&reader);
+
+    switch (slice_type % 5)
+    {
+        case 0:
+            return AV_PICTURE_TYPE_P;
+        case 1:
+            return AV_PICTURE_TYPE_B;
+        case 2:
+            return AV_PICTURE_TYPE_I;
+        case 3:
+            return AV_PICTURE_TYPE_SP;
+        case 4:
+            return AV_PICTURE_TYPE_SI;
+    }
+
+    return AV_PICTURE_TYPE_NONE;
+}
+
+bool ffbb_is_resume_point(const uint8_t *nal, int size)
+{
+    if (size < 1) return false;
+
+    int type = nal[0] & 0x1f;
+    if (type == NAL_TYPE_SLICE_IDR || type == NAL_TYPE_SPS || type == NAL_TYPE_PPS) return true;
+    if (type != NAL_TYPE_SEI) return false;
+
+    ffbb_bit_reader reader;
+    reader.data = nal + 1;
+    reader.size = size - 1;
+    reader.byte = 0;
+    reader.bit = 0;
+    reader.zeros = 0;
+
+    // each message is a payload type and size, both coded as runs of 255 plus a last byte
+    while (reader.byte + 1 < reader.size)
+    {
+        int payload_type = 0;
+        int payload_size = 0;
+        int value;
+
+        do
+        {
+            value = read_byte(&reader);
+            if (value < 0) return false;
+            payload_type += value;
+        }
+        while (value == 255);
+
+        do
+        {
+            value = read_byte(&reader);
+            if (value < 0) return false;
+            payload_size += value;
+        }
+        while (value == 255);
+
+        if (payload_type == SEI_TYPE_RECOVERY_POINT) return true;
+
+        for (int i = 0; i < payload_size; i++)
+        {
+            if (read_byte(&reader) < 0) return false;
+        }
+    }
+
+    return false;
+}
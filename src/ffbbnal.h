@@ -0,0 +1,47 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBNAL_H
+#define FFBBNAL_H
+
+#include "ffbbenc.h"
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_SLICE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+
+/**
+ * Find the NAL units of an Annex B H.264 buffer. Offsets point past the
+ * start code at the NAL header. Returns the number of NAL units found,
+ * which is at most max_nals.
+ */
+int ffbb_split_nals(const uint8_t *data, int size, ffenc_nal *nals, int max_nals);
+
+/**
+ * Read slice_type from the header of a slice NAL unit and return it as an
+ * AV_PICTURE_TYPE, or AV_PICTURE_TYPE_NONE if it is not a slice.
+ */
+int ffbb_slice_picture_type(const uint8_t *nal, int size);
+
+/**
+ * Whether a decoder can start from this NAL unit: an SPS, a PPS, an IDR
+ * slice, or an SEI with a recovery point, which is how periodic intra
+ * refresh marks where a clean picture starts to build up.
+ */
+bool ffbb_is_resume_point(const uint8_t *nal, int size);
+
+#endif
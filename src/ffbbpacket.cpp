@@ -0,0 +1,172 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbpacket.h"
+
+#include <string.h>
+
+void ffenc_packet::retain()
+{
+    __sync_fetch_and_add(&refcount, 1);
+}
+
+void ffenc_packet::release()
+{
+    if (__sync_sub_and_fetch(&refcount, 1) == 0)
+    {
+        pool->recycle(this);
+    }
+}
+
+ffenc_packet_pool::ffenc_packet_pool()
+{
+    pthread_mutex_init(&mutex, 0);
+
+    for (int i = 0; i < PACKET_CLASSES; i++)
+    {
+        idle[i] = 0;
+        idle_count[i] = 0;
+    }
+
+    outstanding = 0;
+    destroyed = false;
+}
+
+ffenc_packet_pool::~ffenc_packet_pool()
+{
+    for (int i = 0; i < PACKET_CLASSES; i++)
+    {
+        while (idle[i])
+        {
+            ffenc_packet *packet = idle[i];
+            idle[i] = packet->next;
+            av_free(packet->buffer);
+            delete packet;
+        }
+    }
+
+    pthread_mutex_destroy(&mutex);
+}
+
+static int size_class(int size)
+{
+    int size_class = 0;
+    while (size_class < PACKET_CLASSES - 1 && (1 << (size_class + PACKET_MIN_CLASS)) < size)
+        size_class++;
+    return size_class;
+}
+
+ffenc_packet* ffenc_packet_pool::acquire(int size)
+{
+    int index = size_class(size);
+    int capacity = 1 << (index + PACKET_MIN_CLASS);
+    if (capacity < size) return 0;
+
+    pthread_mutex_lock(&mutex);
+
+    ffenc_packet *packet = idle[index];
+
+    if (packet)
+    {
+        idle[index] = packet->next;
+        idle_count[index]--;
+    }
+
+    outstanding++;
+
+    pthread_mutex_unlock(&mutex);
+
+    if (!packet)
+    {
+        packet = new ffenc_packet();
+        packet->pool = this;
+        packet->size_class = index;
+        packet->capacity = capacity;
+
+        // padded so parsers and decoders may read past the end
+        packet->buffer = (uint8_t*) av_malloc(capacity + FF_INPUT_BUFFER_PADDING_SIZE);
+
+        if (!packet->buffer)
+        {
+            delete packet;
+
+            pthread_mutex_lock(&mutex);
+            outstanding--;
+            pthread_mutex_unlock(&mutex);
+            return 0;
+        }
+    }
+
+    memset(packet->buffer + capacity, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    packet->data = packet->buffer;
+    packet->size = 0;
+    packet->pts = AV_NOPTS_VALUE;
+    packet->dts = AV_NOPTS_VALUE;
+    packet->flags = 0;
+    packet->frame_type = AV_PICTURE_TYPE_NONE;
+    packet->frame_end = true;
+    packet->nal_count = 0;
+    packet->refcount = 1;
+    packet->next = 0;
+
+    return packet;
+}
+
+void ffenc_packet_pool::recycle(ffenc_packet *packet)
+{
+    int index = packet->size_class;
+
+    pthread_mutex_lock(&mutex);
+
+    outstanding--;
+
+    if (idle_count[index] < PACKET_IDLE_PER_CLASS)
+    {
+        packet->next = idle[index];
+        idle[index] = packet;
+        idle_count[index]++;
+        packet = 0;
+    }
+
+    bool done = destroyed && outstanding == 0;
+
+    pthread_mutex_unlock(&mutex);
+
+    if (packet)
+    {
+        av_free(packet->buffer);
+        delete packet;
+    }
+
+    if (done) delete this;
+}
+
+void ffenc_packet_pool::destroy()
+{
+    pthread_mutex_lock(&mutex);
+    destroyed = true;
+    bool done = outstanding == 0;
+    pthread_mutex_unlock(&mutex);
+
+    if (done) delete this;
+}
+
+int ffenc_max_packet_size(int width, int height)
+{
+    // an I picture made only of PCM macroblocks is just over the size of
+    // the raw frame, leave room for that plus the headers and SEI
+    return width * height * 2 + FF_MIN_BUFFER_SIZE;
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBPACKET_H
+#define FFBBPACKET_H
+
+#include "ffbbenc.h"
+
+// size classes are powers of two from 4 KB up to 1 GB
+#define PACKET_MIN_CLASS 12
+#define PACKET_CLASSES 19
+#define PACKET_IDLE_PER_CLASS 8
+
+/**
+ * Recycles packet buffers by power of two size class. The pool stays
+ * alive until its owner has called destroy() and every packet handed
+ * out has been released, so packets may outlive the encoder context.
+ */
+class ffenc_packet_pool
+{
+public:
+
+    ffenc_packet_pool();
+
+    /**
+     * Take a packet with room for at least size bytes and a reference count of 1.
+     */
+    ffenc_packet* acquire(int size);
+
+    /**
+     * Called by ffenc_packet::release once the last reference is gone.
+     */
+    void recycle(ffenc_packet *packet);
+
+    /**
+     * Give up the owner's hold on the pool.
+     */
+    void destroy();
+
+private:
+
+    virtual ~ffenc_packet_pool();
+
+    pthread_mutex_t mutex;
+    ffenc_packet *idle[PACKET_CLASSES];
+    int idle_count[PACKET_CLASSES];
+    int outstanding;
+    bool destroyed;
+};
+
+/**
+ * The worst case size of one encoded picture, sized from the
+ * resolution instead of a fixed allowance.
+ */
+int ffenc_max_packet_size(int width, int height);
+
+#endif
@@ -0,0 +1,460 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbpool.h"
+#include "ffbbconv.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_ALIGN 64
+
+ffenc_frame_pool::ffenc_frame_pool()
+{
+    pthread_mutex_init(&mutex, 0);
+
+    // a width of 0 marks a free slot
+    memset(layouts, 0, sizeof(layouts));
+    uses = 0;
+    limit = 0;
+    memset(&stats, 0, sizeof(ffenc_pool_stats));
+
+    idle_layers = 0;
+    layer_count = 0;
+    layer_box = true;
+    layer_generation = 0;
+}
+
+ffenc_frame_pool::~ffenc_frame_pool()
+{
+    for (int i = 0; i < POOL_LAYOUTS; i++)
+        free_idle(&layouts[i]);
+
+    while (idle_layers)
+    {
+        ffenc_layers *layers = idle_layers;
+        idle_layers = layers->next;
+        free_layers(layers);
+    }
+
+    pthread_mutex_destroy(&mutex);
+}
+
+void ffenc_frame_pool::free_idle(layout *slot)
+{
+    while (slot->idle)
+    {
+        ffenc_frame *entry = slot->idle;
+        slot->idle = entry->next;
+        free(entry->buffer);
+        av_free(entry->frame);
+        free(entry);
+        stats.allocated--;
+    }
+}
+
+ffenc_frame_pool::layout* ffenc_frame_pool::find_layout(int format, int width, int height, bool create)
+{
+    layout *oldest = &layouts[0];
+
+    for (int i = 0; i < POOL_LAYOUTS; i++)
+    {
+        layout *slot = &layouts[i];
+        if (slot->format == format && slot->width == width && slot->height == height) return slot;
+        if (!slot->width || (oldest->width && slot->used < oldest->used)) oldest = slot;
+    }
+
+    if (!create) return 0;
+
+    // the camera changed resolution or format, the oldest buffers make room
+    free_idle(oldest);
+    oldest->format = format;
+    oldest->width = width;
+    oldest->height = height;
+    oldest->used = uses;
+    return oldest;
+}
+
+void ffenc_frame_pool::configure(int format, int width, int height)
+{
+    pthread_mutex_lock(&mutex);
+
+    layout *current = find_layout(format, width, height, true);
+
+    for (int i = 0; i < POOL_LAYOUTS; i++)
+    {
+        if (&layouts[i] == current) continue;
+        free_idle(&layouts[i]);
+        layouts[i].width = 0;
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void ffenc_frame_pool::set_limit(int max_in_flight)
+{
+    pthread_mutex_lock(&mutex);
+    limit = max_in_flight;
+    pthread_mutex_unlock(&mutex);
+}
+
+ffenc_frame* ffenc_frame_pool::acquire(int format, int width, int height)
+{
+    pthread_mutex_lock(&mutex);
+
+    if (limit > 0 && stats.in_flight >= limit)
+    {
+        stats.rejected++;
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+
+    layout *slot = find_layout(format, width, height, true);
+    slot->used = ++uses;
+
+    ffenc_frame *entry = slot->idle;
+
+    if (entry)
+    {
+        slot->idle = entry->next;
+        stats.hits++;
+    }
+    else
+    {
+        stats.misses++;
+        stats.allocated++;
+    }
+
+    stats.in_flight++;
+    if (stats.in_flight > stats.high_water) stats.high_water = stats.in_flight;
+
+    pthread_mutex_unlock(&mutex);
+
+    // nv12 keeps u and v interleaved in a single full width plane
+    int planes = format == PIX_FMT_NV12 ? 2 : 3;
+    int stride = FFALIGN(width, POOL_ALIGN);
+    int uv_stride = planes == 2 ? stride : FFALIGN(width / 2, POOL_ALIGN);
+    int y_size = stride * height;
+    int uv_size = uv_stride * (height / 2);
+
+    if (!entry)
+    {
+        // allocate outside of the lock, this is the page faulting part
+        entry = (ffenc_frame*) malloc(sizeof(ffenc_frame));
+        entry->frame = avcodec_alloc_frame();
+        entry->buffer_size = y_size + uv_size * (planes - 1);
+        entry->format = format;
+        entry->width = width;
+        entry->height = height;
+
+        void *buffer = 0;
+        if (posix_memalign(&buffer, POOL_ALIGN, entry->buffer_size) != 0) buffer = 0;
+        entry->buffer = (uint8_t*) buffer;
+
+        if (!entry->frame || !entry->buffer)
+        {
+            free(entry->buffer);
+            av_free(entry->frame);
+            free(entry);
+
+            pthread_mutex_lock(&mutex);
+            stats.in_flight--;
+            stats.allocated--;
+            pthread_mutex_unlock(&mutex);
+            return 0;
+        }
+    }
+
+    entry->queued_at = 0;
+    entry->sequence = 0;
+    entry->release = 0;
+    entry->opaque = 0;
+    entry->layers = 0;
+    entry->next = 0;
+
+    AVFrame *frame = entry->frame;
+    avcodec_get_frame_defaults(frame);
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+
+    frame->linesize[0] = stride;
+    frame->linesize[1] = uv_stride;
+    frame->data[0] = entry->buffer;
+    frame->data[1] = entry->buffer + y_size;
+
+    if (planes == 3)
+    {
+        frame->linesize[2] = uv_stride;
+        frame->data[2] = entry->buffer + y_size + uv_size;
+    }
+
+    return entry;
+}
+
+ffenc_frame* ffenc_frame_pool::wrap(AVFrame *frame)
+{
+    ffenc_frame *entry = (ffenc_frame*) malloc(sizeof(ffenc_frame));
+    entry->frame = frame;
+    entry->buffer = 0;
+    entry->buffer_size = 0;
+    entry->format = frame->format;
+    entry->width = frame->width;
+    entry->height = frame->height;
+    entry->queued_at = 0;
+    entry->sequence = 0;
+    entry->release = 0;
+    entry->opaque = 0;
+    entry->layers = 0;
+    entry->next = 0;
+    return entry;
+}
+
+ffenc_frame* ffenc_frame_pool::wrap_planes(int format, const uint8_t * const *planes, const int *strides,
+        int width, int height, void (*release)(void *opaque), void *opaque)
+{
+    AVFrame *frame = avcodec_alloc_frame();
+    if (!frame) return 0;
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+
+    // encoders and converters only read the planes
+    for (int i = 0; i < (format == PIX_FMT_NV12 ? 2 : 3); i++)
+    {
+        frame->data[i] = (uint8_t*) planes[i];
+        frame->linesize[i] = strides[i];
+    }
+
+    ffenc_frame *entry = wrap(frame);
+    entry->release = release;
+    entry->opaque = opaque;
+    return entry;
+}
+
+void ffenc_frame_pool::unwrap(ffenc_frame *entry)
+{
+    if (entry->layers) release_layers(entry->layers);
+
+    // the AVFrame of wrap_planes is ours, the one of wrap is the caller's
+    if (entry->release) av_free(entry->frame);
+    free(entry);
+}
+
+void ffenc_frame_pool::release(ffenc_frame *entry)
+{
+    if (entry->layers)
+    {
+        release_layers(entry->layers);
+        entry->layers = 0;
+    }
+
+    if (entry->release)
+    {
+        entry->release(entry->opaque);
+        av_free(entry->frame);
+        free(entry);
+        return;
+    }
+
+    if (!entry->buffer)
+    {
+        free(entry->frame->data[0]);
+        av_free(entry->frame);
+        free(entry);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+
+    stats.in_flight--;
+
+    layout *slot = find_layout(entry->format, entry->width, entry->height, false);
+
+    if (slot)
+    {
+        entry->next = slot->idle;
+        slot->idle = entry;
+        entry = 0;
+    }
+    else
+    {
+        stats.allocated--;
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    if (entry)
+    {
+        free(entry->buffer);
+        av_free(entry->frame);
+        free(entry);
+    }
+}
+
+void ffenc_frame_pool::get_stats(ffenc_pool_stats *stats)
+{
+    pthread_mutex_lock(&mutex);
+    *stats = this->stats;
+    pthread_mutex_unlock(&mutex);
+}
+
+void ffenc_frame_pool::configure_layers(const ffenc_size *sizes, int count, bool box)
+{
+    pthread_mutex_lock(&mutex);
+
+    for (int i = 0; i < count; i++)
+        layer_sizes[i] = sizes[i];
+    layer_count = count;
+    layer_box = box;
+
+    // layers still attached to frames are freed when they come back
+    layer_generation++;
+    while (idle_layers)
+    {
+        ffenc_layers *layers = idle_layers;
+        idle_layers = layers->next;
+        free_layers(layers);
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+void ffenc_frame_pool::free_layers(ffenc_layers *layers)
+{
+    for (int i = 0; i < layers->count; i++)
+        av_free(layers->frames[i]);
+    free(layers->buffer);
+    free(layers);
+}
+
+void ffenc_frame_pool::release_layers(ffenc_layers *layers)
+{
+    pthread_mutex_lock(&mutex);
+
+    if (layers->generation == layer_generation)
+    {
+        layers->next = idle_layers;
+        idle_layers = layers;
+        layers = 0;
+    }
+
+    pthread_mutex_unlock(&mutex);
+
+    if (layers) free_layers(layers);
+}
+
+bool ffenc_frame_pool::build_layers(ffenc_frame *entry)
+{
+    AVFrame *src = entry->frame;
+    if (entry->layers || (src->format != PIX_FMT_YUV420P && src->format != PIX_FMT_NV12)) return true;
+
+    pthread_mutex_lock(&mutex);
+
+    int count = layer_count;
+    bool box = layer_box;
+    int generation = layer_generation;
+    ffenc_size sizes[FFENC_MAX_LAYERS];
+    for (int i = 0; i < count; i++)
+        sizes[i] = layer_sizes[i];
+
+    ffenc_layers *layers = idle_layers;
+    if (layers) idle_layers = layers->next;
+
+    pthread_mutex_unlock(&mutex);
+
+    if (!count) return true;
+
+    if (!layers)
+    {
+        int size = 0;
+        for (int i = 0; i < count; i++)
+        {
+            size += FFALIGN(sizes[i].width, POOL_ALIGN) * sizes[i].height
+                    + FFALIGN(sizes[i].width / 2, POOL_ALIGN) * sizes[i].height;
+        }
+
+        layers = (ffenc_layers*) malloc(sizeof(ffenc_layers));
+        if (!layers) return false;
+
+        void *buffer = 0;
+        if (posix_memalign(&buffer, POOL_ALIGN, size) != 0) buffer = 0;
+        layers->buffer = (uint8_t*) buffer;
+        layers->count = 0;
+        layers->generation = generation;
+
+        uint8_t *data = layers->buffer;
+        for (int i = 0; data && i < count; i++)
+        {
+            AVFrame *frame = avcodec_alloc_frame();
+            if (!frame) break;
+            layers->frames[layers->count++] = frame;
+
+            int width = sizes[i].width;
+            int height = sizes[i].height;
+            int stride = FFALIGN(width, POOL_ALIGN);
+            int uv_stride = FFALIGN(width / 2, POOL_ALIGN);
+
+            frame->width = width;
+            frame->height = height;
+            frame->format = PIX_FMT_YUV420P;
+            frame->linesize[0] = stride;
+            frame->linesize[1] = uv_stride;
+            frame->linesize[2] = uv_stride;
+            frame->data[0] = data;
+            frame->data[1] = data + stride * height;
+            frame->data[2] = frame->data[1] + uv_stride * (height / 2);
+            data = frame->data[2] + uv_stride * (height / 2);
+        }
+
+        if (!layers->buffer || layers->count < count)
+        {
+            free_layers(layers);
+            return false;
+        }
+    }
+
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+
+    // each layer from the one above it, so only the first reads the whole frame
+    for (int i = 0; i < count; i++)
+    {
+        AVFrame *dst = layers->frames[i];
+
+        if (i == 0 && src->format == PIX_FMT_NV12)
+        {
+            ffconv_nv12_to_i420_scaled(kernels, box, src->data[0], src->linesize[0], src->data[1], src->linesize[1],
+                    entry->width, entry->height,
+                    dst->data[0], dst->linesize[0], dst->data[1], dst->linesize[1], dst->data[2], dst->linesize[2],
+                    dst->width, dst->height);
+        }
+        else
+        {
+            AVFrame *above = i == 0 ? src : layers->frames[i - 1];
+            int width = i == 0 ? entry->width : above->width;
+            int height = i == 0 ? entry->height : above->height;
+
+            ffconv_scale_i420(kernels, box, above->data[0], above->linesize[0], above->data[1], above->linesize[1],
+                    above->data[2], above->linesize[2], width, height,
+                    dst->data[0], dst->linesize[0], dst->data[1], dst->linesize[1], dst->data[2], dst->linesize[2],
+                    dst->width, dst->height);
+        }
+    }
+
+    entry->layers = layers;
+    return true;
+}
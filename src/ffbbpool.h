@@ -0,0 +1,157 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBPOOL_H
+#define FFBBPOOL_H
+
+#include "ffbbenc.h"
+
+// how many frame layouts keep idle buffers at once, enough for inputs
+// that alternate between NV12 and I420 at two sizes
+#define POOL_LAYOUTS 4
+
+/**
+ * Reduced copies of a frame, largest first, all I420 and in one buffer.
+ */
+struct ffenc_layers
+{
+    AVFrame *frames[FFENC_MAX_LAYERS];
+    int count;
+    uint8_t *buffer;
+    int generation;
+    ffenc_layers *next;
+};
+
+/**
+ * A queued frame. Frames handed in through add_frame(AVFrame*) are
+ * owned by the caller's allocation and have no buffer, everything
+ * else is recycled through an ffenc_frame_pool.
+ */
+struct ffenc_frame
+{
+    AVFrame *frame;
+    uint8_t *buffer;
+    int buffer_size;
+    int format;
+    int width;
+    int height;
+    int64_t queued_at;
+    int64_t sequence;
+    void (*release)(void *opaque);
+    void *opaque;
+    ffenc_layers *layers;
+    ffenc_frame *next;
+};
+
+class ffenc_frame_pool
+{
+public:
+
+    ffenc_frame_pool();
+    virtual ~ffenc_frame_pool();
+
+    /**
+     * Set the frame layout expected from now on. Idle buffers of every
+     * other layout are freed. The format is PIX_FMT_YUV420P or
+     * PIX_FMT_NV12.
+     */
+    void configure(int format, int width, int height);
+
+    /**
+     * Limit how many pooled frames may be in flight at once, 0 for no limit.
+     */
+    void set_limit(int max_in_flight);
+
+    /**
+     * Take a frame of the given layout. Each layout has idle buffers of
+     * its own, so frames of several layouts can be taken in turn and
+     * still be recycled. Past POOL_LAYOUTS layouts the idle buffers of
+     * the one used least recently are freed. Returns 0 when the limit
+     * on frames in flight has been reached.
+     */
+    ffenc_frame* acquire(int format, int width, int height);
+
+    /**
+     * Wrap a caller allocated AVFrame so it can be queued.
+     */
+    ffenc_frame* wrap(AVFrame *frame);
+
+    /**
+     * Wrap caller owned PIX_FMT_YUV420P or PIX_FMT_NV12 planes so they
+     * can be queued without a copy. release is called with opaque when
+     * the frame is released.
+     */
+    ffenc_frame* wrap_planes(int format, const uint8_t * const *planes, const int *strides, int width, int height,
+            void (*release)(void *opaque), void *opaque);
+
+    /**
+     * Free the wrapper from wrap() or wrap_planes() without touching the
+     * caller's memory.
+     */
+    void unwrap(ffenc_frame *entry);
+
+    /**
+     * Return a frame to the pool, or free it if it was wrapped.
+     * Its layers go back to the pool either way.
+     */
+    void release(ffenc_frame *entry);
+
+    /**
+     * Keep reduced copies of frames at these sizes, largest first, made
+     * by build_layers. Use a count of 0 for none. Idle layers of other
+     * sizes are freed.
+     */
+    void configure_layers(const ffenc_size *sizes, int count, bool box);
+
+    /**
+     * Make the configured layers of an I420 or NV12 frame, each scaled
+     * from the next larger one, and attach them to it. Does nothing when
+     * none are configured or the frame has its layers already. Returns
+     * false if they could not be allocated.
+     */
+    bool build_layers(ffenc_frame *entry);
+
+    void get_stats(ffenc_pool_stats *stats);
+
+private:
+
+    struct layout
+    {
+        int format;
+        int width;
+        int height;
+        ffenc_frame *idle;
+        int64_t used;
+    };
+
+    layout* find_layout(int format, int width, int height, bool create);
+    void free_idle(layout *slot);
+    void release_layers(ffenc_layers *layers);
+    static void free_layers(ffenc_layers *layers);
+
+    pthread_mutex_t mutex;
+    layout layouts[POOL_LAYOUTS];
+    int64_t uses;
+    int limit;
+    ffenc_pool_stats stats;
+
+    ffenc_layers *idle_layers;
+    ffenc_size layer_sizes[FFENC_MAX_LAYERS];
+    int layer_count;
+    bool layer_box;
+    int layer_generation;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBRECORDER_H
+#define FFBBRECORDER_H
+
+#include "ffbbstats.h"
+
+/**
+ * Collects ffbb_stats without locks. Every counter and bucket is
+ * updated with a single atomic add so any thread may record at any
+ * time. A snapshot taken while frames are recorded can see a frame in
+ * one histogram and not yet in another.
+ */
+class ffbb_recorder
+{
+public:
+
+    ffbb_recorder(int stage_count, const char * const *stage_names);
+
+    void record_stage(int stage, int64_t usec);
+    void record_depth(int depth);
+
+    void add_frames_in()
+    {
+        __sync_fetch_and_add(&frames_in, 1);
+    }
+
+    void add_frames_out()
+    {
+        __sync_fetch_and_add(&frames_out, 1);
+    }
+
+    void add_frames_dropped()
+    {
+        __sync_fetch_and_add(&frames_dropped, 1);
+    }
+
+    void add_bytes(int64_t bytes)
+    {
+        __sync_fetch_and_add(&this->bytes, bytes);
+    }
+
+    /**
+     * Copy everything out, and with reset also start a new period. The
+     * reset swaps each value for zero so nothing recorded in between is lost.
+     */
+    void snapshot(ffbb_stats *stats, bool reset);
+
+    void reset();
+
+private:
+
+    struct histogram
+    {
+        volatile int64_t count;
+        volatile int64_t sum;
+        volatile int64_t min;
+        volatile int64_t max;
+        volatile int64_t buckets[FFBB_HISTOGRAM_BUCKETS];
+    };
+
+    static void record(histogram *histogram, int64_t value);
+    static void copy(ffbb_histogram *dst, histogram *src, bool reset);
+
+    int stage_count;
+    const char *stage_names[FFBB_STATS_MAX_STAGES];
+
+    volatile int64_t started_at;
+    volatile int64_t frames_in;
+    volatile int64_t frames_out;
+    volatile int64_t frames_dropped;
+    volatile int64_t bytes;
+
+    histogram queue_depth;
+    histogram stages[FFBB_STATS_MAX_STAGES];
+};
+
+#endif
@@ -0,0 +1,191 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBRING_H
+#define FFBBRING_H
+
+#include <stdlib.h>
+
+#define FFBB_CACHE_LINE 64
+
+/**
+ * A bounded lock-free ring buffer. Any number of threads may push and
+ * pop at the same time. Each slot carries a sequence number that tells
+ * a producer when the slot is free and a consumer when it is filled, so
+ * the only contended writes are the compare-and-swap on the two cursors
+ * and the count of queued items.
+ *
+ * The slots are rounded up to a power of two, but the count keeps the
+ * ring to exactly the capacity it was made with, which must be at least 1.
+ */
+template<typename T>
+class ffbb_ring
+{
+public:
+
+    ffbb_ring(int capacity)
+    {
+        unsigned int size = 2;
+        while (size < (unsigned int) capacity)
+            size <<= 1;
+
+        mask = size - 1;
+        limit = capacity;
+        slots = (slot*) malloc(sizeof(slot) * size);
+
+        for (unsigned int i = 0; i < size; i++)
+        {
+            slots[i].sequence = i;
+        }
+
+        enqueue_pos = 0;
+        dequeue_pos = 0;
+        count = 0;
+    }
+
+    virtual ~ffbb_ring()
+    {
+        free(slots);
+    }
+
+    int capacity() const
+    {
+        return limit;
+    }
+
+    /**
+     * The number of queued items. This is only a snapshot when other
+     * threads are pushing or popping.
+     */
+    int size() const
+    {
+        __sync_synchronize();
+        return (int) (enqueue_pos - dequeue_pos);
+    }
+
+    bool empty() const
+    {
+        return size() <= 0;
+    }
+
+    /**
+     * Returns false without blocking if the ring is full.
+     */
+    bool push(T value)
+    {
+        // a place is taken before a slot, so no more than limit are ever queued
+        if (__sync_add_and_fetch(&count, 1) > limit)
+        {
+            __sync_sub_and_fetch(&count, 1);
+            return false;
+        }
+
+        slot *cell;
+        unsigned int pos = enqueue_pos;
+
+        while (true)
+        {
+            cell = &slots[pos & mask];
+            __sync_synchronize();
+            int dif = (int) (cell->sequence - pos);
+
+            if (dif == 0)
+            {
+                unsigned int prev = __sync_val_compare_and_swap(&enqueue_pos, pos, pos + 1);
+                if (prev == pos) break;
+                pos = prev;
+            }
+            else if (dif < 0)
+            {
+                __sync_sub_and_fetch(&count, 1);
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos;
+            }
+        }
+
+        cell->value = value;
+        __sync_synchronize();
+        cell->sequence = pos + 1;
+        __sync_synchronize();
+
+        return true;
+    }
+
+    /**
+     * Returns false without blocking if the ring is empty.
+     */
+    bool pop(T *value)
+    {
+        slot *cell;
+        unsigned int pos = dequeue_pos;
+
+        while (true)
+        {
+            cell = &slots[pos & mask];
+            __sync_synchronize();
+            int dif = (int) (cell->sequence - (pos + 1));
+
+            if (dif == 0)
+            {
+                unsigned int prev = __sync_val_compare_and_swap(&dequeue_pos, pos, pos + 1);
+                if (prev == pos) break;
+                pos = prev;
+            }
+            else if (dif < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos;
+            }
+        }
+
+        *value = cell->value;
+        __sync_synchronize();
+        cell->sequence = pos + mask + 1;
+
+        // only once the slot is free again, so a push that got a place finds it
+        __sync_sub_and_fetch(&count, 1);
+
+        return true;
+    }
+
+private:
+
+    struct slot
+    {
+        volatile unsigned int sequence;
+        T value;
+    };
+
+    // keep the two cursors on separate cache lines so producers
+    // and the consumer do not invalidate each other
+    slot *slots;
+    unsigned int mask;
+    int limit;
+    char pad0[FFBB_CACHE_LINE];
+    volatile unsigned int enqueue_pos;
+    char pad1[FFBB_CACHE_LINE];
+    volatile unsigned int dequeue_pos;
+    char pad2[FFBB_CACHE_LINE];
+    volatile int count;
+    char pad3[FFBB_CACHE_LINE];
+};
+
+#endif
@@ -0,0 +1,115 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbscene.h"
+
+#include <stdlib.h>
+
+ffenc_scene_detector::ffenc_scene_detector(const ffenc_scene_config *config)
+{
+    this->config = *config;
+    kernels = ffconv_get_kernels();
+
+    current = 0;
+    reference = 0;
+    thumb_width = 0;
+    thumb_height = 0;
+    have_reference = false;
+
+    changed_blocks = 0;
+    static_run = 0;
+}
+
+ffenc_scene_detector::~ffenc_scene_detector()
+{
+    free(current);
+    free(reference);
+}
+
+float ffenc_scene_detector::analyze(AVFrame *frame)
+{
+    int width = frame->width / 8;
+    int height = frame->height / 8;
+
+    if (width != thumb_width || height != thumb_height)
+    {
+        free(current);
+        free(reference);
+        current = (uint8_t*) malloc(width * height);
+        reference = (uint8_t*) malloc(width * height);
+        thumb_width = width;
+        thumb_height = height;
+        have_reference = false;
+    }
+
+    kernels->downsample_8x8(current, width, frame->data[0], frame->linesize[0], frame->width, frame->height);
+
+    int blocks = 0;
+    changed_blocks = 0;
+
+    for (int y = 0; y < height; y += SCENE_BLOCK)
+    {
+        int block_height = height - y < SCENE_BLOCK ? height - y : SCENE_BLOCK;
+
+        for (int x = 0; x < width; x += SCENE_BLOCK)
+        {
+            int block_width = width - x < SCENE_BLOCK ? width - x : SCENE_BLOCK;
+            blocks++;
+
+            if (!have_reference)
+            {
+                changed_blocks++;
+                continue;
+            }
+
+            int offset = y * width + x;
+            uint32_t sad = kernels->sad(current + offset, width, reference + offset, width,
+                    block_width, block_height);
+
+            // compare the mean difference so edge blocks are held to the same bar
+            if ((int) sad > config.block_threshold * block_width * block_height) changed_blocks++;
+        }
+    }
+
+    if (blocks == 0) return 100;
+    return changed_blocks * 100.0f / blocks;
+}
+
+bool ffenc_scene_detector::is_static()
+{
+    if (!have_reference || changed_blocks >= config.min_changed_blocks)
+    {
+        static_run = 0;
+        return false;
+    }
+
+    // let one through now and then so the output never stalls for good
+    if (config.max_static_frames > 0 && static_run >= config.max_static_frames)
+    {
+        static_run = 0;
+        return false;
+    }
+
+    static_run++;
+    return true;
+}
+
+void ffenc_scene_detector::accept()
+{
+    uint8_t *swap = reference;
+    reference = current;
+    current = swap;
+    have_reference = true;
+}
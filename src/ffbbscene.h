@@ -0,0 +1,74 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSCENE_H
+#define FFBBSCENE_H
+
+#include "ffbbenc.h"
+#include "ffbbconv.h"
+
+// thumbnail samples per side of a compared block, 64x64 pixels of the frame
+#define SCENE_BLOCK 8
+
+/**
+ * Compares the luma of each frame with the last frame that was encoded
+ * as changed. Both are shrunk by 8 in each direction first, so the cost
+ * is one pass over the luma plane plus a small compare.
+ */
+class ffenc_scene_detector
+{
+public:
+
+    ffenc_scene_detector(const ffenc_scene_config *config);
+    virtual ~ffenc_scene_detector();
+
+    /**
+     * Score the frame as the percentage of blocks that changed, from 0
+     * to 100. The first frame, and any frame after a size change, scores 100.
+     */
+    float analyze(AVFrame *frame);
+
+    /**
+     * Whether the last analyzed frame counts as unchanged. A run of
+     * unchanged frames is cut off after max_static_frames.
+     */
+    bool is_static();
+
+    /**
+     * Make the last analyzed frame the one the next frames are compared with.
+     */
+    void accept();
+
+    ffenc_static_action action()
+    {
+        return config.action;
+    }
+
+private:
+
+    ffenc_scene_config config;
+    const ffconv_kernels *kernels;
+
+    uint8_t *current;
+    uint8_t *reference;
+    int thumb_width;
+    int thumb_height;
+    bool have_reference;
+
+    int changed_blocks;
+    int static_run;
+};
+
+#endif
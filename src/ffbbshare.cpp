@@ -0,0 +1,107 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbshare.h"
+
+#include <stdlib.h>
+
+ffenc_shared_pool::ffenc_shared_pool()
+{
+    pthread_mutex_init(&mutex, 0);
+
+    frames = new ffenc_frame_pool();
+    idle = 0;
+    outstanding = 0;
+    destroyed = false;
+}
+
+ffenc_shared_pool::~ffenc_shared_pool()
+{
+    while (idle)
+    {
+        ffenc_shared_frame *shared = idle;
+        idle = shared->next;
+        free(shared);
+    }
+
+    delete frames;
+
+    pthread_mutex_destroy(&mutex);
+}
+
+ffenc_shared_frame* ffenc_shared_pool::acquire(int width, int height)
+{
+    ffenc_frame *entry = frames->acquire(PIX_FMT_YUV420P, width, height);
+    if (!entry) return 0;
+
+    pthread_mutex_lock(&mutex);
+
+    ffenc_shared_frame *shared = idle;
+    if (shared) idle = shared->next;
+    else shared = (ffenc_shared_frame*) malloc(sizeof(ffenc_shared_frame));
+    if (shared) outstanding++;
+
+    pthread_mutex_unlock(&mutex);
+
+    if (!shared)
+    {
+        frames->release(entry);
+        return 0;
+    }
+
+    shared->entry = entry;
+    shared->refs = 1;
+    shared->pool = this;
+    shared->next = 0;
+    return shared;
+}
+
+void ffenc_shared_pool::retain(ffenc_shared_frame *shared)
+{
+    __sync_fetch_and_add(&shared->refs, 1);
+}
+
+void ffenc_shared_pool::release(void *opaque)
+{
+    ffenc_shared_frame *shared = (ffenc_shared_frame*) opaque;
+    if (__sync_sub_and_fetch(&shared->refs, 1) == 0) shared->pool->recycle(shared);
+}
+
+void ffenc_shared_pool::recycle(ffenc_shared_frame *shared)
+{
+    frames->release(shared->entry);
+    shared->entry = 0;
+
+    pthread_mutex_lock(&mutex);
+
+    shared->next = idle;
+    idle = shared;
+    outstanding--;
+    bool done = destroyed && outstanding == 0;
+
+    pthread_mutex_unlock(&mutex);
+
+    if (done) delete this;
+}
+
+void ffenc_shared_pool::destroy()
+{
+    pthread_mutex_lock(&mutex);
+    destroyed = true;
+    bool done = outstanding == 0;
+    pthread_mutex_unlock(&mutex);
+
+    if (done) delete this;
+}
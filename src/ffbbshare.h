@@ -0,0 +1,82 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBSHARE_H
+#define FFBBSHARE_H
+
+#include "ffbbpool.h"
+
+class ffenc_shared_pool;
+
+/**
+ * A pooled frame queued by several contexts at once. It goes back to
+ * the pool when the last of them releases it.
+ */
+struct ffenc_shared_frame
+{
+    ffenc_frame *entry;
+    volatile int refs;
+    ffenc_shared_pool *pool;
+    ffenc_shared_frame *next;
+};
+
+/**
+ * Frames and their layers for contexts that share them without a copy.
+ * Frames still held when the pool is destroyed keep it alive until the
+ * last one is released.
+ */
+class ffenc_shared_pool
+{
+public:
+
+    ffenc_shared_pool();
+
+    /**
+     * Where the shared frames come from, configured by the owner.
+     */
+    ffenc_frame_pool *frames;
+
+    /**
+     * Take a frame from frames and give it one reference, held by the
+     * caller. Returns 0 if the pool is out of frames or memory.
+     */
+    ffenc_shared_frame* acquire(int width, int height);
+
+    static void retain(ffenc_shared_frame *shared);
+
+    /**
+     * Drop a reference, taking a void pointer so it can be the release
+     * function of an ffenc_image.
+     */
+    static void release(void *shared);
+
+    /**
+     * Delete the pool now, or once the last frame comes back.
+     */
+    void destroy();
+
+private:
+
+    virtual ~ffenc_shared_pool();
+
+    void recycle(ffenc_shared_frame *shared);
+
+    pthread_mutex_t mutex;
+    ffenc_shared_frame *idle;
+    int outstanding;
+    bool destroyed;
+};
+
+#endif
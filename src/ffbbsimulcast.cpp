@@ -0,0 +1,347 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbsimulcast.h"
+#include "ffbbshare.h"
+#include "ffbbconv.h"
+#include "ffbbrecorder.h"
+#include "ffbbtime.h"
+#include "ffbbtracer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the group only times the shared conversion, the rest comes from the layers
+#define STAGE_INGEST 0
+
+static const char *stage_names[] = { "ingest", "queue", "encode", "write", "total" };
+
+ffenc_simulcast::ffenc_simulcast()
+{
+    layer_count = 0;
+    width = 0;
+    height = 0;
+    scale_filter = FFENC_SCALE_BOX;
+    shared = new ffenc_shared_pool();
+    recorder = new ffbb_recorder(5, stage_names);
+    running = false;
+}
+
+ffenc_simulcast::~ffenc_simulcast()
+{
+    stop();
+
+    // frames the layers still hold keep the pool alive
+    shared->destroy();
+    delete recorder;
+}
+
+ffenc_error ffenc_simulcast::add_layer(ffenc_context *context)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (layer_count == FFENC_SIMULCAST_MAX_LAYERS) return FFENC_QUEUE_FULL;
+
+    layers[layer_count++] = context;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::set_scale_filter(ffenc_scale_filter filter)
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    scale_filter = filter;
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::start()
+{
+    if (running) return FFENC_ALREADY_RUNNING;
+    if (!layer_count) return FFENC_NO_CODEC_SPECIFIED;
+
+    ffenc_size sizes[FFENC_SIMULCAST_MAX_LAYERS];
+    width = 0;
+    height = 0;
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        ffenc_error result = layers[i]->get_frame_size(&sizes[i]);
+        if (result != FFENC_OK) return result;
+
+        if (sizes[i].width * sizes[i].height > width * height)
+        {
+            width = sizes[i].width;
+            height = sizes[i].height;
+        }
+    }
+
+    // every other size once, largest first, so each is scaled from the one above it
+    ffenc_size pyramid[FFENC_MAX_LAYERS];
+    int pyramid_count = 0;
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        ffenc_size size = sizes[i];
+        if (size.width == width && size.height == height) continue;
+
+        int at = 0;
+        while (at < pyramid_count && (pyramid[at].width != size.width || pyramid[at].height != size.height))
+            at++;
+        if (at < pyramid_count) continue;
+        if (pyramid_count == FFENC_MAX_LAYERS) return FFENC_FRAME_NOT_SUPPORTED;
+
+        at = pyramid_count++;
+        while (at > 0 && pyramid[at - 1].width * pyramid[at - 1].height < size.width * size.height)
+        {
+            pyramid[at] = pyramid[at - 1];
+            at--;
+        }
+        pyramid[at] = size;
+    }
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        sources[i] = -1;
+        for (int j = 0; j < pyramid_count; j++)
+        {
+            if (pyramid[j].width == sizes[i].width && pyramid[j].height == sizes[i].height) sources[i] = j;
+        }
+    }
+
+    shared->frames->configure(PIX_FMT_YUV420P, width, height);
+    shared->frames->configure_layers(pyramid, pyramid_count, scale_filter != FFENC_SCALE_BILINEAR);
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        ffenc_error result = layers[i]->start();
+        if (result != FFENC_OK)
+        {
+            while (i-- > 0)
+                layers[i]->stop();
+            return result;
+        }
+    }
+
+    recorder->reset();
+    running = true;
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::stop()
+{
+    if (!running) return FFENC_ALREADY_STOPPED;
+
+    running = false;
+
+    for (int i = 0; i < layer_count; i++)
+        layers[i]->stop();
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::add_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+        int width, int height, int64_t timestamp)
+{
+    return add_nv12_frame(srcy, stride, srcuv, uv_stride, width, height, timestamp, false);
+}
+
+ffenc_error ffenc_simulcast::add_frame(const ffenc_image *image)
+{
+    if (image->format != FFENC_PIXEL_NV12 && image->format != FFENC_PIXEL_NV21) return FFENC_FRAME_NOT_SUPPORTED;
+
+    ffenc_error result = add_nv12_frame(image->planes[0], image->strides[0], image->planes[1], image->strides[1],
+            image->width, image->height, image->timestamp, image->format == FFENC_PIXEL_NV21);
+
+    if (result == FFENC_OK && image->release) image->release(image->opaque);
+
+    return result;
+}
+
+#if !OSX_PLATFORM && !LINUX_PLATFORM
+ffenc_error ffenc_simulcast::add_frame(camera_buffer_t* buf)
+{
+    if (buf->frametype != CAMERA_FRAMETYPE_NV12) return FFENC_FRAME_NOT_SUPPORTED;
+
+    int64_t uv_offset = buf->framedesc.nv12.uv_offset;
+    uint32_t stride = buf->framedesc.nv12.stride;
+
+    return add_nv12_frame(buf->framebuf, stride, &buf->framebuf[uv_offset], stride,
+            buf->framedesc.nv12.width, buf->framedesc.nv12.height, buf->frametimestamp, false);
+}
+#elif OSX_PLATFORM
+ffenc_error ffenc_simulcast::add_frame(CVImageBufferRef pixelBuffer)
+{
+    OSType formatType = CVPixelBufferGetPixelFormatType(pixelBuffer);
+    if (formatType != kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange)
+    {
+        return FFENC_FRAME_NOT_SUPPORTED;
+    }
+
+    CVPixelBufferLockBaseAddress(pixelBuffer, 0);
+
+    uint8_t *srcy = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 0);
+    uint8_t *srcuv = (uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 1);
+
+    ffenc_error result = add_nv12_frame(srcy, CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 0),
+            srcuv, CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 1),
+            CVPixelBufferGetWidth(pixelBuffer), CVPixelBufferGetHeight(pixelBuffer), ffbb_time_usec(), false);
+
+    CVPixelBufferUnlockBaseAddress(pixelBuffer, 0);
+
+    return result;
+}
+#endif
+
+ffenc_error ffenc_simulcast::add_nv12_frame(const uint8_t *srcy, int stride, const uint8_t *srcuv, int uv_stride,
+        int width, int height, int64_t timestamp, bool nv21)
+{
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) return FFENC_FRAME_NOT_SUPPORTED;
+
+    if (!running) return FFENC_NOT_RUNNING;
+
+    int64_t started_at = ffbb_time_usec();
+    recorder->add_frames_in();
+
+    ffenc_shared_frame *frame = shared->acquire(this->width, this->height);
+    if (!frame)
+    {
+        recorder->add_frames_dropped();
+        return FFENC_POOL_EXHAUSTED;
+    }
+
+    const ffconv_kernels *kernels = ffconv_get_kernels();
+    ffenc_frame *entry = frame->entry;
+    AVFrame *picture = entry->frame;
+
+    // NV21 is NV12 with the chroma planes swapped
+    uint8_t *dstu = picture->data[nv21 ? 2 : 1];
+    uint8_t *dstv = picture->data[nv21 ? 1 : 2];
+
+    if (width == this->width && height == this->height)
+    {
+        ffconv_nv12_to_i420(kernels, srcy, stride, srcuv, uv_stride,
+                picture->data[0], picture->linesize[0], dstu, picture->linesize[1], dstv, picture->linesize[2],
+                width, height);
+    }
+    else
+    {
+        ffconv_nv12_to_i420_scaled(kernels, scale_filter != FFENC_SCALE_BILINEAR, srcy, stride, srcuv, uv_stride,
+                width, height,
+                picture->data[0], picture->linesize[0], dstu, picture->linesize[1], dstv, picture->linesize[2],
+                this->width, this->height);
+    }
+
+    shared->frames->build_layers(entry);
+
+    int64_t converted_at = ffbb_time_usec();
+    if (ffbb_tracing()) ffbb_trace_span("convert", started_at, converted_at, -1);
+
+    int accepted = 0;
+    ffenc_error error = FFENC_OK;
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        AVFrame *source = picture;
+        if (sources[i] >= 0) source = entry->layers ? entry->layers->frames[sources[i]] : 0;
+
+        // the layers could not be allocated, the smaller sizes miss this frame
+        if (!source)
+        {
+            if (error == FFENC_OK) error = FFENC_POOL_EXHAUSTED;
+            continue;
+        }
+
+        ffenc_image image;
+        memset(&image, 0, sizeof(ffenc_image));
+        image.format = FFENC_PIXEL_I420;
+        image.width = source->width;
+        image.height = source->height;
+        image.timestamp = timestamp;
+        image.release = &ffenc_shared_pool::release;
+        image.opaque = frame;
+
+        for (int j = 0; j < 3; j++)
+        {
+            image.planes[j] = source->data[j];
+            image.strides[j] = source->linesize[j];
+        }
+
+        // released by the layer once encoded, or right here if it does not take the frame
+        ffenc_shared_pool::retain(frame);
+        ffenc_error result = layers[i]->add_frame(&image);
+
+        if (result == FFENC_OK)
+        {
+            accepted++;
+        }
+        else
+        {
+            ffenc_shared_pool::release(frame);
+            if (error == FFENC_OK) error = result;
+        }
+    }
+
+    ffenc_shared_pool::release(frame);
+
+    int64_t finished_at = ffbb_time_usec();
+    recorder->record_stage(STAGE_INGEST, finished_at - started_at);
+    if (ffbb_tracing()) ffbb_trace_span("ingest", started_at, finished_at, -1);
+
+    if (!accepted)
+    {
+        recorder->add_frames_dropped();
+        return error;
+    }
+
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::get_stats(ffbb_stats *stats, bool reset)
+{
+    ffbb_stats *layer = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    if (!layer) return FFENC_POOL_EXHAUSTED;
+
+    recorder->snapshot(stats, reset);
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        layers[i]->get_stats(layer, reset);
+
+        stats->frames_out += layer->frames_out;
+        stats->frames_dropped += layer->frames_dropped;
+        stats->bytes += layer->bytes;
+        ffbb_histogram_merge(&stats->queue_depth, &layer->queue_depth);
+
+        // the ingest of a layer is only the hand off, the group timed the real one
+        for (int j = STAGE_INGEST + 1; j < stats->stage_count && j < layer->stage_count; j++)
+            ffbb_histogram_merge(&stats->stages[j], &layer->stages[j]);
+    }
+
+    stats->fps = stats->elapsed > 0 ? stats->frames_out * 1000000.0 / stats->elapsed : 0;
+
+    free(layer);
+    return FFENC_OK;
+}
+
+ffenc_error ffenc_simulcast::write_stats(int fd, bool reset)
+{
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+    if (!stats) return FFENC_WRITE_ERROR;
+
+    ffenc_error result = get_stats(stats, reset);
+    if (result == FFENC_OK && ffbb_stats_write(stats, "ffenc_simulcast", fd) != 0) result = FFENC_WRITE_ERROR;
+    free(stats);
+
+    return result;
+}
@@ -0,0 +1,297 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbrecorder.h"
+#include "ffbbtime.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// each power of two is split into 1 << HISTOGRAM_SUB_BITS buckets
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+
+// the minimum of a histogram nothing was recorded in
+#define HISTOGRAM_EMPTY_MIN 0x7fffffffffffffffLL
+
+static int bucket_index(int64_t value)
+{
+    if (value < HISTOGRAM_SUB_COUNT) return value < 0 ? 0 : (int) value;
+
+    int exponent = 63 - __builtin_clzll((unsigned long long) value);
+    int sub = (int) (value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1);
+    int index = (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT + sub;
+
+    return index < FFBB_HISTOGRAM_BUCKETS ? index : FFBB_HISTOGRAM_BUCKETS - 1;
+}
+
+static int64_t bucket_upper(int index)
+{
+    if (index < HISTOGRAM_SUB_COUNT) return index;
+
+    int exponent = index / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS - 1;
+    int64_t sub = index % HISTOGRAM_SUB_COUNT;
+    int64_t width = (int64_t) 1 << (exponent - HISTOGRAM_SUB_BITS);
+
+    return ((HISTOGRAM_SUB_COUNT + sub) << (exponent - HISTOGRAM_SUB_BITS)) + width - 1;
+}
+
+int64_t ffbb_histogram_percentile(const ffbb_histogram *histogram, double fraction)
+{
+    if (histogram->count <= 0) return 0;
+
+    int64_t target = (int64_t) (fraction * histogram->count + 0.5);
+    if (target < 1) target = 1;
+
+    int64_t seen = 0;
+    for (int i = 0; i < FFBB_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= target)
+        {
+            int64_t value = bucket_upper(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+void ffbb_histogram_merge(ffbb_histogram *dst, const ffbb_histogram *src)
+{
+    if (src->count <= 0) return;
+
+    // an empty histogram reads a min of 0, which is not a value to keep
+    if (dst->count <= 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (int i = 0; i < FFBB_HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+ffbb_recorder::ffbb_recorder(int stage_count, const char * const *stage_names)
+{
+    if (stage_count > FFBB_STATS_MAX_STAGES) stage_count = FFBB_STATS_MAX_STAGES;
+    this->stage_count = stage_count;
+
+    for (int i = 0; i < FFBB_STATS_MAX_STAGES; i++)
+        this->stage_names[i] = i < stage_count ? stage_names[i] : 0;
+
+    memset(&queue_depth, 0, sizeof(queue_depth));
+    memset(stages, 0, sizeof(stages));
+
+    queue_depth.min = HISTOGRAM_EMPTY_MIN;
+    for (int i = 0; i < FFBB_STATS_MAX_STAGES; i++)
+        stages[i].min = HISTOGRAM_EMPTY_MIN;
+
+    reset();
+}
+
+void ffbb_recorder::record(histogram *histogram, int64_t value)
+{
+    if (value < 0) value = 0;
+
+    __sync_fetch_and_add(&histogram->buckets[bucket_index(value)], 1);
+    __sync_fetch_and_add(&histogram->sum, value);
+    __sync_fetch_and_add(&histogram->count, 1);
+
+    ffbb_atomic_max(&histogram->max, value);
+    ffbb_atomic_min(&histogram->min, value);
+}
+
+void ffbb_recorder::record_stage(int stage, int64_t usec)
+{
+    if (stage < 0 || stage >= stage_count) return;
+    record(&stages[stage], usec);
+}
+
+void ffbb_recorder::record_depth(int depth)
+{
+    record(&queue_depth, depth);
+}
+
+void ffbb_recorder::copy(ffbb_histogram *dst, histogram *src, bool reset)
+{
+    if (reset)
+    {
+        dst->count = __sync_fetch_and_and(&src->count, 0);
+        dst->sum = __sync_fetch_and_and(&src->sum, 0);
+        dst->min = __sync_lock_test_and_set(&src->min, HISTOGRAM_EMPTY_MIN);
+        dst->max = __sync_fetch_and_and(&src->max, 0);
+
+        for (int i = 0; i < FFBB_HISTOGRAM_BUCKETS; i++)
+            dst->buckets[i] = __sync_fetch_and_and(&src->buckets[i], 0);
+    }
+    else
+    {
+        dst->count = src->count;
+        dst->sum = src->sum;
+        dst->min = src->min;
+        dst->max = src->max;
+
+        for (int i = 0; i < FFBB_HISTOGRAM_BUCKETS; i++)
+            dst->buckets[i] = src->buckets[i];
+    }
+
+    if (dst->min == HISTOGRAM_EMPTY_MIN) dst->min = 0;
+}
+
+void ffbb_recorder::snapshot(ffbb_stats *stats, bool reset)
+{
+    int64_t now = ffbb_time_usec();
+    int64_t started = reset ? __sync_lock_test_and_set(&started_at, now) : started_at;
+
+    stats->elapsed = now - started;
+
+    if (reset)
+    {
+        stats->frames_in = __sync_fetch_and_and(&frames_in, 0);
+        stats->frames_out = __sync_fetch_and_and(&frames_out, 0);
+        stats->frames_dropped = __sync_fetch_and_and(&frames_dropped, 0);
+        stats->bytes = __sync_fetch_and_and(&bytes, 0);
+    }
+    else
+    {
+        stats->frames_in = frames_in;
+        stats->frames_out = frames_out;
+        stats->frames_dropped = frames_dropped;
+        stats->bytes = bytes;
+    }
+
+    stats->fps = stats->elapsed > 0 ? stats->frames_out * 1000000.0 / stats->elapsed : 0;
+
+    copy(&stats->queue_depth, &queue_depth, reset);
+
+    stats->stage_count = stage_count;
+    for (int i = 0; i < FFBB_STATS_MAX_STAGES; i++)
+    {
+        stats->stage_names[i] = stage_names[i];
+        if (i < stage_count) copy(&stats->stages[i], &stages[i], reset);
+        else memset(&stats->stages[i], 0, sizeof(ffbb_histogram));
+    }
+}
+
+void ffbb_recorder::reset()
+{
+    ffbb_stats *stats = (ffbb_stats*) malloc(sizeof(ffbb_stats));
+
+    if (stats)
+    {
+        snapshot(stats, true);
+        free(stats);
+    }
+    else
+    {
+        started_at = ffbb_time_usec();
+    }
+}
+
+typedef struct
+{
+    char *buf;
+    int size;
+    int length;
+} text_buffer;
+
+static void append(text_buffer *text, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    int room = text->length < text->size ? text->size - text->length : 0;
+    int length = vsnprintf(room ? text->buf + text->length : 0, room, format, args);
+    if (length > 0) text->length += length;
+
+    va_end(args);
+}
+
+static void append_histogram(text_buffer *text, const char *prefix, const char *name,
+        const char *labels, const ffbb_histogram *histogram)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    static const char *quantile_names[] = { "0.5", "0.9", "0.99", "0.999" };
+
+    const char *separator = labels[0] ? "," : "";
+
+    char braced[80] = "";
+    if (labels[0]) snprintf(braced, sizeof(braced), "{%s}", labels);
+
+    for (int i = 0; i < 4; i++)
+    {
+        append(text, "%s_%s{%s%squantile=\"%s\"} %lld\n", prefix, name, labels, separator,
+                quantile_names[i], (long long) ffbb_histogram_percentile(histogram, quantiles[i]));
+    }
+
+    append(text, "%s_%s_min%s %lld\n", prefix, name, braced, (long long) histogram->min);
+    append(text, "%s_%s_max%s %lld\n", prefix, name, braced, (long long) histogram->max);
+    append(text, "%s_%s_sum%s %lld\n", prefix, name, braced, (long long) histogram->sum);
+    append(text, "%s_%s_count%s %lld\n", prefix, name, braced, (long long) histogram->count);
+}
+
+int ffbb_stats_format(const ffbb_stats *stats, const char *prefix, char *buf, int size)
+{
+    text_buffer text;
+    text.buf = buf;
+    text.size = buf ? size : 0;
+    text.length = 0;
+
+    if (text.size > 0) buf[0] = '\0';
+
+    append(&text, "%s_elapsed_usec %lld\n", prefix, (long long) stats->elapsed);
+    append(&text, "%s_frames_in %lld\n", prefix, (long long) stats->frames_in);
+    append(&text, "%s_frames_out %lld\n", prefix, (long long) stats->frames_out);
+    append(&text, "%s_frames_dropped %lld\n", prefix, (long long) stats->frames_dropped);
+    append(&text, "%s_bytes %lld\n", prefix, (long long) stats->bytes);
+    append(&text, "%s_fps %.2f\n", prefix, stats->fps);
+
+    append_histogram(&text, prefix, "queue_depth", "", &stats->queue_depth);
+
+    for (int i = 0; i < stats->stage_count && i < FFBB_STATS_MAX_STAGES; i++)
+    {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", stats->stage_names[i]);
+        append_histogram(&text, prefix, "latency_usec", labels, &stats->stages[i]);
+    }
+
+    return text.length;
+}
+
+int ffbb_stats_write(const ffbb_stats *stats, const char *prefix, int fd)
+{
+    int length = ffbb_stats_format(stats, prefix, 0, 0);
+
+    char *buf = (char*) malloc(length + 1);
+    if (!buf) return -1;
+
+    ffbb_stats_format(stats, prefix, buf, length + 1);
+
+    int written = 0;
+    while (written < length)
+    {
+        ssize_t result = write(fd, buf + written, length - written);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) break;
+        written += result;
+    }
+
+    free(buf);
+    return written == length ? 0 : -1;
+}
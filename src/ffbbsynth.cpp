@@ -0,0 +1,411 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbsynth.h"
+#include "ffbbtime.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// pixels the bars move each frame
+#define BARS_SPEED 4
+
+// 75% color bars in limited range BT.601, as Y, U, V
+static const uint8_t bar_colors[8][3] =
+{
+    { 180, 128, 128 }, // white
+    { 162, 44, 142 }, // yellow
+    { 131, 156, 44 }, // cyan
+    { 112, 72, 58 }, // green
+    { 84, 184, 198 }, // magenta
+    { 65, 100, 212 }, // red
+    { 35, 212, 114 }, // blue
+    { 16, 128, 128 } // black
+};
+
+void* synthesizing_thread(void* arg);
+
+ffsynth_source::ffsynth_source()
+{
+    width = 1280;
+    height = 720;
+    fps = 30;
+    pattern = FFSYNTH_PATTERN_BARS;
+    frame_limit = 0;
+    frame_index = 0;
+    started_at = 0;
+
+    y = 0;
+    uv = 0;
+    background = 0;
+    seed = 0x9e3779b9;
+
+    replay = 0;
+
+    running = false;
+    joinable = false;
+
+    ffe_context = 0;
+
+    frame_callback = 0;
+    frame_callback_arg = 0;
+
+    close_callback = 0;
+    close_callback_arg = 0;
+}
+
+ffsynth_source::~ffsynth_source()
+{
+    stop();
+
+    free(y);
+    free(uv);
+    free(background);
+
+    if (replay) fclose(replay);
+}
+
+ffsynth_error ffsynth_source::set_size(int width, int height)
+{
+    if (running) return FFSYNTH_ALREADY_RUNNING;
+    if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) return FFSYNTH_INVALID_SIZE;
+
+    this->width = width;
+    this->height = height;
+
+    // allocated again at the new size by the next frame
+    free(y);
+    free(uv);
+    free(background);
+    y = 0;
+    uv = 0;
+    background = 0;
+
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_fps(double fps)
+{
+    if (running) return FFSYNTH_ALREADY_RUNNING;
+    this->fps = fps > 0 ? fps : 0;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_pattern(ffsynth_pattern pattern)
+{
+    this->pattern = pattern;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_replay_file(const char *path)
+{
+    if (running) return FFSYNTH_ALREADY_RUNNING;
+
+    if (replay) fclose(replay);
+    replay = 0;
+
+    if (!path) return FFSYNTH_OK;
+
+    replay = fopen(path, "rb");
+    if (!replay) return FFSYNTH_FILE_ERROR;
+
+    // at least one whole frame or there is nothing to loop over
+    fseek(replay, 0, SEEK_END);
+    long size = ftell(replay);
+    rewind(replay);
+
+    if (size < (long) width * height * 3 / 2)
+    {
+        fclose(replay);
+        replay = 0;
+        return FFSYNTH_INVALID_SIZE;
+    }
+
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_frame_limit(int64_t frames)
+{
+    frame_limit = frames > 0 ? frames : 0;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_encoder(ffenc_context *ffe_context)
+{
+    if (running) return FFSYNTH_ALREADY_RUNNING;
+    this->ffe_context = ffe_context;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_frame_callback(
+        void (*frame_callback)(ffsynth_source *source, const ffsynth_frame *frame, void *arg),
+        void *arg)
+{
+    this->frame_callback = frame_callback;
+    frame_callback_arg = arg;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::set_close_callback(
+        void (*close_callback)(ffsynth_source *source, void *arg),
+        void *arg)
+{
+    this->close_callback = close_callback;
+    close_callback_arg = arg;
+    return FFSYNTH_OK;
+}
+
+bool ffsynth_source::allocate()
+{
+    if (y) return true;
+
+    y = (uint8_t*) malloc(width * height);
+    uv = (uint8_t*) malloc(width * height / 2);
+    background = (uint8_t*) malloc(width * height);
+
+    if (!y || !uv || !background)
+    {
+        free(y);
+        free(uv);
+        free(background);
+        y = 0;
+        uv = 0;
+        background = 0;
+        return false;
+    }
+
+    // a diagonal ramp for the box to move over
+    for (int row = 0; row < height; row++)
+    {
+        uint8_t *dst = background + row * width;
+        for (int x = 0; x < width; x++)
+            dst[x] = (uint8_t) (16 + (x + row) * 219 / (width + height));
+    }
+
+    return true;
+}
+
+void ffsynth_source::draw_bars(int offset)
+{
+    // every row is the same, draw one of each plane and copy it down
+    for (int x = 0; x < width; x++)
+    {
+        int bar = ((x + offset) % width) * 8 / width;
+        y[x] = bar_colors[bar][0];
+    }
+
+    for (int x = 0; x < width; x += 2)
+    {
+        int bar = ((x + offset) % width) * 8 / width;
+        uv[x] = bar_colors[bar][1];
+        uv[x + 1] = bar_colors[bar][2];
+    }
+
+    for (int row = 1; row < height; row++)
+        memcpy(y + row * width, y, width);
+
+    for (int row = 1; row < height / 2; row++)
+        memcpy(uv + row * width, uv, width);
+}
+
+static int bounce(int64_t position, int range)
+{
+    if (range <= 0) return 0;
+    int64_t phase = position % (range * 2);
+    return (int) (phase < range ? phase : range * 2 - phase);
+}
+
+void ffsynth_source::draw_box(int64_t index)
+{
+    memcpy(y, background, width * height);
+    memset(uv, 128, width * height / 2);
+
+    // even sizes and positions so the box covers whole chroma samples
+    int box_width = (width / 8) & ~1;
+    int box_height = (height / 8) & ~1;
+    int left = bounce(index * 6, width - box_width) & ~1;
+    int top = bounce(index * 4, height - box_height) & ~1;
+
+    for (int row = top; row < top + box_height; row++)
+        memset(y + row * width + left, 235, box_width);
+
+    for (int row = top / 2; row < (top + box_height) / 2; row++)
+    {
+        uint8_t *dst = uv + row * width + left;
+        for (int x = 0; x < box_width; x += 2)
+        {
+            dst[x] = 90;
+            dst[x + 1] = 240;
+        }
+    }
+}
+
+void ffsynth_source::draw_noise()
+{
+    uint32_t state = seed;
+
+    // xorshift, four pixels per step
+    int y_words = width * height / 4;
+    uint32_t *dst = (uint32_t*) y;
+    for (int i = 0; i < y_words; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        dst[i] = state;
+    }
+
+    int uv_words = width * height / 8;
+    dst = (uint32_t*) uv;
+    for (int i = 0; i < uv_words; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        dst[i] = state;
+    }
+
+    seed = state;
+}
+
+bool ffsynth_source::read_frame()
+{
+    size_t y_size = width * height;
+    size_t uv_size = width * height / 2;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (fread(y, 1, y_size, replay) == y_size && fread(uv, 1, uv_size, replay) == uv_size)
+            return true;
+
+        // a partial frame at the end is skipped along with the loop back
+        rewind(replay);
+    }
+
+    return false;
+}
+
+ffsynth_error ffsynth_source::next_frame(ffsynth_frame *frame)
+{
+    if (!allocate()) return FFSYNTH_INVALID_SIZE;
+
+    if (replay)
+    {
+        if (!read_frame()) return FFSYNTH_FILE_ERROR;
+    }
+    else
+    {
+        switch (pattern)
+        {
+            case FFSYNTH_PATTERN_BARS:
+                draw_bars((int) ((frame_index * BARS_SPEED) % width));
+                break;
+
+            case FFSYNTH_PATTERN_BOX:
+                draw_box(frame_index);
+                break;
+
+            case FFSYNTH_PATTERN_NOISE:
+                draw_noise();
+                break;
+
+            case FFSYNTH_PATTERN_STILL:
+                draw_bars(0);
+                break;
+        }
+    }
+
+    if (!started_at) started_at = ffbb_time_usec();
+
+    frame->y = y;
+    frame->y_stride = width;
+    frame->uv = uv;
+    frame->uv_stride = width;
+    frame->width = width;
+    frame->height = height;
+    frame->index = frame_index;
+    frame->timestamp = fps > 0 ? started_at + (int64_t) (frame_index * 1000000.0 / fps) : ffbb_time_usec();
+
+    frame_index++;
+
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::start()
+{
+    if (running) return FFSYNTH_ALREADY_RUNNING;
+
+    // a second start after the thread finished on its own
+    if (joinable) pthread_join(thread, 0);
+    joinable = false;
+
+    frame_index = 0;
+    started_at = 0;
+    running = true;
+
+    if (pthread_create(&thread, 0, &::synthesizing_thread, this) != 0)
+    {
+        running = false;
+        return FFSYNTH_THREAD_ERROR;
+    }
+
+    joinable = true;
+    return FFSYNTH_OK;
+}
+
+ffsynth_error ffsynth_source::stop()
+{
+    if (!joinable) return FFSYNTH_ALREADY_STOPPED;
+
+    running = false;
+    pthread_join(thread, 0);
+    joinable = false;
+
+    return FFSYNTH_OK;
+}
+
+void* synthesizing_thread(void* arg)
+{
+    ffsynth_source *source = (ffsynth_source*) arg;
+    source->synthesizing_thread();
+    return 0;
+}
+
+void ffsynth_source::synthesizing_thread()
+{
+    ffsynth_frame frame;
+
+    while (running && (!frame_limit || frame_index < frame_limit))
+    {
+        if (next_frame(&frame) != FFSYNTH_OK) break;
+
+        // wait for the frame's time so the rate holds however long drawing took
+        int64_t wait = frame.timestamp - ffbb_time_usec();
+        if (fps > 0 && wait > 0) usleep(wait);
+
+        if (ffe_context)
+        {
+            ffe_context->add_frame(frame.y, frame.y_stride, frame.uv, frame.uv_stride,
+                    frame.width, frame.height, frame.timestamp);
+        }
+
+        if (frame_callback) frame_callback(this, &frame, frame_callback_arg);
+    }
+
+    running = false;
+
+    if (close_callback) close_callback(this, close_callback_arg);
+}
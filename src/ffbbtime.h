@@ -0,0 +1,60 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBTIME_H
+#define FFBBTIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Microseconds on the monotonic clock.
+ */
+static inline int64_t ffbb_time_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Raise *max to value if it is larger, safe against concurrent callers.
+ */
+static inline void ffbb_atomic_max(volatile int64_t *max, int64_t value)
+{
+    int64_t current = *max;
+    while (value > current)
+    {
+        int64_t prev = __sync_val_compare_and_swap(max, current, value);
+        if (prev == current) break;
+        current = prev;
+    }
+}
+
+/**
+ * Lower *min to value if it is smaller, safe against concurrent callers.
+ */
+static inline void ffbb_atomic_min(volatile int64_t *min, int64_t value)
+{
+    int64_t current = *min;
+    while (value < current)
+    {
+        int64_t prev = __sync_val_compare_and_swap(min, current, value);
+        if (prev == current) break;
+        current = prev;
+    }
+}
+
+#endif
@@ -0,0 +1,300 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbtracer.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_DEFAULT_EVENTS 16384
+
+// flushed to the file descriptor whenever it fills
+#define TRACE_WRITE_BUFFER 65536
+
+typedef struct
+{
+    const char *name;
+    int64_t begin;
+    int64_t end;
+    int64_t id;
+    bool async;
+} trace_event;
+
+typedef struct trace_ring
+{
+    trace_event *events;
+    int capacity;
+    volatile int64_t head;
+    int generation;
+    int tid;
+    const char *thread_name;
+    volatile bool exited;
+    struct trace_ring *next;
+} trace_ring;
+
+volatile int ffbb_trace_on = 0;
+
+static pthread_once_t keys_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_key_t name_key;
+
+// only taken when a thread records its first event or a capture starts
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring *rings = 0;
+static int next_tid = 1;
+static volatile int generation = 0;
+static int events_per_thread = TRACE_DEFAULT_EVENTS;
+
+static void thread_exited(void *arg)
+{
+    // kept for the capture, freed by the next start
+    trace_ring *ring = (trace_ring*) arg;
+    ring->exited = true;
+}
+
+static void create_keys()
+{
+    pthread_key_create(&ring_key, &thread_exited);
+    pthread_key_create(&name_key, 0);
+}
+
+static trace_ring* thread_ring()
+{
+    pthread_once(&keys_once, &create_keys);
+
+    trace_ring *ring = (trace_ring*) pthread_getspecific(ring_key);
+    if (ring) return ring;
+
+    ring = (trace_ring*) malloc(sizeof(trace_ring));
+    if (!ring) return 0;
+
+    pthread_mutex_lock(&rings_mutex);
+
+    ring->capacity = events_per_thread;
+    ring->events = (trace_event*) malloc(ring->capacity * sizeof(trace_event));
+    ring->head = 0;
+    ring->generation = generation;
+    ring->tid = next_tid++;
+    ring->thread_name = (const char*) pthread_getspecific(name_key);
+    ring->exited = false;
+
+    if (ring->events)
+    {
+        ring->next = rings;
+        rings = ring;
+    }
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (!ring->events)
+    {
+        free(ring);
+        return 0;
+    }
+
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void record(const char *name, int64_t begin, int64_t end, int64_t id, bool async)
+{
+    if (!ffbb_trace_on) return;
+
+    trace_ring *ring = thread_ring();
+    if (!ring) return;
+
+    // only the owning thread moves head, so it clears its own ring for a new capture
+    if (ring->generation != generation)
+    {
+        ring->head = 0;
+        ring->generation = generation;
+    }
+
+    trace_event *event = &ring->events[ring->head % ring->capacity];
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    event->id = id;
+    event->async = async;
+
+    // publish the event before the slot counts as written
+    __sync_synchronize();
+    ring->head++;
+}
+
+void ffbb_trace_span(const char *name, int64_t begin, int64_t end, int64_t frame)
+{
+    record(name, begin, end, frame, false);
+}
+
+void ffbb_trace_async(const char *name, int64_t begin, int64_t end, int64_t id)
+{
+    record(name, begin, end, id, true);
+}
+
+void ffbb_trace_name_thread(const char *name)
+{
+    pthread_once(&keys_once, &create_keys);
+    pthread_setspecific(name_key, name);
+
+    trace_ring *ring = (trace_ring*) pthread_getspecific(ring_key);
+    if (ring) ring->thread_name = name;
+}
+
+void ffbb_trace_start(int events_per_thread)
+{
+    pthread_mutex_lock(&rings_mutex);
+
+    if (events_per_thread > 0) ::events_per_thread = events_per_thread;
+
+    trace_ring **link = &rings;
+    while (*link)
+    {
+        trace_ring *ring = *link;
+
+        if (ring->exited)
+        {
+            *link = ring->next;
+            free(ring->events);
+            free(ring);
+            continue;
+        }
+
+        link = &ring->next;
+    }
+
+    // live threads keep their ring and drop its events on their next one
+    generation++;
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    __sync_synchronize();
+    ffbb_trace_on = 1;
+}
+
+void ffbb_trace_stop()
+{
+    ffbb_trace_on = 0;
+    __sync_synchronize();
+}
+
+typedef struct
+{
+    int fd;
+    char buf[TRACE_WRITE_BUFFER];
+    int length;
+    bool failed;
+} json_writer;
+
+static void flush(json_writer *writer)
+{
+    int written = 0;
+    while (!writer->failed && written < writer->length)
+    {
+        ssize_t result = write(writer->fd, writer->buf + written, writer->length - written);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) writer->failed = true;
+        else written += result;
+    }
+
+    writer->length = 0;
+}
+
+static void append(json_writer *writer, const char *format, ...)
+{
+    // no single event comes close to this, so a flush always makes room
+    if (writer->length > TRACE_WRITE_BUFFER - 512) flush(writer);
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(writer->buf + writer->length, TRACE_WRITE_BUFFER - writer->length, format, args);
+    va_end(args);
+
+    if (length > 0) writer->length += length;
+}
+
+int ffbb_trace_write(int fd)
+{
+    json_writer *writer = (json_writer*) malloc(sizeof(json_writer));
+    if (!writer) return -1;
+
+    writer->fd = fd;
+    writer->length = 0;
+    writer->failed = false;
+
+    int pid = getpid();
+    const char *separator = "";
+
+    append(writer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    pthread_mutex_lock(&rings_mutex);
+
+    for (trace_ring *ring = rings; ring; ring = ring->next)
+    {
+        if (ring->thread_name)
+        {
+            append(writer, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", separator, pid, ring->tid, ring->thread_name);
+            separator = ",";
+        }
+
+        // a thread that has not recorded since the start still holds the last capture
+        if (ring->generation != generation) continue;
+
+        int64_t head = ring->head;
+        int64_t first = head > ring->capacity ? head - ring->capacity : 0;
+
+        for (int64_t i = first; i < head; i++)
+        {
+            const trace_event *event = &ring->events[i % ring->capacity];
+
+            if (event->async)
+            {
+                append(writer, "%s\n{\"name\":\"%s\",\"cat\":\"ffbb\",\"ph\":\"b\",\"id\":\"0x%llx\","
+                        "\"pid\":%d,\"tid\":%d,\"ts\":%lld}", separator, event->name,
+                        (unsigned long long) event->id, pid, ring->tid, (long long) event->begin);
+                append(writer, ",\n{\"name\":\"%s\",\"cat\":\"ffbb\",\"ph\":\"e\",\"id\":\"0x%llx\","
+                        "\"pid\":%d,\"tid\":%d,\"ts\":%lld}", event->name,
+                        (unsigned long long) event->id, pid, ring->tid, (long long) event->end);
+            }
+            else
+            {
+                append(writer, "%s\n{\"name\":\"%s\",\"cat\":\"ffbb\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                        "\"ts\":%lld,\"dur\":%lld", separator, event->name, pid, ring->tid,
+                        (long long) event->begin, (long long) (event->end - event->begin));
+
+                if (event->id >= 0) append(writer, ",\"args\":{\"frame\":%lld}}", (long long) event->id);
+                else append(writer, "}");
+            }
+
+            separator = ",";
+        }
+    }
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    append(writer, "\n]}\n");
+    flush(writer);
+
+    bool failed = writer->failed;
+    free(writer);
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBTRACER_H
+#define FFBBTRACER_H
+
+#include "ffbbtrace.h"
+
+#include <stdint.h>
+
+extern volatile int ffbb_trace_on;
+
+/**
+ * Whether events are being recorded, check before reading the clock.
+ */
+static inline bool ffbb_tracing()
+{
+    return ffbb_trace_on;
+}
+
+/**
+ * Name the calling thread in the timeline. The name must outlive the trace.
+ */
+void ffbb_trace_name_thread(const char *name);
+
+/**
+ * Record a span on the calling thread. The name must be a literal, only
+ * the pointer is kept. frame is shown with the span unless it is negative.
+ */
+void ffbb_trace_span(const char *name, int64_t begin, int64_t end, int64_t frame);
+
+/**
+ * Record a span that may overlap the ones around it, such as the time a
+ * frame waits in a queue. id ties the begin and end together.
+ */
+void ffbb_trace_async(const char *name, int64_t begin, int64_t end, int64_t id);
+
+#endif
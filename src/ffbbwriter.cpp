@@ -0,0 +1,262 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbwriter.h"
+#include "ffbbnal.h"
+#include "ffbbtime.h"
+#include "ffbbtracer.h"
+
+#include <string.h>
+
+void* writing_thread(void* arg);
+
+ffenc_writer::ffenc_writer(int capacity, ffenc_writer_policy policy,
+        void (*deliver)(ffenc_packet **packets, int count, void *arg), void *arg)
+{
+    packets = new ffbb_ring<ffenc_packet*>(capacity);
+    this->policy = policy;
+
+    this->deliver = deliver;
+    deliver_arg = arg;
+
+    dropping_callback = 0;
+    dropping_arg = 0;
+
+    running = false;
+    reader_waiting = 0;
+    writer_waiting = 0;
+    dropping = false;
+
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&read_cond, 0);
+    pthread_cond_init(&write_cond, 0);
+
+    memset(&stats, 0, sizeof(ffenc_writer_stats));
+    stats.capacity = packets->capacity();
+    stats.policy = policy;
+}
+
+ffenc_writer::~ffenc_writer()
+{
+    finish();
+
+    ffenc_packet *packet;
+    while (packets->pop(&packet))
+    {
+        packet->release();
+    }
+
+    delete packets;
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&read_cond);
+    pthread_cond_destroy(&write_cond);
+}
+
+bool ffenc_writer::start()
+{
+    if (running) return true;
+
+    running = true;
+    dropping = false;
+
+    if (pthread_create(&thread, 0, &::writing_thread, this) != 0)
+    {
+        running = false;
+        return false;
+    }
+
+    return true;
+}
+
+void ffenc_writer::finish()
+{
+    if (!running) return;
+
+    running = false;
+
+    __sync_synchronize();
+    pthread_mutex_lock(&mutex);
+    pthread_cond_signal(&read_cond);
+    pthread_cond_broadcast(&write_cond);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(thread, 0);
+}
+
+void ffenc_writer::set_drop_callback(void (*dropping)(void *arg), void *arg)
+{
+    dropping_callback = dropping;
+    dropping_arg = arg;
+}
+
+bool ffenc_writer::resume_point(ffenc_packet *packet)
+{
+    if (packet->flags & AV_PKT_FLAG_KEY) return true;
+
+    // with intra refresh there are no more keyframes, only recovery points
+    for (int i = 0; i < packet->nal_count; i++)
+    {
+        if (ffbb_is_resume_point(packet->data + packet->nals[i].offset, packet->nals[i].size)) return true;
+    }
+
+    return false;
+}
+
+void ffenc_writer::push(ffenc_packet *packet)
+{
+    if (dropping && !resume_point(packet))
+    {
+        // the decoder cannot use anything until it has a place to start over
+        __sync_fetch_and_add(&stats.dropped_packets, 1);
+        packet->release();
+        return;
+    }
+
+    packet->queued_at = ffbb_time_usec();
+
+    while (!packets->push(packet))
+    {
+        if (policy == FFENC_WRITER_BLOCK && running)
+        {
+            __sync_fetch_and_add(&stats.blocked, 1);
+
+            pthread_mutex_lock(&mutex);
+            writer_waiting = 1;
+            __sync_synchronize();
+            if (running && packets->size() >= packets->capacity())
+            {
+                pthread_cond_wait(&write_cond, &mutex);
+            }
+            writer_waiting = 0;
+            pthread_mutex_unlock(&mutex);
+            continue;
+        }
+
+        // drop from here to the next resume point rather than leave holes,
+        // what was queued before this still goes out
+        __sync_fetch_and_add(&stats.dropped_packets, 1);
+        packet->release();
+
+        if (!dropping)
+        {
+            __sync_fetch_and_add(&stats.dropped_gops, 1);
+            dropping = true;
+
+            // otherwise the next resume point may be a whole GOP away
+            if (dropping_callback) dropping_callback(dropping_arg);
+        }
+
+        return;
+    }
+
+    dropping = false;
+
+    // slices of the low latency mode are pushed from several threads
+    int depth = packets->size();
+    int max_depth = stats.max_depth;
+    while (depth > max_depth)
+    {
+        int prev = __sync_val_compare_and_swap(&stats.max_depth, max_depth, depth);
+        if (prev == max_depth) break;
+        max_depth = prev;
+    }
+
+    __sync_synchronize();
+
+    if (reader_waiting)
+    {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&read_cond);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+void ffenc_writer::get_stats(ffenc_writer_stats *stats)
+{
+    __sync_synchronize();
+    *stats = this->stats;
+    stats->depth = packets->size();
+}
+
+void* writing_thread(void* arg)
+{
+    ffenc_writer *writer = (ffenc_writer*) arg;
+    writer->writing_thread();
+    return 0;
+}
+
+void ffenc_writer::writing_thread()
+{
+    ffbb_trace_name_thread("ffenc write");
+
+    ffenc_packet *batch[WRITER_MAX_BATCH];
+
+    while (true)
+    {
+        int count = 0;
+        while (count < WRITER_MAX_BATCH && packets->pop(&batch[count]))
+            count++;
+
+        if (count == 0)
+        {
+            if (!running) break;
+
+            pthread_mutex_lock(&mutex);
+            reader_waiting = 1;
+            __sync_synchronize();
+            if (running && packets->empty())
+            {
+                pthread_cond_wait(&read_cond, &mutex);
+            }
+            reader_waiting = 0;
+            pthread_mutex_unlock(&mutex);
+            continue;
+        }
+
+        __sync_synchronize();
+
+        if (writer_waiting)
+        {
+            pthread_mutex_lock(&mutex);
+            pthread_cond_broadcast(&write_cond);
+            pthread_mutex_unlock(&mutex);
+        }
+
+        int64_t begin = ffbb_time_usec();
+
+        for (int i = 0; i < count; i++)
+        {
+            int64_t queued = begin - batch[i]->queued_at;
+            __sync_fetch_and_add(&stats.queue_usec_total, queued);
+            ffbb_atomic_max(&stats.queue_usec_max, queued);
+            __sync_fetch_and_add(&stats.bytes, batch[i]->size);
+        }
+
+        deliver(batch, count, deliver_arg);
+
+        int64_t elapsed = ffbb_time_usec() - begin;
+        __sync_lock_test_and_set(&stats.write_usec_last, elapsed);
+        __sync_fetch_and_add(&stats.write_usec_total, elapsed);
+        ffbb_atomic_max(&stats.write_usec_max, elapsed);
+        __sync_fetch_and_add(&stats.packets, count);
+        __sync_fetch_and_add(&stats.batches, 1);
+
+        for (int i = 0; i < count; i++)
+        {
+            batch[i]->release();
+        }
+    }
+}
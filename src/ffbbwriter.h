@@ -0,0 +1,88 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBWRITER_H
+#define FFBBWRITER_H
+
+#include "ffbbenc.h"
+#include "ffbbring.h"
+
+// the most packets coalesced into one delivery
+#define WRITER_MAX_BATCH 64
+
+/**
+ * Moves packet delivery off the encoding thread. Packets are queued in
+ * a bounded ring and a writing thread hands everything that is waiting
+ * to the sink in a single batch.
+ */
+class ffenc_writer
+{
+    friend void* writing_thread(void* arg);
+
+public:
+
+    ffenc_writer(int capacity, ffenc_writer_policy policy,
+            void (*deliver)(ffenc_packet **packets, int count, void *arg), void *arg);
+    virtual ~ffenc_writer();
+
+    bool start();
+
+    /**
+     * Deliver everything still queued and wait for the writing thread to exit.
+     */
+    void finish();
+
+    /**
+     * Called on the pushing thread when packets start being dropped, so
+     * the encoder can be asked for a keyframe to resume from.
+     */
+    void set_drop_callback(void (*dropping)(void *arg), void *arg);
+
+    /**
+     * Queue a packet, taking over the caller's reference.
+     */
+    void push(ffenc_packet *packet);
+
+    void get_stats(ffenc_writer_stats *stats);
+
+private:
+
+    void writing_thread();
+    static bool resume_point(ffenc_packet *packet);
+
+    ffbb_ring<ffenc_packet*> *packets;
+    ffenc_writer_policy policy;
+
+    void (*deliver)(ffenc_packet **packets, int count, void *arg);
+    void *deliver_arg;
+
+    void (*dropping_callback)(void *arg);
+    void *dropping_arg;
+
+    pthread_t thread;
+    volatile bool running;
+    volatile int reader_waiting;
+    volatile int writer_waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t read_cond;
+    pthread_cond_t write_cond;
+
+    // set once a packet has been dropped, cleared by the next resume point
+    bool dropping;
+
+    ffenc_writer_stats stats;
+};
+
+#endif
@@ -0,0 +1,524 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ffbbx264.h"
+#include "ffbbpacket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if X264_SUPPORT
+
+// a static frame is coded this far above the last quantizer that came
+// out, which with frame threads need not be that of its reference
+#define STATIC_QP_MARGIN 2
+
+// nalu_process has no user pointer, so open encoders are looked up by handle
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ffenc_x264 **registry = 0;
+static x264_t **registry_handles = 0;
+static int registry_size = 0;
+
+// slice threads call nalu_process with their own copies of the handle, and
+// those are only seen once they write a slice. An encoder that has not seen
+// them all encodes holding learn_mutex, so any handle nobody knows is its.
+static pthread_mutex_t learn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ffenc_x264 *learning = 0;
+
+static bool register_encoder(x264_t *handle, ffenc_x264 *encoder)
+{
+    pthread_mutex_lock(&registry_mutex);
+
+    int slot = -1;
+    for (int i = 0; i < registry_size && slot < 0; i++)
+    {
+        if (!registry_handles[i]) slot = i;
+    }
+
+    if (slot < 0)
+    {
+        // grows by doubling and is never shrunk, the lookups stay cheap
+        int size = registry_size ? registry_size * 2 : 16;
+        ffenc_x264 **encoders = (ffenc_x264**) realloc(registry, size * sizeof(ffenc_x264*));
+        if (encoders) registry = encoders;
+        x264_t **handles = encoders ? (x264_t**) realloc(registry_handles, size * sizeof(x264_t*)) : 0;
+
+        if (!handles)
+        {
+            pthread_mutex_unlock(&registry_mutex);
+            return false;
+        }
+
+        registry_handles = handles;
+        for (int i = registry_size; i < size; i++)
+        {
+            registry[i] = 0;
+            registry_handles[i] = 0;
+        }
+
+        slot = registry_size;
+        registry_size = size;
+    }
+
+    registry_handles[slot] = handle;
+    registry[slot] = encoder;
+
+    pthread_mutex_unlock(&registry_mutex);
+    return true;
+}
+
+static void unregister_encoder(ffenc_x264 *encoder)
+{
+    pthread_mutex_lock(&registry_mutex);
+    for (int i = 0; i < registry_size; i++)
+    {
+        if (registry[i] == encoder)
+        {
+            registry_handles[i] = 0;
+            registry[i] = 0;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static ffenc_x264* find_encoder(x264_t *handle)
+{
+    ffenc_x264 *encoder = 0;
+    pthread_mutex_lock(&registry_mutex);
+    for (int i = 0; i < registry_size; i++)
+    {
+        if (registry_handles[i] == handle)
+        {
+            encoder = registry[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return encoder;
+}
+
+ffenc_x264::ffenc_x264(const x264_param_t *param)
+{
+    this->param = *param;
+
+    pthread_mutex_init(&mutex, 0);
+    pthread_mutex_init(&slice_mutex, 0);
+
+    encoder = 0;
+    handle_count = 0;
+    reconfig_pending = false;
+    next_pts = 0;
+
+    static_frames = false;
+    static_next = false;
+    last_qpplus1 = 0;
+    static_mb_info = 0;
+    static_mb_info_count = 0;
+
+    low_latency = false;
+    slice_pool = 0;
+    slice_callback = 0;
+    slice_callback_arg = 0;
+    pending_count = 0;
+    next_mb = 0;
+    slice_pts = 0;
+}
+
+ffenc_x264::~ffenc_x264()
+{
+    close();
+
+    free(static_mb_info);
+
+    pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&slice_mutex);
+}
+
+void ffenc_x264::set_low_latency(bool low_latency, ffenc_packet_pool *pool,
+        void (*slice_callback)(ffenc_packet *packet, void *arg), void *arg)
+{
+    this->low_latency = low_latency;
+    slice_pool = pool;
+    this->slice_callback = slice_callback;
+    slice_callback_arg = arg;
+}
+
+bool ffenc_x264::open()
+{
+    if (encoder) return true;
+
+    next_pts = 0;
+    reconfig_pending = false;
+
+    x264_param_t open_param = param;
+
+#ifdef X264_MBINFO_CONSTANT
+    // kept off otherwise, x264 stores extra state for every macroblock
+    if (static_frames) open_param.analyse.b_mb_info = 1;
+#endif
+
+    if (low_latency)
+    {
+        // the same settings as --tune zerolatency, plus intra refresh
+        open_param.i_bframe = 0;
+        open_param.rc.i_lookahead = 0;
+        open_param.i_sync_lookahead = 0;
+        open_param.rc.b_mb_tree = 0;
+        open_param.b_vfr_input = 0;
+        open_param.b_sliced_threads = 1;
+        open_param.b_intra_refresh = 1;
+        open_param.nalu_process = &ffenc_x264::nalu_process;
+    }
+
+    // the handle is only known once open returns, no NAL is produced before then
+    encoder = x264_encoder_open(&open_param);
+    if (!encoder) return false;
+
+    x264_encoder_parameters(encoder, &param);
+
+    // the slice threads are made by open and kept until close, the first is the handle itself
+    handle_count = 1;
+
+    // an unregistered encoder would encode and drop every slice
+    if (low_latency && !register_encoder(encoder, this))
+    {
+        x264_encoder_close(encoder);
+        encoder = 0;
+        return false;
+    }
+
+    return true;
+}
+
+void ffenc_x264::close()
+{
+    if (!encoder) return;
+
+    unregister_encoder(this);
+    x264_encoder_close(encoder);
+    encoder = 0;
+    handle_count = 0;
+}
+
+void ffenc_x264::nalu_process(x264_t *h, x264_nal_t *nal)
+{
+    ffenc_x264 *encoder = find_encoder(h);
+
+    // learning is only set while its encode holds learn_mutex
+    if (!encoder && learning && register_encoder(h, learning))
+    {
+        encoder = learning;
+        __sync_fetch_and_add(&encoder->handle_count, 1);
+    }
+
+    if (encoder) encoder->process_nal(nal);
+}
+
+void ffenc_x264::process_nal(x264_nal_t *nal)
+{
+    // runs on the slice threads, each escapes its own slice into a packet
+    // and only the hand-off below is done one at a time. x264 asks for this
+    // much room to escape the payload into.
+    ffenc_packet *packet = slice_pool->acquire(nal->i_payload * 3 / 2 + 5 + 16);
+    bool slice = nal->i_type == NAL_SLICE || nal->i_type == NAL_SLICE_IDR;
+
+    if (packet)
+    {
+        x264_nal_encode(encoder, packet->data, nal);
+
+        packet->size = nal->i_payload;
+        packet->pts = slice_pts;
+        packet->dts = slice_pts;
+        if (nal->i_type == NAL_SLICE_IDR) packet->flags |= AV_PKT_FLAG_KEY;
+
+        // the parameter sets and SEI come first, the last slice ends the picture
+        int mb_count = ((param.i_width + 15) / 16) * ((param.i_height + 15) / 16);
+        packet->frame_end = slice && nal->i_last_mb >= mb_count - 1;
+    }
+    else if (!slice)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&slice_mutex);
+
+    if (!slice || nal->i_first_mb == next_mb)
+    {
+        // parameter sets and SEI are written by the calling thread ahead of the slices
+        emit_slice(packet, slice ? nal->i_last_mb : next_mb - 1);
+
+        bool found = true;
+        while (found)
+        {
+            found = false;
+            for (int i = 0; i < pending_count; i++)
+            {
+                if (pending_first_mb[i] == next_mb)
+                {
+                    emit_slice(pending_slices[i], pending_last_mb[i]);
+                    pending_count--;
+                    pending_slices[i] = pending_slices[pending_count];
+                    pending_first_mb[i] = pending_first_mb[pending_count];
+                    pending_last_mb[i] = pending_last_mb[pending_count];
+                    found = true;
+                    break;
+                }
+            }
+        }
+    }
+    else if (pending_count < X264_MAX_PENDING_SLICES)
+    {
+        // a slice lost to a full pool still holds its place, so the ones after it go out
+        pending_slices[pending_count] = packet;
+        pending_first_mb[pending_count] = nal->i_first_mb;
+        pending_last_mb[pending_count] = nal->i_last_mb;
+        pending_count++;
+    }
+    else if (packet)
+    {
+        packet->release();
+    }
+
+    pthread_mutex_unlock(&slice_mutex);
+}
+
+void ffenc_x264::emit_slice(ffenc_packet *packet, int last_mb)
+{
+    next_mb = last_mb + 1;
+    if (packet) slice_callback(packet, slice_callback_arg);
+}
+
+void ffenc_x264::flush_slices()
+{
+    pthread_mutex_lock(&slice_mutex);
+
+    // anything left means a slice went missing, send the rest in order anyway
+    while (pending_count > 0)
+    {
+        int first = 0;
+        for (int i = 1; i < pending_count; i++)
+        {
+            if (pending_first_mb[i] < pending_first_mb[first]) first = i;
+        }
+
+        ffenc_packet *packet = pending_slices[first];
+        int last_mb = pending_last_mb[first];
+        pending_count--;
+        pending_slices[first] = pending_slices[pending_count];
+        pending_first_mb[first] = pending_first_mb[pending_count];
+        pending_last_mb[first] = pending_last_mb[pending_count];
+
+        if (packet && !pending_count) packet->frame_end = true;
+        emit_slice(packet, last_mb);
+    }
+
+    next_mb = 0;
+
+    pthread_mutex_unlock(&slice_mutex);
+}
+
+void ffenc_x264::reconfig(const x264_param_t *param)
+{
+    pthread_mutex_lock(&mutex);
+    pending = *param;
+    reconfig_pending = true;
+    pthread_mutex_unlock(&mutex);
+}
+
+void ffenc_x264::apply_preset(x264_param_t *param, const char *preset)
+{
+    // presets only list what differs from medium so start from the defaults
+    x264_param_t defaults;
+    x264_param_default(&defaults);
+    if (x264_param_default_preset(&defaults, preset, 0) < 0) return;
+
+    param->i_frame_reference = defaults.i_frame_reference;
+    param->b_deblocking_filter = defaults.b_deblocking_filter;
+    param->analyse.inter = defaults.analyse.inter;
+    param->analyse.intra = defaults.analyse.intra;
+    param->analyse.i_direct_mv_pred = defaults.analyse.i_direct_mv_pred;
+    param->analyse.i_me_method = defaults.analyse.i_me_method;
+    param->analyse.i_me_range = defaults.analyse.i_me_range;
+    param->analyse.i_subpel_refine = defaults.analyse.i_subpel_refine;
+    param->analyse.i_trellis = defaults.analyse.i_trellis;
+    param->analyse.b_mixed_references = defaults.analyse.b_mixed_references;
+    param->analyse.b_transform_8x8 = defaults.analyse.b_transform_8x8;
+}
+
+int ffenc_x264::preset_distance(const x264_param_t *param, const char *preset)
+{
+    x264_param_t copy = *param;
+    apply_preset(&copy, preset);
+
+    // the analysis flags are one bit field, each flag counts on its own
+    int distance = 0;
+    distance += copy.i_frame_reference != param->i_frame_reference;
+    distance += copy.b_deblocking_filter != param->b_deblocking_filter;
+    distance += __builtin_popcount(copy.analyse.inter ^ param->analyse.inter);
+    distance += __builtin_popcount(copy.analyse.intra ^ param->analyse.intra);
+    distance += copy.analyse.i_direct_mv_pred != param->analyse.i_direct_mv_pred;
+    distance += copy.analyse.i_me_method != param->analyse.i_me_method;
+    distance += copy.analyse.i_me_range != param->analyse.i_me_range;
+    distance += copy.analyse.i_subpel_refine != param->analyse.i_subpel_refine;
+    distance += copy.analyse.i_trellis != param->analyse.i_trellis;
+    distance += copy.analyse.b_mixed_references != param->analyse.b_mixed_references;
+    distance += copy.analyse.b_transform_8x8 != param->analyse.b_transform_8x8;
+    return distance;
+}
+
+void ffenc_x264::apply_bitrate(x264_param_t *param, int bitrate)
+{
+    param->rc.i_bitrate = bitrate / 1000;
+    if (param->rc.i_vbv_max_bitrate > 0) param->rc.i_vbv_max_bitrate = param->rc.i_bitrate;
+}
+
+void ffenc_x264::set_static_frames(bool static_frames)
+{
+    this->static_frames = static_frames;
+}
+
+bool ffenc_x264::encode_next_as_static()
+{
+#ifdef X264_MBINFO_CONSTANT
+    if (!encoder || !param.analyse.b_mb_info) return false;
+
+    int count = ((param.i_width + 15) / 16) * ((param.i_height + 15) / 16);
+
+    if (count != static_mb_info_count)
+    {
+        free(static_mb_info);
+        static_mb_info = (uint8_t*) malloc(count);
+        static_mb_info_count = static_mb_info ? count : 0;
+        if (static_mb_info) memset(static_mb_info, X264_MBINFO_CONSTANT, count);
+    }
+
+    static_next = static_mb_info != 0;
+    return static_next;
+#else
+    return false;
+#endif
+}
+
+int ffenc_x264::delayed_frames()
+{
+    if (!encoder) return 0;
+    return x264_encoder_delayed_frames(encoder);
+}
+
+int ffenc_x264::encode(AVFrame *frame, x264_nal_t **nals, int *nal_count, x264_picture_t *pic_out)
+{
+    if (!encoder) return -1;
+
+    if (reconfig_pending)
+    {
+        pthread_mutex_lock(&mutex);
+
+        if (x264_encoder_reconfig(encoder, &pending) == 0)
+        {
+            // keep our copy in step with what the encoder accepted
+            x264_encoder_parameters(encoder, &param);
+        }
+
+        reconfig_pending = false;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    *nals = 0;
+    *nal_count = 0;
+
+    if (!frame) return encode_picture(0, nals, nal_count, pic_out);
+
+    x264_picture_t pic;
+    x264_picture_init(&pic);
+
+    if (frame->format == PIX_FMT_NV12)
+    {
+        pic.img.i_csp = X264_CSP_NV12;
+        pic.img.i_plane = 2;
+    }
+    else
+    {
+        pic.img.i_csp = X264_CSP_I420;
+        pic.img.i_plane = 3;
+    }
+
+    for (int i = 0; i < pic.img.i_plane; i++)
+    {
+        pic.img.plane[i] = frame->data[i];
+        pic.img.i_stride[i] = frame->linesize[i];
+    }
+
+    pic.i_pts = frame->pts != (int64_t) AV_NOPTS_VALUE ? frame->pts : next_pts;
+    next_pts = pic.i_pts + 1;
+
+    // forced intra frames are always IDR so a decoder can start on them
+    if (frame->pict_type == AV_PICTURE_TYPE_I) pic.i_type = X264_TYPE_IDR;
+
+#ifdef X264_MBINFO_CONSTANT
+    if (static_next)
+    {
+        // the flags never change, so x264 may hold on to them until the
+        // frame is encoded without a free callback
+        pic.prop.mb_info = static_mb_info;
+        static_next = false;
+
+        // x264 only skips a macroblock without looking at it when the
+        // reference was coded at the same quantizer or a finer one, and
+        // rate control keeps lowering it while the frames cost nothing
+        if (last_qpplus1 > 0)
+        {
+            int qp = last_qpplus1 - 1 + STATIC_QP_MARGIN;
+            pic.i_qpplus1 = (qp < param.rc.i_qp_max ? qp : param.rc.i_qp_max) + 1;
+        }
+    }
+#endif
+
+    // without B-frames the slices that come out belong to this picture
+    slice_pts = pic.i_pts;
+
+    return encode_picture(&pic, nals, nal_count, pic_out);
+}
+
+int ffenc_x264::encode_picture(x264_picture_t *pic, x264_nal_t **nals, int *nal_count, x264_picture_t *pic_out)
+{
+    // other encoders wait here only until every slice thread of this one was seen
+    bool learn = low_latency && handle_count < param.i_threads;
+
+    if (learn)
+    {
+        pthread_mutex_lock(&learn_mutex);
+        learning = this;
+    }
+
+    int result = x264_encoder_encode(encoder, nals, nal_count, pic, pic_out);
+
+    if (learn)
+    {
+        learning = 0;
+        pthread_mutex_unlock(&learn_mutex);
+    }
+
+    if (result > 0 && pic_out->i_qpplus1 > 0) last_qpplus1 = pic_out->i_qpplus1;
+
+    if (!low_latency) return result;
+
+    // every NAL went through the slice callback, nothing is left to return
+    flush_slices();
+    *nals = 0;
+    *nal_count = 0;
+    return result < 0 ? result : 0;
+}
+
+#endif
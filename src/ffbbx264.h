@@ -0,0 +1,142 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FFBBX264_H
+#define FFBBX264_H
+
+#include "ffbbenc.h"
+
+#if X264_SUPPORT
+
+// the most slices of one picture that can complete out of order
+#define X264_MAX_PENDING_SLICES 64
+
+/**
+ * Drives libx264 directly so NV12 camera frames reach the encoder
+ * without the I420 conversion or the libavcodec wrapper.
+ */
+class ffenc_x264
+{
+public:
+
+    ffenc_x264(const x264_param_t *param);
+    virtual ~ffenc_x264();
+
+    bool open();
+    void close();
+
+    /**
+     * Use zero latency tuning when the encoder is opened: no B-frames or
+     * lookahead, sliced threads and periodic intra refresh instead of IDR
+     * frames. Each NAL unit is handed to the slice callback as soon as it
+     * and the slices before it are done, in picture order, instead of
+     * being returned by encode.
+     */
+    void set_low_latency(bool low_latency, ffenc_packet_pool *pool,
+            void (*slice_callback)(ffenc_packet *packet, void *arg), void *arg);
+
+    bool is_low_latency()
+    {
+        return low_latency;
+    }
+
+    /**
+     * Queue new parameters. They are applied by the encoding thread
+     * right before the next frame so this is safe to call at any time.
+     */
+    void reconfig(const x264_param_t *param);
+
+    /**
+     * Encode an NV12 or I420 AVFrame, or flush a delayed frame if the
+     * frame is 0. Returns the number of bytes in the returned NAL units,
+     * 0 if nothing was output yet, or a negative value on error.
+     */
+    int encode(AVFrame *frame, x264_nal_t **nals, int *nal_count, x264_picture_t *pic_out);
+
+    int delayed_frames();
+
+    /**
+     * Track macroblock info so encode_next_as_static can be used. Only
+     * takes effect on the next open.
+     */
+    void set_static_frames(bool static_frames);
+
+    /**
+     * Mark every macroblock of the next frame as unchanged from the one
+     * before it, so x264 codes them as skip without analysing them.
+     * Returns false when this x264 cannot take macroblock info or it was
+     * not enabled with set_static_frames, the frame is better not
+     * encoded at all then.
+     */
+    bool encode_next_as_static();
+
+    /**
+     * Copy the analysis settings of an x264 preset that can be changed
+     * by reconfig into param, leaving everything else alone.
+     */
+    static void apply_preset(x264_param_t *param, const char *preset);
+
+    /**
+     * How many of the settings apply_preset copies differ from those of
+     * the preset, so the closest preset to a tuned config can be found.
+     */
+    static int preset_distance(const x264_param_t *param, const char *preset);
+
+    /**
+     * Set the bitrate in bits per second, along with the VBV rate if VBV is on.
+     */
+    static void apply_bitrate(x264_param_t *param, int bitrate);
+
+    x264_param_t param;
+
+private:
+
+    static void nalu_process(x264_t *h, x264_nal_t *nal);
+    void process_nal(x264_nal_t *nal);
+    void emit_slice(ffenc_packet *packet, int last_mb);
+    void flush_slices();
+    int encode_picture(x264_picture_t *pic, x264_nal_t **nals, int *nal_count, x264_picture_t *pic_out);
+
+    x264_t *encoder;
+    int handle_count;
+    pthread_mutex_t mutex;
+    x264_param_t pending;
+    volatile bool reconfig_pending;
+    int64_t next_pts;
+
+    bool static_frames;
+    bool static_next;
+    uint8_t *static_mb_info;
+    int static_mb_info_count;
+    int last_qpplus1;
+
+    bool low_latency;
+    ffenc_packet_pool *slice_pool;
+    void (*slice_callback)(ffenc_packet *packet, void *arg);
+    void *slice_callback_arg;
+
+    // slices finished by other threads wait here until the ones before them are out
+    pthread_mutex_t slice_mutex;
+    ffenc_packet *pending_slices[X264_MAX_PENDING_SLICES];
+    int pending_first_mb[X264_MAX_PENDING_SLICES];
+    int pending_last_mb[X264_MAX_PENDING_SLICES];
+    int pending_count;
+    int next_mb;
+    int64_t slice_pts;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,357 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs every SIMD kernel table the CPU supports against the C kernels
+ * over odd widths, tail lengths and unaligned pointers and strides, and
+ * compares every output byte, including guard bytes around each plane so
+ * a write past the end shows up too. See "Testing" in the README.
+ */
+
+#include "ffbbconv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// bytes of slack around each buffer, also the most a pointer is misaligned by
+#define GUARD 64
+#define GUARD_BYTE 0xa5
+
+typedef struct
+{
+    uint8_t *base;
+    uint8_t *data;
+    int stride;
+    int size;
+} test_plane;
+
+static uint32_t seed = 1;
+
+static uint8_t next_byte()
+{
+    seed = seed * 1103515245 + 12345;
+    return (uint8_t) (seed >> 16);
+}
+
+// a plane of rows x bytes, starting offset bytes past an aligned address
+static void plane_init(test_plane *plane, int bytes, int rows, int offset, bool random)
+{
+    plane->stride = bytes + (offset & 7) + 3;
+    plane->size = plane->stride * rows;
+    plane->base = (uint8_t*) malloc(plane->size + 2 * GUARD);
+    plane->data = plane->base + GUARD + offset;
+
+    memset(plane->base, GUARD_BYTE, plane->size + 2 * GUARD);
+    if (random)
+    {
+        for (int i = 0; i < plane->size; i++)
+            plane->data[i] = next_byte();
+    }
+}
+
+static void plane_free(test_plane *plane)
+{
+    free(plane->base);
+}
+
+static bool plane_equal(const test_plane *a, const test_plane *b)
+{
+    return !memcmp(a->base, b->base, a->size + 2 * GUARD);
+}
+
+static int failures = 0;
+static int checks = 0;
+
+static void report(const char *kernels, const char *kernel, int width, int height, int offset, bool ok)
+{
+    checks++;
+    if (ok) return;
+
+    failures++;
+    fprintf(stderr, "FAIL %s %s width %d height %d offset %d\n", kernels, kernel, width, height, offset);
+}
+
+static void check_copy(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane src, ref, out;
+    plane_init(&src, width, height, offset, true);
+    plane_init(&ref, width, height, offset + 1, false);
+    plane_init(&out, width, height, offset + 1, false);
+
+    ffconv_kernels_c.copy_plane(ref.data, ref.stride, src.data, src.stride, width, height);
+    k->copy_plane(out.data, out.stride, src.data, src.stride, width, height);
+    report(k->name, "copy_plane", width, height, offset, plane_equal(&ref, &out));
+
+    ffconv_kernels_c.mirror(ref.data, ref.stride, src.data, src.stride, width, height);
+    k->mirror(out.data, out.stride, src.data, src.stride, width, height);
+    report(k->name, "mirror", width, height, offset, plane_equal(&ref, &out));
+
+    plane_free(&src);
+    plane_free(&ref);
+    plane_free(&out);
+}
+
+// the kernels that turn one interleaved UV plane of width pairs into two
+static void check_uv(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane src, refu, refv, outu, outv;
+    plane_init(&src, width * 2, height, offset, true);
+    plane_init(&refu, width, height, offset + 3, false);
+    plane_init(&refv, width, height, offset + 5, false);
+    plane_init(&outu, width, height, offset + 3, false);
+    plane_init(&outv, width, height, offset + 5, false);
+
+    ffconv_kernels_c.split_uv(refu.data, refu.stride, refv.data, refv.stride, src.data, src.stride, width, height);
+    k->split_uv(outu.data, outu.stride, outv.data, outv.stride, src.data, src.stride, width, height);
+    report(k->name, "split_uv", width, height, offset, plane_equal(&refu, &outu) && plane_equal(&refv, &outv));
+
+    ffconv_kernels_c.mirror_uv(refu.data, refu.stride, refv.data, refv.stride, src.data, src.stride, width, height);
+    k->mirror_uv(outu.data, outu.stride, outv.data, outv.stride, src.data, src.stride, width, height);
+    report(k->name, "mirror_uv", width, height, offset, plane_equal(&refu, &outu) && plane_equal(&refv, &outv));
+
+    plane_free(&src);
+    plane_free(&refu);
+    plane_free(&refv);
+    plane_free(&outu);
+    plane_free(&outv);
+
+    // 16-bit samples, two bytes each
+    plane_init(&src, width * 4, height, offset, true);
+    plane_init(&refu, width, height, offset + 3, false);
+    plane_init(&refv, width, height, offset + 5, false);
+    plane_init(&outu, width, height, offset + 3, false);
+    plane_init(&outv, width, height, offset + 5, false);
+
+    ffconv_kernels_c.split_uv_16(refu.data, refu.stride, refv.data, refv.stride, src.data, src.stride, width, height);
+    k->split_uv_16(outu.data, outu.stride, outv.data, outv.stride, src.data, src.stride, width, height);
+    report(k->name, "split_uv_16", width, height, offset, plane_equal(&refu, &outu) && plane_equal(&refv, &outv));
+
+    ffconv_kernels_c.narrow_16(refu.data, refu.stride, src.data, src.stride, width, height);
+    k->narrow_16(outu.data, outu.stride, src.data, src.stride, width, height);
+    report(k->name, "narrow_16", width, height, offset, plane_equal(&refu, &outu));
+
+    plane_free(&src);
+    plane_free(&refu);
+    plane_free(&refv);
+    plane_free(&outu);
+    plane_free(&outv);
+}
+
+static void check_transpose(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane src, ref, out, refv, outv;
+    plane_init(&src, width * 2, height, offset, true);
+    plane_init(&ref, height, width, offset + 1, false);
+    plane_init(&out, height, width, offset + 1, false);
+    plane_init(&refv, height, width, offset + 2, false);
+    plane_init(&outv, height, width, offset + 2, false);
+
+    ffconv_kernels_c.transpose(ref.data, ref.stride, src.data, src.stride, width, height);
+    k->transpose(out.data, out.stride, src.data, src.stride, width, height);
+    report(k->name, "transpose", width, height, offset, plane_equal(&ref, &out));
+
+    // bottom up, as for a rotation
+    const uint8_t *last = src.data + (height - 1) * src.stride;
+    ffconv_kernels_c.transpose(ref.data, ref.stride, last, -src.stride, width, height);
+    k->transpose(out.data, out.stride, last, -src.stride, width, height);
+    report(k->name, "transpose bottom up", width, height, offset, plane_equal(&ref, &out));
+
+    ffconv_kernels_c.transpose_uv(ref.data, ref.stride, refv.data, refv.stride, src.data, src.stride, width, height);
+    k->transpose_uv(out.data, out.stride, outv.data, outv.stride, src.data, src.stride, width, height);
+    report(k->name, "transpose_uv", width, height, offset, plane_equal(&ref, &out) && plane_equal(&refv, &outv));
+
+    plane_free(&src);
+    plane_free(&ref);
+    plane_free(&out);
+    plane_free(&refv);
+    plane_free(&outv);
+}
+
+// width and height are those of the output, the source is twice the size
+static void check_halve(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane src, ref, out, refv, outv;
+    plane_init(&src, width * 4, height * 2, offset, true);
+    plane_init(&ref, width, height, offset + 1, false);
+    plane_init(&out, width, height, offset + 1, false);
+    plane_init(&refv, width, height, offset + 2, false);
+    plane_init(&outv, width, height, offset + 2, false);
+
+    ffconv_kernels_c.halve(ref.data, ref.stride, src.data, src.stride, width, height);
+    k->halve(out.data, out.stride, src.data, src.stride, width, height);
+    report(k->name, "halve", width, height, offset, plane_equal(&ref, &out));
+
+    ffconv_kernels_c.halve_uv(ref.data, ref.stride, refv.data, refv.stride, src.data, src.stride, width, height);
+    k->halve_uv(out.data, out.stride, outv.data, outv.stride, src.data, src.stride, width, height);
+    report(k->name, "halve_uv", width, height, offset, plane_equal(&ref, &out) && plane_equal(&refv, &outv));
+
+    plane_free(&src);
+    plane_free(&ref);
+    plane_free(&out);
+    plane_free(&refv);
+    plane_free(&outv);
+}
+
+static void check_rows(const ffconv_kernels *k, int width, int rows, int offset)
+{
+    test_plane src, ref, out;
+    plane_init(&src, width, rows, offset, true);
+    plane_init(&ref, width * 2, 1, offset + 1, false);
+    plane_init(&out, width * 2, 1, offset + 1, false);
+
+    // 16-bit sums want an even address
+    uint16_t *ref_sums = (uint16_t*) (ref.base + GUARD);
+    uint16_t *out_sums = (uint16_t*) (out.base + GUARD);
+    ffconv_kernels_c.sum_rows(ref_sums, src.data, src.stride, width, rows);
+    k->sum_rows(out_sums, src.data, src.stride, width, rows);
+    report(k->name, "sum_rows", width, rows, offset, plane_equal(&ref, &out));
+
+    for (int fraction = 0; fraction < 256; fraction += 37)
+    {
+        const uint8_t *row1 = src.data + (rows > 1 ? src.stride : 0);
+        ffconv_kernels_c.blend_rows(ref.data, src.data, row1, width, fraction);
+        k->blend_rows(out.data, src.data, row1, width, fraction);
+        report(k->name, "blend_rows", width, fraction, offset, plane_equal(&ref, &out));
+    }
+
+    plane_free(&src);
+    plane_free(&ref);
+    plane_free(&out);
+}
+
+// width and height in pixels, even
+static void check_packed(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane src, refy, refu, refv, outy, outu, outv;
+    plane_init(&src, width * 4, height, offset, true);
+    plane_init(&refy, width, height, offset + 1, false);
+    plane_init(&refu, width / 2, height / 2, offset + 2, false);
+    plane_init(&refv, width / 2, height / 2, offset + 3, false);
+    plane_init(&outy, width, height, offset + 1, false);
+    plane_init(&outu, width / 2, height / 2, offset + 2, false);
+    plane_init(&outv, width / 2, height / 2, offset + 3, false);
+
+    for (int uyvy = 0; uyvy < 2; uyvy++)
+    {
+        ffconv_kernels_c.packed_422_to_i420(refy.data, refy.stride, refu.data, refu.stride,
+                refv.data, refv.stride, src.data, src.stride, width, height, uyvy);
+        k->packed_422_to_i420(outy.data, outy.stride, outu.data, outu.stride,
+                outv.data, outv.stride, src.data, src.stride, width, height, uyvy);
+        report(k->name, uyvy ? "packed_422_to_i420 uyvy" : "packed_422_to_i420 yuyv", width, height, offset,
+                plane_equal(&refy, &outy) && plane_equal(&refu, &outu) && plane_equal(&refv, &outv));
+    }
+
+    for (int matrix = 0; matrix < 8; matrix++)
+    {
+        ffconv_rgb_coeffs coeffs;
+        ffconv_rgb_coeffs_init(&coeffs, matrix & 1, matrix & 2, matrix & 4);
+
+        ffconv_kernels_c.rgb_to_i420(refy.data, refy.stride, refu.data, refu.stride,
+                refv.data, refv.stride, src.data, src.stride, width, height, &coeffs);
+        k->rgb_to_i420(outy.data, outy.stride, outu.data, outu.stride,
+                outv.data, outv.stride, src.data, src.stride, width, height, &coeffs);
+        report(k->name, "rgb_to_i420", width, height, offset,
+                plane_equal(&refy, &outy) && plane_equal(&refu, &outu) && plane_equal(&refv, &outv));
+    }
+
+    plane_free(&src);
+    plane_free(&refy);
+    plane_free(&refu);
+    plane_free(&refv);
+    plane_free(&outy);
+    plane_free(&outu);
+    plane_free(&outv);
+}
+
+static void check_block(const ffconv_kernels *k, int width, int height, int offset)
+{
+    test_plane a, b, ref, out;
+    plane_init(&a, width, height, offset, true);
+    plane_init(&b, width, height, offset + 1, true);
+    plane_init(&ref, width / 8 + 1, height / 8 + 1, offset + 2, false);
+    plane_init(&out, width / 8 + 1, height / 8 + 1, offset + 2, false);
+
+    ffconv_kernels_c.downsample_8x8(ref.data, ref.stride, a.data, a.stride, width, height);
+    k->downsample_8x8(out.data, out.stride, a.data, a.stride, width, height);
+    report(k->name, "downsample_8x8", width, height, offset, plane_equal(&ref, &out));
+
+    uint32_t expected = ffconv_kernels_c.sad(a.data, a.stride, b.data, b.stride, width, height);
+    report(k->name, "sad", width, height, offset, k->sad(a.data, a.stride, b.data, b.stride, width, height) == expected);
+
+    plane_free(&a);
+    plane_free(&b);
+    plane_free(&ref);
+    plane_free(&out);
+}
+
+static void check_kernels(const ffconv_kernels *k)
+{
+    // around every vector width and the tails that follow it
+    static const int widths[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 100, 127, 129, 255, 321 };
+    static const int heights[] = { 1, 2, 3, 8, 9, 17 };
+
+    int width_count = (int) (sizeof(widths) / sizeof(widths[0]));
+    int height_count = (int) (sizeof(heights) / sizeof(heights[0]));
+
+    for (int w = 0; w < width_count; w++)
+    {
+        for (int h = 0; h < height_count; h++)
+        {
+            for (int offset = 0; offset < 4; offset++)
+            {
+                int width = widths[w];
+                int height = heights[h];
+
+                check_copy(k, width, height, offset);
+                check_uv(k, width, height, offset);
+                check_transpose(k, width, height, offset);
+                check_halve(k, width, height, offset);
+                check_rows(k, width, height, offset);
+                check_block(k, width, height, offset);
+
+                if (!(width & 1) && !(height & 1)) check_packed(k, width, height, offset);
+            }
+        }
+    }
+}
+
+int main()
+{
+    int tables = 0;
+
+#if FFCONV_HAVE_SSE2
+    check_kernels(&ffconv_kernels_sse2);
+    tables++;
+#endif
+
+#if FFCONV_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+        check_kernels(&ffconv_kernels_avx2);
+        tables++;
+    }
+#endif
+
+#if FFCONV_HAVE_NEON
+    check_kernels(&ffconv_kernels_neon);
+    tables++;
+#endif
+
+    printf("%d checks of %d kernel tables against %s, %d failed, %s selected\n",
+            checks, tables, ffconv_kernels_c.name, failures, ffconv_get_kernels()->name);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress test of the frame queue. Several producers push numbered items
+ * through ffbb_ring to one consumer, then add numbered frames to an
+ * ffenc_context under every queue policy, and with conversion threads,
+ * while it is stopped under them. Every item and every accepted frame has
+ * to come out exactly once and, for each producer, in the order it went in. See "Testing" in the README.
+ */
+
+#include "ffbbenc.h"
+#include "ffbbring.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRODUCERS 4
+#define RING_ITEMS 1000000
+#define FRAME_WIDTH 64
+#define FRAME_HEIGHT 48
+#define ROUNDS 50
+
+static int failures = 0;
+
+static void fail(const char *what, int first, int second)
+{
+    if (__sync_fetch_and_add(&failures, 1) < 20)
+        fprintf(stderr, "FAIL %s (%d, %d)\n", what, first, second);
+}
+
+typedef struct
+{
+    ffbb_ring<int> *ring;
+    int producer;
+} ring_producer;
+
+static void* push_items(void *arg)
+{
+    ring_producer *self = (ring_producer*) arg;
+
+    // the producer in the top bits, its sequence in the rest
+    for (int i = 0; i < RING_ITEMS; i++)
+    {
+        while (!self->ring->push(self->producer << 24 | i))
+            sched_yield();
+    }
+
+    return 0;
+}
+
+static void check_ring(int capacity)
+{
+    ffbb_ring<int> ring(capacity);
+
+    // holds exactly its capacity even where that is not a power of two
+    int filled = 0;
+    while (ring.push(filled)) filled++;
+    if (filled != capacity) fail("ring holds the wrong number of items", capacity, filled);
+
+    int value;
+    while (ring.pop(&value)) filled--;
+    if (filled != 0) fail("ring lost items", capacity, filled);
+
+    ring_producer producers[PRODUCERS];
+    pthread_t threads[PRODUCERS];
+
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        producers[i].ring = &ring;
+        producers[i].producer = i;
+        pthread_create(&threads[i], 0, &push_items, &producers[i]);
+    }
+
+    int next[PRODUCERS];
+    memset(next, 0, sizeof(next));
+
+    for (int received = 0; received < PRODUCERS * RING_ITEMS;)
+    {
+        int value;
+        if (!ring.pop(&value))
+        {
+            sched_yield();
+            continue;
+        }
+
+        int producer = value >> 24;
+        int sequence = value & 0xffffff;
+
+        if (producer < 0 || producer >= PRODUCERS) fail("ring unknown producer", producer, sequence);
+        else if (sequence != next[producer]) fail("ring out of order", producer, sequence);
+        else next[producer]++;
+
+        received++;
+    }
+
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(threads[i], 0);
+
+    if (ring.pop(&value)) fail("ring item left over", value >> 24, value & 0xffffff);
+
+    printf("ring of %d: %d items from %d producers\n", ring.capacity(), PRODUCERS * RING_ITEMS, PRODUCERS);
+}
+
+// what the encoding thread saw, checked against what add_frame accepted
+typedef struct
+{
+    ffenc_context *context;
+    int producer;
+    int accepted;
+    int next;
+    int seen;
+    bool strict;
+    volatile bool closed;
+} frame_producer;
+
+static frame_producer frame_producers[PRODUCERS];
+
+static bool frame_seen(ffenc_context *ffe_context, AVFrame *frame, int index, void *arg)
+{
+    int producer = frame->data[0][0];
+    int sequence = frame->data[0][1] | frame->data[0][2] << 8 | frame->data[0][3] << 16;
+
+    if (producer >= PRODUCERS)
+    {
+        fail("frame unknown producer", producer, sequence);
+        return false;
+    }
+
+    frame_producer *self = &frame_producers[producer];
+
+    // the drop policies may skip frames but never reorder or repeat them
+    if (self->strict ? sequence != self->next : sequence < self->next) fail("frame out of order", producer, sequence);
+
+    self->next = sequence + 1;
+    self->seen++;
+
+    // slower than the producers so stop finds the queue full, and nothing
+    // has to be encoded for this test
+    usleep(500);
+    return false;
+}
+
+static void encoder_closed(ffenc_context *ffe_context, void *arg)
+{
+    frame_producer *first = (frame_producer*) arg;
+    first->closed = true;
+}
+
+static void* add_frames(void *arg)
+{
+    frame_producer *self = (frame_producer*) arg;
+
+    uint8_t *y = (uint8_t*) calloc(FRAME_WIDTH * FRAME_HEIGHT, 1);
+    uint8_t *uv = (uint8_t*) calloc(FRAME_WIDTH * FRAME_HEIGHT / 2, 1);
+
+    // keep adding until stop turns us away, a refused frame is tried again
+    for (int i = 0;;)
+    {
+        y[0] = self->producer;
+        y[1] = i;
+        y[2] = i >> 8;
+        y[3] = i >> 16;
+
+        ffenc_error result = self->context->add_frame(y, FRAME_WIDTH, uv, FRAME_WIDTH, FRAME_WIDTH, FRAME_HEIGHT, i);
+        if (result == FFENC_OK)
+        {
+            self->accepted++;
+            i++;
+        }
+        else if (result == FFENC_NOT_RUNNING) break;
+    }
+
+    free(y);
+    free(uv);
+    return 0;
+}
+
+static void check_context(ffenc_queue_policy policy, int conversion_threads, const char *name)
+{
+    int64_t accepted = 0;
+    int64_t seen = 0;
+
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        ffenc_context *context = new ffenc_context();
+
+        AVCodec *codec = avcodec_find_encoder(CODEC_ID_RAWVIDEO);
+        if (!codec) codec = avcodec_find_encoder(CODEC_ID_MPEG4);
+
+        AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+        codec_context->width = FRAME_WIDTH;
+        codec_context->height = FRAME_HEIGHT;
+        codec_context->pix_fmt = PIX_FMT_YUV420P;
+        codec_context->time_base.num = 1;
+        codec_context->time_base.den = 30;
+        avcodec_open2(codec_context, codec, 0);
+
+        context->codec_context = codec_context;
+        context->set_frame_queue(4, policy);
+        context->set_conversion_threads(conversion_threads);
+        context->set_frame_callback(&frame_seen, 0);
+        context->set_close_callback(&encoder_closed, &frame_producers[0]);
+
+        pthread_t threads[PRODUCERS];
+
+        for (int i = 0; i < PRODUCERS; i++)
+        {
+            memset(&frame_producers[i], 0, sizeof(frame_producer));
+            frame_producers[i].context = context;
+            frame_producers[i].producer = i;
+            frame_producers[i].strict = policy == FFENC_QUEUE_BLOCK;
+        }
+
+        context->start();
+
+        for (int i = 0; i < PRODUCERS; i++)
+            pthread_create(&threads[i], 0, &add_frames, &frame_producers[i]);
+
+        // stop at a different point of the traffic each round
+        usleep(1000 + round * 200);
+        context->stop();
+
+        for (int i = 0; i < PRODUCERS; i++)
+            pthread_join(threads[i], 0);
+
+        while (!frame_producers[0].closed)
+            usleep(1000);
+
+        ffenc_queue_stats stats;
+        context->get_frame_queue_stats(&stats);
+        int64_t dropped = stats.dropped_newest + stats.dropped_oldest + stats.dropped_until_keyframe;
+
+        for (int i = 0; i < PRODUCERS; i++)
+        {
+            accepted += frame_producers[i].accepted;
+            seen += frame_producers[i].seen;
+        }
+
+        // an accepted frame is seen once, unless a policy dropped it from the queue
+        int64_t missing = accepted - seen;
+        if (policy == FFENC_QUEUE_DROP_NEWEST ? missing != 0 : missing < 0 || missing > dropped)
+            fail(name, round, (int) missing);
+
+        accepted = seen = 0;
+        context->close();
+        delete context;
+    }
+
+    printf("%s: %d rounds of %d producers stopped mid-stream\n", name, ROUNDS, PRODUCERS);
+}
+
+int main()
+{
+    avcodec_register_all();
+
+    check_ring(1);
+    check_ring(2);
+    check_ring(3);
+    check_ring(64);
+
+    check_context(FFENC_QUEUE_BLOCK, 0, "block");
+    check_context(FFENC_QUEUE_DROP_NEWEST, 0, "drop-newest");
+    check_context(FFENC_QUEUE_DROP_OLDEST, 0, "drop-oldest");
+    check_context(FFENC_QUEUE_DROP_UNTIL_KEYFRAME, 0, "drop-until-keyframe");
+
+    // frames still converting when stop is called are encoded too
+    check_context(FFENC_QUEUE_BLOCK, 3, "block with conversion threads");
+
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
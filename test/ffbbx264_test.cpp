@@ -0,0 +1,252 @@
+/* Copyright (c) 2012 Martin M Reed
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Encodes with libx264 in low-latency mode at several thread counts and
+ * checks every picture arrives as one slice per thread, in picture order,
+ * covering the picture from its first macroblock, with only the last
+ * packet of each marked as ending it, although the slice threads finish
+ * them in any order. Also opens more low-latency encoders at once than
+ * the first size of the registry nalu_process looks them up in, so the
+ * handles of their slice threads are learnt side by side. Needs libffbb
+ * built with X264_SUPPORT=1. See "Testing" in the README.
+ */
+
+#include "ffbbenc.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if !X264_SUPPORT
+#error "build with -DX264_SUPPORT=1"
+#endif
+
+// x264 gives each slice thread at least 4 rows of macroblocks, 512 lines
+// leave room for 8 threads
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 512
+#define FRAMES 30
+#define MAX_FRAMES 64
+#define ENCODERS 20
+
+static int failures = 0;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool closed;
+
+    // slices seen for each picture, and where the last one started
+    int slices[MAX_FRAMES];
+    int last_mb[MAX_FRAMES];
+    int ends[MAX_FRAMES];
+    int64_t last_pts;
+    bool out_of_order;
+} slice_count;
+
+// first_mb_in_slice is the first exp-Golomb code after the NAL header
+static int first_mb(const uint8_t *nal, int size)
+{
+    int bit = 8;
+    int zeros = 0;
+
+    while (bit < size * 8 && !((nal[bit / 8] >> (7 - bit % 8)) & 1))
+    {
+        zeros++;
+        bit++;
+    }
+
+    bit++;
+    int value = 0;
+
+    for (int i = 0; i < zeros && bit < size * 8; i++, bit++)
+        value = (value << 1) | ((nal[bit / 8] >> (7 - bit % 8)) & 1);
+
+    return (1 << zeros) - 1 + value;
+}
+
+static void packet_written(ffenc_context *ffe_context, ffenc_packet *packet, void *arg)
+{
+    slice_count *count = (slice_count*) arg;
+
+    if (packet->pts >= 0 && packet->pts < MAX_FRAMES)
+    {
+        // nothing of a picture may follow the packet that ends it
+        if (count->ends[packet->pts]) count->out_of_order = true;
+        if (packet->frame_end) count->ends[packet->pts]++;
+    }
+
+    for (int i = 0; i < packet->nal_count; i++)
+    {
+        if (packet->nals[i].type != 1 && packet->nals[i].type != 5) continue;
+
+        int64_t pts = packet->pts;
+        if (pts < 0 || pts >= MAX_FRAMES) continue;
+
+        if (pts < count->last_pts) count->out_of_order = true;
+        count->last_pts = pts;
+
+        // the first slice starts the picture and each one after starts further on
+        int mb = first_mb(packet->data + packet->nals[i].offset, packet->nals[i].size);
+        if (count->slices[pts] == 0 ? mb != 0 : mb <= count->last_mb[pts]) count->out_of_order = true;
+
+        count->slices[pts]++;
+        count->last_mb[pts] = mb;
+    }
+}
+
+static void encoder_closed(ffenc_context *ffe_context, void *arg)
+{
+    slice_count *count = (slice_count*) arg;
+
+    pthread_mutex_lock(&count->mutex);
+    count->closed = true;
+    pthread_cond_broadcast(&count->cond);
+    pthread_mutex_unlock(&count->mutex);
+}
+
+static ffenc_context* open_encoder(int threads, slice_count *count)
+{
+    x264_param_t param;
+    x264_param_default(&param);
+    x264_param_default_preset(&param, "ultrafast", 0);
+
+    param.i_width = FRAME_WIDTH;
+    param.i_height = FRAME_HEIGHT;
+    param.i_csp = X264_CSP_NV12;
+    param.i_threads = threads;
+    param.i_fps_num = 30;
+    param.i_fps_den = 1;
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    param.i_log_level = X264_LOG_NONE;
+
+    memset(count, 0, sizeof(slice_count));
+    pthread_mutex_init(&count->mutex, 0);
+    pthread_cond_init(&count->cond, 0);
+
+    ffenc_context *ffe_context = new ffenc_context();
+    ffe_context->set_x264_params(&param);
+    ffe_context->set_low_latency(true);
+    ffe_context->set_frame_queue(MAX_FRAMES, FFENC_QUEUE_BLOCK);
+    ffe_context->set_packet_callback(&packet_written, count);
+    ffe_context->set_close_callback(&encoder_closed, count);
+
+    if (ffe_context->start() != FFENC_OK)
+    {
+        fprintf(stderr, "FAIL could not start an encoder with %d threads\n", threads);
+        failures++;
+        delete ffe_context;
+        return 0;
+    }
+
+    return ffe_context;
+}
+
+static void add_frames(ffenc_context *ffe_context)
+{
+    uint8_t *y = (uint8_t*) malloc(FRAME_WIDTH * FRAME_HEIGHT);
+    uint8_t *uv = (uint8_t*) malloc(FRAME_WIDTH * FRAME_HEIGHT / 2);
+
+    for (int i = 0; i < FRAMES; i++)
+    {
+        // something different in every picture so no slice is skipped
+        for (int j = 0; j < FRAME_WIDTH * FRAME_HEIGHT; j++)
+            y[j] = (uint8_t) (j * 7 + i * 13);
+        memset(uv, 128 + i, FRAME_WIDTH * FRAME_HEIGHT / 2);
+
+        ffe_context->add_frame(y, FRAME_WIDTH, uv, FRAME_WIDTH, FRAME_WIDTH, FRAME_HEIGHT, i);
+    }
+
+    free(y);
+    free(uv);
+}
+
+static void close_encoder(ffenc_context *ffe_context, slice_count *count)
+{
+    ffe_context->stop();
+
+    pthread_mutex_lock(&count->mutex);
+    while (!count->closed) pthread_cond_wait(&count->cond, &count->mutex);
+    pthread_mutex_unlock(&count->mutex);
+
+    ffe_context->close();
+    delete ffe_context;
+
+    pthread_mutex_destroy(&count->mutex);
+    pthread_cond_destroy(&count->cond);
+}
+
+static void check_slices(const char *name, int threads, slice_count *count)
+{
+    int wrong = 0;
+
+    for (int i = 0; i < FRAMES; i++)
+    {
+        if (count->slices[i] != threads || count->ends[i] != 1) wrong++;
+    }
+
+    if (wrong || count->out_of_order)
+    {
+        fprintf(stderr, "FAIL %s: %d of %d pictures without %d slices and one end, first has %d%s\n", name, wrong, FRAMES,
+                threads, count->slices[0], count->out_of_order ? ", slices out of order" : "");
+        failures++;
+    }
+}
+
+int main()
+{
+    avcodec_register_all();
+
+    int thread_counts[] = { 1, 2, 4, 8 };
+
+    for (int t = 0; t < (int) (sizeof(thread_counts) / sizeof(thread_counts[0])); t++)
+    {
+        slice_count count;
+        ffenc_context *ffe_context = open_encoder(thread_counts[t], &count);
+        if (!ffe_context) continue;
+
+        add_frames(ffe_context);
+        close_encoder(ffe_context, &count);
+
+        check_slices("threads", thread_counts[t], &count);
+        printf("%d threads: %d slices in the first picture\n", thread_counts[t], count.slices[0]);
+    }
+
+    // more open at once than the registry starts with
+    ffenc_context *encoders[ENCODERS];
+    slice_count *counts = new slice_count[ENCODERS];
+
+    for (int i = 0; i < ENCODERS; i++)
+        encoders[i] = open_encoder(2, &counts[i]);
+
+    for (int i = 0; i < ENCODERS; i++)
+    {
+        if (!encoders[i]) continue;
+        add_frames(encoders[i]);
+        close_encoder(encoders[i], &counts[i]);
+        check_slices("registry", 2, &counts[i]);
+    }
+
+    delete[] counts;
+    printf("%d encoders open at once\n", ENCODERS);
+
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}